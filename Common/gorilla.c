@@ -0,0 +1,304 @@
+#include <string.h>
+
+#include "gorilla.h"
+
+#define NO_WINDOW 0xff
+
+static uint64_t zigzag(int64_t value) {
+      return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+      return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static uint64_t lowMask(unsigned bits) {
+      return bits >= 64 ? UINT64_MAX : ((uint64_t)1 << bits) - 1;
+}
+
+uint32_t gorillaFloatBits(float value) {
+      uint32_t bits;
+      memcpy(&bits, &value, sizeof bits);
+      return bits;
+}
+
+float gorillaBitsFloat(uint32_t bits) {
+      float value;
+      memcpy(&value, &bits, sizeof value);
+      return value;
+}
+
+static void stateInit(GorillaState* state, const GorillaKind* kinds, size_t channels) {
+      memset(state, 0, sizeof *state);
+      state->kinds = kinds;
+      state->channels = channels > GORILLA_MAX_CHANNELS ? GORILLA_MAX_CHANNELS : channels;
+      memset(state->leading, NO_WINDOW, sizeof state->leading);
+}
+
+static size_t sampleBitsBound(const GorillaState* state) {
+      size_t bits = 68;
+      for(size_t c = 0; c < state->channels; c++)
+            bits += state->kinds[c] == GORILLA_FLOAT ? 45 : 11;
+      return bits;
+}
+
+// most significant bit first
+static void writeBits(GorillaEncoder* encoder, uint64_t value, unsigned count) {
+      while(count > 0) {
+            unsigned take = count > 56 ? 56 : count;
+            count -= take;
+            encoder->bits = (encoder->bits << take) | ((value >> count) & lowMask(take));
+            encoder->bitCount += take;
+
+            while(encoder->bitCount >= 8) {
+                  encoder->bitCount -= 8;
+                  encoder->data[encoder->length++] = (uint8_t)(encoder->bits >> encoder->bitCount);
+            }
+            encoder->bits &= lowMask(encoder->bitCount);
+      }
+}
+
+void gorillaEncoderInit(GorillaEncoder* encoder, uint8_t* data, size_t capacity, const GorillaKind* kinds, size_t channels) {
+      stateInit(&encoder->state, kinds, channels);
+      encoder->data = data;
+      encoder->capacity = capacity;
+      encoder->length = 0;
+      encoder->bits = 0;
+      encoder->bitCount = 0;
+}
+
+static void encodeTimestamp(GorillaEncoder* encoder, int64_t timestamp) {
+      GorillaState* state = &encoder->state;
+      int64_t delta = timestamp - state->timestamp;
+      uint64_t dod = zigzag(delta - state->delta);
+
+      if(dod == 0)
+            writeBits(encoder, 0x0, 1);
+      else if(dod < (1 << 7))
+            writeBits(encoder, (0x2 << 7) | dod, 2 + 7);
+      else if(dod < (1 << 9))
+            writeBits(encoder, (0x6 << 9) | dod, 3 + 9);
+      else if(dod < (1 << 12))
+            writeBits(encoder, (0xe << 12) | dod, 4 + 12);
+      else {
+            writeBits(encoder, 0xf, 4);
+            writeBits(encoder, dod, 64);
+      }
+
+      state->timestamp = timestamp;
+      state->delta = delta;
+}
+
+static void encodeByte(GorillaEncoder* encoder, size_t channel, uint32_t value) {
+      GorillaState* state = &encoder->state;
+      value &= 0xff;
+      uint64_t delta = zigzag((int64_t)value - state->values[channel]);
+
+      if(delta == 0)
+            writeBits(encoder, 0x0, 1);
+      else if(delta < (1 << 4))
+            writeBits(encoder, (0x2 << 4) | delta, 2 + 4);
+      else
+            writeBits(encoder, (0x3 << 9) | delta, 2 + 9);
+
+      state->values[channel] = value;
+}
+
+static void encodeFloat(GorillaEncoder* encoder, size_t channel, uint32_t value) {
+      GorillaState* state = &encoder->state;
+      uint32_t xor = value ^ state->values[channel];
+
+      if(xor == 0) {
+            writeBits(encoder, 0x0, 1);
+            return;
+      }
+
+      unsigned leading = __builtin_clz(xor);
+      unsigned trailing = __builtin_ctz(xor);
+      if(leading > 31)
+            leading = 31;
+
+      // the previous window still holds every changed bit: skip its description
+      if(state->leading[channel] != NO_WINDOW
+            && leading >= state->leading[channel]
+            && trailing >= state->trailing[channel]) {
+            unsigned meaningful = 32 - state->leading[channel] - state->trailing[channel];
+            writeBits(encoder, 0x2, 2);
+            writeBits(encoder, xor >> state->trailing[channel], meaningful);
+      } else {
+            unsigned meaningful = 32 - leading - trailing;
+            writeBits(encoder, 0x3, 2);
+            writeBits(encoder, leading, 5);
+            writeBits(encoder, meaningful, 6);
+            writeBits(encoder, xor >> trailing, meaningful);
+            state->leading[channel] = (uint8_t)leading;
+            state->trailing[channel] = (uint8_t)trailing;
+      }
+
+      state->values[channel] = value;
+}
+
+bool gorillaAppend(GorillaEncoder* encoder, const GorillaSample* sample) {
+      GorillaState* state = &encoder->state;
+      if((encoder->length + 1) * 8 + sampleBitsBound(state) > encoder->capacity * 8)
+            return false;
+
+      if(state->count == 0) {
+            writeBits(encoder, (uint64_t)sample->timestamp, 64);
+            state->timestamp = sample->timestamp;
+            for(size_t c = 0; c < state->channels; c++) {
+                  uint32_t value = sample->values[c];
+                  if(state->kinds[c] == GORILLA_BYTE)
+                        value &= 0xff;
+                  writeBits(encoder, value, state->kinds[c] == GORILLA_FLOAT ? 32 : 8);
+                  state->values[c] = value;
+            }
+      } else {
+            encodeTimestamp(encoder, sample->timestamp);
+            for(size_t c = 0; c < state->channels; c++) {
+                  if(state->kinds[c] == GORILLA_FLOAT)
+                        encodeFloat(encoder, c, sample->values[c]);
+                  else
+                        encodeByte(encoder, c, sample->values[c]);
+            }
+      }
+
+      state->count++;
+      return true;
+}
+
+size_t gorillaFinish(GorillaEncoder* encoder) {
+      if(encoder->bitCount > 0)
+            writeBits(encoder, 0, 8 - encoder->bitCount);
+      return encoder->length;
+}
+
+void gorillaDecoderInit(GorillaDecoder* decoder, const uint8_t* data, size_t length, const GorillaKind* kinds, size_t channels) {
+      stateInit(&decoder->state, kinds, channels);
+      decoder->data = data;
+      decoder->length = length;
+      decoder->bitOffset = 0;
+}
+
+static bool readBits(GorillaDecoder* decoder, unsigned count, uint64_t* value) {
+      if(decoder->bitOffset + count > decoder->length * 8)
+            return false;
+
+      uint64_t result = 0;
+      while(count > 0) {
+            unsigned available = 8 - (decoder->bitOffset & 7);
+            unsigned take = count < available ? count : available;
+            uint8_t byte = decoder->data[decoder->bitOffset >> 3];
+
+            result = (result << take) | ((byte >> (available - take)) & lowMask(take));
+            decoder->bitOffset += take;
+            count -= take;
+      }
+
+      *value = result;
+      return true;
+}
+
+// number of leading 1 bits of a prefix code, up to max
+static bool readPrefix(GorillaDecoder* decoder, unsigned max, unsigned* ones) {
+      uint64_t bit;
+      *ones = 0;
+      while(*ones < max) {
+            if(!readBits(decoder, 1, &bit))
+                  return false;
+            if(bit == 0)
+                  break;
+            (*ones)++;
+      }
+      return true;
+}
+
+static bool decodeTimestamp(GorillaDecoder* decoder) {
+      static const unsigned widths[] = { 0, 7, 9, 12, 64 };
+      GorillaState* state = &decoder->state;
+      unsigned prefix;
+      uint64_t dod = 0;
+
+      if(!readPrefix(decoder, 4, &prefix))
+            return false;
+      if(prefix > 0 && !readBits(decoder, widths[prefix], &dod))
+            return false;
+
+      state->delta += unzigzag(dod);
+      state->timestamp += state->delta;
+      return true;
+}
+
+static bool decodeByte(GorillaDecoder* decoder, size_t channel) {
+      GorillaState* state = &decoder->state;
+      unsigned prefix;
+      uint64_t delta = 0;
+
+      if(!readPrefix(decoder, 2, &prefix))
+            return false;
+      if(prefix > 0 && !readBits(decoder, prefix == 1 ? 4 : 9, &delta))
+            return false;
+
+      state->values[channel] = (uint32_t)((int64_t)state->values[channel] + unzigzag(delta)) & 0xff;
+      return true;
+}
+
+static bool decodeFloat(GorillaDecoder* decoder, size_t channel) {
+      GorillaState* state = &decoder->state;
+      unsigned prefix;
+      uint64_t leading, meaningful, xor;
+
+      if(!readPrefix(decoder, 2, &prefix))
+            return false;
+      if(prefix == 0)
+            return true;
+
+      if(prefix == 2) {
+            if(!readBits(decoder, 5, &leading) || !readBits(decoder, 6, &meaningful))
+                  return false;
+            if(meaningful == 0 || leading + meaningful > 32)
+                  return false;
+            state->leading[channel] = (uint8_t)leading;
+            state->trailing[channel] = (uint8_t)(32 - leading - meaningful);
+      } else if(state->leading[channel] == NO_WINDOW) {
+            return false;
+      }
+
+      meaningful = 32 - state->leading[channel] - state->trailing[channel];
+      if(!readBits(decoder, meaningful, &xor))
+            return false;
+
+      state->values[channel] ^= (uint32_t)(xor << state->trailing[channel]);
+      return true;
+}
+
+bool gorillaNext(GorillaDecoder* decoder, GorillaSample* sample) {
+      GorillaState* state = &decoder->state;
+
+      if(state->count == 0) {
+            uint64_t raw;
+            if(!readBits(decoder, 64, &raw))
+                  return false;
+            state->timestamp = (int64_t)raw;
+            for(size_t c = 0; c < state->channels; c++) {
+                  if(!readBits(decoder, state->kinds[c] == GORILLA_FLOAT ? 32 : 8, &raw))
+                        return false;
+                  state->values[c] = (uint32_t)raw;
+            }
+      } else {
+            if(!decodeTimestamp(decoder))
+                  return false;
+            for(size_t c = 0; c < state->channels; c++) {
+                  bool decoded = state->kinds[c] == GORILLA_FLOAT
+                        ? decodeFloat(decoder, c)
+                        : decodeByte(decoder, c);
+                  if(!decoded)
+                        return false;
+            }
+      }
+
+      state->count++;
+      sample->timestamp = state->timestamp;
+      memcpy(sample->values, state->values, sizeof sample->values);
+      return true;
+}
@@ -0,0 +1,83 @@
+#ifndef GORILLA_H
+#define GORILLA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GORILLA_MAX_CHANNELS 4
+// worst case of one sample: 4 + 64 bits of timestamp, 2 + 5 + 6 + 32 per channel
+#define GORILLA_MAX_SAMPLE_BITS (68 + GORILLA_MAX_CHANNELS * 45)
+
+/*
+Gorilla style block codec for sensor series. Timestamps are stored as
+delta of delta, so a sensor ticking at a steady rate costs one bit per
+reading. Each value channel is either:
+- GORILLA_BYTE: zigzag delta from the previous value, one bit when unchanged
+- GORILLA_FLOAT: XOR with the previous bit pattern, only the meaningful
+  bits are written, one bit when unchanged
+The first sample of a block is stored raw. A block does not record its
+own length: the sample count travels next to it (storage index, datagram
+header).
+*/
+typedef enum GorillaKindTag {
+      GORILLA_BYTE,
+      GORILLA_FLOAT
+} GorillaKind;
+
+/*
+One reading: floats travel as their bit pattern (see gorillaFloatBits).
+*/
+typedef struct GorillaSampleTag {
+      int64_t timestamp;
+      uint32_t values[GORILLA_MAX_CHANNELS];
+} GorillaSample;
+
+typedef struct GorillaStateTag {
+      const GorillaKind* kinds;
+      size_t channels;
+      size_t count;
+      int64_t timestamp;
+      int64_t delta;
+      uint32_t values[GORILLA_MAX_CHANNELS];
+      uint8_t leading[GORILLA_MAX_CHANNELS];
+      uint8_t trailing[GORILLA_MAX_CHANNELS];
+} GorillaState;
+
+typedef struct GorillaEncoderTag {
+      GorillaState state;
+      uint8_t* data;
+      size_t capacity;
+      size_t length;          // whole bytes written to data
+      uint64_t bits;          // pending bits, not yet a whole byte
+      unsigned bitCount;
+} GorillaEncoder;
+
+typedef struct GorillaDecoderTag {
+      GorillaState state;
+      const uint8_t* data;
+      size_t length;
+      size_t bitOffset;
+} GorillaDecoder;
+
+uint32_t gorillaFloatBits(float value);
+float gorillaBitsFloat(uint32_t bits);
+
+void gorillaEncoderInit(GorillaEncoder* encoder, uint8_t* data, size_t capacity, const GorillaKind* kinds, size_t channels);
+/*
+Returns false, writing nothing, if the sample might not fit in the block.
+*/
+bool gorillaAppend(GorillaEncoder* encoder, const GorillaSample* sample);
+/*
+Pads the last byte and returns the block length in bytes.
+*/
+size_t gorillaFinish(GorillaEncoder* encoder);
+
+void gorillaDecoderInit(GorillaDecoder* decoder, const uint8_t* data, size_t length, const GorillaKind* kinds, size_t channels);
+/*
+Returns false at the end of a truncated block: the caller stops at the
+sample count it was given.
+*/
+bool gorillaNext(GorillaDecoder* decoder, GorillaSample* sample);
+
+#endif // GORILLA_H
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "textbuf.h"
+
+#define METRICS_REQUEST_MAX 2048
+#define METRICS_HTTP_HEADER "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n"
+
+static Metric metrics[METRICS_MAX];
+static size_t metricCount;
+static atomic_size_t threadCount;
+// the last shard is shared by the threads past METRICS_SHARDS - 1
+static _Thread_local size_t threadIndex = SIZE_MAX;
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999, 1 };
+static const char* quantileLabels[] = { "0.5", "0.9", "0.99", "0.999", "1" };
+
+static size_t threadShard() {
+      if(threadIndex == SIZE_MAX) {
+            size_t index = atomic_fetch_add(&threadCount, 1);
+            threadIndex = index < METRICS_SHARDS - 1 ? index : METRICS_SHARDS - 1;
+      }
+      return threadIndex;
+}
+
+// only the owner writes an exclusive shard: a load and a store, no locked instruction
+static void shardAdd(atomic_uint_fast64_t* value, uint64_t amount, bool shared) {
+      if(shared)
+            atomic_fetch_add_explicit(value, amount, memory_order_relaxed);
+      else
+            atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static Metric* addMetric(MetricsKind kind, const char* name, const char* help) {
+      if(metricCount == METRICS_MAX) {
+            fprintf(stderr, "Too many metrics, %s dropped\n", name);
+            return NULL;
+      }
+
+      Metric* metric = &metrics[metricCount++];
+      metric->kind = kind;
+      snprintf(metric->name, sizeof metric->name, "%s", name);
+      metric->help = help;
+      return metric;
+}
+
+Metric* metricsCounter(const char* name, const char* help) {
+      return addMetric(METRICS_COUNTER, name, help);
+}
+
+static Metric* addReadMetric(MetricsKind kind, const char* name, const char* help, MetricsGaugeFn read, void* ctx) {
+      Metric* metric = addMetric(kind, name, help);
+      if(metric) {
+            metric->read = read;
+            metric->ctx = ctx;
+      }
+      return metric;
+}
+
+Metric* metricsCounterFn(const char* name, const char* help, MetricsGaugeFn read, void* ctx) {
+      return addReadMetric(METRICS_COUNTER, name, help, read, ctx);
+}
+
+Metric* metricsGauge(const char* name, const char* help, MetricsGaugeFn read, void* ctx) {
+      return addReadMetric(METRICS_GAUGE, name, help, read, ctx);
+}
+
+Metric* metricsHistogram(const char* name, const char* help) {
+      return addMetric(METRICS_HISTOGRAM, name, help);
+}
+
+void metricsAdd(Metric* counter, uint64_t amount) {
+      if(!counter)
+            return;
+      size_t index = threadShard();
+      shardAdd(&counter->counters[index].value, amount, index == METRICS_SHARDS - 1);
+}
+
+/*
+Values under METRICS_SUB_BUCKETS have a bucket each, larger ones share
+a bucket with the values of the same top METRICS_SUB_BITS bits.
+*/
+static size_t bucketOf(uint64_t value) {
+      if(value < METRICS_SUB_BUCKETS)
+            return (size_t)value;
+
+      unsigned shift = (unsigned)(63 - __builtin_clzll(value)) - (METRICS_SUB_BITS - 1);
+      size_t top = (size_t)(value >> shift);
+      return METRICS_SUB_BUCKETS + (shift - 1) * (METRICS_SUB_BUCKETS / 2) + top - METRICS_SUB_BUCKETS / 2;
+}
+
+// largest value of the bucket
+static uint64_t bucketHigh(size_t bucket) {
+      if(bucket < METRICS_SUB_BUCKETS)
+            return bucket;
+
+      size_t offset = bucket - METRICS_SUB_BUCKETS;
+      unsigned shift = (unsigned)(offset / (METRICS_SUB_BUCKETS / 2)) + 1;
+      uint64_t top = offset % (METRICS_SUB_BUCKETS / 2) + METRICS_SUB_BUCKETS / 2;
+      return ((top + 1) << shift) - 1;
+}
+
+static MetricsHistogramShard* histogramShard(Metric* histogram, size_t index) {
+      MetricsHistogramShard* shard = atomic_load_explicit(&histogram->histograms[index], memory_order_acquire);
+      if(shard != NULL)
+            return shard;
+
+      shard = aligned_alloc(CACHE_LINE, sizeof *shard);
+      if(!shard) {
+            perror("Memory allocation failed");
+            return NULL;
+      }
+      memset(shard, 0, sizeof *shard);
+
+      // the shared shard may be raced for, the loser frees its copy
+      MetricsHistogramShard* expected = NULL;
+      if(!atomic_compare_exchange_strong_explicit(&histogram->histograms[index], &expected, shard, memory_order_acq_rel, memory_order_acquire)) {
+            free(shard);
+            shard = expected;
+      }
+      return shard;
+}
+
+void metricsRecord(Metric* histogram, uint64_t value) {
+      if(!histogram)
+            return;
+      size_t index = threadShard();
+      bool shared = index == METRICS_SHARDS - 1;
+      MetricsHistogramShard* shard = histogramShard(histogram, index);
+      if(!shard)
+            return;
+
+      shardAdd(&shard->buckets[bucketOf(value)], 1, shared);
+      shardAdd(&shard->sum, value, shared);
+      shardAdd(&shard->count, 1, shared);
+
+      uint64_t max = atomic_load_explicit(&shard->max, memory_order_relaxed);
+      while(value > max && !atomic_compare_exchange_weak_explicit(&shard->max, &max, value, memory_order_relaxed, memory_order_relaxed))
+            ;
+}
+
+uint64_t metricsNow() {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void writeSample(TextBuffer* text, const char* name, const char* suffix, const char* quantile, uint64_t value) {
+      textAppend(text, name, strlen(name));
+      textAppend(text, suffix, strlen(suffix));
+      if(quantile != NULL) {
+            textAppend(text, "{quantile=\"", 11);
+            textAppend(text, quantile, strlen(quantile));
+            textAppend(text, "\"}", 2);
+      }
+      textAppendChar(text, ' ');
+      textAppendUint(text, value);
+      textAppendChar(text, '\n');
+}
+
+static void writeHistogram(TextBuffer* text, Metric* metric) {
+      uint64_t buckets[METRICS_BUCKETS] = { 0 };
+      uint64_t count = 0, sum = 0, max = 0;
+
+      for(size_t s = 0; s < METRICS_SHARDS; s++) {
+            MetricsHistogramShard* shard = atomic_load_explicit(&metric->histograms[s], memory_order_acquire);
+            if(shard == NULL)
+                  continue;
+            for(size_t b = 0; b < METRICS_BUCKETS; b++) {
+                  uint64_t n = atomic_load_explicit(&shard->buckets[b], memory_order_relaxed);
+                  buckets[b] += n;
+                  count += n;
+            }
+            sum += atomic_load_explicit(&shard->sum, memory_order_relaxed);
+            uint64_t shardMax = atomic_load_explicit(&shard->max, memory_order_relaxed);
+            if(shardMax > max)
+                  max = shardMax;
+      }
+
+      size_t b = 0;
+      uint64_t seen = 0;
+      for(size_t q = 0; q < sizeof quantiles / sizeof *quantiles; q++) {
+            uint64_t rank = (uint64_t)(quantiles[q] * (double)count + 0.5);
+            if(rank == 0)
+                  rank = 1;
+            while(b < METRICS_BUCKETS && seen + buckets[b] < rank)
+                  seen += buckets[b++];
+            uint64_t value = count == 0 ? 0 : bucketHigh(b);
+            writeSample(text, metric->name, "", quantileLabels[q], value < max ? value : max);
+      }
+      writeSample(text, metric->name, "_sum", NULL, sum);
+      writeSample(text, metric->name, "_count", NULL, count);
+}
+
+bool metricsWrite(int fd) {
+      static const char* types[] = { "counter", "gauge", "summary" };
+      TextBuffer* text = malloc(sizeof *text);
+      if(!text) {
+            perror("Memory allocation failed");
+            return false;
+      }
+      textInit(text, fd);
+
+      for(size_t i = 0; i < metricCount; i++) {
+            Metric* metric = &metrics[i];
+            textAppend(text, "# HELP ", 7);
+            textAppend(text, metric->name, strlen(metric->name));
+            textAppendChar(text, ' ');
+            textAppend(text, metric->help, strlen(metric->help));
+            textAppend(text, "\n# TYPE ", 8);
+            textAppend(text, metric->name, strlen(metric->name));
+            textAppendChar(text, ' ');
+            textAppend(text, types[metric->kind], strlen(types[metric->kind]));
+            textAppendChar(text, '\n');
+
+            if(metric->read != NULL) {
+                  writeSample(text, metric->name, "", NULL, metric->read(metric->ctx));
+            } else if(metric->kind == METRICS_COUNTER) {
+                  uint64_t value = 0;
+                  for(size_t s = 0; s < METRICS_SHARDS; s++)
+                        value += atomic_load_explicit(&metric->counters[s].value, memory_order_relaxed);
+                  writeSample(text, metric->name, "", NULL, value);
+            } else {
+                  writeHistogram(text, metric);
+            }
+      }
+
+      bool written = textFlush(text);
+      free(text);
+      return written;
+}
+
+/*
+Answers every request the same way, whatever its path: one scrape at a
+time is plenty for a local endpoint.
+*/
+static void* serveMetrics(void* arg) {
+      int listenFD = (int)(intptr_t)arg;
+
+      // a scraper going away turns into EPIPE on this thread only
+      sigset_t pipe;
+      sigemptyset(&pipe);
+      sigaddset(&pipe, SIGPIPE);
+      pthread_sigmask(SIG_BLOCK, &pipe, NULL);
+
+      while(true) {
+            int clientFD = accept(listenFD, NULL, NULL);
+            if(clientFD < 0) {
+                  if(errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                  perror("Metrics accept failed");
+                  break;
+            }
+
+            // a silent client cannot hold the endpoint
+            struct timeval timeout = { .tv_sec = 1 };
+            setsockopt(clientFD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+            char request[METRICS_REQUEST_MAX];
+            size_t received = 0;
+            while(received < sizeof request - 1) {
+                  ssize_t n = recv(clientFD, request + received, sizeof request - 1 - received, 0);
+                  if(n <= 0)
+                        break;
+                  received += (size_t)n;
+                  request[received] = '\0';
+                  if(strstr(request, "\r\n\r\n") != NULL)
+                        break;
+            }
+
+            if(received > 0 && write(clientFD, METRICS_HTTP_HEADER, sizeof METRICS_HTTP_HEADER - 1) > 0)
+                  metricsWrite(clientFD);
+            close(clientFD);
+      }
+
+      close(listenFD);
+      return NULL;
+}
+
+bool metricsServe(uint16_t port) {
+      int listenFD = socket(AF_INET, SOCK_STREAM, 0);
+      if(listenFD < 0) {
+            perror("Metrics socket creation failed");
+            return false;
+      }
+
+      int reuse = 1;
+      setsockopt(listenFD, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+
+      struct sockaddr_in address;
+      memset(&address, 0, sizeof address);
+      address.sin_family = AF_INET;
+      address.sin_port = htons(port);
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+      if(bind(listenFD, (struct sockaddr*)&address, sizeof address) < 0 || listen(listenFD, SOMAXCONN) < 0) {
+            perror("Metrics endpoint failed");
+            close(listenFD);
+            return false;
+      }
+
+      pthread_t thread;
+      if(pthread_create(&thread, NULL, serveMetrics, (void*)(intptr_t)listenFD) != 0) {
+            perror("Thread creation failed");
+            close(listenFD);
+            return false;
+      }
+      pthread_detach(thread);
+      return true;
+}
@@ -0,0 +1,88 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define CACHE_LINE 64
+#define METRICS_MAX 64
+// threads that may update metrics, each writes its own shard
+#define METRICS_SHARDS 64
+#define METRICS_NAME_MAX 64
+// histogram precision: values keep their top 5 bits, about 3%
+#define METRICS_SUB_BITS 5
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS (METRICS_SUB_BUCKETS + (64 - METRICS_SUB_BITS) * (METRICS_SUB_BUCKETS / 2))
+
+/*
+Process wide metrics exposed in the Prometheus text format.
+Every updating thread gets a shard of its own on first use: counters
+and histograms are plain loads and stores on cache lines no other
+thread writes, and a scrape sums the shards without stopping anyone.
+Metrics are created at startup, before the threads that update them.
+
+      counter     monotonic, e.g. readings_total, counted here or read
+                  through a callback from a counter kept elsewhere
+      gauge       read through a callback at scrape time
+      histogram   log-linear buckets (HDR style) over 64 bit values,
+                  exported as a summary: p50, p90, p99, p99.9, max, sum, count
+*/
+typedef enum MetricsKindTag {
+      METRICS_COUNTER,
+      METRICS_GAUGE,
+      METRICS_HISTOGRAM
+} MetricsKind;
+
+typedef uint64_t (*MetricsGaugeFn)(void* ctx);
+
+typedef struct MetricsCounterShardTag {
+      _Alignas(CACHE_LINE) atomic_uint_fast64_t value;
+} MetricsCounterShard;
+
+typedef struct MetricsHistogramShardTag {
+      _Alignas(CACHE_LINE) atomic_uint_fast64_t count;
+      atomic_uint_fast64_t sum;
+      atomic_uint_fast64_t max;
+      atomic_uint_fast64_t buckets[METRICS_BUCKETS];
+} MetricsHistogramShard;
+
+typedef struct MetricTag {
+      MetricsKind kind;
+      char name[METRICS_NAME_MAX];
+      const char* help;
+      MetricsCounterShard counters[METRICS_SHARDS];
+      // allocated by the thread of the shard on its first record
+      _Atomic(MetricsHistogramShard*) histograms[METRICS_SHARDS];
+      MetricsGaugeFn read;          // gauges, counters kept elsewhere
+      void* ctx;
+} Metric;
+
+/*
+NULL, with a message, once METRICS_MAX metrics exist. Updating a NULL
+metric does nothing, so a failed creation only loses that metric.
+*/
+Metric* metricsCounter(const char* name, const char* help);
+Metric* metricsCounterFn(const char* name, const char* help, MetricsGaugeFn read, void* ctx);
+Metric* metricsGauge(const char* name, const char* help, MetricsGaugeFn read, void* ctx);
+Metric* metricsHistogram(const char* name, const char* help);
+
+void metricsAdd(Metric* counter, uint64_t amount);
+void metricsRecord(Metric* histogram, uint64_t value);
+/*
+Monotonic clock in nanoseconds, for latencies.
+*/
+uint64_t metricsNow();
+
+/*
+Writes every metric to fd in the Prometheus text format.
+*/
+bool metricsWrite(int fd);
+/*
+Starts a thread answering every HTTP request on 127.0.0.1:port with
+the metrics.
+*/
+bool metricsServe(uint16_t port);
+
+#endif // METRICS_H
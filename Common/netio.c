@@ -0,0 +1,811 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef NETIO_NO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include "netio.h"
+
+#define NETIO_SQ_ENTRIES 256
+#define NETIO_BUFFER_GROUP 0
+#define NETIO_MAX_BUFFERS 32768
+// readiness events taken per epoll_wait, datagrams per recvmmsg
+#define NETIO_EPOLL_BATCH 64
+
+struct NetIOOpTag {
+      NetIOKind kind;
+      int fd;
+      void* ctx;
+      bool inKernel;          // io_uring: a submission is still live
+      bool cancelled;         // io_uring: freed by its last completion
+      bool done;              // epoll: send finished, result to report
+      int result;
+      struct msghdr msg;      // recvmsg template, or the send
+      struct iovec iov[NETIO_MAX_IOV];
+      struct sockaddr_in name;
+};
+
+static size_t slotSize(const NetIO* io) {
+      return io->bufferSize + NETIO_HEADROOM;
+}
+
+static uint8_t* slot(const NetIO* io, size_t index) {
+      return io->buffers + index * slotSize(io);
+}
+
+static NetIOFile* fileFor(NetIO* io, int fd) {
+      if(fd < 0)
+            return NULL;
+      if((size_t)fd >= io->fileCount) {
+            size_t count = io->fileCount ? io->fileCount : 64;
+            while(count <= (size_t)fd)
+                  count *= 2;
+            NetIOFile* files = realloc(io->files, count * sizeof *files);
+            if(!files)
+                  return NULL;
+            memset(files + io->fileCount, 0, (count - io->fileCount) * sizeof *files);
+            io->files = files;
+            io->fileCount = count;
+      }
+      return &io->files[fd];
+}
+
+static bool pushReady(NetIO* io, NetIOOp* op) {
+      if(io->readyCount == io->readyCapacity) {
+            size_t capacity = io->readyCapacity ? io->readyCapacity * 2 : 64;
+            NetIOOp** ready = realloc(io->ready, capacity * sizeof *ready);
+            if(!ready)
+                  return false;
+            io->ready = ready;
+            io->readyCapacity = capacity;
+      }
+      io->ready[io->readyCount++] = op;
+      return true;
+}
+
+static void dropReady(NetIO* io, const NetIOOp* op) {
+      for(size_t i = 0; i < io->readyCount; i++) {
+            if(io->ready[i] == op) {
+                  io->ready[i] = io->ready[--io->readyCount];
+                  return;
+            }
+      }
+}
+
+static NetIOOp* createOp(NetIOKind kind, int fd, void* ctx) {
+      NetIOOp* op = calloc(1, sizeof *op);
+      if(!op) {
+            perror("Memory allocation failed");
+            return NULL;
+      }
+      op->kind = kind;
+      op->fd = fd;
+      op->ctx = ctx;
+      // recvmsg only reserves room for these, the buffer comes from the ring
+      op->msg.msg_namelen = sizeof op->name;
+      op->msg.msg_controllen = CMSG_SPACE(sizeof(uint32_t));
+      return op;
+}
+
+static void readDrops(struct msghdr* msg, NetIOEvent* event) {
+      for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+            if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                  memcpy(&event->drops, CMSG_DATA(cmsg), sizeof event->drops);
+                  event->hasDrops = true;
+            }
+      }
+}
+
+static void fillEvent(NetIOEvent* event, const NetIOOp* op, int result) {
+      memset(event, 0, sizeof *event);
+      event->kind = op->kind;
+      event->fd = op->fd;
+      event->ctx = op->ctx;
+      event->result = result;
+}
+
+/* ---------------------------------------------------------------- epoll */
+
+static void epollWatch(NetIO* io, int fd, NetIOFile* file) {
+      uint32_t wanted = 0;
+      if(file->reader)
+            wanted |= EPOLLIN;
+      if(file->writer && !file->writer->done)
+            wanted |= EPOLLOUT;
+      if(wanted == file->watching)
+            return;
+
+      struct epoll_event event = { .events = wanted, .data.fd = fd };
+      int op = file->watching == 0 ? EPOLL_CTL_ADD : wanted == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+      if(epoll_ctl(io->epollFD, op, fd, &event) < 0)
+            perror("Epoll update failed");
+      file->watching = wanted;
+}
+
+static void epollSend(NetIOOp* op) {
+      ssize_t sent = sendmsg(op->fd, &op->msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+      if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+      op->result = sent < 0 ? -errno : (int)sent;
+      op->done = true;
+}
+
+static void endReader(NetIO* io, NetIOFile* file) {
+      free(file->reader);
+      file->reader = NULL;
+      (void)io;
+}
+
+/*
+Carries out the receive operation of a readable descriptor, an event per
+connection, chunk or datagram while there is room.
+*/
+static int epollRead(NetIO* io, int fd, NetIOFile* file, NetIOEvent* events, int room) {
+      NetIOOp* op = file->reader;
+      int count = 0;
+
+      if(op->kind == NETIO_ACCEPT) {
+            while(count < room) {
+                  struct sockaddr_in peer;
+                  socklen_t length = sizeof peer;
+                  int client = accept4(fd, (struct sockaddr*)&peer, &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                  if(client < 0) {
+                        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                              fillEvent(&events[count++], op, -errno);
+                        break;
+                  }
+                  fillEvent(&events[count], op, client);
+                  events[count++].peer = peer;
+            }
+            return count;
+      }
+
+      size_t free = io->bufferCount - io->lentCount;
+      if(free == 0 || room == 0)
+            return 0;
+
+      if(op->kind == NETIO_RECV) {
+            uint8_t* buffer = slot(io, io->lentCount);
+            ssize_t n = recv(fd, buffer, slotSize(io), MSG_DONTWAIT);
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                  return 0;
+            fillEvent(&events[0], op, n < 0 ? -errno : (int)n);
+            if(n > 0) {
+                  events[0].data = buffer;
+                  io->lentCount++;
+            } else {
+                  endReader(io, file);
+            }
+            return 1;
+      }
+
+      // NETIO_RECVFROM: as many queued datagrams as buffers and room allow
+      struct mmsghdr messages[NETIO_EPOLL_BATCH];
+      struct iovec iovecs[NETIO_EPOLL_BATCH];
+      struct sockaddr_in sources[NETIO_EPOLL_BATCH];
+      union {
+            char data[CMSG_SPACE(sizeof(uint32_t))];
+            struct cmsghdr align;
+      } controls[NETIO_EPOLL_BATCH];
+
+      size_t batch = free < (size_t)room ? free : (size_t)room;
+      if(batch > NETIO_EPOLL_BATCH)
+            batch = NETIO_EPOLL_BATCH;
+      for(size_t i = 0; i < batch; i++) {
+            iovecs[i].iov_base = slot(io, io->lentCount + i);
+            iovecs[i].iov_len = io->bufferSize;
+            memset(&messages[i].msg_hdr, 0, sizeof messages[i].msg_hdr);
+            messages[i].msg_hdr.msg_name = &sources[i];
+            messages[i].msg_hdr.msg_namelen = sizeof sources[i];
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_control = controls[i].data;
+            messages[i].msg_hdr.msg_controllen = sizeof controls[i].data;
+      }
+
+      int received = recvmmsg(fd, messages, batch, MSG_DONTWAIT, NULL);
+      if(received < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                  return 0;
+            fillEvent(&events[0], op, -errno);
+            endReader(io, file);
+            return 1;
+      }
+
+      for(int i = 0; i < received; i++) {
+            NetIOEvent* event = &events[count++];
+            fillEvent(event, op, (int)messages[i].msg_len);
+            event->data = iovecs[i].iov_base;
+            event->peer = sources[i];
+            event->truncated = messages[i].msg_hdr.msg_flags & MSG_TRUNC;
+            readDrops(&messages[i].msg_hdr, event);
+      }
+      io->lentCount += received;
+      return count;
+}
+
+static int epollWait(NetIO* io, NetIOEvent* events, int max, int timeoutMs) {
+      io->lentCount = 0;
+      int count = 0;
+
+      // sends that completed on the spot
+      while(io->readyCount > 0 && count < max) {
+            NetIOOp* op = io->ready[--io->readyCount];
+            NetIOFile* file = &io->files[op->fd];
+            fillEvent(&events[count++], op, op->result);
+            file->writer = NULL;
+            epollWatch(io, op->fd, file);
+            free(op);
+      }
+      if(count > 0)
+            timeoutMs = 0;
+
+      struct epoll_event ready[NETIO_EPOLL_BATCH];
+      int n = epoll_wait(io->epollFD, ready, NETIO_EPOLL_BATCH, timeoutMs);
+      if(n < 0)
+            return count > 0 ? count : -1;
+
+      for(int i = 0; i < n && count < max; i++) {
+            int fd = ready[i].data.fd;
+            NetIOFile* file = &io->files[fd];
+
+            NetIOOp* writer = file->writer;
+            if(writer && !writer->done && (ready[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                  epollSend(writer);
+                  if(writer->done) {
+                        fillEvent(&events[count++], writer, writer->result);
+                        file->writer = NULL;
+                        free(writer);
+                  }
+            }
+
+            if(file->reader && count < max && (ready[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+                  count += epollRead(io, fd, file, events + count, max - count);
+
+            epollWatch(io, fd, file);
+      }
+
+      return count;
+}
+
+/* ------------------------------------------------------------- io_uring */
+
+#ifndef NETIO_NO_URING
+
+_Static_assert(NETIO_HEADROOM >= sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + CMSG_SPACE(sizeof(uint32_t)),
+      "NETIO_HEADROOM cannot hold the recvmsg header");
+
+static struct io_uring_sqe* uringSqe(NetIO* io) {
+      uint32_t head = __atomic_load_n(io->sqHead, __ATOMIC_ACQUIRE);
+      if(io->sqTail - head == io->sqEntries) {
+            // full: hand what is queued to the kernel first
+            __atomic_store_n(io->sqTailShared, io->sqTail, __ATOMIC_RELEASE);
+            int submitted = syscall(__NR_io_uring_enter, io->ringFD, io->toSubmit, 0, 0, NULL, 0);
+            if(submitted < 0)
+                  return NULL;
+            io->toSubmit -= submitted;
+            head = __atomic_load_n(io->sqHead, __ATOMIC_ACQUIRE);
+            if(io->sqTail - head == io->sqEntries)
+                  return NULL;
+      }
+
+      uint32_t index = io->sqTail & io->sqMask;
+      struct io_uring_sqe* sqe = &((struct io_uring_sqe*)io->sqes)[index];
+      memset(sqe, 0, sizeof *sqe);
+      io->sqArray[index] = index;
+      io->sqTail++;
+      io->toSubmit++;
+      return sqe;
+}
+
+static bool uringArm(NetIO* io, NetIOOp* op) {
+      struct io_uring_sqe* sqe = uringSqe(io);
+      if(!sqe)
+            return false;
+
+      sqe->fd = op->fd;
+      sqe->user_data = (uint64_t)(uintptr_t)op;
+      switch(op->kind) {
+            case NETIO_ACCEPT:
+                  sqe->opcode = IORING_OP_ACCEPT;
+                  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+                  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+                  break;
+            case NETIO_RECV:
+                  sqe->opcode = IORING_OP_RECV;
+                  sqe->ioprio = IORING_RECV_MULTISHOT;
+                  sqe->flags = IOSQE_BUFFER_SELECT;
+                  sqe->buf_group = NETIO_BUFFER_GROUP;
+                  break;
+            case NETIO_RECVFROM:
+                  sqe->opcode = IORING_OP_RECVMSG;
+                  sqe->ioprio = IORING_RECV_MULTISHOT;
+                  sqe->flags = IOSQE_BUFFER_SELECT;
+                  sqe->buf_group = NETIO_BUFFER_GROUP;
+                  sqe->addr = (uint64_t)(uintptr_t)&op->msg;
+                  sqe->len = 1;
+                  break;
+            case NETIO_SEND:
+                  sqe->opcode = IORING_OP_SENDMSG;
+                  sqe->addr = (uint64_t)(uintptr_t)&op->msg;
+                  sqe->len = 1;
+                  sqe->msg_flags = MSG_NOSIGNAL;
+                  break;
+      }
+      op->inKernel = true;
+      return true;
+}
+
+static void uringRecycle(NetIO* io, uint16_t id) {
+      struct io_uring_buf_ring* ring = io->bufferRing;
+      struct io_uring_buf* buffer = &ring->bufs[io->bufferTail & (io->bufferCount - 1)];
+      buffer->addr = (uint64_t)(uintptr_t)slot(io, id);
+      buffer->len = (uint32_t)slotSize(io);
+      buffer->bid = id;
+      io->bufferTail++;
+}
+
+static void uringPublishBuffers(NetIO* io) {
+      struct io_uring_buf_ring* ring = io->bufferRing;
+      __atomic_store_n(&ring->tail, io->bufferTail, __ATOMIC_RELEASE);
+}
+
+static bool uringInit(NetIO* io) {
+      struct io_uring_params params;
+      memset(&params, 0, sizeof params);
+      params.flags = IORING_SETUP_CQSIZE;
+      params.cq_entries = io->bufferCount * 2 > NETIO_SQ_ENTRIES * 2 ? io->bufferCount * 2 : NETIO_SQ_ENTRIES * 2;
+
+      io->ringFD = syscall(__NR_io_uring_setup, NETIO_SQ_ENTRIES, &params);
+      if(io->ringFD < 0)
+            return false;
+      // a single mapping, the extended wait and lasting completions are needed further down
+      uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+      if((params.features & needed) != needed) {
+            errno = ENOSYS;
+            return false;
+      }
+
+      io->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+      io->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+      if(io->cqRingSize > io->sqRingSize)
+            io->sqRingSize = io->cqRingSize;
+      io->sqRing = mmap(NULL, io->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ringFD, IORING_OFF_SQ_RING);
+      if(io->sqRing == MAP_FAILED) {
+            io->sqRing = NULL;
+            return false;
+      }
+      io->cqRing = io->sqRing;
+      io->cqRingSize = 0;
+
+      io->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+      io->sqes = mmap(NULL, io->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ringFD, IORING_OFF_SQES);
+      if(io->sqes == MAP_FAILED) {
+            io->sqes = NULL;
+            return false;
+      }
+
+      uint8_t* sq = io->sqRing;
+      io->sqHead = (uint32_t*)(sq + params.sq_off.head);
+      io->sqTailShared = (uint32_t*)(sq + params.sq_off.tail);
+      io->sqArray = (uint32_t*)(sq + params.sq_off.array);
+      io->sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+      io->sqEntries = params.sq_entries;
+      io->sqTail = *io->sqTailShared;
+      uint8_t* cq = io->cqRing;
+      io->cqHead = (uint32_t*)(cq + params.cq_off.head);
+      io->cqTail = (uint32_t*)(cq + params.cq_off.tail);
+      io->cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+      io->cqes = cq + params.cq_off.cqes;
+
+      // the provided buffer ring, every buffer starts in it
+      io->bufferRingSize = io->bufferCount * sizeof(struct io_uring_buf);
+      io->bufferRing = mmap(NULL, io->bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(io->bufferRing == MAP_FAILED) {
+            io->bufferRing = NULL;
+            return false;
+      }
+      struct io_uring_buf_reg reg;
+      memset(&reg, 0, sizeof reg);
+      reg.ring_addr = (uint64_t)(uintptr_t)io->bufferRing;
+      reg.ring_entries = io->bufferCount;
+      reg.bgid = NETIO_BUFFER_GROUP;
+      if(syscall(__NR_io_uring_register, io->ringFD, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            return false;
+
+      io->bufferTail = 0;
+      for(size_t i = 0; i < io->bufferCount; i++)
+            uringRecycle(io, (uint16_t)i);
+      uringPublishBuffers(io);
+      return true;
+}
+
+static void uringDestroy(NetIO* io) {
+      if(io->bufferRing)
+            munmap(io->bufferRing, io->bufferRingSize);
+      if(io->sqes)
+            munmap(io->sqes, io->sqesSize);
+      if(io->sqRing)
+            munmap(io->sqRing, io->sqRingSize);
+      if(io->ringFD >= 0)
+            close(io->ringFD);
+      io->bufferRing = io->sqes = io->sqRing = io->cqRing = NULL;
+      io->ringFD = -1;
+}
+
+/*
+Turns a completion into an event, false when there is nothing to report.
+Operations that end are detached from their descriptor and freed,
+multishot ones the kernel stopped go on the ready list to be armed again.
+*/
+static bool uringComplete(NetIO* io, const struct io_uring_cqe* cqe, NetIOEvent* event) {
+      NetIOOp* op = (NetIOOp*)(uintptr_t)cqe->user_data;
+      bool more = cqe->flags & IORING_CQE_F_MORE;
+      int buffer = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+      // cancel requests report with no operation attached
+      if(op == NULL)
+            return false;
+      if(!more)
+            op->inKernel = false;
+      if(op->cancelled) {
+            if(buffer >= 0)
+                  uringRecycle(io, (uint16_t)buffer);
+            if(!op->inKernel)
+                  free(op);
+            return false;
+      }
+
+      NetIOFile* file = &io->files[op->fd];
+      int result = cqe->res;
+
+      // out of buffers: armed again once this round's buffers are back
+      if(result == -ENOBUFS) {
+            if(!more)
+                  pushReady(io, op);
+            return false;
+      }
+
+      fillEvent(event, op, result);
+      if(buffer >= 0)
+            io->lent[io->lentCount++] = (uint16_t)buffer;
+
+      switch(op->kind) {
+            case NETIO_ACCEPT:
+                  if(result >= 0) {
+                        socklen_t length = sizeof event->peer;
+                        getpeername(result, (struct sockaddr*)&event->peer, &length);
+                  }
+                  if(!more)
+                        pushReady(io, op);
+                  return true;
+            case NETIO_RECV:
+                  if(buffer >= 0)
+                        event->data = slot(io, buffer);
+                  break;
+            case NETIO_RECVFROM:
+                  if(result >= 0 && buffer >= 0) {
+                        uint8_t* base = slot(io, buffer);
+                        const struct io_uring_recvmsg_out* out = (const struct io_uring_recvmsg_out*)base;
+                        uint8_t* name = base + sizeof *out;
+                        uint8_t* control = name + op->msg.msg_namelen;
+                        uint8_t* payload = control + op->msg.msg_controllen;
+                        size_t available = (size_t)result - (size_t)(payload - base);
+
+                        memcpy(&event->peer, name, out->namelen < sizeof event->peer ? out->namelen : sizeof event->peer);
+                        event->data = payload;
+                        event->result = (int)(out->payloadlen < available ? out->payloadlen : available);
+                        event->truncated = (out->flags & MSG_TRUNC) || out->payloadlen > io->bufferSize;
+
+                        struct msghdr msg;
+                        memset(&msg, 0, sizeof msg);
+                        msg.msg_control = control;
+                        msg.msg_controllen = out->controllen;
+                        readDrops(&msg, event);
+                  }
+                  break;
+            case NETIO_SEND:
+                  file->writer = NULL;
+                  free(op);
+                  return true;
+      }
+
+      // receives: data keeps them armed, the end of the stream or an error does not
+      if(!more) {
+            if(result > 0 || (op->kind == NETIO_RECVFROM && result >= 0)) {
+                  pushReady(io, op);
+            } else {
+                  file->reader = NULL;
+                  free(op);
+            }
+      }
+      return true;
+}
+
+static int uringWait(NetIO* io, NetIOEvent* events, int max, int timeoutMs) {
+      for(size_t i = 0; i < io->lentCount; i++)
+            uringRecycle(io, io->lent[i]);
+      if(io->lentCount > 0)
+            uringPublishBuffers(io);
+      io->lentCount = 0;
+
+      // multishot operations the kernel ended, now that buffers are back
+      size_t rearm = io->readyCount;
+      io->readyCount = 0;
+      for(size_t i = 0; i < rearm; i++) {
+            NetIOOp* op = io->ready[i];
+            if(!uringArm(io, op))
+                  pushReady(io, op);
+      }
+      __atomic_store_n(io->sqTailShared, io->sqTail, __ATOMIC_RELEASE);
+
+      uint32_t head = *io->cqHead;
+      uint32_t tail = __atomic_load_n(io->cqTail, __ATOMIC_ACQUIRE);
+      if(head == tail || io->toSubmit > 0) {
+            unsigned flags = IORING_ENTER_GETEVENTS;
+            unsigned wait = head == tail && timeoutMs != 0 ? 1 : 0;
+            struct __kernel_timespec ts = { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+            struct io_uring_getevents_arg arg;
+            memset(&arg, 0, sizeof arg);
+            arg.sigmask_sz = _NSIG / 8;
+            void* argp = NULL;
+            size_t argSize = 0;
+            if(wait && timeoutMs > 0) {
+                  arg.ts = (uint64_t)(uintptr_t)&ts;
+                  argp = &arg;
+                  argSize = sizeof arg;
+                  flags |= IORING_ENTER_EXT_ARG;
+            }
+
+            int submitted = syscall(__NR_io_uring_enter, io->ringFD, io->toSubmit, wait, flags, argp, argSize);
+            if(submitted >= 0) {
+                  io->toSubmit -= submitted;
+            } else if(errno != ETIME && errno != EBUSY) {
+                  return -1;
+            }
+            tail = __atomic_load_n(io->cqTail, __ATOMIC_ACQUIRE);
+      }
+
+      int count = 0;
+      const struct io_uring_cqe* cqes = io->cqes;
+      while(head != tail && count < max && io->lentCount < io->bufferCount) {
+            if(uringComplete(io, &cqes[head & io->cqMask], &events[count]))
+                  count++;
+            head++;
+      }
+      __atomic_store_n(io->cqHead, head, __ATOMIC_RELEASE);
+
+      // buffers given back by cancelled operations
+      uringPublishBuffers(io);
+      return count;
+}
+
+#endif
+
+/* ------------------------------------------------------------ interface */
+
+bool netioInit(NetIO* io, NetIOBackend backend, size_t bufferSize, size_t bufferCount) {
+      memset(io, 0, sizeof *io);
+      io->epollFD = -1;
+      io->ringFD = -1;
+
+      size_t count = 1;
+      while(count < bufferCount && count < NETIO_MAX_BUFFERS)
+            count *= 2;
+      io->bufferSize = bufferSize;
+      io->bufferCount = count;
+      io->buffers = malloc(count * slotSize(io));
+      io->lent = malloc(count * sizeof *io->lent);
+      if(!io->buffers || !io->lent) {
+            perror("Memory allocation failed");
+            netioDestroy(io);
+            return false;
+      }
+
+#ifndef NETIO_NO_URING
+      if(backend == NETIO_URING || backend == NETIO_AUTO) {
+            io->backend = NETIO_URING;
+            if(uringInit(io))
+                  return true;
+            if(backend == NETIO_URING) {
+                  perror("io_uring unavailable");
+                  netioDestroy(io);
+                  return false;
+            }
+            // seccomp, old kernels, io_uring_disabled: epoll does the same job
+            uringDestroy(io);
+      }
+#else
+      if(backend == NETIO_URING) {
+            fprintf(stderr, "Built without io_uring\n");
+            netioDestroy(io);
+            return false;
+      }
+#endif
+
+      io->backend = NETIO_EPOLL;
+      if((io->epollFD = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+            perror("Epoll creation failed");
+            netioDestroy(io);
+            return false;
+      }
+      return true;
+}
+
+void netioDestroy(NetIO* io) {
+      for(size_t fd = 0; fd < io->fileCount; fd++) {
+            // operations still in the kernel go away with the ring
+            free(io->files[fd].reader);
+            free(io->files[fd].writer);
+      }
+#ifndef NETIO_NO_URING
+      uringDestroy(io);
+#endif
+      if(io->epollFD >= 0)
+            close(io->epollFD);
+      free(io->files);
+      free(io->ready);
+      free(io->lent);
+      free(io->buffers);
+      memset(io, 0, sizeof *io);
+      io->epollFD = -1;
+      io->ringFD = -1;
+}
+
+const char* netioBackendName(const NetIO* io) {
+      return io->backend == NETIO_URING ? "io_uring" : "epoll";
+}
+
+bool netioParseBackend(const char* name, NetIOBackend* backend) {
+      if(strcmp(name, "uring") == 0)
+            *backend = NETIO_URING;
+      else if(strcmp(name, "epoll") == 0)
+            *backend = NETIO_EPOLL;
+      else if(strcmp(name, "auto") == 0)
+            *backend = NETIO_AUTO;
+      else
+            return false;
+      return true;
+}
+
+static bool armReader(NetIO* io, NetIOKind kind, int fd, void* ctx) {
+      NetIOFile* file = fileFor(io, fd);
+      if(!file || file->reader)
+            return false;
+
+      NetIOOp* op = createOp(kind, fd, ctx);
+      if(!op)
+            return false;
+      file->reader = op;
+
+#ifndef NETIO_NO_URING
+      if(io->backend == NETIO_URING) {
+            // armed by the next wait, with the rest of the submissions
+            pushReady(io, op);
+            return true;
+      }
+#endif
+      epollWatch(io, fd, file);
+      return true;
+}
+
+bool netioAccept(NetIO* io, int listenFD, void* ctx) {
+      // the epoll accept loop runs until EAGAIN
+      int flags = fcntl(listenFD, F_GETFL);
+      if(flags < 0 || fcntl(listenFD, F_SETFL, flags | O_NONBLOCK) < 0) {
+            perror("Listener setup failed");
+            return false;
+      }
+      return armReader(io, NETIO_ACCEPT, listenFD, ctx);
+}
+
+bool netioRecv(NetIO* io, int fd, void* ctx) {
+      return armReader(io, NETIO_RECV, fd, ctx);
+}
+
+bool netioRecvFrom(NetIO* io, int fd, void* ctx) {
+      return armReader(io, NETIO_RECVFROM, fd, ctx);
+}
+
+bool netioSend(NetIO* io, int fd, const struct iovec* iov, size_t count, void* ctx) {
+      NetIOFile* file = fileFor(io, fd);
+      if(!file || file->writer || count == 0 || count > NETIO_MAX_IOV)
+            return false;
+
+      NetIOOp* op = createOp(NETIO_SEND, fd, ctx);
+      if(!op)
+            return false;
+      memcpy(op->iov, iov, count * sizeof *iov);
+      memset(&op->msg, 0, sizeof op->msg);
+      op->msg.msg_iov = op->iov;
+      op->msg.msg_iovlen = count;
+      file->writer = op;
+
+#ifndef NETIO_NO_URING
+      if(io->backend == NETIO_URING) {
+            if(!uringArm(io, op)) {
+                  file->writer = NULL;
+                  free(op);
+                  return false;
+            }
+            return true;
+      }
+#endif
+      // most sends fit the socket buffer: no readiness round trip for them
+      epollSend(op);
+      if(op->done && !pushReady(io, op)) {
+            file->writer = NULL;
+            free(op);
+            return false;
+      }
+      epollWatch(io, fd, file);
+      return true;
+}
+
+static void cancelOp(NetIO* io, NetIOOp* op) {
+      dropReady(io, op);
+#ifndef NETIO_NO_URING
+      if(io->backend == NETIO_URING && op->inKernel) {
+            // its last completion frees it
+            op->cancelled = true;
+            struct io_uring_sqe* sqe = uringSqe(io);
+            if(sqe) {
+                  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                  sqe->fd = -1;
+                  sqe->addr = (uint64_t)(uintptr_t)op;
+                  sqe->user_data = 0;
+            }
+            return;
+      }
+#endif
+      (void)io;
+      free(op);
+}
+
+void netioCancel(NetIO* io, int fd) {
+      if(fd < 0 || (size_t)fd >= io->fileCount)
+            return;
+
+      NetIOFile* file = &io->files[fd];
+      if(file->reader)
+            cancelOp(io, file->reader);
+      if(file->writer)
+            cancelOp(io, file->writer);
+      file->reader = NULL;
+      file->writer = NULL;
+
+      if(io->backend == NETIO_EPOLL && file->watching != 0) {
+            epoll_ctl(io->epollFD, EPOLL_CTL_DEL, fd, NULL);
+            file->watching = 0;
+      }
+#ifndef NETIO_NO_URING
+      // the cancellations must reach the kernel before the caller closes fd
+      if(io->backend == NETIO_URING && io->toSubmit > 0) {
+            __atomic_store_n(io->sqTailShared, io->sqTail, __ATOMIC_RELEASE);
+            int submitted = syscall(__NR_io_uring_enter, io->ringFD, io->toSubmit, 0, 0, NULL, 0);
+            if(submitted > 0)
+                  io->toSubmit -= submitted;
+      }
+#endif
+}
+
+int netioWait(NetIO* io, NetIOEvent* events, int max, int timeoutMs) {
+      if(max > (int)io->bufferCount)
+            max = (int)io->bufferCount;
+#ifndef NETIO_NO_URING
+      if(io->backend == NETIO_URING)
+            return uringWait(io, events, max, timeoutMs);
+#endif
+      return epollWait(io, events, max, timeoutMs);
+}
@@ -0,0 +1,152 @@
+#ifndef NETIO_H
+#define NETIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+// iovecs a single netioSend takes
+#define NETIO_MAX_IOV 16
+#define NETIO_DEFAULT_BUFFERS 256
+// room in every buffer for the source address and control data of a datagram
+#define NETIO_HEADROOM 64
+
+/*
+Completion based socket I/O for a single thread. Operations are armed
+once and report through netioWait; accept and receive stay armed and
+report every connection / chunk / datagram until they fail or are
+cancelled.
+
+Two backends behind the same calls:
+      NETIO_URING   io_uring through the raw syscalls: multishot accept,
+                    multishot recv/recvmsg into a provided buffer ring,
+                    every armed operation and wait in one io_uring_enter
+      NETIO_EPOLL   readiness with epoll, the operations are carried out
+                    with accept4/recv/recvmmsg/sendmsg when the socket is ready
+NETIO_AUTO takes io_uring when the kernel allows it. Building with
+-DNETIO_NO_URING leaves only epoll, for systems without linux/io_uring.h.
+*/
+typedef enum NetIOBackendTag {
+      NETIO_AUTO,
+      NETIO_URING,
+      NETIO_EPOLL
+} NetIOBackend;
+
+typedef enum NetIOKindTag {
+      NETIO_ACCEPT,
+      NETIO_RECV,
+      NETIO_RECVFROM,
+      NETIO_SEND
+} NetIOKind;
+
+/*
+result: the accepted socket (non-blocking), the bytes received or sent,
+0 when the peer closed, -errno on failure. A receive that ends (peer
+closed, error) is disarmed, so are send completions.
+*/
+typedef struct NetIOEventTag {
+      NetIOKind kind;
+      int fd;                       // listener, or the socket of the operation
+      void* ctx;
+      int result;
+      const uint8_t* data;          // received bytes, valid until the next netioWait
+      struct sockaddr_in peer;      // accepted peer, datagram source
+      bool truncated;               // datagram longer than the buffer
+      bool hasDrops;
+      uint32_t drops;               // SO_RXQ_OVFL counter, when the socket has it on
+} NetIOEvent;
+
+typedef struct NetIOOpTag NetIOOp;
+
+// the operations of one descriptor: at most one receiving and one sending
+typedef struct NetIOFileTag {
+      NetIOOp* reader;
+      NetIOOp* writer;
+      uint32_t watching;            // epoll: events currently registered
+} NetIOFile;
+
+typedef struct NetIOTag {
+      NetIOBackend backend;
+      NetIOFile* files;             // by descriptor
+      size_t fileCount;
+      size_t bufferSize;
+      size_t bufferCount;
+      uint8_t* buffers;
+      // buffers handed out with the last events, recycled by the next wait
+      uint16_t* lent;
+      size_t lentCount;
+      // operations with a completion to report, or to arm again
+      NetIOOp** ready;
+      size_t readyCount;
+      size_t readyCapacity;
+      // epoll
+      int epollFD;
+      // io_uring: the mapped rings, SQEs are published in batches by netioWait
+      int ringFD;
+      void* sqRing;
+      size_t sqRingSize;
+      void* cqRing;
+      size_t cqRingSize;
+      void* sqes;
+      size_t sqesSize;
+      uint32_t* sqHead;
+      uint32_t* sqTailShared;
+      uint32_t* sqArray;
+      uint32_t sqMask;
+      uint32_t sqEntries;
+      uint32_t sqTail;
+      uint32_t toSubmit;
+      uint32_t* cqHead;
+      uint32_t* cqTail;
+      uint32_t cqMask;
+      void* cqes;
+      void* bufferRing;
+      size_t bufferRingSize;
+      uint16_t bufferTail;
+} NetIO;
+
+/*
+bufferSize is the largest datagram received whole (a stream chunk may
+come a little larger), bufferCount how many chunks one wait can hand out;
+it is rounded up to a power of two.
+*/
+bool netioInit(NetIO* io, NetIOBackend backend, size_t bufferSize, size_t bufferCount);
+void netioDestroy(NetIO* io);
+const char* netioBackendName(const NetIO* io);
+/*
+Parses "uring", "epoll" or "auto", false on anything else.
+*/
+bool netioParseBackend(const char* name, NetIOBackend* backend);
+
+/*
+Switches listenFD to non-blocking, accepted sockets are non-blocking too.
+*/
+bool netioAccept(NetIO* io, int listenFD, void* ctx);
+bool netioRecv(NetIO* io, int fd, void* ctx);
+/*
+Datagram receive with the source address and, with SO_RXQ_OVFL set on
+the socket, the kernel drop counter.
+*/
+bool netioRecvFrom(NetIO* io, int fd, void* ctx);
+/*
+One completion for the whole call, which may have sent less than asked
+on a stream socket. The data (not the iovec array) must stay valid
+until then; false while another send on fd is in flight.
+*/
+bool netioSend(NetIO* io, int fd, const struct iovec* iov, size_t count, void* ctx);
+/*
+Disarms every operation on fd: no later wait reports it any more, but
+events of fd the last wait returned after the current one are still
+there, so their ctx must stay valid until the end of the round. Closing
+fd stays with the caller.
+*/
+void netioCancel(NetIO* io, int fd);
+/*
+Submits what was armed and waits up to timeoutMs (-1 forever) for
+completions, returns how many events were written (at most max) or -1.
+*/
+int netioWait(NetIO* io, NetIOEvent* events, int max, int timeoutMs);
+
+#endif // NETIO_H
@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+static Pool* pools[POOL_MAX];
+static size_t poolCount;
+static pthread_mutex_t poolsMutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_size_t threadCount;
+// POOL_THREADS: the thread came too late for a cache and goes through the depot
+static _Thread_local size_t threadIndex = SIZE_MAX;
+
+static size_t threadSlot() {
+      if(threadIndex == SIZE_MAX) {
+            size_t index = atomic_fetch_add(&threadCount, 1);
+            threadIndex = index < POOL_THREADS ? index : POOL_THREADS;
+      }
+      return threadIndex;
+}
+
+static size_t alignUp(size_t size) {
+      size_t alignment = _Alignof(max_align_t);
+      return (size + alignment - 1) / alignment * alignment;
+}
+
+// bytes between two objects of a slab
+static size_t stride(const Pool* pool) {
+      return alignUp(pool->objectSize > sizeof(PoolObject) ? pool->objectSize : sizeof(PoolObject));
+}
+
+// only the owning thread writes its cache
+static void cacheCount(atomic_uint_fast64_t* counter) {
+      atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static void registerPool(Pool* pool) {
+      pthread_mutex_lock(&poolsMutex);
+      bool known = false;
+      for(size_t i = 0; i < poolCount; i++)
+            known = known || pools[i] == pool;
+      if(!known && poolCount < POOL_MAX)
+            pools[poolCount++] = pool;
+      else if(!known)
+            fprintf(stderr, "Too many pools, %s is left out of the report\n", pool->name);
+      pthread_mutex_unlock(&poolsMutex);
+}
+
+// with the pool mutex held
+static bool addSlab(Pool* pool) {
+      size_t size = stride(pool);
+      size_t header = alignUp(sizeof(void*));
+      char* slab = malloc(header + size * POOL_SLAB_OBJECTS);
+      if(!slab) {
+            perror("Pool allocation failed");
+            return false;
+      }
+      if(pool->slabCount == 0)
+            registerPool(pool);
+
+      *(void**)slab = pool->slabs;
+      pool->slabs = slab;
+      pool->slabCount++;
+
+      for(size_t i = POOL_SLAB_OBJECTS; i > 0; i--) {
+            PoolObject* object = (PoolObject*)(slab + header + (i - 1) * size);
+            object->next = pool->depot;
+            pool->depot = object;
+      }
+      pool->depotCount += POOL_SLAB_OBJECTS;
+      return true;
+}
+
+// with the pool mutex held: up to max objects off the depot, chained
+static PoolObject* takeDepot(Pool* pool, size_t max, size_t* count) {
+      if(pool->depot == NULL && !addSlab(pool))
+            return NULL;
+
+      PoolObject* first = pool->depot;
+      PoolObject* last = first;
+      size_t taken = 1;
+      while(taken < max && last->next != NULL) {
+            last = last->next;
+            taken++;
+      }
+      pool->depot = last->next;
+      pool->depotCount -= taken;
+      last->next = NULL;
+      *count = taken;
+      return first;
+}
+
+void* poolAllocate(Pool* pool, size_t size) {
+      if(size > pool->objectSize) {
+            fprintf(stderr, "%zu bytes do not fit in pool %s\n", size, pool->name);
+            return NULL;
+      }
+
+      size_t slot = threadSlot();
+      size_t count;
+      if(slot == POOL_THREADS) {
+            pthread_mutex_lock(&pool->mutex);
+            PoolObject* object = takeDepot(pool, 1, &count);
+            if(object != NULL)
+                  pool->sharedAllocations++;
+            pthread_mutex_unlock(&pool->mutex);
+            return object;
+      }
+
+      PoolCache* cache = &pool->caches[slot];
+      if(cache->free == NULL) {
+            pthread_mutex_lock(&pool->mutex);
+            cache->free = takeDepot(pool, POOL_BATCH, &count);
+            pthread_mutex_unlock(&pool->mutex);
+            if(cache->free == NULL)
+                  return NULL;
+            cache->freeCount = count;
+      }
+
+      PoolObject* object = cache->free;
+      cache->free = object->next;
+      cache->freeCount--;
+      cacheCount(&cache->allocations);
+      return object;
+}
+
+void poolFree(Pool* pool, void* object) {
+      if(object == NULL)
+            return;
+
+      PoolObject* freed = (PoolObject*)object;
+      size_t slot = threadSlot();
+      if(slot == POOL_THREADS) {
+            pthread_mutex_lock(&pool->mutex);
+            freed->next = pool->depot;
+            pool->depot = freed;
+            pool->depotCount++;
+            pool->sharedReleases++;
+            pthread_mutex_unlock(&pool->mutex);
+            return;
+      }
+
+      PoolCache* cache = &pool->caches[slot];
+      freed->next = cache->free;
+      cache->free = freed;
+      cache->freeCount++;
+      cacheCount(&cache->releases);
+      if(cache->freeCount <= POOL_CACHE_MAX)
+            return;
+
+      // a thread freeing what others allocate hands the surplus back
+      PoolObject* first = cache->free;
+      PoolObject* last = first;
+      for(size_t i = 1; i < POOL_BATCH; i++)
+            last = last->next;
+      cache->free = last->next;
+      cache->freeCount -= POOL_BATCH;
+
+      pthread_mutex_lock(&pool->mutex);
+      last->next = pool->depot;
+      pool->depot = first;
+      pool->depotCount += POOL_BATCH;
+      pthread_mutex_unlock(&pool->mutex);
+}
+
+void poolDestroy(Pool* pool) {
+      pthread_mutex_lock(&pool->mutex);
+      void* slab = pool->slabs;
+      while(slab != NULL) {
+            void* next = *(void**)slab;
+            free(slab);
+            slab = next;
+      }
+      pool->slabs = NULL;
+      pool->slabCount = 0;
+      pool->depot = NULL;
+      pool->depotCount = 0;
+      for(size_t i = 0; i < POOL_THREADS; i++) {
+            pool->caches[i].free = NULL;
+            pool->caches[i].freeCount = 0;
+      }
+      pthread_mutex_unlock(&pool->mutex);
+}
+
+// allocations and releases over every thread
+static void poolTotals(Pool* pool, uint64_t* allocations, uint64_t* releases) {
+      pthread_mutex_lock(&pool->mutex);
+      *allocations = pool->sharedAllocations;
+      *releases = pool->sharedReleases;
+      pthread_mutex_unlock(&pool->mutex);
+
+      for(size_t i = 0; i < POOL_THREADS; i++) {
+            *allocations += atomic_load_explicit(&pool->caches[i].allocations, memory_order_relaxed);
+            *releases += atomic_load_explicit(&pool->caches[i].releases, memory_order_relaxed);
+      }
+}
+
+uint64_t poolInUse(Pool* pool) {
+      uint64_t allocations, releases;
+      poolTotals(pool, &allocations, &releases);
+      // counters of different threads are read at slightly different times
+      return allocations > releases ? allocations - releases : 0;
+}
+
+void poolReport(FILE* out) {
+      pthread_mutex_lock(&poolsMutex);
+      for(size_t i = 0; i < poolCount; i++) {
+            Pool* pool = pools[i];
+            uint64_t allocations, releases;
+            poolTotals(pool, &allocations, &releases);
+            uint64_t inUse = allocations > releases ? allocations - releases : 0;
+
+            fprintf(out, "Pool %s: %llu allocated, %llu freed, %llu still in use, %zu slabs (%zu bytes)\n",
+                  pool->name, (unsigned long long)allocations, (unsigned long long)releases,
+                  (unsigned long long)inUse, pool->slabCount, pool->slabCount * POOL_SLAB_OBJECTS * stride(pool));
+      }
+      pthread_mutex_unlock(&poolsMutex);
+}
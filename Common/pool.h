@@ -0,0 +1,93 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+// threads with a free list of their own, the others share the depot
+#define POOL_THREADS 64
+#define POOL_SLAB_OBJECTS 64
+// objects moved between a thread and the depot at a time
+#define POOL_BATCH 32
+// free objects a thread keeps before handing a batch back to the depot
+#define POOL_CACHE_MAX (4 * POOL_BATCH)
+// pools in the shutdown report
+#define POOL_MAX 16
+
+typedef struct PoolObjectTag {
+      struct PoolObjectTag* next;
+} PoolObject;
+
+/*
+What one thread holds of a pool. Only that thread writes it: the
+counters are a load and a store, like the metrics shards.
+*/
+typedef struct PoolCacheTag {
+      _Alignas(CACHE_LINE) PoolObject* free;
+      size_t freeCount;
+      atomic_uint_fast64_t allocations;
+      atomic_uint_fast64_t releases;
+} PoolCache;
+
+/*
+Fixed size objects carved out of slabs of POOL_SLAB_OBJECTS. Freed
+objects go to the free list of the freeing thread, whichever allocated
+them, and travel back through the depot in batches: once warm, a pool
+allocates and frees without touching the heap or a lock.
+Slabs are only returned with poolDestroy.
+
+Pools are statically initialized, with the type they hold:
+
+      Pool sensorPool = POOL_OF(SensorInfo);
+      SensorInfo* sensor = POOL_NEW(&sensorPool, SensorInfo);
+      poolFree(&sensorPool, sensor);
+*/
+typedef struct PoolTag {
+      const char* name;
+      size_t objectSize;
+      PoolCache caches[POOL_THREADS];
+      pthread_mutex_t mutex;        // the depot, the slabs and the shared threads
+      PoolObject* depot;
+      size_t depotCount;
+      void* slabs;                  // chained through their first word
+      size_t slabCount;
+      uint64_t sharedAllocations;   // threads past POOL_THREADS
+      uint64_t sharedReleases;
+} Pool;
+
+#define POOL_INITIALIZER(poolName, size) { .name = (poolName), .objectSize = (size), .mutex = PTHREAD_MUTEX_INITIALIZER }
+#define POOL_OF(type) POOL_INITIALIZER(#type, sizeof(type))
+#define POOL_NEW(pool, type) ((type*)poolAllocate((pool), sizeof(type)))
+
+/*
+An object of the pool, NULL, with a message, if the heap is exhausted
+or size does not fit the objects of the pool.
+*/
+void* poolAllocate(Pool* pool, size_t size);
+/*
+Hands object, from this pool, back to it. NULL is ignored.
+*/
+void poolFree(Pool* pool, void* object);
+/*
+Frees every slab: no object of the pool may be used afterwards.
+*/
+void poolDestroy(Pool* pool);
+
+/*
+Objects in use by pool, a leak once its users are gone.
+*/
+uint64_t poolInUse(Pool* pool);
+/*
+Writes allocations, frees and objects still in use of every pool that
+allocated anything to out, for a leak check at shutdown.
+*/
+void poolReport(FILE* out);
+
+#endif // POOL_H
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc.h"
+
+bool spscInit(SpscQueue* queue, size_t capacity, size_t elementSize) {
+      size_t rounded = 1;
+      while(rounded < capacity)
+            rounded <<= 1;
+
+      queue->data = malloc(rounded * elementSize);
+      if(!queue->data)
+            return false;
+
+      atomic_init(&queue->head, 0);
+      atomic_init(&queue->tail, 0);
+      queue->capacity = rounded;
+      queue->elementSize = elementSize;
+      return true;
+}
+
+void spscDestroy(SpscQueue* queue) {
+      free(queue->data);
+      queue->data = NULL;
+}
+
+// copies count elements between the ring and a flat array, the ring part may wrap
+static void ringCopy(SpscQueue* queue, size_t position, void* flat, size_t count, bool intoRing) {
+      size_t start = position & (queue->capacity - 1);
+      size_t first = queue->capacity - start;
+      if(first > count)
+            first = count;
+
+      uint8_t* ring = queue->data + start * queue->elementSize;
+      size_t firstBytes = first * queue->elementSize;
+      size_t restBytes = (count - first) * queue->elementSize;
+
+      if(intoRing) {
+            memcpy(ring, flat, firstBytes);
+            memcpy(queue->data, (uint8_t*)flat + firstBytes, restBytes);
+      } else {
+            memcpy(flat, ring, firstBytes);
+            memcpy((uint8_t*)flat + firstBytes, queue->data, restBytes);
+      }
+}
+
+size_t spscPush(SpscQueue* queue, const void* elements, size_t count) {
+      size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+      size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+      size_t space = queue->capacity - (tail - head);
+      if(count > space)
+            count = space;
+      if(count == 0)
+            return 0;
+
+      ringCopy(queue, tail, (void*)elements, count, true);
+      atomic_store_explicit(&queue->tail, tail + count, memory_order_release);
+      return count;
+}
+
+size_t spscPop(SpscQueue* queue, void* elements, size_t max) {
+      size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+      size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+      size_t count = tail - head;
+      if(count > max)
+            count = max;
+      if(count == 0)
+            return 0;
+
+      ringCopy(queue, head, elements, count, false);
+      atomic_store_explicit(&queue->head, head + count, memory_order_release);
+      return count;
+}
+
+size_t spscSize(SpscQueue* queue) {
+      // acquire: the tail read after it is at least the tail this head was
+      // popped up to, so the difference cannot underflow
+      size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+      size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+      // pushes between the two loads may outrun the head read
+      size_t size = tail - head;
+      return size < queue->capacity ? size : queue->capacity;
+}
@@ -0,0 +1,39 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define CACHE_LINE 64
+
+/*
+Bounded single producer / single consumer queue of fixed size elements.
+The producer only writes tail and the consumer only writes head, each on
+its own cache line, so the two sides never contend on a lock.
+*/
+typedef struct SpscQueueTag {
+      _Alignas(CACHE_LINE) atomic_size_t head;
+      _Alignas(CACHE_LINE) atomic_size_t tail;
+      _Alignas(CACHE_LINE) size_t capacity;     // power of two
+      size_t elementSize;
+      uint8_t* data;
+} SpscQueue;
+
+bool spscInit(SpscQueue* queue, size_t capacity, size_t elementSize);
+void spscDestroy(SpscQueue* queue);
+/*
+Producer side: copies as many of the count elements as fit, returns how many.
+*/
+size_t spscPush(SpscQueue* queue, const void* elements, size_t count);
+/*
+Consumer side: copies up to max elements out, returns how many.
+*/
+size_t spscPop(SpscQueue* queue, void* elements, size_t max);
+/*
+Elements queued, from any thread: a snapshot that may already be stale.
+*/
+size_t spscSize(SpscQueue* queue);
+
+#endif // SPSC_H
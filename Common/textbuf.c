@@ -0,0 +1,120 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "textbuf.h"
+
+void textInit(TextBuffer* text, int fd) {
+      text->fd = fd;
+      text->length = 0;
+      text->cachedSecond = (time_t)-1;
+      text->cachedDate[0] = '\0';
+}
+
+size_t textSpace(const TextBuffer* text) {
+      return TEXTBUF_SIZE - text->length;
+}
+
+void textAppend(TextBuffer* text, const char* str, size_t length) {
+      if(length > textSpace(text))
+            textFlush(text);
+      if(length > textSpace(text))
+            length = textSpace(text);
+
+      memcpy(text->data + text->length, str, length);
+      text->length += length;
+}
+
+void textAppendChar(TextBuffer* text, char c) {
+      if(textSpace(text) == 0)
+            textFlush(text);
+      text->data[text->length++] = c;
+}
+
+// digits of value, written backwards from the end of digits, returns the count
+static size_t renderUint(char digits[20], uint64_t value) {
+      size_t count = 0;
+      do {
+            digits[19 - count++] = (char)('0' + value % 10);
+            value /= 10;
+      } while(value != 0);
+      return count;
+}
+
+void textAppendUint(TextBuffer* text, uint64_t value) {
+      char digits[20];
+      size_t count = renderUint(digits, value);
+      textAppend(text, digits + 20 - count, count);
+}
+
+void textAppendUintPadded(TextBuffer* text, uint64_t value, size_t width) {
+      char digits[20];
+      size_t count = renderUint(digits, value);
+      for(size_t i = count; i < width; i++)
+            textAppendChar(text, ' ');
+      textAppend(text, digits + 20 - count, count);
+}
+
+void textAppendFixed2(TextBuffer* text, double value) {
+      if(value < 0) {
+            textAppendChar(text, '-');
+            value = -value;
+      }
+
+      uint64_t hundredths = (uint64_t)(value * 100.0 + 0.5);
+      textAppendUint(text, hundredths / 100);
+      textAppendChar(text, '.');
+      textAppendChar(text, (char)('0' + hundredths / 10 % 10));
+      textAppendChar(text, (char)('0' + hundredths % 10));
+}
+
+static void put2(char* dst, int value) {
+      dst[0] = (char)('0' + value / 10 % 10);
+      dst[1] = (char)('0' + value % 10);
+}
+
+void textAppendDate(TextBuffer* text, time_t timestamp) {
+      if(timestamp != text->cachedSecond) {
+            struct tm timeinfo;
+            // localtime is not thread safe and slow, it runs once per second at most
+            if(localtime_r(&timestamp, &timeinfo) == NULL)
+                  memset(&timeinfo, 0, sizeof timeinfo);
+
+            char* date = text->cachedDate;
+            int year = timeinfo.tm_year + 1900;
+            put2(date, year / 100);
+            put2(date + 2, year % 100);
+            date[4] = '-';
+            put2(date + 5, timeinfo.tm_mon + 1);
+            date[7] = '-';
+            put2(date + 8, timeinfo.tm_mday);
+            date[10] = ' ';
+            put2(date + 11, timeinfo.tm_hour);
+            date[13] = ':';
+            put2(date + 14, timeinfo.tm_min);
+            date[16] = ':';
+            put2(date + 17, timeinfo.tm_sec);
+            date[TEXTBUF_DATE_LENGTH] = '\0';
+
+            text->cachedSecond = timestamp;
+      }
+
+      textAppend(text, text->cachedDate, TEXTBUF_DATE_LENGTH);
+}
+
+bool textFlush(TextBuffer* text) {
+      size_t written = 0;
+      while(written < text->length) {
+            ssize_t n = write(text->fd, text->data + written, text->length - written);
+            if(n < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  text->length = 0;
+                  return false;
+            }
+            written += (size_t)n;
+      }
+
+      text->length = 0;
+      return true;
+}
@@ -0,0 +1,48 @@
+#ifndef TEXTBUF_H
+#define TEXTBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define TEXTBUF_SIZE (64 * 1024)
+// "YYYY-mm-dd HH:MM:SS"
+#define TEXTBUF_DATE_LENGTH 19
+
+/*
+Output buffer for hot logging paths: numbers are formatted by hand, the
+date is rendered at most once per second and the whole buffer leaves
+with a single write.
+*/
+typedef struct TextBufferTag {
+      int fd;
+      size_t length;
+      time_t cachedSecond;
+      char cachedDate[TEXTBUF_DATE_LENGTH + 1];
+      char data[TEXTBUF_SIZE];
+} TextBuffer;
+
+void textInit(TextBuffer* text, int fd);
+/*
+Room left before the buffer has to be flushed.
+*/
+size_t textSpace(const TextBuffer* text);
+void textAppend(TextBuffer* text, const char* str, size_t length);
+void textAppendChar(TextBuffer* text, char c);
+void textAppendUint(TextBuffer* text, uint64_t value);
+/*
+Right aligned in width characters, like printf "%*u".
+*/
+void textAppendUintPadded(TextBuffer* text, uint64_t value, size_t width);
+/*
+value with two decimals, like printf "%.2f".
+*/
+void textAppendFixed2(TextBuffer* text, double value);
+/*
+Local time as "%Y-%m-%d %H:%M:%S".
+*/
+void textAppendDate(TextBuffer* text, time_t timestamp);
+bool textFlush(TextBuffer* text);
+
+#endif // TEXTBUF_H
@@ -9,6 +9,8 @@
 #include <pthread.h>
 #include <termios.h>
 
+#include "framing.h"
+
 #define MSG_BUFFER 1024
 #define PREFIX_SEND ">> "
 #define PREFIX_RECEIVED "<< "
@@ -39,6 +41,8 @@ void enableRawMode(void) {
 
 void checkArgs(int argc, char** argv);
 void* receiveHandler(void* arg);
+// prints a message of the server above the line being typed
+bool printFrame(const char* payload, size_t length, void* ctx);
 void* sendHandler(void* arg);
 
 int main(int argc, char** argv) {
@@ -105,10 +109,12 @@ void checkArgs(int argc, char** argv) {
 
 void* receiveHandler(void* arg) {
     char buffer[MSG_BUFFER];
+    FrameReader frames;
+    frameReaderInit(&frames);
     bool communicating = true;
 
     while (communicating) {
-        ssize_t bytesReceived = recv(socketFD, buffer, MSG_BUFFER - 1, 0);
+        ssize_t bytesReceived = recv(socketFD, buffer, MSG_BUFFER, 0);
         if (bytesReceived < 0) {
             perror("Receive error");
             communicating = false;
@@ -120,34 +126,42 @@ void* receiveHandler(void* arg) {
             break;
         }
 
-        buffer[bytesReceived] = '\0';
-
-        // Lock the line buffer, save its content
-        pthread_mutex_lock(&lineMutex);
-        size_t savedLen = lineLen;
-        char savedBuf[MSG_BUFFER];
-        memcpy(savedBuf, lineBuffer, savedLen);
-        savedBuf[savedLen] = '\0';
-        pthread_mutex_unlock(&lineMutex);
-
-        // Clear current line: move to start, overwrite with spaces, move to start again
-        int totalLen = strlen(PREFIX_SEND) + savedLen;
-        printf("\r");
-        for (int i = 0; i < totalLen; i++) {
-            putchar(' ');
+        // a read may hold several messages, or part of one
+        if (frameParse(&frames, buffer, bytesReceived, printFrame, NULL) != FRAME_OK) {
+            printf("\nMalformed message from the server\n");
+            communicating = false;
+            break;
         }
-        printf("\r");
+    }
 
-        // Print the incoming message
-        printf("%s%s\n", PREFIX_RECEIVED, buffer);
+    return NULL;
+}
+
+bool printFrame(const char* payload, size_t length, void* ctx) {
+    // Lock the line buffer, save its content
+    pthread_mutex_lock(&lineMutex);
+    size_t savedLen = lineLen;
+    char savedBuf[MSG_BUFFER];
+    memcpy(savedBuf, lineBuffer, savedLen);
+    savedBuf[savedLen] = '\0';
+    pthread_mutex_unlock(&lineMutex);
 
-        // Reprint prompt and restored input
-        printf("%s", PREFIX_SEND);
-        fwrite(savedBuf, 1, savedLen, stdout);
-        fflush(stdout);
+    // Clear current line: move to start, overwrite with spaces, move to start again
+    int totalLen = strlen(PREFIX_SEND) + savedLen;
+    printf("\r");
+    for (int i = 0; i < totalLen; i++) {
+        putchar(' ');
     }
+    printf("\r");
 
-    return NULL;
+    // Print the incoming message
+    printf("%s%.*s\n", PREFIX_RECEIVED, (int)length, payload);
+
+    // Reprint prompt and restored input
+    printf("%s", PREFIX_SEND);
+    fwrite(savedBuf, 1, savedLen, stdout);
+    fflush(stdout);
+    return true;
 }
 
 void* sendHandler(void* arg) {
@@ -173,15 +187,13 @@ void* sendHandler(void* arg) {
             strcpy(messageToSend, lineBuffer);
             pthread_mutex_unlock(&lineMutex);
 
-            if (strcmp(messageToSend, "exit\n") == 0) {
-                send(socketFD, "connection closed", strlen("connection closed"), 0);
+            // one frame per line, "exit" closes the connection on the server
+            if (!frameSend(socketFD, messageToSend, strlen(messageToSend))) {
+                perror("Send failed");
                 communicating = false;
                 break;
             }
-
-            ssize_t bytesSent = send(socketFD, messageToSend, strlen(messageToSend), 0);
-            if (bytesSent < 0) {
-                perror("Send failed");
+            if (strcmp(messageToSend, "exit") == 0) {
                 communicating = false;
                 break;
             }
@@ -0,0 +1,140 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "fanout.h"
+#include "../Common/pool.h"
+
+// a chat line is short: most messages never touch the heap
+static Pool messagePool = POOL_INITIALIZER("Message", sizeof(Message) + MESSAGE_POOLED_LENGTH);
+
+Message* messageCreate(const char* data, size_t length) {
+      Message* msg = messageAllocate(length);
+      if(!msg)
+            return NULL;
+
+      memcpy(msg->data, data, length);
+      return msg;
+}
+
+Message* messageAllocate(size_t length) {
+      bool pooled = length <= MESSAGE_POOLED_LENGTH;
+      Message* msg = pooled ? poolAllocate(&messagePool, sizeof *msg + length) : malloc(sizeof *msg + length);
+      if(!msg)
+            return NULL;
+
+      atomic_init(&msg->refs, 1);
+      msg->length = length;
+      msg->pooled = pooled;
+      return msg;
+}
+
+Message* messageRetain(Message* msg) {
+      atomic_fetch_add_explicit(&msg->refs, 1, memory_order_relaxed);
+      return msg;
+}
+
+void messageRelease(Message* msg) {
+      if(atomic_fetch_sub_explicit(&msg->refs, 1, memory_order_acq_rel) != 1)
+            return;
+
+      // the last holder may be on any worker: the pool takes it on its thread
+      if(msg->pooled)
+            poolFree(&messagePool, msg);
+      else
+            free(msg);
+}
+
+bool messageShared(Message* msg) {
+      // acquire: the other holders are done with the data once they let go
+      return atomic_load_explicit(&msg->refs, memory_order_acquire) > 1;
+}
+
+void queueInit(OutboundQueue* queue) {
+      queue->head = 0;
+      queue->count = 0;
+      queue->offset = 0;
+}
+
+bool queuePush(OutboundQueue* queue, Message* msg) {
+      return queuePushSlice(queue, msg, 0, msg->length);
+}
+
+bool queuePushSlice(OutboundQueue* queue, Message* msg, size_t start, size_t length) {
+      if(queue->count == OUTBOUND_CAPACITY)
+            return false;
+
+      OutboundSlice* slice = &queue->slices[(queue->head + queue->count) % OUTBOUND_CAPACITY];
+      slice->msg = messageRetain(msg);
+      slice->start = start;
+      slice->length = length;
+      queue->count++;
+      return true;
+}
+
+bool queueEmpty(const OutboundQueue* queue) {
+      return queue->count == 0;
+}
+
+static void queuePop(OutboundQueue* queue) {
+      messageRelease(queue->slices[queue->head].msg);
+      queue->head = (queue->head + 1) % OUTBOUND_CAPACITY;
+      queue->count--;
+      queue->offset = 0;
+}
+
+void queueClear(OutboundQueue* queue) {
+      while(queue->count > 0)
+            queuePop(queue);
+}
+
+size_t queuePrepare(const OutboundQueue* queue, struct iovec* iov, size_t max) {
+      size_t batch = queue->count < max ? queue->count : max;
+
+      for(size_t i = 0; i < batch; i++) {
+            const OutboundSlice* slice = &queue->slices[(queue->head + i) % OUTBOUND_CAPACITY];
+            size_t skip = i == 0 ? queue->offset : 0;
+            iov[i].iov_base = (char*)slice->msg->data + slice->start + skip;
+            iov[i].iov_len = slice->length - skip;
+      }
+      return batch;
+}
+
+void queueConsume(OutboundQueue* queue, size_t written) {
+      // release every fully written message, remember where the partial one stopped
+      while(queue->count > 0) {
+            size_t left = queue->slices[queue->head].length - queue->offset;
+            if(written < left) {
+                  queue->offset += written;
+                  break;
+            }
+            written -= left;
+            queuePop(queue);
+      }
+}
+
+FlushResult queueFlush(OutboundQueue* queue, int socketFD) {
+      while(queue->count > 0) {
+            struct iovec iov[FLUSH_BATCH];
+            size_t batch = queuePrepare(queue, iov, FLUSH_BATCH);
+            size_t total = 0;
+            for(size_t i = 0; i < batch; i++)
+                  total += iov[i].iov_len;
+
+            ssize_t bytesSent = writev(socketFD, iov, batch);
+            if(bytesSent < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  if(errno == EAGAIN || errno == EWOULDBLOCK)
+                        return FLUSH_PENDING;
+                  return FLUSH_ERROR;
+            }
+            queueConsume(queue, (size_t)bytesSent);
+
+            // short write: the socket buffer is full
+            if((size_t)bytesSent < total)
+                  return FLUSH_PENDING;
+      }
+
+      return FLUSH_DONE;
+}
@@ -0,0 +1,94 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+// messages a single client may have waiting before the policy kicks in
+#define OUTBOUND_CAPACITY 64
+// messages handed to a single writev
+#define FLUSH_BATCH 16
+// messages up to this many bytes come from a pool, longer ones from the heap
+#define MESSAGE_POOLED_LENGTH 512
+
+/*
+A message is encoded once and shared by every recipient queue,
+the last queue to release it frees it.
+*/
+typedef struct MessageTag {
+      atomic_size_t refs;
+      size_t length;
+      bool pooled;
+      char data[];
+} Message;
+
+typedef enum SlowConsumerPolicyTag {
+      DROP_CLIENT,      // disconnect the client whose queue is full
+      DROP_MESSAGE      // the client misses the message, the room goes on
+} SlowConsumerPolicy;
+
+typedef enum FlushResultTag {
+      FLUSH_DONE,       // queue empty
+      FLUSH_PENDING,    // socket full, wait for EPOLLOUT
+      FLUSH_ERROR
+} FlushResult;
+
+/*
+The bytes of a message a client is sent: the whole message, or part of
+a larger one such as a history block.
+*/
+typedef struct OutboundSliceTag {
+      Message* msg;
+      size_t start;
+      size_t length;
+} OutboundSlice;
+
+/*
+Bounded outbound queue of a single client. offset is how much of the
+first slice has already been written.
+*/
+typedef struct OutboundQueueTag {
+      OutboundSlice slices[OUTBOUND_CAPACITY];
+      size_t head;
+      size_t count;
+      size_t offset;
+} OutboundQueue;
+
+Message* messageCreate(const char* data, size_t length);
+/*
+A message of length bytes the caller fills in.
+*/
+Message* messageAllocate(size_t length);
+Message* messageRetain(Message* msg);
+void messageRelease(Message* msg);
+/*
+Whether anyone but the caller still holds a reference.
+*/
+bool messageShared(Message* msg);
+
+void queueInit(OutboundQueue* queue);
+/*
+Takes a reference to msg. Returns false, without taking it, when the queue is full.
+*/
+bool queuePush(OutboundQueue* queue, Message* msg);
+bool queuePushSlice(OutboundQueue* queue, Message* msg, size_t start, size_t length);
+bool queueEmpty(const OutboundQueue* queue);
+void queueClear(OutboundQueue* queue);
+/*
+Describes the head of the queue, from where the last write stopped, in
+at most max iovecs. Returns how many were filled.
+*/
+size_t queuePrepare(const OutboundQueue* queue, struct iovec* iov, size_t max);
+/*
+Releases the messages the last bytes written completed.
+*/
+void queueConsume(OutboundQueue* queue, size_t written);
+/*
+Writes as much of the queue as the non-blocking socket accepts,
+a batch of messages per writev.
+*/
+FlushResult queueFlush(OutboundQueue* queue, int socketFD);
+
+#endif // FANOUT_H
@@ -0,0 +1,108 @@
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "framing.h"
+
+void frameHeader(char* header, size_t length) {
+      header[0] = (char)(length >> 24);
+      header[1] = (char)(length >> 16);
+      header[2] = (char)(length >> 8);
+      header[3] = (char)length;
+}
+
+size_t frameLength(const char* header) {
+      const uint8_t* bytes = (const uint8_t*)header;
+      return (size_t)bytes[0] << 24 | (size_t)bytes[1] << 16 | (size_t)bytes[2] << 8 | bytes[3];
+}
+
+void frameReaderInit(FrameReader* reader) {
+      reader->length = 0;
+}
+
+// moves up to want bytes of data into the reader, returns how many
+static size_t fill(FrameReader* reader, const char* data, size_t length, size_t want) {
+      size_t taken = want - reader->length;
+      if(taken > length)
+            taken = length;
+      memcpy(reader->data + reader->length, data, taken);
+      reader->length += taken;
+      return taken;
+}
+
+FrameResult frameParse(FrameReader* reader, const char* data, size_t length, FrameHandler handler, void* ctx) {
+      // first complete the frame the previous read cut
+      if(reader->length > 0) {
+            size_t taken = 0;
+            if(reader->length < FRAME_HEADER)
+                  taken = fill(reader, data, length, FRAME_HEADER);
+            if(reader->length < FRAME_HEADER)
+                  return FRAME_OK;
+
+            size_t payload = frameLength(reader->data);
+            if(payload > FRAME_MAX_PAYLOAD)
+                  return FRAME_MALFORMED;
+            taken += fill(reader, data + taken, length - taken, FRAME_HEADER + payload);
+            if(reader->length < FRAME_HEADER + payload)
+                  return FRAME_OK;
+
+            reader->length = 0;
+            if(!handler(reader->data + FRAME_HEADER, payload, ctx))
+                  return FRAME_STOPPED;
+            data += taken;
+            length -= taken;
+      }
+
+      // then every whole frame straight from data
+      while(length >= FRAME_HEADER) {
+            size_t payload = frameLength(data);
+            if(payload > FRAME_MAX_PAYLOAD)
+                  return FRAME_MALFORMED;
+            if(length < FRAME_HEADER + payload)
+                  break;
+
+            if(!handler(data + FRAME_HEADER, payload, ctx))
+                  return FRAME_STOPPED;
+            data += FRAME_HEADER + payload;
+            length -= FRAME_HEADER + payload;
+      }
+
+      // the header of a cut frame is checked once it is whole
+      memcpy(reader->data, data, length);
+      reader->length = length;
+      return FRAME_OK;
+}
+
+bool frameSend(int socketFD, const char* payload, size_t length) {
+      char header[FRAME_HEADER];
+      frameHeader(header, length);
+
+      struct iovec iov[2] = {
+            { .iov_base = header, .iov_len = FRAME_HEADER },
+            { .iov_base = (char*)payload, .iov_len = length }
+      };
+      struct iovec* next = iov;
+      size_t count = 2;
+
+      while(count > 0) {
+            ssize_t bytesSent = writev(socketFD, next, count);
+            if(bytesSent < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  return false;
+            }
+
+            // a short write goes on from where it stopped
+            size_t written = (size_t)bytesSent;
+            while(count > 0 && written >= next->iov_len) {
+                  written -= next->iov_len;
+                  next++;
+                  count--;
+            }
+            if(count > 0) {
+                  next->iov_base = (char*)next->iov_base + written;
+                  next->iov_len -= written;
+            }
+      }
+      return true;
+}
@@ -0,0 +1,58 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// payload length, 32 bit big endian
+#define FRAME_HEADER 4
+// longest payload either side accepts, longer is a protocol error
+#define FRAME_MAX_PAYLOAD 4096
+
+/*
+Every message on a MessagingApp connection, both ways, is a frame:
+
+      | length (4 bytes, network order) | payload (length bytes) |
+
+so a message never fuses with the next one or splits across two reads,
+whatever TCP does to the stream. Payloads are text without terminator.
+*/
+
+typedef enum FrameResultTag {
+      FRAME_OK,         // every complete frame handled, the rest kept for the next read
+      FRAME_STOPPED,    // the handler asked to stop
+      FRAME_MALFORMED   // a frame longer than FRAME_MAX_PAYLOAD
+} FrameResult;
+
+/*
+Called for every complete frame, payload is only valid during the call.
+Returning false stops the parsing.
+*/
+typedef bool (*FrameHandler)(const char* payload, size_t length, void* ctx);
+
+/*
+What is left of the stream between two reads: at most one incomplete frame.
+*/
+typedef struct FrameReaderTag {
+      size_t length;
+      char data[FRAME_HEADER + FRAME_MAX_PAYLOAD];
+} FrameReader;
+
+void frameHeader(char* header, size_t length);
+size_t frameLength(const char* header);
+
+void frameReaderInit(FrameReader* reader);
+/*
+Hands every frame data completes to handler, in order. Frames that lie
+whole in data are handed in place, only a frame cut by the end of data
+is copied into the reader.
+*/
+FrameResult frameParse(FrameReader* reader, const char* data, size_t length, FrameHandler handler, void* ctx);
+
+/*
+Writes a whole frame to the blocking socket, false on error.
+*/
+bool frameSend(int socketFD, const char* payload, size_t length);
+
+#endif // FRAMING_H
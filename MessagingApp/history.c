@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "history.h"
+#include "framing.h"
+
+void historyInit(RoomHistory* history, uint64_t firstID) {
+      memset(history, 0, sizeof *history);
+      history->firstID = firstID;
+      history->nextID = firstID;
+}
+
+void historyDestroy(RoomHistory* history) {
+      for(size_t i = 0; i < HISTORY_BLOCKS; i++) {
+            if(history->blocks[i].arena != NULL)
+                  messageRelease(history->blocks[i].arena);
+      }
+      historyInit(history, history->nextID);
+}
+
+bool historyEmpty(const RoomHistory* history) {
+      return history->nextID == history->firstID;
+}
+
+// makes the next block of the ring the current one, empty
+static bool advance(RoomHistory* history) {
+      size_t next = (history->current + 1) % HISTORY_BLOCKS;
+      HistoryBlock* block = &history->blocks[next];
+
+      // a block still being sent somewhere is left to its senders
+      if(block->arena != NULL && messageShared(block->arena)) {
+            messageRelease(block->arena);
+            block->arena = NULL;
+      }
+      if(block->arena == NULL && (block->arena = messageAllocate(HISTORY_BLOCK_SIZE)) == NULL) {
+            perror("History allocation failed");
+            return false;
+      }
+
+      block->firstID = history->nextID;
+      block->count = 0;
+      block->used = 0;
+      history->current = next;
+      return true;
+}
+
+bool historyAppend(RoomHistory* history, const char* text, size_t length, HistorySlice* slice) {
+      char prefix[24];
+      int prefixLength = snprintf(prefix, sizeof prefix, "%llu ", (unsigned long long)history->nextID);
+      if(length > FRAME_MAX_PAYLOAD - (size_t)prefixLength)
+            length = FRAME_MAX_PAYLOAD - (size_t)prefixLength;
+      size_t size = FRAME_HEADER + (size_t)prefixLength + length;
+
+      HistoryBlock* block = &history->blocks[history->current];
+      if(block->arena == NULL || block->used + size > HISTORY_BLOCK_SIZE) {
+            if(!advance(history))
+                  return false;
+            block = &history->blocks[history->current];
+      }
+
+      char* frame = block->arena->data + block->used;
+      frameHeader(frame, (size_t)prefixLength + length);
+      memcpy(frame + FRAME_HEADER, prefix, (size_t)prefixLength);
+      memcpy(frame + FRAME_HEADER + prefixLength, text, length);
+
+      slice->arena = block->arena;
+      slice->start = block->used;
+      slice->length = size;
+      block->used += size;
+      block->count++;
+      history->nextID++;
+      return true;
+}
+
+size_t historySince(const RoomHistory* history, uint64_t id, HistorySlice* slices) {
+      size_t count = 0;
+
+      // oldest block first: the one after the current
+      for(size_t i = 1; i <= HISTORY_BLOCKS; i++) {
+            const HistoryBlock* block = &history->blocks[(history->current + i) % HISTORY_BLOCKS];
+            if(block->arena == NULL || block->count == 0 || block->firstID + block->count - 1 <= id)
+                  continue;
+
+            // skip the frames the client has, the headers give their lengths
+            size_t start = 0;
+            for(uint64_t skipped = block->firstID; skipped <= id; skipped++)
+                  start += FRAME_HEADER + frameLength(block->arena->data + start);
+
+            slices[count].arena = block->arena;
+            slices[count].start = start;
+            slices[count].length = block->used - start;
+            count++;
+      }
+      return count;
+}
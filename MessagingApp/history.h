@@ -0,0 +1,66 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fanout.h"
+
+// a frame always fits in a block: FRAME_HEADER + FRAME_MAX_PAYLOAD
+#define HISTORY_BLOCK_SIZE 16384
+// the history of a room is at most HISTORY_BLOCKS * HISTORY_BLOCK_SIZE bytes
+#define HISTORY_BLOCKS 4
+
+/*
+Consecutive frames of a room, encoded once. The arena is a message
+other threads may be sending slices of: a block is only rewritten once
+nobody else holds it, otherwise it is replaced.
+*/
+typedef struct HistoryBlockTag {
+      Message* arena;               // NULL until the ring gets to it
+      uint64_t firstID;
+      size_t count;                 // frames
+      size_t used;                  // bytes
+} HistoryBlock;
+
+/*
+The last messages of a room as a ring of arena blocks. Every message
+gets the next ID, its frame payload is "<ID> <text>"; the oldest block
+is dropped whole when the ring comes back to it.
+*/
+typedef struct RoomHistoryTag {
+      HistoryBlock blocks[HISTORY_BLOCKS];
+      size_t current;               // the block being filled
+      uint64_t firstID;             // of the first message
+      uint64_t nextID;
+} RoomHistory;
+
+/*
+Frames lying contiguously in an arena, ready for a single iovec.
+*/
+typedef struct HistorySliceTag {
+      Message* arena;
+      size_t start;
+      size_t length;
+} HistorySlice;
+
+/*
+An empty history whose first message gets firstID (at least 1).
+*/
+void historyInit(RoomHistory* history, uint64_t firstID);
+void historyDestroy(RoomHistory* history);
+bool historyEmpty(const RoomHistory* history);
+
+/*
+Encodes text as the frame of the next ID, slice tells where it went.
+False on allocation failure, the message then has no ID.
+*/
+bool historyAppend(RoomHistory* history, const char* text, size_t length, HistorySlice* slice);
+/*
+The frames of the messages after id the ring still holds, oldest first,
+in at most HISTORY_BLOCKS slices. Returns how many were filled.
+*/
+size_t historySince(const RoomHistory* history, uint64_t id, HistorySlice* slices);
+
+#endif // HISTORY_H
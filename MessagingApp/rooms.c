@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rooms.h"
+
+bool roomTableInit(RoomTable* table) {
+      table->buckets = calloc(ROOM_TABLE_MIN_BUCKETS, sizeof *table->buckets);
+      if(!table->buckets) {
+            perror("Room table allocation failed");
+            return false;
+      }
+      table->bucketCount = ROOM_TABLE_MIN_BUCKETS;
+      table->count = 0;
+      table->retainedOldest = NULL;
+      table->retainedNewest = NULL;
+      table->retainedCount = 0;
+      table->firstID = 1;
+      return true;
+}
+
+static void roomFree(Room* room) {
+      free(room->members);
+      free(room->subscribers);
+      historyDestroy(&room->history);
+      free(room);
+}
+
+void roomTableDestroy(RoomTable* table) {
+      for(size_t i = 0; i < table->bucketCount; i++) {
+            Room* room = table->buckets[i];
+            while(room != NULL) {
+                  Room* next = room->next;
+                  roomFree(room);
+                  room = next;
+            }
+      }
+      free(table->buckets);
+      table->buckets = NULL;
+      table->count = 0;
+      table->retainedOldest = NULL;
+      table->retainedNewest = NULL;
+      table->retainedCount = 0;
+}
+
+bool roomValidName(const char* name) {
+      size_t length = 0;
+      for(; name[length] != '\0'; length++) {
+            char c = name[length];
+            bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+            if(!valid || length == ROOM_NAME_MAX - 1)
+                  return false;
+      }
+      return length > 0;
+}
+
+// FNV-1a
+uint64_t roomHash(const char* name) {
+      uint64_t hash = 14695981039346656037ULL;
+      for(; *name != '\0'; name++) {
+            hash ^= (uint8_t)*name;
+            hash *= 1099511628211ULL;
+      }
+      return hash;
+}
+
+Room* roomFind(const RoomTable* table, const char* name, uint64_t hash) {
+      Room* room = table->buckets[hash & (table->bucketCount - 1)];
+      while(room != NULL && (room->hash != hash || strcmp(room->name, name) != 0))
+            room = room->next;
+      return room;
+}
+
+static void grow(RoomTable* table) {
+      size_t bucketCount = table->bucketCount * 2;
+      Room** buckets = calloc(bucketCount, sizeof *buckets);
+      // a longer chain is no failure
+      if(!buckets)
+            return;
+
+      for(size_t i = 0; i < table->bucketCount; i++) {
+            Room* room = table->buckets[i];
+            while(room != NULL) {
+                  Room* next = room->next;
+                  size_t bucket = room->hash & (bucketCount - 1);
+                  room->next = buckets[bucket];
+                  buckets[bucket] = room;
+                  room = next;
+            }
+      }
+      free(table->buckets);
+      table->buckets = buckets;
+      table->bucketCount = bucketCount;
+}
+
+static void retainedRemove(RoomTable* table, Room* room) {
+      if(!room->retained)
+            return;
+
+      if(room->retainedPrev != NULL)
+            room->retainedPrev->retainedNext = room->retainedNext;
+      else
+            table->retainedOldest = room->retainedNext;
+      if(room->retainedNext != NULL)
+            room->retainedNext->retainedPrev = room->retainedPrev;
+      else
+            table->retainedNewest = room->retainedPrev;
+      room->retained = false;
+      table->retainedCount--;
+}
+
+static void retainedAppend(RoomTable* table, Room* room) {
+      room->retainedPrev = table->retainedNewest;
+      room->retainedNext = NULL;
+      if(table->retainedNewest != NULL)
+            table->retainedNewest->retainedNext = room;
+      else
+            table->retainedOldest = room;
+      table->retainedNewest = room;
+      room->retained = true;
+      table->retainedCount++;
+}
+
+// takes room out of the table and frees it
+static void removeRoom(RoomTable* table, Room* room) {
+      retainedRemove(table, room);
+      Room** link = &table->buckets[room->hash & (table->bucketCount - 1)];
+      while(*link != room)
+            link = &(*link)->next;
+      *link = room->next;
+      table->count--;
+      if(room->history.nextID > table->firstID)
+            table->firstID = room->history.nextID;
+      roomFree(room);
+}
+
+Room* roomGet(RoomTable* table, const char* name, uint64_t hash) {
+      Room* room = roomFind(table, name, hash);
+      if(room != NULL) {
+            retainedRemove(table, room);
+            return room;
+      }
+
+      room = calloc(1, sizeof *room);
+      if(!room) {
+            perror("Room allocation failed");
+            return NULL;
+      }
+      snprintf(room->name, sizeof room->name, "%s", name);
+      room->hash = hash;
+      historyInit(&room->history, table->firstID);
+
+      if(table->count == table->bucketCount)
+            grow(table);
+      size_t bucket = hash & (table->bucketCount - 1);
+      room->next = table->buckets[bucket];
+      table->buckets[bucket] = room;
+      table->count++;
+      return room;
+}
+
+void roomRelease(RoomTable* table, Room* room) {
+      if(room->memberCount > 0 || room->subscriberCount > 0 || room->retained)
+            return;
+      if(historyEmpty(&room->history)) {
+            removeRoom(table, room);
+            return;
+      }
+
+      // otherwise anyone could pin memory with a message in a new room each
+      retainedAppend(table, room);
+      if(table->retainedCount > ROOM_RETAINED_MAX)
+            removeRoom(table, table->retainedOldest);
+}
+
+// doubles array (of size bytes elements) once it is full
+static bool reserve(void** array, size_t* capacity, size_t count, size_t size) {
+      if(count < *capacity)
+            return true;
+
+      size_t grown = *capacity ? *capacity * 2 : 8;
+      void* resized = realloc(*array, grown * size);
+      if(!resized) {
+            perror("Room allocation failed");
+            return false;
+      }
+      *array = resized;
+      *capacity = grown;
+      return true;
+}
+
+bool roomJoin(Room* room, RoomSeat* seat, uint64_t id, OutboundQueue* outbound) {
+      if(!reserve((void**)&room->members, &room->memberCapacity, room->memberCount, sizeof *room->members))
+            return false;
+
+      seat->room = room;
+      seat->index = room->memberCount;
+      room->members[room->memberCount++] = (RoomMember){ .id = id, .outbound = outbound, .seat = seat };
+      return true;
+}
+
+void roomLeave(RoomSeat* seat) {
+      Room* room = seat->room;
+      if(room == NULL)
+            return;
+
+      // the last member takes the empty place
+      RoomMember* last = &room->members[--room->memberCount];
+      room->members[seat->index] = *last;
+      last->seat->index = seat->index;
+      seat->room = NULL;
+}
+
+bool roomSubscribe(Room* room, uint16_t worker) {
+      for(size_t i = 0; i < room->subscriberCount; i++) {
+            if(room->subscribers[i] == worker)
+                  return true;
+      }
+      if(!reserve((void**)&room->subscribers, &room->subscriberCapacity, room->subscriberCount, sizeof *room->subscribers))
+            return false;
+
+      room->subscribers[room->subscriberCount++] = worker;
+      return true;
+}
+
+void roomUnsubscribe(Room* room, uint16_t worker) {
+      for(size_t i = 0; i < room->subscriberCount; i++) {
+            if(room->subscribers[i] == worker) {
+                  room->subscribers[i] = room->subscribers[--room->subscriberCount];
+                  return;
+            }
+      }
+}
@@ -0,0 +1,113 @@
+#ifndef ROOMS_H
+#define ROOMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "fanout.h"
+#include "history.h"
+
+#define ROOM_NAME_MAX 32
+// where every client starts
+#define ROOM_DEFAULT "lobby"
+#define ROOM_TABLE_MIN_BUCKETS 64
+// rooms a worker keeps for their history only, the least recently left go first
+#define ROOM_RETAINED_MAX 256
+
+struct RoomTag;
+
+/*
+Place of a member in its room: the member array is dense and a leaving
+member is replaced by the last one, so leaving never shifts the array.
+Embedded first in whatever joins rooms, a seat pointer is also a
+pointer to its owner.
+*/
+typedef struct RoomSeatTag {
+      struct RoomTag* room;         // NULL outside any room
+      size_t index;
+} RoomSeat;
+
+/*
+A member as fan-out sees it, inline in the member array so a delivery
+walks one array: the id tells the sender apart, the queue takes the
+message. The seat leads back to the member for leaving and for the
+rare deliveries that need more.
+*/
+typedef struct RoomMemberTag {
+      uint64_t id;
+      OutboundQueue* outbound;
+      RoomSeat* seat;
+} RoomMember;
+
+/*
+A room as seen by one worker thread. Every worker keeps the members
+connected to it; the worker the room hashes to also orders its
+messages, keeps their history and which workers have members
+(subscribers).
+*/
+typedef struct RoomTag {
+      char name[ROOM_NAME_MAX];
+      uint64_t hash;
+      struct RoomTag* next;         // bucket chain
+      RoomMember* members;
+      size_t memberCount;
+      size_t memberCapacity;
+      uint16_t* subscribers;
+      size_t subscriberCount;
+      size_t subscriberCapacity;
+      RoomHistory history;
+      bool retained;                // in the retained list: only its history keeps it
+      struct RoomTag* retainedPrev;
+      struct RoomTag* retainedNext;
+} Room;
+
+/*
+Rooms by name of a single thread, chained hashing with a power of two
+bucket count that doubles with the rooms. Rooms nobody is in but with
+a history are also listed from the least recently left, and at most
+ROOM_RETAINED_MAX of them are kept. A room created again starts its
+IDs past every ID a freed one gave, so a client's since never runs
+ahead of a room it comes back to.
+*/
+typedef struct RoomTableTag {
+      Room** buckets;
+      size_t bucketCount;
+      size_t count;
+      Room* retainedOldest;
+      Room* retainedNewest;
+      size_t retainedCount;
+      uint64_t firstID;             // of the next room: past the IDs of every freed one
+} RoomTable;
+
+bool roomTableInit(RoomTable* table);
+void roomTableDestroy(RoomTable* table);
+
+/*
+1 to ROOM_NAME_MAX - 1 characters among letters, digits, '-' and '_'.
+*/
+bool roomValidName(const char* name);
+uint64_t roomHash(const char* name);
+Room* roomFind(const RoomTable* table, const char* name, uint64_t hash);
+/*
+Finds the room or creates it empty, NULL on allocation failure. A
+retained room is in use again: it leaves the retained list.
+*/
+Room* roomGet(RoomTable* table, const char* name, uint64_t hash);
+/*
+Frees room once it has neither members nor subscribers. A room with
+history is retained for the clients coming back to it, unless it is
+past ROOM_RETAINED_MAX: then the least recently left room is freed,
+history and all.
+*/
+void roomRelease(RoomTable* table, Room* room);
+
+bool roomJoin(Room* room, RoomSeat* seat, uint64_t id, OutboundQueue* outbound);
+/*
+Takes the seat out of its room, which stays in the table.
+*/
+void roomLeave(RoomSeat* seat);
+bool roomSubscribe(Room* room, uint16_t worker);
+void roomUnsubscribe(Room* room, uint16_t worker);
+
+#endif // ROOMS_H
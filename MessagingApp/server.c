@@ -1,216 +1,897 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <stdbool.h>
 
+#include "fanout.h"
+#include "framing.h"
+#include "rooms.h"
+#include "../Common/netio.h"
+#include "../Common/spsc.h"
+#include "../Common/pool.h"
+
 #define PORT 8080
-#define MAX_CLIENTS 10
-#define BUFFER_SIZE 1024
+// a read may carry many frames, or end in the middle of one
+#define BUFFER_SIZE 4096
+#define MAX_EVENTS 64
+// commands a worker may have queued to another before they wait in its backlog
+#define INBOX_CAPACITY 256
+#define INBOX_BATCH 32
+// wait of a worker whose backlog is waiting for room in an inbox
+#define BACKLOG_RETRY_MS 1
+#define USAGE "[drop-client|drop-message] [uring|epoll|auto] [workers, 0 = one per core]"
+
+typedef struct WorkerTag Worker;
 
 typedef struct ClientInfoTag {
-      int socketFD; 
+      RoomSeat seat;     // first: room members lead back to their client through it
+      Worker* worker;
+      uint64_t id;       // unique in the worker, for replies that may outlive the client
+      size_t slot;       // in the client array of the worker
+      int socketFD;
       struct sockaddr_in address;
+      char ip[INET_ADDRSTRLEN];
+      int port;
+      FrameReader frames;
+      OutboundQueue outbound;
+      bool sending;      // a send of the queue head is in flight
+      bool flushing;     // in the flush list of the worker
+      bool dropped;      // removed at the end of the current event
 } ClientInfo;
 
-typedef struct ClientListTag {
-      ClientInfo* clients[MAX_CLIENTS];
-      size_t active;
-      pthread_mutex_t mutex;
-} ClientList;
+/*
+What the workers tell each other. The worker a room hashes to orders
+it: messages are published to that worker, which numbers them in the
+room history and delivers them to every worker with members in the
+room, so all members see one order.
+*/
+typedef enum WorkerCommandKindTag {
+      COMMAND_SUBSCRIBE,      // to the owner: the worker has members in the room
+      COMMAND_UNSUBSCRIBE,    // to the owner: the worker has none left
+      COMMAND_PUBLISH,        // to the owner: msg (text) was said in the room
+      COMMAND_DELIVER,        // from the owner: the slice of msg goes to the local members
+      COMMAND_HISTORY,        // to the owner: client wants the messages after since
+      COMMAND_REPLAY          // from the owner: the slice of msg goes to client
+} WorkerCommandKind;
+
+typedef struct WorkerCommandTag {
+      WorkerCommandKind kind;
+      uint16_t worker;              // subscriptions: that worker, messages: the sender's
+      Message* msg;                 // a reference travels with the command
+      size_t start;                 // the frames of msg to send
+      size_t length;
+      uint64_t client;              // history: the id of the client asking, messages: the sender
+      uint64_t since;
+      uint64_t hash;
+      char room[ROOM_NAME_MAX];
+} WorkerCommand;
+
+typedef struct CommandBacklogTag {
+      WorkerCommand* commands;
+      size_t count;
+      size_t capacity;
+} CommandBacklog;
+
+/*
+A worker owns a SO_REUSEPORT listener, the clients the kernel hands to
+it and their NetIO: a client never changes worker. Rooms are sharded
+across the workers by name, and a worker only talks to another through
+the inbox it alone fills, a SPSC queue: no lock anywhere, two rooms of
+different owners never touch the same memory.
+*/
+struct WorkerTag {
+      uint16_t index;
+      pthread_t thread;
+      NetIO io;
+      int listenFD;
+      int wakeFDs[2];               // socketpair, the others write [1] to wake the worker up
+      atomic_bool wakePending;
+      RoomTable rooms;
+      ClientInfo** clients;
+      size_t clientCount;
+      size_t clientCapacity;
+      uint64_t nextClientID;
+      ClientInfo** flushes;         // clients with frames queued this round
+      size_t flushCount;
+      size_t flushCapacity;
+      SpscQueue* inbox;             // by sending worker
+      CommandBacklog* backlog;      // by receiving worker: what its inbox did not take
+      bool* notify;                 // by receiving worker: sent something this round
+};
+
+Worker* workers;
+size_t workerCount;
+NetIOBackend backend = NETIO_AUTO;
+SlowConsumerPolicy policy = DROP_CLIENT;
+// context of the wake up socket in the NetIO of every worker, the listener's is NULL
+int wakeMarker;
+// every worker recycles the clients it removes
+Pool clientPool = POOL_OF(ClientInfo);
+
+void checkArgs(int argc, char** argv);
+int createListener(uint16_t port);
+bool initWorker(Worker* worker, uint16_t index);
+/*
+This thread routine is the event loop of a single worker.
+*/
+void* runWorker(void* arg);
+ClientInfo* createClient(Worker* worker, const int* clientSocketFD, const struct sockaddr_in* clientAddress);
+void acceptClient(Worker* worker, const NetIOEvent* event);
+/*
+This routine handles what a client sent, every frame it completes.
+It returns false once the client has to be removed.
+*/
+bool handleClient(ClientInfo* info, const NetIOEvent* event);
+/*
+A single frame: a command (/join <room>, /leave, /since <ID>, exit) or
+a line for the room of the client. Returns false once the client has
+to go.
+*/
+bool handleFrame(const char* payload, size_t length, void* ctx);
+/*
+A frame holding text, NULL on allocation failure.
+*/
+Message* createFrame(const char* text, size_t length);
+/*
+Moves the client to room, out of the one it was in.
+*/
+void joinRoom(ClientInfo* info, const char* room);
+void leaveRoom(ClientInfo* info);
+/*
+A line for the client alone.
+*/
+void notifyClient(ClientInfo* info, const char* text);
+/*
+Hands a command to the worker to, running it right away when it is the
+sender itself. A full inbox keeps the command in the sender's backlog.
+*/
+void sendCommand(Worker* worker, uint16_t to, const WorkerCommand* command);
+void runCommand(Worker* worker, const WorkerCommand* command);
+void drainInbox(Worker* worker);
+/*
+Moves what the backlogs can into the inboxes, returns true while some
+command is still waiting.
+*/
+bool flushBacklogs(Worker* worker);
+/*
+Wakes up the workers sent something this round.
+*/
+void wakeWorkers(Worker* worker);
+/*
+Queues msg to every local member of the room but the sender, slow
+clients are handled by the policy instead of blocking the room.
+*/
+void deliverMsg(Worker* worker, Room* room, const WorkerCommand* delivery);
+/*
+Queues the history frames of a replay to the client that asked for
+them, if it is still there.
+*/
+void replayMsg(Worker* worker, const WorkerCommand* replay);
+/*
+Sends are deferred to the end of the round, so that every frame queued
+to a client meanwhile leaves in the same writev.
+*/
+void scheduleFlush(ClientInfo* info);
+void flushScheduled(Worker* worker);
+/*
+Hands the head of the queue to a single send, unless one is in flight:
+its completion sends the rest.
+*/
+void flushClient(ClientInfo* info);
+void sendDone(ClientInfo* info, const NetIOEvent* event);
+void removeClient(ClientInfo* info);
+void removeDropped(Worker* worker);
+/*
+This thread routine waits for SIGINT or SIGTERM, reports the pools and
+ends the server.
+*/
+void* handleShutdown(void* arg);
+
+int main(int argc, char** argv) {
+      checkArgs(argc, argv);
+      // a client vanishing mid write must not kill the whole room
+      signal(SIGPIPE, SIG_IGN);
+
+      // every thread inherits the mask: only the shutdown thread takes them
+      sigset_t shutdownSignals;
+      sigemptyset(&shutdownSignals);
+      sigaddset(&shutdownSignals, SIGINT);
+      sigaddset(&shutdownSignals, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &shutdownSignals, NULL);
+      pthread_t shutdownThread;
+      if(pthread_create(&shutdownThread, NULL, handleShutdown, &shutdownSignals) != 0) {
+            perror("Thread creation failed");
+            exit(EXIT_FAILURE);
+      }
 
-int socketServerFD;  // global socket descriptor for thread access
-ClientList clients;
+      workers = calloc(workerCount, sizeof *workers);
+      if(!workers) {
+            perror("Worker allocation failed");
+            exit(EXIT_FAILURE);
+      }
+      // every inbox exists before any worker may write to it
+      for(size_t i = 0; i < workerCount; i++) {
+            if(!initWorker(&workers[i], (uint16_t)i))
+                  exit(EXIT_FAILURE);
+      }
 
-void initClientList();
-ClientInfo* createClient(const int* clientSocketFD, const struct sockaddr_in* clientAddress);
-void* handleClient(void* arg);
-void broadcastMsg(const char* msg, int senderFD);
+      // the main thread runs the first worker itself
+      for(size_t i = 1; i < workerCount; i++) {
+            if(pthread_create(&workers[i].thread, NULL, runWorker, &workers[i]) != 0) {
+                  perror("Thread creation failed");
+                  exit(EXIT_FAILURE);
+            }
+      }
+      runWorker(&workers[0]);
 
-int main() {
-      initClientList();
-      struct sockaddr_in address;
+      for(size_t i = 1; i < workerCount; i++)
+            pthread_join(workers[i].thread, NULL);
+      exit(EXIT_SUCCESS);
+}
 
-      // creating socket
-      int serverFD = socket(AF_INET, SOCK_STREAM, 0);
-      if(serverFD == 0) {
-            perror("Socket creation failed");
+void checkArgs(int argc, char** argv) {
+      if(argc > 4) {
+            fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
+            exit(EXIT_FAILURE);
+      }
+
+      if(argc > 1) {
+            if(strcmp(argv[1], "drop-client") == 0) {
+                  policy = DROP_CLIENT;
+            } else if(strcmp(argv[1], "drop-message") == 0) {
+                  policy = DROP_MESSAGE;
+            } else {
+                  fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
+                  exit(EXIT_FAILURE);
+            }
+      }
+
+      if(argc > 2 && !netioParseBackend(argv[2], &backend)) {
+            fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
             exit(EXIT_FAILURE);
       }
 
-      
+      workerCount = 1;
+      if(argc > 3) {
+            long workerCheck = atol(argv[3]);
+            if(workerCheck < 0 || workerCheck > UINT16_MAX) {
+                  fprintf(stderr, "Invalid workers: %s\n", argv[3]);
+                  exit(EXIT_FAILURE);
+            }
+            if(workerCheck == 0) {
+                  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+                  workerCheck = cores > 0 ? cores : 1;
+            }
+            workerCount = (size_t)workerCheck;
+      }
+}
+
+int createListener(uint16_t port) {
+      int serverFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if(serverFD < 0) {
+            perror("Socket creation failed");
+            return -1;
+      }
+
+      // every worker binds the same port, the kernel balances the accepts
+      int reuse = 1;
+      if(setsockopt(serverFD, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof reuse) < 0
+            || setsockopt(serverFD, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse) < 0) {
+            perror("Socket options failed");
+            close(serverFD);
+            return -1;
+      }
 
       // setting address and port
+      struct sockaddr_in address;
       memset(&address, 0, sizeof(address));
       address.sin_family = AF_INET;
-      address.sin_addr.s_addr = INADDR_ANY;  
-      address.sin_port = htons(PORT);   
+      address.sin_addr.s_addr = INADDR_ANY;
+      address.sin_port = htons(port);
 
       // binding
       int bindCheck = bind(serverFD, (struct sockaddr*)&address, sizeof(address));
       if(bindCheck < 0) {
             perror("Binding failed");
-            exit(EXIT_FAILURE);
+            close(serverFD);
+            return -1;
       }
 
       // listening
-      int listenCheck = listen(serverFD, MAX_CLIENTS);
+      int listenCheck = listen(serverFD, SOMAXCONN);
       if(listenCheck < 0) {
             perror("Listening failed");
+            close(serverFD);
+            return -1;
+      }
+
+      return serverFD;
+}
+
+bool initWorker(Worker* worker, uint16_t index) {
+      worker->index = index;
+      atomic_init(&worker->wakePending, false);
+      if((worker->listenFD = createListener(PORT)) < 0)
+            return false;
+
+      if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, worker->wakeFDs) < 0) {
+            perror("Wake up socket creation failed");
+            return false;
+      }
+
+      worker->inbox = calloc(workerCount, sizeof *worker->inbox);
+      worker->backlog = calloc(workerCount, sizeof *worker->backlog);
+      worker->notify = calloc(workerCount, sizeof *worker->notify);
+      if(!worker->inbox || !worker->backlog || !worker->notify || !roomTableInit(&worker->rooms)) {
+            perror("Worker allocation failed");
+            return false;
+      }
+      for(size_t i = 0; i < workerCount; i++) {
+            if(i != index && !spscInit(&worker->inbox[i], INBOX_CAPACITY, sizeof(WorkerCommand))) {
+                  perror("Worker allocation failed");
+                  return false;
+            }
+      }
+      return true;
+}
+
+void* runWorker(void* arg) {
+      Worker* worker = (Worker*)arg;
+
+      if(!netioInit(&worker->io, backend, BUFFER_SIZE - NETIO_HEADROOM, NETIO_DEFAULT_BUFFERS))
+            exit(EXIT_FAILURE);
+      if(!netioAccept(&worker->io, worker->listenFD, NULL) || !netioRecv(&worker->io, worker->wakeFDs[0], &wakeMarker)) {
+            fprintf(stderr, "Accept failed to start\n");
             exit(EXIT_FAILURE);
       }
 
-      printf("Chat server listening on port %d\n", PORT);
+      if(worker->index == 0)
+            printf("Chat server listening on port %d (%zu workers, %s)\n", PORT, workerCount, netioBackendName(&worker->io));
 
       bool listening = true;
-      bool clientCreated;
+      bool backlogged = false;
+      NetIOEvent events[MAX_EVENTS];
 
       while(listening) {
-            // accepting client connection
-            clientCreated = true;
-            struct sockaddr_in newClientAddress;
-            socklen_t addrLen = sizeof(newClientAddress);
-            int newClientFD = accept(serverFD, (struct sockaddr*)&newClientAddress, &addrLen);
-            
-            if(newClientFD < 0) {
-                  perror("Accepting connection went wrong");
-                  clientCreated = false;
+            int ready = netioWait(&worker->io, events, MAX_EVENTS, backlogged ? BACKLOG_RETRY_MS : -1);
+            if(ready < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  perror("Wait failed");
+                  listening = false;
+                  break;
             }
 
-            if(clientCreated) {
-                  // allocating client
-                  ClientInfo* newClient = createClient(&newClientFD, &newClientAddress);
-                  pthread_t threadID;
-                  int threadCheck = pthread_create(&threadID, NULL, handleClient, (void*)newClient);
-                  if(threadCheck != 0) {
-                        perror("Thread creation failed");
-                        close(newClient->socketFD);
-                        free(newClient);
-                        clientCreated = false;
-                  } else {
-                        pthread_detach(threadID);
+            for(int i = 0; i < ready; i++) {
+                  ClientInfo* info = events[i].ctx;
+                  if(info == NULL) {
+                        acceptClient(worker, &events[i]);
+                        continue;
                   }
+                  // the inbox is drained below, whatever woke us up
+                  if(events[i].ctx == &wakeMarker) {
+                        atomic_store(&worker->wakePending, false);
+                        continue;
+                  }
+                  // a delivery earlier in this round may have dropped it already
+                  if(info->dropped)
+                        continue;
+
+                  if(events[i].kind == NETIO_SEND)
+                        sendDone(info, &events[i]);
+                  else if(!handleClient(info, &events[i]))
+                        info->dropped = true;
             }
-      }
 
-      close(serverFD);
-      pthread_mutex_destroy(&clients.mutex);
-      exit(EXIT_SUCCESS);
-}
+            drainInbox(worker);
+            flushScheduled(worker);
+            removeDropped(worker);
+            backlogged = flushBacklogs(worker);
+            wakeWorkers(worker);
+      }
 
-void initClientList() {
-    clients.active = 0;
-    for (size_t i = 0; i < MAX_CLIENTS; i++) {
-        clients.clients[i] = NULL;
-    }
-    if (pthread_mutex_init(&clients.mutex, NULL) != 0) {
-        perror("pthread_mutex_init");
-        exit(EXIT_FAILURE);
-    }
+      close(worker->listenFD);
+      netioDestroy(&worker->io);
+      return NULL;
 }
 
-ClientInfo* createClient(const int* clientSocketFD, const struct sockaddr_in* clientAddress) {
+ClientInfo* createClient(Worker* worker, const int* clientSocketFD, const struct sockaddr_in* clientAddress) {
       if(clientSocketFD == NULL || clientAddress == NULL)
             return NULL;
 
-      ClientInfo* newClient = malloc(sizeof(ClientInfo));
+      ClientInfo* newClient = POOL_NEW(&clientPool, ClientInfo);
       if(!newClient) {
             perror("Client memory allocation failed");
             exit(EXIT_FAILURE);
       }
-      
 
+
+      newClient->seat.room = NULL;
+      newClient->worker = worker;
+      newClient->id = worker->nextClientID++;
       newClient->socketFD = *clientSocketFD;
       newClient->address = *clientAddress;
+      inet_ntop(AF_INET, &newClient->address.sin_addr, newClient->ip, INET_ADDRSTRLEN);
+      newClient->port = ntohs(newClient->address.sin_port);
+      frameReaderInit(&newClient->frames);
+      queueInit(&newClient->outbound);
+      newClient->sending = false;
+      newClient->flushing = false;
+      newClient->dropped = false;
 
       return newClient;
 }
 
-void* handleClient(void *arg) {
-      ClientInfo *info = (ClientInfo*)arg;
-      int clientSocket = info->socketFD;
-      char buffer[BUFFER_SIZE];
-      char clientIP[INET_ADDRSTRLEN];
-      
-      inet_ntop(AF_INET, &info->address.sin_addr, clientIP, INET_ADDRSTRLEN);
-      int clientPort = ntohs(info->address.sin_port);
-
-      printf("New connection from %s:%d\n", clientIP, clientPort);
-
-      // Add client to list
-      pthread_mutex_lock(&clients.mutex);
-      if(clients.active < MAX_CLIENTS) {
-            // insert in "active" index and then increment active
-            clients.clients[clients.active] = info;
-            clients.active++;
-      } else {
-            // list full: unlock mutex and close fd
-            pthread_mutex_unlock(&clients.mutex);
-            close(info->socketFD);
-            free(info);
-            return NULL;
+void acceptClient(Worker* worker, const NetIOEvent* event) {
+      // accepting client connection
+      int newClientFD = event->result;
+      if(newClientFD < 0) {
+            errno = -newClientFD;
+            perror("Accepting connection went wrong");
+            return;
+      }
+
+      if(worker->clientCount == worker->clientCapacity) {
+            size_t capacity = worker->clientCapacity ? worker->clientCapacity * 2 : 64;
+            ClientInfo** clients = realloc(worker->clients, capacity * sizeof *clients);
+            if(!clients) {
+                  perror("Client list allocation failed");
+                  close(newClientFD);
+                  return;
+            }
+            worker->clients = clients;
+            worker->clientCapacity = capacity;
+      }
+
+      // frames are coalesced here already, Nagle would only delay them
+      int noDelay = 1;
+      setsockopt(newClientFD, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof noDelay);
+
+      // allocating client
+      ClientInfo* newClient = createClient(worker, &newClientFD, &event->peer);
+
+      if(!netioRecv(&worker->io, newClientFD, newClient)) {
+            fprintf(stderr, "Receive failed to start\n");
+            close(newClientFD);
+            poolFree(&clientPool, newClient);
+            return;
+      }
+
+      newClient->slot = worker->clientCount;
+      worker->clients[worker->clientCount++] = newClient;
+
+      printf("New connection from %s:%d\n", newClient->ip, newClient->port);
+      joinRoom(newClient, ROOM_DEFAULT);
+}
+
+bool handleClient(ClientInfo* info, const NetIOEvent* event) {
+      ssize_t bytesReceived = event->result;
+      if(bytesReceived < 0) {
+            errno = -bytesReceived;
+            perror("Receive failed");
+            return false;
+      } else if(bytesReceived == 0) {
+            printf("Client %s:%d disconnected\n", info->ip, info->port);
+            return false;
+      }
+
+      FrameResult result = frameParse(&info->frames, (const char*)event->data, (size_t)bytesReceived, handleFrame, info);
+      if(result == FRAME_MALFORMED)
+            printf("Client %s:%d sent a frame over %d bytes\n", info->ip, info->port, FRAME_MAX_PAYLOAD);
+      return result == FRAME_OK;
+}
+
+bool handleFrame(const char* payload, size_t length, void* ctx) {
+      ClientInfo* info = (ClientInfo*)ctx;
+
+      if(length == 4 && memcmp(payload, "exit", 4) == 0)
+            return false;
+      if(length >= 6 && memcmp(payload, "/join ", 6) == 0) {
+            // longer than any valid name stays invalid once cut
+            char name[ROOM_NAME_MAX + 1];
+            size_t nameLength = length - 6 < ROOM_NAME_MAX ? length - 6 : ROOM_NAME_MAX;
+            memcpy(name, payload + 6, nameLength);
+            name[nameLength] = '\0';
+            joinRoom(info, name);
+            return !info->dropped;
+      }
+      if(length == 6 && memcmp(payload, "/leave", 6) == 0) {
+            joinRoom(info, ROOM_DEFAULT);
+            return !info->dropped;
       }
-      pthread_mutex_unlock(&clients.mutex);
-
-      bool connected = true;
-      while(connected) {
-            ssize_t bytesReceived = recv(clientSocket, buffer, BUFFER_SIZE-1, 0);
-            if(bytesReceived == -1) {
-                  perror("Receive failed");
-                  connected = false;
-            } else if(bytesReceived == 0) {
-                  printf("Client %s:%d disconnected\n", clientIP, clientPort);
-                  connected = false;
+      // only a client that could not join anything is outside every room
+      if(info->seat.room == NULL) {
+            notifyClient(info, "* you are in no room, /join one");
+            return !info->dropped;
+      }
+      Room* room = info->seat.room;
+
+      if(length >= 7 && memcmp(payload, "/since ", 7) == 0) {
+            char id[24];
+            size_t idLength = length - 7 < sizeof id - 1 ? length - 7 : sizeof id - 1;
+            memcpy(id, payload + 7, idLength);
+            id[idLength] = '\0';
+
+            // the owner answers with the frames after since, straight from the history
+            WorkerCommand command = { .kind = COMMAND_HISTORY, .worker = info->worker->index, .client = info->id };
+            command.since = strtoull(id, NULL, 10);
+            command.hash = room->hash;
+            memcpy(command.room, room->name, ROOM_NAME_MAX);
+            sendCommand(info->worker, (uint16_t)(room->hash % workerCount), &command);
+            return true;
+      }
+
+      // sending message to the room
+      char formattedMsg[FRAME_MAX_PAYLOAD + 1];
+      int formattedLength = snprintf(formattedMsg, sizeof(formattedMsg), "[%s:%d] %.*s", info->ip, info->port, (int)length, payload);
+      if(formattedLength >= (int)sizeof(formattedMsg))
+            formattedLength = sizeof(formattedMsg) - 1;
+
+      // the owner frames it, once it has its ID
+      WorkerCommand command = { .kind = COMMAND_PUBLISH, .worker = info->worker->index, .client = info->id };
+      command.msg = messageCreate(formattedMsg, (size_t)formattedLength);
+      if(!command.msg) {
+            perror("Message memory allocation failed");
+            return true;
+      }
+      command.hash = room->hash;
+      memcpy(command.room, room->name, ROOM_NAME_MAX);
+      sendCommand(info->worker, (uint16_t)(room->hash % workerCount), &command);
+
+      printf("%s: %s\n", room->name, formattedMsg);
+
+      return !info->dropped;
+}
+
+Message* createFrame(const char* text, size_t length) {
+      char frame[FRAME_HEADER + FRAME_MAX_PAYLOAD];
+      if(length > FRAME_MAX_PAYLOAD)
+            length = FRAME_MAX_PAYLOAD;
+
+      frameHeader(frame, length);
+      memcpy(frame + FRAME_HEADER, text, length);
+      return messageCreate(frame, FRAME_HEADER + length);
+}
+
+void joinRoom(ClientInfo* info, const char* name) {
+      if(!roomValidName(name)) {
+            notifyClient(info, "* room names are letters, digits, '-' and '_'");
+            return;
+      }
+      leaveRoom(info);
+
+      Worker* worker = info->worker;
+      uint64_t hash = roomHash(name);
+      Room* room = roomGet(&worker->rooms, name, hash);
+      if(room == NULL || !roomJoin(room, &info->seat, info->id, &info->outbound)) {
+            if(room != NULL)
+                  roomRelease(&worker->rooms, room);
+            notifyClient(info, "* joining failed");
+            return;
+      }
+
+      // the first local member brings the room's messages to this worker
+      if(room->memberCount == 1) {
+            WorkerCommand command = { .kind = COMMAND_SUBSCRIBE, .worker = worker->index, .hash = hash };
+            memcpy(command.room, room->name, ROOM_NAME_MAX);
+            sendCommand(worker, (uint16_t)(hash % workerCount), &command);
+      }
+
+      char notice[ROOM_NAME_MAX + 16];
+      snprintf(notice, sizeof notice, "* you are in %s", room->name);
+      notifyClient(info, notice);
+}
+
+void leaveRoom(ClientInfo* info) {
+      Room* room = info->seat.room;
+      if(room == NULL)
+            return;
+
+      Worker* worker = info->worker;
+      roomLeave(&info->seat);
+      if(room->memberCount > 0)
+            return;
+
+      WorkerCommand command = { .kind = COMMAND_UNSUBSCRIBE, .worker = worker->index, .hash = room->hash };
+      memcpy(command.room, room->name, ROOM_NAME_MAX);
+      // the owner may be this worker, which releases the room right away
+      sendCommand(worker, (uint16_t)(command.hash % workerCount), &command);
+      if((room = roomFind(&worker->rooms, command.room, command.hash)) != NULL)
+            roomRelease(&worker->rooms, room);
+}
+
+void notifyClient(ClientInfo* info, const char* text) {
+      Message* msg = createFrame(text, strlen(text));
+      if(!msg) {
+            perror("Message memory allocation failed");
+            return;
+      }
+      if(queuePush(&info->outbound, msg))
+            scheduleFlush(info);
+      messageRelease(msg);
+}
+
+void sendCommand(Worker* worker, uint16_t to, const WorkerCommand* command) {
+      if(to == worker->index) {
+            runCommand(worker, command);
+            return;
+      }
+
+      // behind a backlog the command waits its turn
+      CommandBacklog* backlog = &worker->backlog[to];
+      worker->notify[to] = true;
+      if(backlog->count == 0 && spscPush(&workers[to].inbox[worker->index], command, 1) == 1)
+            return;
+
+      if(backlog->count == backlog->capacity) {
+            size_t capacity = backlog->capacity ? backlog->capacity * 2 : INBOX_CAPACITY;
+            WorkerCommand* commands = realloc(backlog->commands, capacity * sizeof *commands);
+            if(!commands) {
+                  perror("Backlog allocation failed");
+                  if(command->msg)
+                        messageRelease(command->msg);
+                  return;
             }
+            backlog->commands = commands;
+            backlog->capacity = capacity;
+      }
+      backlog->commands[backlog->count++] = *command;
+}
+
+void runCommand(Worker* worker, const WorkerCommand* command) {
+      Room* room;
+      HistorySlice slice;
+
+      switch(command->kind) {
+            case COMMAND_SUBSCRIBE:
+                  room = roomGet(&worker->rooms, command->room, command->hash);
+                  if(room == NULL || !roomSubscribe(room, command->worker))
+                        fprintf(stderr, "Room %s lost worker %u\n", command->room, command->worker);
+                  break;
+            case COMMAND_UNSUBSCRIBE:
+                  if((room = roomFind(&worker->rooms, command->room, command->hash)) != NULL) {
+                        roomUnsubscribe(room, command->worker);
+                        roomRelease(&worker->rooms, room);
+                  }
+                  break;
+            case COMMAND_PUBLISH:
+                  // the frame in the history is the one every member is sent
+                  if((room = roomFind(&worker->rooms, command->room, command->hash)) != NULL
+                        && historyAppend(&room->history, command->msg->data, command->msg->length, &slice)) {
+                        WorkerCommand delivery = *command;
+                        delivery.kind = COMMAND_DELIVER;
+                        delivery.msg = slice.arena;
+                        delivery.start = slice.start;
+                        delivery.length = slice.length;
+                        for(size_t i = 0; i < room->subscriberCount; i++) {
+                              messageRetain(delivery.msg);
+                              sendCommand(worker, room->subscribers[i], &delivery);
+                        }
+                  }
+                  messageRelease(command->msg);
+                  break;
+            case COMMAND_DELIVER:
+                  if((room = roomFind(&worker->rooms, command->room, command->hash)) != NULL)
+                        deliverMsg(worker, room, command);
+                  messageRelease(command->msg);
+                  break;
+            case COMMAND_HISTORY:
+                  if((room = roomFind(&worker->rooms, command->room, command->hash)) != NULL) {
+                        HistorySlice slices[HISTORY_BLOCKS];
+                        size_t count = historySince(&room->history, command->since, slices);
+                        WorkerCommand replay = *command;
+                        replay.kind = COMMAND_REPLAY;
+                        for(size_t i = 0; i < count; i++) {
+                              replay.msg = messageRetain(slices[i].arena);
+                              replay.start = slices[i].start;
+                              replay.length = slices[i].length;
+                              sendCommand(worker, command->worker, &replay);
+                        }
+                  }
+                  break;
+            case COMMAND_REPLAY:
+                  replayMsg(worker, command);
+                  messageRelease(command->msg);
+                  break;
+      }
+}
 
-            if(connected) {
-                  buffer[bytesReceived] = '\0';
+void drainInbox(Worker* worker) {
+      WorkerCommand commands[INBOX_BATCH];
 
-                  // sending message to all clients
-                  char formattedMsg[BUFFER_SIZE + INET_ADDRSTRLEN];
-                  snprintf(formattedMsg, sizeof(formattedMsg), "[%s:%d] %s", clientIP, clientPort, buffer);
-                  broadcastMsg(formattedMsg, clientSocket);
+      for(size_t i = 0; i < workerCount; i++) {
+            if(i == worker->index)
+                  continue;
+            size_t count;
+            while((count = spscPop(&worker->inbox[i], commands, INBOX_BATCH)) > 0) {
+                  for(size_t j = 0; j < count; j++)
+                        runCommand(worker, &commands[j]);
+            }
+      }
+}
 
-                  if(strcmp(buffer, "exit") == 0)
-                        connected = false;
+bool flushBacklogs(Worker* worker) {
+      bool waiting = false;
+
+      for(size_t i = 0; i < workerCount; i++) {
+            CommandBacklog* backlog = &worker->backlog[i];
+            if(backlog->count == 0)
+                  continue;
+
+            size_t pushed = spscPush(&workers[i].inbox[worker->index], backlog->commands, backlog->count);
+            backlog->count -= pushed;
+            memmove(backlog->commands, backlog->commands + pushed, backlog->count * sizeof *backlog->commands);
+            if(pushed > 0)
+                  worker->notify[i] = true;
+            if(backlog->count > 0)
+                  waiting = true;
+      }
+      return waiting;
+}
 
-                  printf("%s\n", formattedMsg);
+void wakeWorkers(Worker* worker) {
+      for(size_t i = 0; i < workerCount; i++) {
+            if(!worker->notify[i])
+                  continue;
+            worker->notify[i] = false;
+
+            // one byte per sleep, whatever the number of commands
+            if(!atomic_exchange(&workers[i].wakePending, true)) {
+                  char wake = 0;
+                  if(write(workers[i].wakeFDs[1], &wake, 1) < 0 && errno != EAGAIN)
+                        perror("Wake up failed");
             }
       }
+}
 
-      // removing client
-      bool removing = true;
-      pthread_mutex_lock(&clients.mutex);
-      for(size_t i = 0; i < clients.active && removing; i++) {
-            if(clients.clients[i]->socketFD == clientSocket) {
-                  free(clients.clients[i]);
-                  // left shift
-                  for(size_t j = i; j < clients.active - 1; j++) 
-                        clients.clients[j] = clients.clients[j + 1];
+void deliverMsg(Worker* worker, Room* room, const WorkerCommand* delivery) {
+      // by id: the sender may be gone and its ClientInfo reused by now
+      bool local = delivery->worker == worker->index;
+
+      for(size_t i = 0; i < room->memberCount; i++) {
+            const RoomMember* member = &room->members[i];
+            if(local && member->id == delivery->client)
+                  continue;
+
+            // a queue with messages already has its flush scheduled or its send in flight;
+            // a dropped client's queue is cleared when it is removed, at the end of the round
+            bool idle = queueEmpty(member->outbound);
+            if(!queuePushSlice(member->outbound, delivery->msg, delivery->start, delivery->length)) {
+                  ClientInfo* c = (ClientInfo*)member->seat;
+                  if(policy == DROP_CLIENT && !c->dropped) {
+                        printf("Client %s:%d too slow, dropped\n", c->ip, c->port);
+                        c->dropped = true;
+                  }
+                  continue;
+            }
+            if(idle)
+                  scheduleFlush((ClientInfo*)member->seat);
+      }
+}
 
-                  clients.clients[clients.active - 1] = NULL;
-                  clients.active--;
+void replayMsg(Worker* worker, const WorkerCommand* replay) {
+      // replays are rare, a scan beats keeping an index of the clients
+      for(size_t i = 0; i < worker->clientCount; i++) {
+            ClientInfo* c = worker->clients[i];
+            if(c->id != replay->client)
+                  continue;
+            if(c->dropped)
+                  return;
+
+            if(!queuePushSlice(&c->outbound, replay->msg, replay->start, replay->length)) {
+                  if(policy == DROP_CLIENT) {
+                        printf("Client %s:%d too slow, dropped\n", c->ip, c->port);
+                        c->dropped = true;
+                  }
+                  return;
+            }
+            scheduleFlush(c);
+            return;
+      }
+}
 
-                  removing = false;
+void scheduleFlush(ClientInfo* info) {
+      if(info->flushing)
+            return;
+
+      Worker* worker = info->worker;
+      if(worker->flushCount == worker->flushCapacity) {
+            size_t capacity = worker->flushCapacity ? worker->flushCapacity * 2 : 64;
+            ClientInfo** flushes = realloc(worker->flushes, capacity * sizeof *flushes);
+            if(!flushes) {
+                  // unbatched, but sent
+                  flushClient(info);
+                  return;
             }
+            worker->flushes = flushes;
+            worker->flushCapacity = capacity;
       }
-      pthread_mutex_unlock(&clients.mutex);
+      info->flushing = true;
+      worker->flushes[worker->flushCount++] = info;
+}
 
-      close(clientSocket);
-      return NULL;
+void flushScheduled(Worker* worker) {
+      for(size_t i = 0; i < worker->flushCount; i++) {
+            ClientInfo* info = worker->flushes[i];
+            info->flushing = false;
+            if(!info->dropped)
+                  flushClient(info);
+      }
+      worker->flushCount = 0;
+}
+
+void flushClient(ClientInfo* info) {
+      if(info->sending || queueEmpty(&info->outbound))
+            return;
+
+      struct iovec iov[NETIO_MAX_IOV];
+      size_t batch = queuePrepare(&info->outbound, iov, NETIO_MAX_IOV);
+      if(!netioSend(&info->worker->io, info->socketFD, iov, batch, info)) {
+            fprintf(stderr, "Send to %s:%d failed to start\n", info->ip, info->port);
+            info->dropped = true;
+            return;
+      }
+      info->sending = true;
 }
 
-void broadcastMsg(const char* msg, int senderFD) {
-    pthread_mutex_lock(&clients.mutex);
-    for (size_t i = 0; i < clients.active; i++) {
-        ClientInfo* c = clients.clients[i];
-        if (c != NULL && c->socketFD != senderFD) {
-            send(c->socketFD, msg, strlen(msg), 0);
-        }
-    }
-    pthread_mutex_unlock(&clients.mutex);
-}
\ No newline at end of file
+void sendDone(ClientInfo* info, const NetIOEvent* event) {
+      info->sending = false;
+      if(event->result < 0) {
+            errno = -event->result;
+            perror("Send failed");
+            info->dropped = true;
+            return;
+      }
+
+      // a short write leaves the rest at the head of the queue
+      queueConsume(&info->outbound, (size_t)event->result);
+      scheduleFlush(info);
+}
+
+void removeClient(ClientInfo* info) {
+      Worker* worker = info->worker;
+      leaveRoom(info);
+
+      // the last client takes the empty slot
+      ClientInfo* last = worker->clients[--worker->clientCount];
+      worker->clients[info->slot] = last;
+      last->slot = info->slot;
+
+      netioCancel(&worker->io, info->socketFD);
+      close(info->socketFD);
+      queueClear(&info->outbound);
+      poolFree(&clientPool, info);
+}
+
+void removeDropped(Worker* worker) {
+      size_t i = 0;
+      while(i < worker->clientCount) {
+            if(worker->clients[i]->dropped)
+                  removeClient(worker->clients[i]);
+            else
+                  i++;
+      }
+}
+
+void* handleShutdown(void* arg) {
+      const sigset_t* signals = (const sigset_t*)arg;
+
+      int received;
+      while(sigwait(signals, &received) != 0)
+            ;
+      // clients still connected and their messages are in use, not leaked
+      printf("Shutting down, %llu clients connected\n", (unsigned long long)poolInUse(&clientPool));
+      fflush(stdout);
+      poolReport(stderr);
+      exit(EXIT_SUCCESS);
+}
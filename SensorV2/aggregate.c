@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aggregate.h"
+
+static const int64_t bucketSeconds[WINDOW_COUNT] = { 1, 5, 60 };
+
+static size_t binOf(uint8_t value) {
+      size_t bin = value / AGGREGATE_BIN_WIDTH;
+      return bin < AGGREGATE_BINS ? bin : AGGREGATE_BINS - 1;
+}
+
+static size_t slotOf(int64_t bucket) {
+      int64_t slot = bucket % AGGREGATE_BUCKETS;
+      return (size_t)(slot < 0 ? slot + AGGREGATE_BUCKETS : slot);
+}
+
+static void resetBucket(AggregateWindow* window, size_t slot) {
+      window->count[slot] = 0;
+      for(size_t m = 0; m < METRIC_COUNT; m++) {
+            window->sum[m][slot] = 0;
+            window->min[m][slot] = UINT8_MAX;
+            window->max[m][slot] = 0;
+            memset(window->histogram[m][slot], 0, sizeof window->histogram[m][slot]);
+      }
+}
+
+// takes the bucket out of the window totals
+static void expireBucket(AggregateWindow* window, size_t slot) {
+      if(window->count[slot] == 0)
+            return;
+
+      window->totalCount -= window->count[slot];
+      for(size_t m = 0; m < METRIC_COUNT; m++) {
+            window->totalSum[m] -= window->sum[m][slot];
+            for(size_t b = 0; b < AGGREGATE_BINS; b++)
+                  window->totalHistogram[m][b] -= window->histogram[m][slot][b];
+      }
+      resetBucket(window, slot);
+}
+
+static void windowInit(AggregateWindow* window) {
+      memset(window, 0, sizeof *window);
+      for(size_t slot = 0; slot < AGGREGATE_BUCKETS; slot++)
+            resetBucket(window, slot);
+}
+
+static void windowAdd(AggregateWindow* window, int64_t bucket, const uint8_t values[METRIC_COUNT]) {
+      if(bucket > window->head) {
+            int64_t steps = bucket - window->head;
+            if(steps > AGGREGATE_BUCKETS)
+                  steps = AGGREGATE_BUCKETS;
+            for(int64_t i = 1; i <= steps; i++)
+                  expireBucket(window, slotOf(window->head + i));
+            window->head = bucket;
+      } else if(window->head - bucket >= AGGREGATE_BUCKETS) {
+            window->late++;
+            return;
+      }
+
+      size_t slot = slotOf(bucket);
+      window->count[slot]++;
+      window->totalCount++;
+      for(size_t m = 0; m < METRIC_COUNT; m++) {
+            uint8_t value = values[m];
+            size_t bin = binOf(value);
+
+            window->sum[m][slot] += value;
+            if(value < window->min[m][slot])
+                  window->min[m][slot] = value;
+            if(value > window->max[m][slot])
+                  window->max[m][slot] = value;
+            window->histogram[m][slot][bin]++;
+
+            window->totalSum[m] += value;
+            window->totalHistogram[m][bin]++;
+      }
+}
+
+static SensorAggregate* createAggregate() {
+      SensorAggregate* aggregate = malloc(sizeof *aggregate);
+      if(!aggregate) {
+            perror("Memory allocation failed");
+            return NULL;
+      }
+
+      atomic_init(&aggregate->seq, 0);
+      aggregate->started = false;
+      aggregate->newest = 0;
+      for(size_t w = 0; w < WINDOW_COUNT; w++)
+            windowInit(&aggregate->windows[w]);
+      return aggregate;
+}
+
+void aggregateInit(AggregateEngine* engine) {
+      for(size_t i = 0; i <= MAX_SENSORS; i++)
+            atomic_init(&engine->sensors[i], NULL);
+}
+
+void aggregateDestroy(AggregateEngine* engine) {
+      for(size_t i = 0; i <= MAX_SENSORS; i++) {
+            free(atomic_load(&engine->sensors[i]));
+            atomic_store(&engine->sensors[i], NULL);
+      }
+}
+
+void aggregateAdd(AggregateEngine* engine, const OutputRecord* records, size_t count) {
+      for(size_t i = 0; i < count; i++) {
+            SensorAggregate* aggregate = atomic_load_explicit(&engine->sensors[records[i].sensorID], memory_order_relaxed);
+            if(aggregate == NULL) {
+                  if((aggregate = createAggregate()) == NULL)
+                        continue;
+                  atomic_store_explicit(&engine->sensors[records[i].sensorID], aggregate, memory_order_release);
+            }
+
+            const SensorPayload* payload = &records[i].payload;
+            uint8_t values[METRIC_COUNT] = { payload->temperature, payload->humidity, payload->airQuality };
+            int64_t timestamp = payload->timestamp;
+
+            unsigned seq = atomic_load_explicit(&aggregate->seq, memory_order_relaxed);
+            atomic_store_explicit(&aggregate->seq, seq + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+
+            if(!aggregate->started) {
+                  for(size_t w = 0; w < WINDOW_COUNT; w++)
+                        aggregate->windows[w].head = timestamp / bucketSeconds[w];
+                  aggregate->newest = timestamp;
+                  aggregate->started = true;
+            }
+            if(timestamp > aggregate->newest)
+                  aggregate->newest = timestamp;
+            for(size_t w = 0; w < WINDOW_COUNT; w++)
+                  windowAdd(&aggregate->windows[w], timestamp / bucketSeconds[w], values);
+
+            atomic_store_explicit(&aggregate->seq, seq + 2, memory_order_release);
+      }
+}
+
+// value below which a fraction of the readings fall, clamped to what was seen
+static uint8_t percentile(const uint32_t histogram[AGGREGATE_BINS], uint64_t count, double fraction, uint8_t min, uint8_t max) {
+      uint64_t rank = (uint64_t)(fraction * count);
+      if(rank >= count)
+            rank = count - 1;
+
+      uint64_t seen = 0;
+      size_t bin = 0;
+      for(; bin < AGGREGATE_BINS - 1; bin++) {
+            seen += histogram[bin];
+            if(seen > rank)
+                  break;
+      }
+
+      unsigned value = bin * AGGREGATE_BIN_WIDTH + AGGREGATE_BIN_WIDTH / 2;
+      if(value < min)
+            value = min;
+      if(value > max)
+            value = max;
+      return (uint8_t)value;
+}
+
+bool aggregateQuery(AggregateEngine* engine, uint8_t sensorID, AggregateWindowId window, AggregateStats* stats) {
+      SensorAggregate* aggregate = atomic_load_explicit(&engine->sensors[sensorID], memory_order_acquire);
+      if(aggregate == NULL || window >= WINDOW_COUNT)
+            return false;
+
+      const AggregateWindow* source = &aggregate->windows[window];
+      uint64_t count;
+      int64_t newest;
+      uint64_t sums[METRIC_COUNT];
+      uint8_t mins[METRIC_COUNT][AGGREGATE_BUCKETS];
+      uint8_t maxs[METRIC_COUNT][AGGREGATE_BUCKETS];
+      uint32_t histograms[METRIC_COUNT][AGGREGATE_BINS];
+      unsigned before, after;
+
+      // retry while the writer is in the middle of an update
+      do {
+            before = atomic_load_explicit(&aggregate->seq, memory_order_acquire);
+            if(before & 1) {
+                  after = before + 1;
+                  continue;
+            }
+            count = source->totalCount;
+            newest = aggregate->newest;
+            memcpy(sums, source->totalSum, sizeof sums);
+            memcpy(mins, source->min, sizeof mins);
+            memcpy(maxs, source->max, sizeof maxs);
+            memcpy(histograms, source->totalHistogram, sizeof histograms);
+            atomic_thread_fence(memory_order_acquire);
+            after = atomic_load_explicit(&aggregate->seq, memory_order_relaxed);
+      } while(before != after);
+
+      if(count == 0)
+            return false;
+
+      stats->count = count;
+      stats->newest = newest;
+      for(size_t m = 0; m < METRIC_COUNT; m++) {
+            MetricStats* metric = &stats->metrics[m];
+            metric->min = UINT8_MAX;
+            metric->max = 0;
+            // empty buckets hold min UINT8_MAX and max 0, no need to skip them
+            for(size_t slot = 0; slot < AGGREGATE_BUCKETS; slot++) {
+                  if(mins[m][slot] < metric->min)
+                        metric->min = mins[m][slot];
+                  if(maxs[m][slot] > metric->max)
+                        metric->max = maxs[m][slot];
+            }
+            metric->mean = (double)sums[m] / count;
+            metric->p50 = percentile(histograms[m], count, 0.50, metric->min, metric->max);
+            metric->p90 = percentile(histograms[m], count, 0.90, metric->min, metric->max);
+            metric->p99 = percentile(histograms[m], count, 0.99, metric->min, metric->max);
+      }
+
+      return true;
+}
@@ -0,0 +1,93 @@
+#ifndef AGGREGATE_H
+
+#define AGGREGATE_H
+#define AGGREGATE_BUCKETS 60
+#define AGGREGATE_BINS 32
+#define AGGREGATE_BIN_WIDTH 4   // the last bin also takes everything above
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "protocol.h"
+#include "output.h"
+
+typedef enum AggregateWindowIdTag {
+      WINDOW_1M,        // 60 buckets of 1 s
+      WINDOW_5M,        // 60 buckets of 5 s
+      WINDOW_1H,        // 60 buckets of 1 min
+      WINDOW_COUNT
+} AggregateWindowId;
+
+typedef enum AggregateMetricTag {
+      METRIC_TEMPERATURE,
+      METRIC_HUMIDITY,
+      METRIC_AIR_QUALITY,
+      METRIC_COUNT
+} AggregateMetric;
+
+/*
+Ring of buckets, struct of arrays: rolling a bucket out touches a few
+contiguous rows instead of one scattered struct per bucket. Every bucket
+keeps its own coarse histogram so it can be subtracted from the window
+totals when it expires, which keeps percentiles incremental.
+*/
+typedef struct AggregateWindowTag {
+      int64_t head;     // bucket number (timestamp / bucket width) of the newest bucket
+      uint64_t late;    // readings older than the whole window
+      uint32_t count[AGGREGATE_BUCKETS];
+      uint32_t sum[METRIC_COUNT][AGGREGATE_BUCKETS];
+      uint8_t min[METRIC_COUNT][AGGREGATE_BUCKETS];
+      uint8_t max[METRIC_COUNT][AGGREGATE_BUCKETS];
+      uint32_t histogram[METRIC_COUNT][AGGREGATE_BUCKETS][AGGREGATE_BINS];
+      uint64_t totalCount;
+      uint64_t totalSum[METRIC_COUNT];
+      uint32_t totalHistogram[METRIC_COUNT][AGGREGATE_BINS];
+} AggregateWindow;
+
+/*
+Written by one thread only; readers copy it under the seqlock (seq is odd
+while an update is in progress).
+*/
+typedef struct SensorAggregateTag {
+      atomic_uint seq;
+      bool started;
+      int64_t newest;
+      AggregateWindow windows[WINDOW_COUNT];
+} SensorAggregate;
+
+typedef struct AggregateEngineTag {
+      _Atomic(SensorAggregate*) sensors[MAX_SENSORS + 1];
+} AggregateEngine;
+
+typedef struct MetricStatsTag {
+      uint8_t min;
+      uint8_t max;
+      double mean;
+      // estimated from the histogram, within AGGREGATE_BIN_WIDTH / 2
+      uint8_t p50;
+      uint8_t p90;
+      uint8_t p99;
+} MetricStats;
+
+typedef struct AggregateStatsTag {
+      uint64_t count;
+      int64_t newest;   // timestamp of the newest reading, the window ends there
+      MetricStats metrics[METRIC_COUNT];
+} AggregateStats;
+
+void aggregateInit(AggregateEngine* engine);
+void aggregateDestroy(AggregateEngine* engine);
+/*
+Adds a batch of readings. Windows follow the timestamps of the sensor
+readings, not the server clock. Only one thread may add.
+*/
+void aggregateAdd(AggregateEngine* engine, const OutputRecord* records, size_t count);
+/*
+Current stats of a sensor over a window, from any thread. Runs in
+constant time; returns false if the window holds no reading.
+*/
+bool aggregateQuery(AggregateEngine* engine, uint8_t sensorID, AggregateWindowId window, AggregateStats* stats);
+
+#endif
@@ -6,30 +6,54 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <pthread.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <time.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "protocol.h"
+#include "wire.h"
 
-#define USAGE "<sensor ID> <server IPv4>"
+#define USAGE "<sensor ID> <server IPv4> [readings per datagram]"
 #define TICK 2
 
 void checkArgs(int argc, char** argv);
-int registerToServer(Sensor* sensor, const char* addr);
-bool alert(const SensorPayload* p);
-void* alertWait(void* arg);
+/*
+Opens the control channel and registers on it. Returns the channel,
+which stays open for heartbeats and alerts, or -1.
+*/
+int registerToServer(Sensor* sensor, const char* addr, in_port_t dataPort);
+int createDataSocket(in_port_t* dataPort);
+/*
+Sends the readings as one batched datagram, numbered so the server can
+account for losses. Returns false when the send failed.
+*/
+bool sendReadings(int socketFD, const Sensor* sensor, const SensorPayload* payloads, size_t count);
+bool sendFrame(int channelFD, ControlFrameType type, const uint8_t* payload, size_t length);
+/*
+Raises the alert on the channel and blocks until the server sends
+REACTIVATE, heartbeating meanwhile: the reactivation time may be longer
+than HEARTBEAT_TIMEOUT.
+*/
+void alertWait(int channelFD, const Sensor* sensor);
 
 int main(int argc, char** argv) {
       srand(time(NULL));
       checkArgs(argc, argv);
+      size_t batchSize = argc == 4 ? (size_t)atoi(argv[3]) : 1;
       
+      // getting send socket first: the server identifies us by its source port
+      in_port_t dataPort;
+      int socketFD = createDataSocket(&dataPort);
+      if(socketFD < 0)
+            exit(EXIT_FAILURE);
+
       // registration
-      int registrationCheck;
+      int channelFD;
       Sensor s;
       s.id = (uint8_t) atoi(argv[1]);
-      if((registrationCheck = registerToServer(&s, argv[2])) == -1)
+      if((channelFD = registerToServer(&s, argv[2], dataPort)) == -1)
             exit(EXIT_FAILURE);
 
       puts("Registration complete");
@@ -37,37 +61,33 @@ int main(int argc, char** argv) {
       // changing port listening to 5050
       s.addr.sin_port = htons(SEND_PORT);
 
-      // getting send socket
-      int socketFD = socket(AF_INET, SOCK_DGRAM, 0);
-      if(socketFD < 0) {
-            perror("Send connection failed");
-            exit(EXIT_FAILURE);
-      }
-
       puts("Starting to send");
 
+      SensorPayload pending[SENSOR_BATCH_MAX_READINGS];
+      size_t pendingCount = 0;
+      time_t lastHeartbeat = time(NULL);
       bool sending = true;
       while(sending) {
+            // the server drops sensors whose channel stays silent
+            if(time(NULL) - lastHeartbeat >= HEARTBEAT_INTERVAL) {
+                  if(!sendFrame(channelFD, CONTROL_HEARTBEAT, NULL, 0))
+                        break;
+                  lastHeartbeat = time(NULL);
+            }
+
             SensorPayload payload = createRandomPayload();
             if(alert(&payload)) {
+                  // what was measured before the alert goes out first
+                  if(pendingCount > 0 && !sendReadings(socketFD, &s, pending, pendingCount))
+                        break;
+                  pendingCount = 0;
+
                   puts("ALERT");
-                  s.addr.sin_port = htons(ALERT_PORT);
-                  pthread_t alertThread;
-                  pthread_create(&alertThread, NULL, alertWait, (void*)&s);
-                  pthread_join(alertThread, NULL);
-                  s.addr.sin_port = htons(SEND_PORT);
+                  alertWait(channelFD, &s);
+                  lastHeartbeat = time(NULL);
             }
             printf("Sending data: ");
 
-            ssize_t bytesSent = sendto(
-                  socketFD, 
-                  &payload, 
-                  sizeof(SensorPayload), 
-                  0, 
-                  (struct sockaddr*)&s.addr,
-                  sizeof(s.addr)
-            );
-
             char timeBuffer[128];
             struct tm* timeinfo = localtime(&payload.timestamp);
             strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", timeinfo);
@@ -81,20 +101,51 @@ int main(int argc, char** argv) {
                   payload.airQuality
             );
 
-            if(bytesSent == -1) {
-                  perror("Sending failed");
-                  sending = false;
-            } else if(bytesSent != sizeof(SensorPayload)) {
-                  perror("Partial message sent");
-                  sending = false;
+            pending[pendingCount++] = payload;
+            if(pendingCount == batchSize) {
+                  sending = sendReadings(socketFD, &s, pending, pendingCount);
+                  pendingCount = 0;
             }
 
             sleep(TICK);
       }
+
+      close(channelFD);
+      close(socketFD);
+      exit(EXIT_FAILURE);
+}
+
+bool sendReadings(int socketFD, const Sensor* sensor, const SensorPayload* payloads, size_t count) {
+      static uint32_t sequence = 0;
+      uint8_t wire[BATCH_MAX_BYTES];
+
+      SensorBatchHeader header = { 0 };
+      header.sensorID = sensor->id;
+      header.count = (uint16_t)count;
+      header.sequence = sequence++;
+      size_t length = sensorBatchEncode(wire, &header, NULL, payloads);
+
+      ssize_t bytesSent = sendto(
+            socketFD, 
+            wire, 
+            length, 
+            0, 
+            (struct sockaddr*)&sensor->addr,
+            sizeof(sensor->addr)
+      );
+
+      if(bytesSent == -1) {
+            perror("Sending failed");
+            return false;
+      } else if((size_t)bytesSent != length) {
+            perror("Partial message sent");
+            return false;
+      }
+      return true;
 }
 
 void checkArgs(int argc, char** argv) {
-      if(argc != 3) {
+      if(argc != 3 && argc != 4) {
             fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
             exit(EXIT_FAILURE);
       }
@@ -104,9 +155,42 @@ void checkArgs(int argc, char** argv) {
             fprintf(stderr, "%s\n", "ID MUST BE BETWEEN 0 AND 255");
             exit(EXIT_FAILURE);
       }
+
+      if(argc == 4) {
+            int batchSize = atoi(argv[3]);
+            if(batchSize < 1 || batchSize > (int)SENSOR_BATCH_MAX_READINGS) {
+                  fprintf(stderr, "READINGS PER DATAGRAM MUST BE BETWEEN 1 AND %d\n", (int)SENSOR_BATCH_MAX_READINGS);
+                  exit(EXIT_FAILURE);
+            }
+      }
+}
+
+int createDataSocket(in_port_t* dataPort) {
+      int socketFD = socket(AF_INET, SOCK_DGRAM, 0);
+      if(socketFD < 0) {
+            perror("Send connection failed");
+            return -1;
+      }
+
+      struct sockaddr_in local;
+      memset(&local, 0, sizeof local);
+      local.sin_family = AF_INET;
+      local.sin_port = htons(0);
+      local.sin_addr.s_addr = htonl(INADDR_ANY);
+      socklen_t localLen = sizeof local;
+
+      if(bind(socketFD, (struct sockaddr*)&local, sizeof local) < 0
+            || getsockname(socketFD, (struct sockaddr*)&local, &localLen) < 0) {
+            perror("Send socket bind failed");
+            close(socketFD);
+            return -1;
+      }
+
+      *dataPort = local.sin_port;
+      return socketFD;
 }
 
-int registerToServer(Sensor* sensor, const char* addr) {
+int registerToServer(Sensor* sensor, const char* addr, in_port_t dataPort) {
       int socketFD = socket(AF_INET, SOCK_STREAM, 0);
       if(socketFD < 0) {
             perror("Socket Creation failed");
@@ -116,7 +200,7 @@ int registerToServer(Sensor* sensor, const char* addr) {
 
       memset(&sensor->addr, 0, sizeof sensor->addr);
       sensor->addr.sin_family = AF_INET;
-      sensor->addr.sin_port = htons(CONNECTION_PORT);
+      sensor->addr.sin_port = htons(CONTROL_PORT);
       if(inet_pton(AF_INET, addr, &sensor->addr.sin_addr) != 1) {
             fprintf(stderr, "Invalid IP address: %s\n", addr);
             return -1;
@@ -128,82 +212,97 @@ int registerToServer(Sensor* sensor, const char* addr) {
             return -1;
       }
 
-      ssize_t bytesSent = send(socketFD, sensor, sizeof* sensor, 0);
-      if(bytesSent < 0) {
-            perror("Send failed");
-            close(socketFD);
-            return -1;
-      } 
-      if(bytesSent != sizeof *sensor) {
-            fprintf(stderr,
-                  "Sent only %zd of %zu bytes\n",
-                  bytesSent, sizeof *sensor);
+      // the server takes our host from the connection, we only announce the data port
+      Sensor announce;
+      memset(&announce, 0, sizeof announce);
+      announce.id = sensor->id;
+      announce.addr.sin_family = AF_INET;
+      announce.addr.sin_port = dataPort;
+
+      uint8_t wire[SENSOR_WIRE_SIZE];
+      sensorEncode(wire, &announce);
+      if(!sendFrame(socketFD, CONTROL_REGISTER, wire, sizeof wire)) {
             close(socketFD);
             return -1;
       }
 
-      close(socketFD);
-      return 0;
+      return socketFD;
 }
 
-bool alert(const SensorPayload* p) {
-      return p->temperature > MAX_ALERT_TEMPERATURE 
-          || p->humidity > MAX_ALERT_HUMIDITY 
-          || p->airQuality < MIN_ALERT_AIR_QUALITY;
-}
+bool sendFrame(int channelFD, ControlFrameType type, const uint8_t* payload, size_t length) {
+      uint8_t frame[CONTROL_FRAME_HEADER_WIRE_SIZE + CONTROL_PAYLOAD_MAX];
+      size_t frameLength = controlFrameEncode(frame, type, payload, length);
 
-void* alertWait(void* arg) {
-      const Sensor* sensor = (const Sensor*)arg;
-      int alertSocketFD = socket(AF_INET, SOCK_STREAM, 0);
-      if(alertSocketFD < 0) {
-            perror("Alert socket creation failed");
-            close(alertSocketFD);
-            exit(EXIT_FAILURE);
+      ssize_t bytesSent = send(channelFD, frame, frameLength, MSG_NOSIGNAL);
+      if(bytesSent < 0) {
+            perror("Send failed");
+            return false;
       }
-
-      if(connect(alertSocketFD, (struct sockaddr*)&sensor->addr, sizeof sensor->addr) < 0) {
-            perror("Alert connection failed");
-            close(alertSocketFD);
-            exit(EXIT_FAILURE);
+      if((size_t)bytesSent != frameLength) {
+            fprintf(stderr,
+                  "Sent only %zd of %zu bytes\n",
+                  bytesSent, frameLength);
+            return false;
       }
+      return true;
+}
 
+void alertWait(int channelFD, const Sensor* sensor) {
       SensorAlert alertMsg;
       alertMsg.sensor = *sensor;
       alertMsg.type = ALERT;
 
-      ssize_t bytesSent = send(alertSocketFD, &alertMsg, sizeof alertMsg, 0);
-      if(bytesSent < 0) {
-            perror("Send failed");
-            close(alertSocketFD);
+      uint8_t wire[SENSOR_ALERT_WIRE_SIZE];
+      sensorAlertEncode(wire, &alertMsg);
+      if(!sendFrame(channelFD, CONTROL_ALERT, wire, sizeof wire))
             exit(EXIT_FAILURE);
 
-      } 
-      if(bytesSent != sizeof alertMsg) {
-            fprintf(stderr,
-                  "Sent only %zd of %zu bytes\n",
-                  bytesSent, sizeof *sensor);
-            close(alertSocketFD);
-            exit(EXIT_FAILURE);
-      }
+      // frames other than REACTIVATE are not for us
+      time_t lastHeartbeat = time(NULL);
+      while(true) {
+            int timeout = (int)(HEARTBEAT_INTERVAL - (time(NULL) - lastHeartbeat)) * 1000;
+            if(timeout <= 0) {
+                  if(!sendFrame(channelFD, CONTROL_HEARTBEAT, NULL, 0))
+                        exit(EXIT_FAILURE);
+                  lastHeartbeat = time(NULL);
+                  continue;
+            }
 
-      ssize_t bytesReceived = recv(alertSocketFD, &alertMsg, sizeof alertMsg, 0);
-      if(bytesReceived < 0) {
-            perror("Reactivate receive failed");
-            close(alertSocketFD);
-            exit(EXIT_FAILURE);
+            struct pollfd channel = { .fd = channelFD, .events = POLLIN };
+            int ready = poll(&channel, 1, timeout);
+            if(ready < 0 && errno != EINTR) {
+                  perror("Reactivate wait failed");
+                  exit(EXIT_FAILURE);
+            }
+            if(ready <= 0)
+                  continue;
 
-      }
-      if(bytesReceived != sizeof alertMsg) {
-            perror("Partial message reactivation");
-            close(alertSocketFD);
-            exit(EXIT_FAILURE);
-      }
+            uint8_t frame[CONTROL_FRAME_HEADER_WIRE_SIZE + CONTROL_PAYLOAD_MAX];
+            ssize_t bytesReceived = recv(channelFD, frame, CONTROL_FRAME_HEADER_WIRE_SIZE, MSG_WAITALL);
+            if(bytesReceived != CONTROL_FRAME_HEADER_WIRE_SIZE) {
+                  perror("Reactivate receive failed");
+                  exit(EXIT_FAILURE);
+            }
+            ControlFrameHeader header;
+            controlFrameHeaderDecode(&header, frame);
+            if(header.length > CONTROL_PAYLOAD_MAX) {
+                  fprintf(stderr, "Control frame of %u bytes\n", header.length);
+                  exit(EXIT_FAILURE);
+            }
 
-      if(alertMsg.type == ALERT) {
-            perror("Alert Error message received");
-            exit(EXIT_FAILURE);
-      }
+            uint8_t* payload = frame + CONTROL_FRAME_HEADER_WIRE_SIZE;
+            if(header.length > 0 && recv(channelFD, payload, header.length, MSG_WAITALL) != header.length) {
+                  perror("Partial message reactivation");
+                  exit(EXIT_FAILURE);
+            }
+            if(header.type != CONTROL_REACTIVATE || header.length != SENSOR_ALERT_WIRE_SIZE)
+                  continue;
 
-      close(alertSocketFD);
-      return NULL;
-}
\ No newline at end of file
+            sensorAlertDecode(&alertMsg, payload);
+            if(alertMsg.type == ALERT) {
+                  fprintf(stderr, "Alert Error message received\n");
+                  exit(EXIT_FAILURE);
+            }
+            return;
+      }
+}
@@ -1,36 +1,47 @@
 import argparse
 import socket
 import struct
-import threading
 import time
 import random
+import select
 import sys
 from dataclasses import dataclass
 from typing import Tuple
 
-# Protocol constants (host byte order little-endian)
+# Protocol constants
 CONNECTION_PORT: int = 4040  # TCP port for sensor registration
 SEND_PORT: int = 5050        # UDP port for regular payloads
 ALERT_PORT: int = 6060       # TCP port for alert notifications
+CONTROL_PORT: int = 7070     # TCP control channel: registration, heartbeats, alerts
 TICK: int = 2                # Interval between payloads (seconds)
+HEARTBEAT_INTERVAL: int = 5  # The server drops sensors silent for 3 intervals
 
 # Alert thresholds
 MAX_ALERT_TEMPERATURE: int = 50  # Celsius threshold for temperature alert
 MAX_ALERT_HUMIDITY: int = 60     # Percent threshold for humidity alert
 MIN_ALERT_AIR_QUALITY: int = 10  # Minimum acceptable air quality index
 
-# Struct formats (little-endian, packed)
-# Sensor: ID (1B) + padding (16B) = 17 bytes
-SENSOR_STRUCT_FORMAT: str = '<B16s'
-# Alert: Type (4B) + ID (1B) + padding (16B) = 21 bytes
-ALERT_STRUCT_FORMAT: str = '<I B16s'
+# Wire formats (big-endian, no padding), see wire.h
+# Sensor: ID (1B) + port (2B) + IPv4 address (4B) = 7 bytes
+SENSOR_STRUCT_FORMAT: str = '>B H I'
+# Alert: Type (1B) + Sensor (7B) = 8 bytes
+ALERT_STRUCT_FORMAT: str = '>B B H I'
 # Payload: Timestamp (8B) + Temperature (1B) + Humidity (1B) + AirQuality (1B) = 11 bytes
-PAYLOAD_STRUCT_FORMAT: str = '<Q B B B'
+PAYLOAD_STRUCT_FORMAT: str = '>q B B B'
+# Batch header: magic (1B) + flags (1B) + ID (1B) + count (2B) + sequence (4B) = 9 bytes,
+# a batch of one reading is the header followed by the payload
+BATCH_HEADER_FORMAT: str = '>B B B H I'
+BATCH_MAGIC: int = 0xB5
+# Control frame header: type (1B) + payload length (2B) = 3 bytes
+CONTROL_HEADER_FORMAT: str = '>B H'
+CONTROL_PAYLOAD_MAX: int = 64
 
 # Calculated sizes
 SENSOR_STRUCT_SIZE: int = struct.calcsize(SENSOR_STRUCT_FORMAT)
 ALERT_STRUCT_SIZE: int = struct.calcsize(ALERT_STRUCT_FORMAT)
 PAYLOAD_STRUCT_SIZE: int = struct.calcsize(PAYLOAD_STRUCT_FORMAT)
+BATCH_HEADER_SIZE: int = struct.calcsize(BATCH_HEADER_FORMAT)
+CONTROL_HEADER_SIZE: int = struct.calcsize(CONTROL_HEADER_FORMAT)
 
 # Human-readable payload print template
 PAYLOAD_TEMPLATE: str = "{sensor_id} at {timestamp}: {temperature} C {humidity} H {airQuality} %%"
@@ -39,6 +50,13 @@ PAYLOAD_TEMPLATE: str = "{sensor_id} at {timestamp}: {temperature} C {humidity}
 ALERT: int = 0       # Outgoing alert notification
 REACTIVATE: int = 1  # Incoming reactivation confirmation
 
+# Control frame types
+CONTROL_REGISTER: int = 0
+CONTROL_HEARTBEAT: int = 1
+CONTROL_ALERT: int = 2
+CONTROL_REACTIVATE: int = 3
+CONTROL_REGISTER_GATEWAY: int = 4
+
 @dataclass(frozen=True)
 class Sensor:
     """
@@ -83,28 +101,53 @@ def CheckArgs() -> Tuple[int, str]:
     return args.sensor_id, args.server_ip
 
 
-def RegisterToServer(sensor: Sensor, server_ip: str) -> None:
+def SendFrame(sock: socket.socket, frame_type: int, payload: bytes = b'') -> None:
+    """
+    Sends one control frame: header, then payload.
+    Exits if the channel is gone.
+    """
+    try:
+        sock.sendall(struct.pack(CONTROL_HEADER_FORMAT, frame_type, len(payload)) + payload)
+    except socket.error as err:
+        print(f"Control channel send failed: {err}", file=sys.stderr)
+        sys.exit(1)
+
+
+def RecvExact(sock: socket.socket, size: int) -> bytes:
     """
-    Establishes a TCP connection to the central server and sends the Sensor struct.
+    Reads exactly size bytes, exits if the channel closes first.
     """
-    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as sock:
-        try:
-            sock.connect((server_ip, CONNECTION_PORT))
-        except socket.error as err:
-            print(f"Connection failed: {err}", file=sys.stderr)
+    buf = b''
+    while len(buf) < size:
+        chunk = sock.recv(size - len(buf))
+        if not chunk:
+            print("Control channel closed", file=sys.stderr)
             sys.exit(1)
-        packed_sensor: bytes = struct.pack(
-            SENSOR_STRUCT_FORMAT,
-            sensor.sensor_id,
-            b'\x00' * 16  # padding, server will ignore
-        )
-        bytes_sent = 0
-        while bytes_sent < SENSOR_STRUCT_SIZE:
-            sent = sock.send(packed_sensor[bytes_sent:])
-            if sent <= 0:
-                print("Failed to send complete Sensor struct", file=sys.stderr)
-                sys.exit(1)
-            bytes_sent += sent
+        buf += chunk
+    return buf
+
+
+def RegisterToServer(sensor: Sensor, server_ip: str, data_port: int) -> socket.socket:
+    """
+    Opens the control channel to the central server and registers on it,
+    announcing the UDP port payloads will come from.
+    Returns the channel, which stays open for heartbeats and alerts.
+    """
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    try:
+        sock.connect((server_ip, CONTROL_PORT))
+    except socket.error as err:
+        print(f"Connection failed: {err}", file=sys.stderr)
+        sys.exit(1)
+    # the server fills in the host from the channel
+    packed_sensor: bytes = struct.pack(
+        SENSOR_STRUCT_FORMAT,
+        sensor.sensor_id,
+        data_port,
+        0
+    )
+    SendFrame(sock, CONTROL_REGISTER, packed_sensor)
+    return sock
 
 
 def CreateRandomPayload() -> SensorPayload:
@@ -130,43 +173,46 @@ def ShouldAlert(payload: SensorPayload) -> bool:
     )
 
 
-def AlertWait(sensor: Sensor) -> None:
+def AlertWait(channel: socket.socket, sensor: Sensor) -> None:
     """
-    Sends an ALERT message over TCP and waits for REACTIVATE response.
+    Sends an ALERT frame on the control channel and waits for REACTIVATE,
+    heartbeating meanwhile: the reactivation time may be longer than the
+    heartbeat timeout of the server.
     Exits on any communication error or incorrect response.
     """
-    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as sock:
-        try:
-            sock.connect((sensor.address[0], ALERT_PORT))
-        except socket.error as err:
-            print(f"Alert connection failed: {err}", file=sys.stderr)
+    # Pack SensorAlert: type, id, no address
+    alert_msg: bytes = struct.pack(
+        ALERT_STRUCT_FORMAT,
+        ALERT,
+        sensor.sensor_id,
+        0,
+        0
+    )
+    SendFrame(channel, CONTROL_ALERT, alert_msg)
+
+    # frames other than REACTIVATE are not for us
+    last_heartbeat = time.monotonic()
+    while True:
+        remaining = HEARTBEAT_INTERVAL - (time.monotonic() - last_heartbeat)
+        if remaining <= 0:
+            SendFrame(channel, CONTROL_HEARTBEAT)
+            last_heartbeat = time.monotonic()
+            continue
+        readable, _, _ = select.select([channel], [], [], remaining)
+        if not readable:
+            continue
+        frame_type, length = struct.unpack(CONTROL_HEADER_FORMAT, RecvExact(channel, CONTROL_HEADER_SIZE))
+        if length > CONTROL_PAYLOAD_MAX:
+            print(f"Control frame of {length} bytes", file=sys.stderr)
             sys.exit(1)
-        # Pack SensorAlert: type (4B), id (1B), padding (16B)
-        alert_msg: bytes = struct.pack(
-            ALERT_STRUCT_FORMAT,
-            ALERT,
-            sensor.sensor_id,
-            b'\x00' * 16
-        )
-        sent_total = 0
-        while sent_total < ALERT_STRUCT_SIZE:
-            sent = sock.send(alert_msg[sent_total:])
-            if sent <= 0:
-                print("Failed to send Alert struct", file=sys.stderr)
-                sys.exit(1)
-            sent_total += sent
-        # Receive full reactivation struct
-        buf = b''
-        while len(buf) < ALERT_STRUCT_SIZE:
-            chunk = sock.recv(ALERT_STRUCT_SIZE - len(buf))
-            if not chunk:
-                print("Connection closed during alert wait", file=sys.stderr)
-                sys.exit(1)
-            buf += chunk
-        resp_type = struct.unpack_from('<I', buf, 0)[0]
+        payload = RecvExact(channel, length)
+        if frame_type != CONTROL_REACTIVATE or length != ALERT_STRUCT_SIZE:
+            continue
+        resp_type = struct.unpack(ALERT_STRUCT_FORMAT, payload)[0]
         if resp_type != REACTIVATE:
             print("Unexpected response to alert", file=sys.stderr)
             sys.exit(1)
+        return
 
 
 def main() -> None:
@@ -178,22 +224,40 @@ def main() -> None:
     sensor_id, server_ip = CheckArgs()
     sensor = Sensor(sensor_id, (server_ip, SEND_PORT))
 
-    RegisterToServer(sensor, server_ip)
+    # bind the data socket first: the server identifies us by its source port
+    udp_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    udp_socket.bind(('', 0))
+    data_port = udp_socket.getsockname()[1]
+
+    channel = RegisterToServer(sensor, server_ip, data_port)
     print("Registration complete")
 
     print("Starting to send payloads...")
-    udp_socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
 
+    sequence = 0
+    last_heartbeat = time.monotonic()
     try:
         while True:
+            # the server drops sensors whose channel stays silent
+            if time.monotonic() - last_heartbeat >= HEARTBEAT_INTERVAL:
+                SendFrame(channel, CONTROL_HEARTBEAT)
+                last_heartbeat = time.monotonic()
+
             payload = CreateRandomPayload()
             if ShouldAlert(payload):
                 print("ALERT")
-                thread = threading.Thread(target=AlertWait, args=(sensor,))
-                thread.start()
-                thread.join()
+                AlertWait(channel, sensor)
+                last_heartbeat = time.monotonic()
 
+            # numbered, so the server can account for lost datagrams
             packed_payload: bytes = struct.pack(
+                BATCH_HEADER_FORMAT,
+                BATCH_MAGIC,
+                0,
+                sensor.sensor_id,
+                1,
+                sequence
+            ) + struct.pack(
                 PAYLOAD_STRUCT_FORMAT,
                 payload.timestamp,
                 payload.temperature,
@@ -201,6 +265,7 @@ def main() -> None:
                 payload.airQuality
             )
             sent_bytes = udp_socket.sendto(packed_payload, sensor.address)
+            sequence = (sequence + 1) & 0xFFFFFFFF
             timestamp_str = time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(payload.timestamp))
             print(PAYLOAD_TEMPLATE.format(
                 sensor_id=sensor.sensor_id,
@@ -210,11 +275,12 @@ def main() -> None:
                 airQuality=payload.airQuality
             ))
 
-            if sent_bytes != PAYLOAD_STRUCT_SIZE:
+            if sent_bytes != BATCH_HEADER_SIZE + PAYLOAD_STRUCT_SIZE:
                 print("Partial payload sent", file=sys.stderr)
                 break
             time.sleep(TICK)
     finally:
+        channel.close()
         udp_socket.close()
 
 
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+
+#include "config.h"
+#include "epoch.h"
+
+#define CONFIG_LINE_MAX 512
+
+static _Atomic(Config*) current;
+
+static ConfigProfile* addProfile(Config* config, const char* name) {
+      if(config->profileCount == CONFIG_PROFILES_MAX)
+            return NULL;
+
+      ConfigProfile* profile = &config->profiles[config->profileCount++];
+      memset(profile, 0, sizeof *profile);
+      snprintf(profile->name, sizeof profile->name, "%s", name);
+      return profile;
+}
+
+static ConfigProfile* findProfile(Config* config, const char* name) {
+      for(size_t i = 0; i < config->profileCount; i++) {
+            if(strcmp(config->profiles[i].name, name) == 0)
+                  return &config->profiles[i];
+      }
+      return NULL;
+}
+
+/*
+Counts the sensors of every profile and builds the rule set.
+*/
+static bool compile(Config* config) {
+      ruleSetInit(&config->rules);
+      for(size_t i = 0; i < config->profileCount; i++)
+            config->profiles[i].sensorCount = 0;
+
+      for(size_t id = 0; id <= MAX_SENSORS; id++) {
+            ConfigProfile* profile = &config->profiles[config->profileOf[id]];
+            profile->sensorCount++;
+            for(size_t r = 0; r < profile->ruleCount; r++) {
+                  if(!ruleSetApply(&config->rules, &profile->rules[r], (uint8_t)id)) {
+                        fprintf(stderr, "More than %d distinct rules\n", RULES_MAX);
+                        return false;
+                  }
+            }
+      }
+      return true;
+}
+
+Config* configDefault() {
+      Config* config = calloc(1, sizeof *config);
+      if(!config) {
+            perror("Memory allocation failed");
+            return NULL;
+      }
+
+      config->connectionPort = CONNECTION_PORT;
+      config->sendPort = SEND_PORT;
+      config->alertPort = ALERT_PORT;
+      config->controlPort = CONTROL_PORT;
+      config->metricsPort = CONFIG_METRICS_PORT;
+      config->maxSensors = MAX_SENSORS;
+      config->reactivateTime = SENSOR_REACTIVATE_TIME;
+
+      // profileOf is all zeroes: every sensor in the default profile
+      ConfigProfile* profile = addProfile(config, CONFIG_DEFAULT_PROFILE);
+      profile->ruleCount = rulesDefaults(profile->rules);
+      compile(config);
+      return config;
+}
+
+static char* trim(char* text) {
+      while(isspace((unsigned char)*text))
+            text++;
+      char* end = text + strlen(text);
+      while(end > text && isspace((unsigned char)end[-1]))
+            end--;
+      *end = '\0';
+      return text;
+}
+
+static bool parseNumber(const char* text, unsigned long min, unsigned long max, unsigned long* value) {
+      char* end;
+      errno = 0;
+      *value = strtoul(text, &end, 10);
+      return errno == 0 && end != text && *end == '\0' && *value >= min && *value <= max;
+}
+
+/*
+"10-19,42": the listed sensors move to profile index.
+*/
+static bool parseSensors(Config* config, char* list, uint8_t index) {
+      for(char* item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+            unsigned long first, last;
+            char* dash = strchr(item, '-');
+            if(dash != NULL)
+                  *dash = '\0';
+            if(!parseNumber(trim(item), 0, MAX_SENSORS, &first))
+                  return false;
+            last = first;
+            if(dash != NULL && (!parseNumber(trim(dash + 1), first, MAX_SENSORS, &last)))
+                  return false;
+
+            for(unsigned long id = first; id <= last; id++) {
+                  if(config->profileOf[id] != 0 && config->profileOf[id] != index) {
+                        fprintf(stderr, "Sensor %lu is in two profiles\n", id);
+                        return false;
+                  }
+                  config->profileOf[id] = index;
+            }
+      }
+      return true;
+}
+
+static bool parseSetting(Config* config, ConfigProfile* profile, const char* key, char* value) {
+      unsigned long number;
+
+      if(profile != NULL) {
+            if(strcmp(key, "rules") == 0) {
+                  int count = rulesParse(value, profile->rules);
+                  if(count < 0)
+                        return false;
+                  profile->ruleCount = (size_t)count;
+                  return true;
+            }
+            // the default profile takes whoever is left
+            if(strcmp(key, "sensors") == 0 && profile != &config->profiles[0])
+                  return parseSensors(config, value, (uint8_t)(profile - config->profiles));
+            return false;
+      }
+
+      uint16_t* port = NULL;
+      if(strcmp(key, "connection_port") == 0)
+            port = &config->connectionPort;
+      else if(strcmp(key, "send_port") == 0)
+            port = &config->sendPort;
+      else if(strcmp(key, "alert_port") == 0)
+            port = &config->alertPort;
+      else if(strcmp(key, "control_port") == 0)
+            port = &config->controlPort;
+      else if(strcmp(key, "metrics_port") == 0)
+            port = &config->metricsPort;
+
+      if(port != NULL) {
+            if(!parseNumber(value, port == &config->metricsPort ? 0 : 1, UINT16_MAX, &number))
+                  return false;
+            *port = (uint16_t)number;
+      } else if(strcmp(key, "receive_buffer") == 0) {
+            if(!parseNumber(value, 0, INT_MAX, &number))
+                  return false;
+            config->receiveBuffer = (int)number;
+      } else if(strcmp(key, "max_sensors") == 0) {
+            if(!parseNumber(value, 1, MAX_SENSORS, &number))
+                  return false;
+            config->maxSensors = number;
+      } else if(strcmp(key, "reactivate_time") == 0) {
+            if(!parseNumber(value, 0, 3600, &number))
+                  return false;
+            config->reactivateTime = (unsigned)number;
+      } else {
+            return false;
+      }
+      return true;
+}
+
+Config* configLoad(const char* path) {
+      FILE* file = fopen(path, "r");
+      if(!file) {
+            perror("Opening the configuration failed");
+            return NULL;
+      }
+      Config* config = configDefault();
+      if(!config) {
+            fclose(file);
+            return NULL;
+      }
+
+      char buffer[CONFIG_LINE_MAX];
+      size_t lineNumber = 0;
+      ConfigProfile* profile = NULL;
+      bool valid = true;
+
+      while(valid && fgets(buffer, sizeof buffer, file)) {
+            lineNumber++;
+            char* comment = strchr(buffer, '#');
+            if(comment != NULL)
+                  *comment = '\0';
+            char* line = trim(buffer);
+            if(*line == '\0')
+                  continue;
+
+            if(*line == '[') {
+                  char name[CONFIG_NAME_MAX];
+                  char end;
+                  valid = sscanf(line, "[profile %31[A-Za-z0-9_-]%c", name, &end) == 2 && end == ']' && line[strlen(line) - 1] == ']';
+                  if(valid && (profile = findProfile(config, name)) == NULL)
+                        valid = (profile = addProfile(config, name)) != NULL;
+                  continue;
+            }
+
+            char* equals = strchr(line, '=');
+            if(equals == NULL) {
+                  valid = false;
+                  continue;
+            }
+            *equals = '\0';
+            valid = parseSetting(config, profile, trim(line), trim(equals + 1));
+      }
+
+      if(!valid)
+            fprintf(stderr, "%s:%zu: invalid line\n", path, lineNumber);
+      else if(ferror(file)) {
+            perror("Reading the configuration failed");
+            valid = false;
+      }
+      fclose(file);
+
+      if(!valid || !compile(config)) {
+            configFree(config);
+            return NULL;
+      }
+      return config;
+}
+
+void configFree(Config* config) {
+      free(config);
+}
+
+static void retireConfig(void* ptr) {
+      configFree((Config*)ptr);
+}
+
+void configPublish(Config* config) {
+      Config* old = atomic_exchange(&current, config);
+      if(old != NULL)
+            epochRetire(old, retireConfig);
+}
+
+Config* configAcquire() {
+      return atomic_load_explicit(&current, memory_order_acquire);
+}
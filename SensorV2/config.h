@@ -0,0 +1,90 @@
+#ifndef CONFIG_H
+
+#define CONFIG_H
+#define CONFIG_PROFILES_MAX 16
+#define CONFIG_NAME_MAX 32
+// profile of the sensors no other profile lists
+#define CONFIG_DEFAULT_PROFILE "default"
+// local Prometheus endpoint, 0 turns it off
+#define CONFIG_METRICS_PORT 9100
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "protocol.h"
+#include "rules.h"
+
+/*
+The alert rules of a group of sensors.
+*/
+typedef struct ConfigProfileTag {
+      char name[CONFIG_NAME_MAX];
+      Rule rules[RULES_MAX];
+      size_t ruleCount;
+      size_t sensorCount;
+} ConfigProfile;
+
+/*
+A snapshot of the server configuration. The protocol.h values are the
+defaults, a file overrides them:
+
+      # comment
+      connection_port = 4040
+      send_port = 5050
+      alert_port = 6060
+      control_port = 7070
+      metrics_port = 9100
+      receive_buffer = 0
+      max_sensors = 255
+      reactivate_time = 3
+
+      [profile default]
+      rules = temperature>50,humidity>60,airquality<10
+
+      [profile greenhouse]
+      sensors = 10-19,42
+      rules = temperature>40,humidity~15
+
+Sensors listed by no profile are in the default one. A published
+snapshot never changes (but for the rule counters): readers take it
+with configAcquire and a reload publishes a new one.
+*/
+typedef struct ConfigTag {
+      uint16_t connectionPort;
+      uint16_t sendPort;
+      uint16_t alertPort;
+      uint16_t controlPort;
+      uint16_t metricsPort;         // 0: no metrics endpoint
+      int receiveBuffer;            // SO_RCVBUF bytes of the send port, 0: system default
+      size_t maxSensors;            // registered at the same time
+      unsigned reactivateTime;      // seconds
+      ConfigProfile profiles[CONFIG_PROFILES_MAX];
+      size_t profileCount;
+      uint8_t profileOf[MAX_SENSORS + 1];
+      RuleSet rules;                // the profiles by sensor, for the rule engine
+} Config;
+
+/*
+The built-in configuration, NULL on allocation failure.
+*/
+Config* configDefault();
+/*
+Reads path over the defaults. NULL, with the offending line printed,
+on an unreadable or malformed file.
+*/
+Config* configLoad(const char* path);
+void configFree(Config* config);
+
+/*
+Makes config the current snapshot; the previous one is retired through
+the epoch module.
+*/
+void configPublish(Config* config);
+/*
+The current snapshot, lock-free. Call between epochEnter and epochExit,
+the snapshot stays valid until epochExit.
+*/
+Config* configAcquire();
+
+#endif
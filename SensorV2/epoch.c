@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "epoch.h"
+
+// one reader per cache line, entering never bounces other readers' lines
+typedef struct EpochReaderTag {
+      _Alignas(CACHE_LINE) atomic_uint_fast64_t epoch;     // 0 when outside
+} EpochReader;
+
+typedef struct RetiredTag {
+      void* ptr;
+      EpochDestructor destroy;
+      uint64_t epoch;
+      struct RetiredTag* next;
+} Retired;
+
+static atomic_uint_fast64_t globalEpoch = 1;
+static EpochReader readers[EPOCH_MAX_READERS];
+static atomic_size_t readerCount;
+static Retired* retiredList;
+static pthread_mutex_t retireMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local EpochReader* self;
+static _Thread_local unsigned nesting;
+
+static EpochReader* registerReader() {
+      size_t index = atomic_fetch_add(&readerCount, 1);
+      if(index >= EPOCH_MAX_READERS) {
+            fprintf(stderr, "Too many epoch readers\n");
+            exit(EXIT_FAILURE);
+      }
+      return &readers[index];
+}
+
+void epochEnter() {
+      if(nesting++ > 0)
+            return;
+      if(self == NULL)
+            self = registerReader();
+
+      // seq_cst: the announcement is ordered before every load done inside
+      atomic_store(&self->epoch, atomic_load(&globalEpoch));
+}
+
+void epochExit() {
+      if(--nesting > 0)
+            return;
+      atomic_store_explicit(&self->epoch, 0, memory_order_release);
+}
+
+static uint64_t oldestActiveEpoch() {
+      uint64_t oldest = UINT64_MAX;
+      size_t count = atomic_load(&readerCount);
+      if(count > EPOCH_MAX_READERS)
+            count = EPOCH_MAX_READERS;
+
+      for(size_t i = 0; i < count; i++) {
+            uint64_t epoch = atomic_load(&readers[i].epoch);
+            if(epoch != 0 && epoch < oldest)
+                  oldest = epoch;
+      }
+      return oldest;
+}
+
+void epochRetire(void* ptr, EpochDestructor destroy) {
+      Retired* node = malloc(sizeof *node);
+      if(!node) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+      }
+
+      node->ptr = ptr;
+      node->destroy = destroy;
+
+      pthread_mutex_lock(&retireMutex);
+      // readers that announce a later epoch started after the unpublish
+      node->epoch = atomic_fetch_add(&globalEpoch, 1);
+      node->next = retiredList;
+      retiredList = node;
+      pthread_mutex_unlock(&retireMutex);
+
+      epochCollect();
+}
+
+size_t epochCollect() {
+      Retired* ready = NULL;
+      size_t waiting = 0;
+
+      pthread_mutex_lock(&retireMutex);
+      uint64_t oldest = oldestActiveEpoch();
+      Retired** link = &retiredList;
+      while(*link != NULL) {
+            Retired* node = *link;
+            if(node->epoch < oldest) {
+                  *link = node->next;
+                  node->next = ready;
+                  ready = node;
+            } else {
+                  link = &node->next;
+                  waiting++;
+            }
+      }
+      pthread_mutex_unlock(&retireMutex);
+
+      while(ready != NULL) {
+            Retired* node = ready;
+            ready = node->next;
+            node->destroy(node->ptr);
+            free(node);
+      }
+
+      return waiting;
+}
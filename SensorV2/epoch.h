@@ -0,0 +1,29 @@
+#ifndef EPOCH_H
+
+#define EPOCH_H
+#define EPOCH_MAX_READERS 64
+#define CACHE_LINE 64
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+Epoch based reclamation for read-mostly shared data.
+Readers wrap every access between epochEnter and epochExit and never
+lock. Writers unpublish an object first, then hand it to epochRetire:
+it is destroyed only once every reader that could still see it has left.
+Reader threads get their slot on first use, up to EPOCH_MAX_READERS.
+*/
+
+typedef void (*EpochDestructor)(void* ptr);
+
+void epochEnter();
+void epochExit();
+void epochRetire(void* ptr, EpochDestructor destroy);
+/*
+Destroys whatever retired object no reader can reach anymore,
+returns how many are still waiting.
+*/
+size_t epochCollect();
+
+#endif
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "tsstore.h"
+#include "../Common/textbuf.h"
+
+typedef struct HistoryTag {
+      uint8_t sensorID;
+      TextBuffer text;
+} History;
+
+/*
+Prints a chunk of readings with the same layout as the server output.
+*/
+void printChunk(const StoreChunk* chunk, void* ctx);
+
+int main(int argc, char** argv) {
+      if(argc < 2 || argc > 3) {
+            fprintf(stderr, "Usage: %s <sensor id> [store directory]\n", argv[0]);
+            exit(EXIT_FAILURE);
+      }
+
+      int id = atoi(argv[1]);
+      if(id < 0 || id > UINT8_MAX) {
+            fprintf(stderr, "Sensor id must be between 0 and %d\n", UINT8_MAX);
+            exit(EXIT_FAILURE);
+      }
+
+      History* history = malloc(sizeof *history);
+      if(!history) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+      }
+      history->sensorID = (uint8_t)id;
+      textInit(&history->text, STDOUT_FILENO);
+
+      long long readings = storeScan(argc == 3 ? argv[2] : STORE_DEFAULT_ROOT, history->sensorID, printChunk, history);
+      if(!textFlush(&history->text))
+            perror("Output write failed");
+      if(readings < 0) {
+            free(history);
+            exit(EXIT_FAILURE);
+      }
+
+      fprintf(stderr, "%lld readings\n", readings);
+      free(history);
+      exit(EXIT_SUCCESS);
+}
+
+void printChunk(const StoreChunk* chunk, void* ctx) {
+      History* history = (History*)ctx;
+      TextBuffer* text = &history->text;
+
+      for(size_t i = 0; i < chunk->count; i++) {
+            textAppendUint(text, history->sensorID);
+            textAppend(text, " at ", 4);
+            textAppendDate(text, chunk->timestamps[i]);
+            textAppend(text, ": ", 2);
+            textAppendUint(text, chunk->temperature[i]);
+            textAppend(text, " C ", 3);
+            textAppendUint(text, chunk->humidity[i]);
+            textAppend(text, " H ", 3);
+            textAppendUint(text, chunk->airQuality[i]);
+            textAppend(text, " %\n", 3);
+      }
+}
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "ingest.h"
+#include "epoch.h"
+#include "wire.h"
+
+static uint64_t readKernelDrops(void* ctx) {
+      IngestEngine* engine = (IngestEngine*)ctx;
+      return atomic_load_explicit(&engine->kernelDrops, memory_order_relaxed);
+}
+
+static uint64_t rejected(const IngestStats* stats) {
+      return stats->malformed + stats->unknownSource + stats->unknownSensor + stats->forged;
+}
+
+bool ingestInit(
+      IngestEngine* engine,
+      int socketFD,
+      size_t batchSize,
+      IngestResolver resolve,
+      IngestIDResolver resolveID,
+      IngestSink sink,
+      void* ctx
+) {
+      if(engine == NULL || resolve == NULL || resolveID == NULL || sink == NULL || socketFD < 0)
+            return false;
+
+      if(batchSize < INGEST_MIN_BATCH)
+            batchSize = INGEST_MIN_BATCH;
+      if(batchSize > INGEST_MAX_BATCH)
+            batchSize = INGEST_MAX_BATCH;
+
+      memset(engine, 0, sizeof *engine);
+      engine->socketFD = socketFD;
+      engine->batchSize = batchSize;
+      engine->backend = NETIO_AUTO;
+      engine->resolve = resolve;
+      engine->resolveID = resolveID;
+      engine->sink = sink;
+      engine->ctx = ctx;
+      for(size_t i = 0; i <= MAX_SENSORS; i++)
+            sequenceInit(&engine->sequences[i]);
+      atomic_init(&engine->kernelDrops, 0);
+      atomic_init(&engine->stopping, false);
+
+      engine->metrics.datagrams = metricsCounter("sensorv2_datagrams_total", "Datagrams received on the data socket.");
+      engine->metrics.readings = metricsCounter("sensorv2_readings_total", "Readings decoded and handed on.");
+      engine->metrics.rejected = metricsCounter("sensorv2_rejected_total", "Malformed or forged datagrams and readings of unregistered senders.");
+      engine->metrics.batchReadings = metricsHistogram("sensorv2_batch_readings", "Readings decoded from one receive batch.");
+      engine->metrics.latency = metricsHistogram("sensorv2_ingest_latency_ns", "From a receive batch in hand to its readings processed, nanoseconds.");
+      engine->metrics.kernelDrops = metricsCounterFn("sensorv2_kernel_drops_total", "Datagrams dropped by the kernel on the data socket.", readKernelDrops, engine);
+
+      // every datagram then carries the socket drop counter
+      int enable = 1;
+      if(setsockopt(socketFD, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof enable) < 0)
+            perror("Drop counter unavailable");
+      return true;
+}
+
+/*
+Hands the records to the sink once the record array is full.
+*/
+static void pushRecord(IngestEngine* engine, IngestRecord* records, size_t* decoded, const Sensor* sensor, const SensorPayload* payload) {
+      records[*decoded].sensor = sensor;
+      records[*decoded].payload = *payload;
+      engine->stats.readings++;
+      if(++*decoded == INGEST_MAX_BATCH) {
+            engine->sink(records, *decoded, engine->ctx);
+            *decoded = 0;
+      }
+}
+
+static void decodeBatch(
+      IngestEngine* engine,
+      const uint8_t* datagram,
+      size_t length,
+      const Sensor* sender,
+      IngestRecord* records,
+      size_t* decoded
+) {
+      SensorBatchHeader header;
+      uint8_t ids[SENSOR_BATCH_MAX_READINGS];
+      SensorPayload payloads[SENSOR_BATCH_MAX_READINGS];
+
+      if(!sensorBatchDecode(datagram, length, &header, ids, payloads)) {
+            engine->stats.malformed++;
+            return;
+      }
+
+      // the source address tells the sender, only a gateway speaks for others
+      bool gateway = header.flags & BATCH_GATEWAY;
+      if(header.sensorID != sender->id || (gateway && !sender->gateway)) {
+            engine->stats.forged++;
+            return;
+      }
+
+      // a new registration numbers its batches from scratch
+      SequenceTracker* tracker = &engine->sequences[sender->id];
+      if(engine->sequenceOwners[sender->id] != sender->registration) {
+            engine->sequenceOwners[sender->id] = sender->registration;
+            sequenceReset(tracker);
+      }
+      sequenceTrack(tracker, header.sequence);
+
+      const Sensor* sensor = sender;
+      for(size_t i = 0; i < header.count; i++) {
+            if(gateway)
+                  sensor = ids[i] == sender->id ? sender : engine->resolveID(ids[i]);
+            if(sensor == NULL) {
+                  engine->stats.unknownSensor++;
+                  continue;
+            }
+            pushRecord(engine, records, decoded, sensor, &payloads[i]);
+      }
+}
+
+static void ingestDatagram(IngestEngine* engine, const NetIOEvent* event, IngestRecord* records, size_t* decoded) {
+      // no oversized message allowed, the length is checked per format
+      if(event->truncated) {
+            engine->stats.malformed++;
+            return;
+      }
+
+      const Sensor* sensor = engine->resolve(&event->peer);
+      if(sensor == NULL) {
+            engine->stats.unknownSource++;
+            return;
+      }
+
+      if(event->result == SENSOR_PAYLOAD_WIRE_SIZE) {
+            engine->stats.unsequenced++;
+            SensorPayload payload;
+            sensorPayloadDecode(&payload, event->data);
+            pushRecord(engine, records, decoded, sensor, &payload);
+      } else {
+            decodeBatch(engine, event->data, event->result, sensor, records, decoded);
+      }
+}
+
+void* ingestLoop(void* arg) {
+      IngestEngine* engine = (IngestEngine*)arg;
+
+      NetIO io;
+      // a few batches of buffers, the kernel keeps filling them while one is decoded
+      if(!netioInit(&io, engine->backend, INGEST_DATAGRAM_MAX, INGEST_MAX_BATCH * 4))
+            return NULL;
+      if(!netioRecvFrom(&io, engine->socketFD, NULL)) {
+            fprintf(stderr, "Receive failed to start\n");
+            netioDestroy(&io);
+            return NULL;
+      }
+
+      NetIOEvent* events = malloc(engine->batchSize * sizeof *events);
+      IngestRecord* records = malloc(INGEST_MAX_BATCH * sizeof *records);
+      if(!events || !records) {
+            perror("Memory allocation failed");
+            free(events);
+            free(records);
+            netioDestroy(&io);
+            return NULL;
+      }
+
+      bool receiving = true;
+      while(receiving && !atomic_load_explicit(&engine->stopping, memory_order_relaxed)) {
+            // block for the first datagram, then take whatever is already there
+            int received = netioWait(&io, events, engine->batchSize, INGEST_STOP_POLL_MS);
+            if(received < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  perror("Receive failed");
+                  break;
+            }
+            if(received == 0)
+                  continue;
+
+            engine->stats.batches++;
+            uint64_t start = metricsNow();
+            uint64_t readings = engine->stats.readings;
+            uint64_t datagrams = engine->stats.datagrams;
+            uint64_t rejectedBefore = rejected(&engine->stats);
+
+            // resolved sensors stay valid until the sink is done with the batch
+            epochEnter();
+            size_t decoded = 0;
+            for(int i = 0; i < received; i++) {
+                  if(events[i].result < 0) {
+                        errno = -events[i].result;
+                        perror("Receive failed");
+                        receiving = false;
+                        break;
+                  }
+
+                  engine->stats.datagrams++;
+                  // the counter is cumulative: the last datagram has the latest value
+                  if(events[i].hasDrops)
+                        atomic_store_explicit(&engine->kernelDrops, events[i].drops, memory_order_relaxed);
+                  ingestDatagram(engine, &events[i], records, &decoded);
+            }
+
+            if(decoded > 0)
+                  engine->sink(records, decoded, engine->ctx);
+            epochExit();
+
+            readings = engine->stats.readings - readings;
+            metricsAdd(engine->metrics.datagrams, engine->stats.datagrams - datagrams);
+            metricsAdd(engine->metrics.readings, readings);
+            metricsAdd(engine->metrics.rejected, rejected(&engine->stats) - rejectedBefore);
+            metricsRecord(engine->metrics.batchReadings, readings);
+            metricsRecord(engine->metrics.latency, metricsNow() - start);
+      }
+
+      free(records);
+      free(events);
+      netioDestroy(&io);
+      return NULL;
+}
+
+void ingestStop(IngestEngine* engine) {
+      atomic_store_explicit(&engine->stopping, true, memory_order_relaxed);
+}
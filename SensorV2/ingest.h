@@ -0,0 +1,111 @@
+#ifndef INGEST_H
+
+#define INGEST_H
+#define INGEST_MIN_BATCH 32
+#define INGEST_MAX_BATCH 256
+#define INGEST_DEFAULT_BATCH 64
+// bigger than any valid datagram (BATCH_MAX_BYTES), so oversized ones show up as truncated
+#define INGEST_DATAGRAM_MAX 2048
+// longest an idle loop takes to notice ingestStop
+#define INGEST_STOP_POLL_MS 100
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+
+#include "protocol.h"
+#include "sequence.h"
+#include "../Common/netio.h"
+#include "../Common/metrics.h"
+
+typedef struct IngestRecordTag {
+      const Sensor* sensor;
+      SensorPayload payload;
+} IngestRecord;
+
+/*
+Maps the source address of a datagram to the registered sensor that sent it,
+NULL if the address does not belong to any sensor. It runs inside an epoch
+critical section, and the sensor it returns is valid until the sink returns.
+*/
+typedef const Sensor* (*IngestResolver)(const struct sockaddr_in* source);
+/*
+Same for the sensor IDs carried by batched datagrams.
+*/
+typedef const Sensor* (*IngestIDResolver)(uint8_t id);
+/*
+Downstream stage: receives the decoded records of a receive batch, at
+most INGEST_MAX_BATCH at a time.
+*/
+typedef void (*IngestSink)(const IngestRecord* records, size_t count, void* ctx);
+
+typedef struct IngestStatsTag {
+      uint64_t datagrams;
+      uint64_t batches;
+      uint64_t readings;
+      uint64_t unknownSource;       // datagrams from unregistered addresses
+      uint64_t unknownSensor;       // batched readings of unregistered IDs
+      uint64_t forged;              // batches claiming another sender, or gateway batches of a sensor
+      uint64_t unsequenced;         // bare payloads, outside sequence tracking
+      uint64_t malformed;
+} IngestStats;
+
+/*
+The stats above as exported metrics, updated once per receive batch.
+*/
+typedef struct IngestMetricsTag {
+      Metric* datagrams;
+      Metric* readings;
+      Metric* rejected;             // malformed, forged or from unknown senders
+      Metric* batchReadings;        // readings of one receive batch
+      Metric* latency;              // receive batch in hand to processed by the sink, ns
+      Metric* kernelDrops;
+} IngestMetrics;
+
+typedef struct IngestEngineTag {
+      int socketFD;
+      size_t batchSize;
+      // socket I/O of the loop, NETIO_AUTO unless changed before it starts
+      NetIOBackend backend;
+      IngestResolver resolve;
+      IngestIDResolver resolveID;
+      IngestSink sink;
+      void* ctx;
+      IngestStats stats;
+      IngestMetrics metrics;
+      // by sender ID, fed by the sequence number of its batches
+      SequenceTracker sequences[MAX_SENSORS + 1];
+      // registration each tracker follows, reset when the ID registers again
+      uint64_t sequenceOwners[MAX_SENSORS + 1];
+      // datagrams the kernel dropped on the socket (SO_RXQ_OVFL), all senders
+      atomic_uint_fast64_t kernelDrops;
+      atomic_bool stopping;
+} IngestEngine;
+
+bool ingestInit(
+      IngestEngine* engine,
+      int socketFD,
+      size_t batchSize,
+      IngestResolver resolve,
+      IngestIDResolver resolveID,
+      IngestSink sink,
+      void* ctx
+);
+
+/*
+This thread routine is the only reader of the UDP socket: it drains it
+with a multishot receive (io_uring) or recvmmsg (epoll), attributes each
+datagram to its sensor and passes the decoded batch to the sink. A datagram is either one SensorPayload or a
+batch (SensorBatchHeader) of the sender itself or, from a gateway, of
+other registered sensors.
+*/
+void* ingestLoop(void* arg);
+/*
+Makes ingestLoop return once the receive batch in hand reached the sink:
+nothing is handed on after the thread is joined.
+*/
+void ingestStop(IngestEngine* engine);
+
+#endif
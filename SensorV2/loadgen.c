@@ -0,0 +1,551 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+
+#include "protocol.h"
+#include "wire.h"
+
+#define USAGE "<server IPv4> [-n sensors] [-t tick ms] [-a alert probability] [-b readings per datagram] [-r storm every s] [-d seconds]"
+#define DEFAULT_SENSORS 10000
+#define DEFAULT_TICK_MS 2000
+#define SLOT_MS 1
+#define SEND_CHUNK 1024
+#define MAX_EVENTS 256
+
+// epoll data: the kind of source in the high half, its index in the low half
+#define EVENT_TIMER 0
+#define EVENT_REGISTRATION 1
+#define EVENT_ALERT 2
+#define EVENT(kind, index) (((uint64_t)(kind) << 32) | (uint32_t)(index))
+
+/*
+SensorV2 sensor IDs are 8 bit, so virtual sensor v speaks as ID v % 256.
+Every ID gets its own UDP socket (registered data port) and sequence
+numbering, shared by the virtual sensors behind it, and at most one
+alert in flight: the server keeps a single reactivation per ID.
+*/
+typedef struct SensorSocketTag {
+      uint8_t id;
+      int udpFD;
+      in_port_t dataPort;
+      uint32_t sequence;
+      int registrationFD;     // -1 when not registering
+      int alertFD;            // -1 when no alert is in flight
+      uint32_t alertOwner;    // virtual sensor that raised it
+      bool alertSent;
+      uint8_t alertReply[SENSOR_ALERT_WIRE_SIZE];
+      size_t alertReceived;
+      struct timespec alertStart;
+      size_t pendingCount;
+      bool queued;
+      SensorPayload pending[SENSOR_BATCH_MAX_READINGS];
+} SensorSocket;
+
+typedef struct LoadStatsTag {
+      uint64_t datagrams;
+      uint64_t readings;
+      uint64_t sendDrops;
+      uint64_t alerts;
+      uint64_t alertsSuppressed;
+      uint64_t reactivations;
+      uint64_t registrations;
+      uint64_t registrationFailures;
+      double reactivationLagMs;
+} LoadStats;
+
+struct sockaddr_in serverAddr;
+size_t sensorCount = DEFAULT_SENSORS;
+unsigned tickMs = DEFAULT_TICK_MS;
+double alertProbability = 0.001;
+size_t batchSize = 1;
+unsigned stormEvery = 0;
+unsigned duration = 0;
+
+int epollFD;
+size_t socketCount;
+SensorSocket* sockets;
+bool* silent;                 // by virtual sensor, while its alert is pending
+size_t registrationsPending;
+SensorSocket** touched;       // sockets holding readings, until the end of the tick
+size_t touchedCount;
+struct timespec stormStart;
+LoadStats stats;
+
+void checkArgs(int argc, char** argv);
+bool initSockets();
+/*
+Opens a registration connection for every ID at once; completions are
+handled by the event loop.
+*/
+void startStorm();
+void handleRegistration(SensorSocket* s, uint32_t events);
+/*
+Produces the readings of every virtual sensor due in this slot. A socket
+sends once it holds a datagram's worth of readings, and the leftovers go
+out at the end of the tick, so no reading waits longer than one tick.
+*/
+void runSlot(uint64_t slot);
+void flushSocket(SensorSocket* s);
+void startAlert(SensorSocket* s, uint32_t owner);
+void handleAlert(SensorSocket* s, uint32_t events);
+void endAlert(SensorSocket* s);
+void report(const LoadStats* last, double seconds, double elapsed);
+SensorPayload createQuietPayload();
+SensorPayload createAlertPayload();
+double elapsedMs(const struct timespec* from, const struct timespec* to);
+
+int main(int argc, char** argv) {
+      checkArgs(argc, argv);
+      srand(time(NULL));
+      signal(SIGPIPE, SIG_IGN);
+
+      if((epollFD = epoll_create1(0)) < 0) {
+            perror("Epoll creation failed");
+            exit(EXIT_FAILURE);
+      }
+      if(!initSockets())
+            exit(EXIT_FAILURE);
+
+      int timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+      struct itimerspec period = { { 0, SLOT_MS * 1000000L }, { 0, SLOT_MS * 1000000L } };
+      if(timerFD < 0 || timerfd_settime(timerFD, 0, &period, NULL) < 0) {
+            perror("Timer creation failed");
+            exit(EXIT_FAILURE);
+      }
+      struct epoll_event timerEvent = { .events = EPOLLIN, .data.u64 = EVENT(EVENT_TIMER, 0) };
+      epoll_ctl(epollFD, EPOLL_CTL_ADD, timerFD, &timerEvent);
+
+      printf("%zu virtual sensors on %zu IDs, tick %u ms, alert probability %g, %zu readings per datagram\n",
+            sensorCount, socketCount, tickMs, alertProbability, batchSize);
+      startStorm();
+
+      struct timespec start, lastReport, lastStorm, now;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      lastReport = lastStorm = start;
+      LoadStats last = stats;
+      uint64_t slot = 0;
+      bool sending = false;
+
+      while(true) {
+            struct epoll_event events[MAX_EVENTS];
+            int ready = epoll_wait(epollFD, events, MAX_EVENTS, -1);
+            if(ready < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  perror("Epoll wait failed");
+                  break;
+            }
+
+            for(int i = 0; i < ready; i++) {
+                  uint32_t kind = events[i].data.u64 >> 32;
+                  uint32_t index = (uint32_t)events[i].data.u64;
+
+                  if(kind == EVENT_REGISTRATION) {
+                        handleRegistration(&sockets[index], events[i].events);
+                  } else if(kind == EVENT_ALERT) {
+                        handleAlert(&sockets[index], events[i].events);
+                  } else {
+                        uint64_t expirations;
+                        if(read(timerFD, &expirations, sizeof expirations) != sizeof expirations)
+                              continue;
+                        // the first storm has to finish before sensors start sending
+                        if(!sending && stats.registrations + stats.registrationFailures < socketCount)
+                              continue;
+                        if(!sending) {
+                              sending = true;
+                              clock_gettime(CLOCK_MONOTONIC, &start);
+                              lastReport = lastStorm = start;
+                              last = stats;
+                        }
+                        // a late wakeup catches up on every missed slot
+                        for(uint64_t e = 0; e < expirations; e++)
+                              runSlot(slot++);
+                  }
+            }
+
+            if(!sending)
+                  continue;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double sinceReport = elapsedMs(&lastReport, &now);
+            if(sinceReport >= 1000) {
+                  report(&last, sinceReport / 1000, elapsedMs(&start, &now) / 1000);
+                  last = stats;
+                  lastReport = now;
+            }
+            if(stormEvery > 0 && registrationsPending == 0 && elapsedMs(&lastStorm, &now) >= stormEvery * 1000.0) {
+                  startStorm();
+                  lastStorm = now;
+            }
+            if(duration > 0 && elapsedMs(&start, &now) >= duration * 1000.0)
+                  break;
+      }
+
+      double seconds = elapsedMs(&start, &now) / 1000;
+      printf("Total: %.1f s, %llu datagrams (%.0f/s), %llu readings (%.0f/s), %llu send drops, %llu alerts, %llu reactivated\n",
+            seconds,
+            (unsigned long long)stats.datagrams, stats.datagrams / seconds,
+            (unsigned long long)stats.readings, stats.readings / seconds,
+            (unsigned long long)stats.sendDrops,
+            (unsigned long long)stats.alerts,
+            (unsigned long long)stats.reactivations);
+
+      free(touched);
+      free(silent);
+      free(sockets);
+      close(timerFD);
+      close(epollFD);
+      exit(EXIT_SUCCESS);
+}
+
+void checkArgs(int argc, char** argv) {
+      int option;
+      while((option = getopt(argc, argv, "n:t:a:b:r:d:")) != -1) {
+            switch(option) {
+                  case 'n': sensorCount = strtoul(optarg, NULL, 10); break;
+                  case 't': tickMs = strtoul(optarg, NULL, 10); break;
+                  case 'a': alertProbability = strtod(optarg, NULL); break;
+                  case 'b': batchSize = strtoul(optarg, NULL, 10); break;
+                  case 'r': stormEvery = strtoul(optarg, NULL, 10); break;
+                  case 'd': duration = strtoul(optarg, NULL, 10); break;
+                  default:
+                        fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
+                        exit(EXIT_FAILURE);
+            }
+      }
+
+      if(optind != argc - 1) {
+            fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
+            exit(EXIT_FAILURE);
+      }
+
+      memset(&serverAddr, 0, sizeof serverAddr);
+      serverAddr.sin_family = AF_INET;
+      if(inet_pton(AF_INET, argv[optind], &serverAddr.sin_addr) != 1) {
+            fprintf(stderr, "Invalid IP address: %s\n", argv[optind]);
+            exit(EXIT_FAILURE);
+      }
+
+      if(sensorCount == 0 || tickMs < SLOT_MS || alertProbability < 0 || alertProbability > 1
+            || batchSize == 0 || batchSize > SENSOR_BATCH_MAX_READINGS) {
+            fprintf(stderr, "Need sensors > 0, tick >= %d ms, alert probability in [0, 1], readings per datagram in [1, %d]\n",
+                  SLOT_MS, (int)SENSOR_BATCH_MAX_READINGS);
+            exit(EXIT_FAILURE);
+      }
+}
+
+bool initSockets() {
+      socketCount = sensorCount < MAX_SENSORS + 1 ? sensorCount : MAX_SENSORS + 1;
+      sockets = calloc(socketCount, sizeof *sockets);
+      silent = calloc(sensorCount, sizeof *silent);
+      touched = malloc(socketCount * sizeof *touched);
+      if(!sockets || !silent || !touched) {
+            perror("Memory allocation failed");
+            return false;
+      }
+
+      for(size_t i = 0; i < socketCount; i++) {
+            SensorSocket* s = &sockets[i];
+            s->id = (uint8_t)i;
+            s->registrationFD = -1;
+            s->alertFD = -1;
+
+            struct sockaddr_in local;
+            memset(&local, 0, sizeof local);
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(INADDR_ANY);
+            socklen_t localLen = sizeof local;
+
+            s->udpFD = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+            if(s->udpFD < 0
+                  || bind(s->udpFD, (struct sockaddr*)&local, sizeof local) < 0
+                  || getsockname(s->udpFD, (struct sockaddr*)&local, &localLen) < 0) {
+                  perror("Send socket creation failed");
+                  return false;
+            }
+            s->dataPort = local.sin_port;
+      }
+
+      return true;
+}
+
+void startStorm() {
+      struct sockaddr_in addr = serverAddr;
+      addr.sin_port = htons(CONNECTION_PORT);
+      clock_gettime(CLOCK_MONOTONIC, &stormStart);
+
+      for(size_t i = 0; i < socketCount; i++) {
+            SensorSocket* s = &sockets[i];
+            s->registrationFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            if(s->registrationFD < 0) {
+                  perror("Registration socket creation failed");
+                  stats.registrationFailures++;
+                  continue;
+            }
+
+            if(connect(s->registrationFD, (struct sockaddr*)&addr, sizeof addr) < 0 && errno != EINPROGRESS) {
+                  perror("Registration connection failed");
+                  close(s->registrationFD);
+                  s->registrationFD = -1;
+                  stats.registrationFailures++;
+                  continue;
+            }
+
+            struct epoll_event event = { .events = EPOLLOUT, .data.u64 = EVENT(EVENT_REGISTRATION, i) };
+            epoll_ctl(epollFD, EPOLL_CTL_ADD, s->registrationFD, &event);
+            registrationsPending++;
+      }
+}
+
+void handleRegistration(SensorSocket* s, uint32_t events) {
+      int error = 0;
+      socklen_t length = sizeof error;
+      getsockopt(s->registrationFD, SOL_SOCKET, SO_ERROR, &error, &length);
+
+      bool registered = false;
+      if(!(events & (EPOLLERR | EPOLLHUP)) && error == 0) {
+            // the server takes our host from the connection, we only announce the data port
+            Sensor announce;
+            memset(&announce, 0, sizeof announce);
+            announce.id = s->id;
+            announce.addr.sin_family = AF_INET;
+            announce.addr.sin_port = s->dataPort;
+
+            uint8_t wire[SENSOR_WIRE_SIZE];
+            sensorEncode(wire, &announce);
+            registered = send(s->registrationFD, wire, sizeof wire, MSG_NOSIGNAL) == sizeof wire;
+      }
+
+      if(registered)
+            stats.registrations++;
+      else
+            stats.registrationFailures++;
+
+      close(s->registrationFD);
+      s->registrationFD = -1;
+
+      if(--registrationsPending == 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double ms = elapsedMs(&stormStart, &now);
+            printf("Registration storm: %zu connections in %.1f ms (%.0f/s), %llu failed so far\n",
+                  socketCount, ms, socketCount / (ms / 1000),
+                  (unsigned long long)stats.registrationFailures);
+      }
+}
+
+void runSlot(uint64_t slot) {
+      uint64_t slots = tickMs / SLOT_MS;
+
+      // virtual sensor v sends in slot v % slots of every tick
+      for(size_t v = slot % slots; v < sensorCount; v += slots) {
+            if(silent[v])
+                  continue;
+
+            SensorSocket* s = &sockets[v % socketCount];
+            bool alerting = (double)rand() / RAND_MAX < alertProbability;
+            SensorPayload payload = alerting ? createAlertPayload() : createQuietPayload();
+
+            if(alert(&payload)) {
+                  // like the client: stop sending until the server reactivates us
+                  if(s->alertFD == -1) {
+                        silent[v] = true;
+                        startAlert(s, (uint32_t)v);
+                        continue;
+                  }
+                  stats.alertsSuppressed++;
+            }
+
+            if(!s->queued) {
+                  s->queued = true;
+                  touched[touchedCount++] = s;
+            }
+            s->pending[s->pendingCount++] = payload;
+            if(s->pendingCount == batchSize)
+                  flushSocket(s);
+      }
+
+      if(slot % slots != slots - 1)
+            return;
+      for(size_t i = 0; i < touchedCount; i++) {
+            flushSocket(touched[i]);
+            touched[i]->queued = false;
+      }
+      touchedCount = 0;
+}
+
+void flushSocket(SensorSocket* s) {
+      static uint8_t buffers[SEND_CHUNK][BATCH_MAX_BYTES];
+      static struct iovec iovecs[SEND_CHUNK];
+      static struct mmsghdr messages[SEND_CHUNK];
+
+      struct sockaddr_in addr = serverAddr;
+      addr.sin_port = htons(SEND_PORT);
+
+      size_t offset = 0;
+      while(offset < s->pendingCount) {
+            size_t count = 0;
+            size_t readings = 0;
+            for(; count < SEND_CHUNK && offset < s->pendingCount; count++) {
+                  size_t take = s->pendingCount - offset < batchSize ? s->pendingCount - offset : batchSize;
+                  SensorBatchHeader header = { 0 };
+                  header.sensorID = s->id;
+                  header.count = (uint16_t)take;
+                  header.sequence = s->sequence++;
+
+                  iovecs[count].iov_base = buffers[count];
+                  iovecs[count].iov_len = sensorBatchEncode(buffers[count], &header, NULL, &s->pending[offset]);
+                  memset(&messages[count], 0, sizeof messages[count]);
+                  messages[count].msg_hdr.msg_name = &addr;
+                  messages[count].msg_hdr.msg_namelen = sizeof addr;
+                  messages[count].msg_hdr.msg_iov = &iovecs[count];
+                  messages[count].msg_hdr.msg_iovlen = 1;
+                  offset += take;
+                  readings += take;
+            }
+
+            int sent = sendmmsg(s->udpFD, messages, count, 0);
+            if(sent < 0) {
+                  if(errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+                        perror("Send failed");
+                  sent = 0;
+            }
+
+            // a full socket buffer drops the rest of the chunk, the server counts it as loss
+            size_t sentReadings = 0;
+            for(int i = 0; i < sent; i++)
+                  sentReadings += (iovecs[i].iov_len - SENSOR_BATCH_HEADER_WIRE_SIZE) / SENSOR_PAYLOAD_WIRE_SIZE;
+            stats.datagrams += sent;
+            stats.readings += sentReadings;
+            stats.sendDrops += count - sent;
+      }
+
+      s->pendingCount = 0;
+}
+
+void startAlert(SensorSocket* s, uint32_t owner) {
+      struct sockaddr_in addr = serverAddr;
+      addr.sin_port = htons(ALERT_PORT);
+
+      s->alertFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if(s->alertFD < 0 || (connect(s->alertFD, (struct sockaddr*)&addr, sizeof addr) < 0 && errno != EINPROGRESS)) {
+            perror("Alert connection failed");
+            if(s->alertFD >= 0)
+                  close(s->alertFD);
+            s->alertFD = -1;
+            silent[owner] = false;
+            return;
+      }
+
+      s->alertOwner = owner;
+      s->alertSent = false;
+      s->alertReceived = 0;
+      clock_gettime(CLOCK_MONOTONIC, &s->alertStart);
+      stats.alerts++;
+
+      struct epoll_event event = { .events = EPOLLOUT, .data.u64 = EVENT(EVENT_ALERT, s - sockets) };
+      epoll_ctl(epollFD, EPOLL_CTL_ADD, s->alertFD, &event);
+}
+
+void handleAlert(SensorSocket* s, uint32_t events) {
+      if(events & EPOLLERR) {
+            endAlert(s);
+            return;
+      }
+
+      if(!s->alertSent) {
+            SensorAlert alertMsg;
+            memset(&alertMsg, 0, sizeof alertMsg);
+            alertMsg.type = ALERT;
+            alertMsg.sensor.id = s->id;
+
+            uint8_t wire[SENSOR_ALERT_WIRE_SIZE];
+            sensorAlertEncode(wire, &alertMsg);
+            if(send(s->alertFD, wire, sizeof wire, MSG_NOSIGNAL) != sizeof wire) {
+                  endAlert(s);
+                  return;
+            }
+            s->alertSent = true;
+
+            struct epoll_event event = { .events = EPOLLIN, .data.u64 = EVENT(EVENT_ALERT, s - sockets) };
+            epoll_ctl(epollFD, EPOLL_CTL_MOD, s->alertFD, &event);
+            return;
+      }
+
+      ssize_t n = recv(s->alertFD, s->alertReply + s->alertReceived, sizeof s->alertReply - s->alertReceived, 0);
+      if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+      if(n <= 0) {
+            endAlert(s);
+            return;
+      }
+
+      s->alertReceived += n;
+      if(s->alertReceived < sizeof s->alertReply)
+            return;
+
+      SensorAlert reply;
+      sensorAlertDecode(&reply, s->alertReply);
+      if(reply.type == REACTIVATE) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            stats.reactivations++;
+            stats.reactivationLagMs += elapsedMs(&s->alertStart, &now) - SENSOR_REACTIVATE_TIME * 1000.0;
+      }
+      endAlert(s);
+}
+
+void endAlert(SensorSocket* s) {
+      epoll_ctl(epollFD, EPOLL_CTL_DEL, s->alertFD, NULL);
+      close(s->alertFD);
+      s->alertFD = -1;
+      silent[s->alertOwner] = false;
+}
+
+void report(const LoadStats* last, double seconds, double elapsed) {
+      uint64_t reactivations = stats.reactivations - last->reactivations;
+      double lag = reactivations > 0 ? (stats.reactivationLagMs - last->reactivationLagMs) / reactivations : 0;
+
+      printf("%6.1f s: %8.0f datagrams/s %9.0f readings/s, %llu send drops, %llu alerts (%llu suppressed), %llu reactivated (lag %.0f ms)\n",
+            elapsed,
+            (stats.datagrams - last->datagrams) / seconds,
+            (stats.readings - last->readings) / seconds,
+            (unsigned long long)(stats.sendDrops - last->sendDrops),
+            (unsigned long long)(stats.alerts - last->alerts),
+            (unsigned long long)(stats.alertsSuppressed - last->alertsSuppressed),
+            (unsigned long long)reactivations,
+            lag);
+      fflush(stdout);
+}
+
+SensorPayload createQuietPayload() {
+      return createPayload(
+            rand() % (MAX_ALERT_TEMPERATURE + 1),
+            rand() % (MAX_ALERT_HUMIDITY + 1),
+            MIN_ALERT_AIR_QUALITY + rand() % (MAX_AIR_QUALITY - MIN_ALERT_AIR_QUALITY + 1)
+      );
+}
+
+SensorPayload createAlertPayload() {
+      SensorPayload payload = createQuietPayload();
+      payload.temperature = MAX_ALERT_TEMPERATURE + 1 + rand() % (MAX_TEMPERATURE - MAX_ALERT_TEMPERATURE);
+      return payload;
+}
+
+double elapsedMs(const struct timespec* from, const struct timespec* to) {
+      return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "output.h"
+
+bool outputInit(OutputStage* stage, int fd) {
+      if(!spscInit(&stage->queue, OUTPUT_QUEUE_CAPACITY, sizeof(OutputRecord))) {
+            perror("Memory allocation failed");
+            return false;
+      }
+
+      textInit(&stage->text, fd);
+      atomic_init(&stage->dropped, 0);
+      atomic_init(&stage->stopping, false);
+      return true;
+}
+
+void outputSubmit(OutputStage* stage, const OutputRecord* records, size_t count) {
+      size_t pushed = spscPush(&stage->queue, records, count);
+      if(pushed < count)
+            atomic_fetch_add_explicit(&stage->dropped, count - pushed, memory_order_relaxed);
+}
+
+// same layout as PAYLOAD_FORMAT_SPECIFIER
+static void renderRecord(TextBuffer* text, const OutputRecord* record) {
+      textAppendUint(text, record->sensorID);
+      textAppend(text, " at ", 4);
+      textAppendDate(text, record->payload.timestamp);
+      textAppend(text, ": ", 2);
+      textAppendUint(text, record->payload.temperature);
+      textAppend(text, " C ", 3);
+      textAppendUint(text, record->payload.humidity);
+      textAppend(text, " H ", 3);
+      textAppendUint(text, record->payload.airQuality);
+      textAppend(text, " %\n", 3);
+}
+
+void* outputLoop(void* arg) {
+      OutputStage* stage = (OutputStage*)arg;
+      OutputRecord batch[OUTPUT_BATCH];
+
+      while(true) {
+            // read before the pop: stopping with nothing popped means drained
+            bool stopping = atomic_load_explicit(&stage->stopping, memory_order_acquire);
+            size_t count = spscPop(&stage->queue, batch, OUTPUT_BATCH);
+            if(count == 0) {
+                  if(stopping)
+                        break;
+                  struct timespec idle = { 0, OUTPUT_IDLE_NS };
+                  nanosleep(&idle, NULL);
+                  continue;
+            }
+
+            for(size_t i = 0; i < count; i++)
+                  renderRecord(&stage->text, &batch[i]);
+
+            if(!textFlush(&stage->text))
+                  perror("Output write failed");
+      }
+
+      return NULL;
+}
+
+void outputStop(OutputStage* stage) {
+      atomic_store_explicit(&stage->stopping, true, memory_order_release);
+}
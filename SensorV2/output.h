@@ -0,0 +1,49 @@
+#ifndef OUTPUT_H
+
+#define OUTPUT_H
+#define OUTPUT_QUEUE_CAPACITY 65536
+#define OUTPUT_BATCH 1024
+// consumer nap when the queue is empty, the producer never makes a syscall
+#define OUTPUT_IDLE_NS 1000000L
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "protocol.h"
+#include "../Common/spsc.h"
+#include "../Common/textbuf.h"
+
+typedef struct OutputRecordTag {
+      uint8_t sensorID;
+      SensorPayload payload;
+} OutputRecord;
+
+/*
+Output stage of the ingest path: the receive thread hands decoded
+records over an SPSC queue and a dedicated thread renders them with
+PAYLOAD_FORMAT_SPECIFIER's layout, one write per batch.
+*/
+typedef struct OutputStageTag {
+      SpscQueue queue;
+      TextBuffer text;
+      atomic_uint_fast64_t dropped;    // records lost to a full queue
+      atomic_bool stopping;
+} OutputStage;
+
+bool outputInit(OutputStage* stage, int fd);
+/*
+Producer side, never blocks: what does not fit is counted as dropped.
+*/
+void outputSubmit(OutputStage* stage, const OutputRecord* records, size_t count);
+/*
+This thread routine is the only consumer of the stage.
+*/
+void* outputLoop(void* arg);
+/*
+Once the producer is done: outputLoop writes what is queued and returns.
+*/
+void outputStop(OutputStage* stage);
+
+#endif
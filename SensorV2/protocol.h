@@ -4,8 +4,17 @@
 #define CONNECTION_PORT 4040
 #define SEND_PORT 5050
 #define ALERT_PORT 6060
+// long-lived framed channel: registration, heartbeats, alerts, reactivations
+#define CONTROL_PORT 7070
 #define MAX_SENSORS UINT8_MAX
 #define SENSOR_REACTIVATE_TIME 3
+#define HEARTBEAT_INTERVAL 5 // seconds
+// a channel silent this long belongs to a dead sensor
+#define HEARTBEAT_TIMEOUT (3 * HEARTBEAT_INTERVAL)
+// batched datagrams, see SensorBatchHeader
+#define BATCH_MAGIC 0xB5
+#define BATCH_GATEWAY 0x01      // readings carry their own sensor ID
+#define BATCH_MAX_BYTES 1400
 //                                ID    ts  t    h    aq
 #define PAYLOAD_FORMAT_SPECIFIER "%u at %s: %u C %u H %u %%\n"
 
@@ -20,6 +29,7 @@
 #define MIN_ALERT_AIR_QUALITY 10
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -28,6 +38,9 @@
 typedef struct SensorTag {
       uint8_t id;
       struct sockaddr_in addr;
+      // server side, not on the wire
+      bool gateway;           // registered with CONTROL_REGISTER_GATEWAY
+      uint64_t registration;  // numbered by registryAdd, tells re-registrations apart
 } Sensor;
 #pragma pack(pop)
 
@@ -50,7 +63,48 @@ typedef struct SensorAlertTag {
 } SensorAlert;
 #pragma pack(pop)
 
+/*
+Frames of the control channel: this header, then length bytes of
+payload. REGISTER carries a Sensor (only the data port of its address),
+ALERT and REACTIVATE a SensorAlert, HEARTBEAT nothing. Every frame from
+the sensor counts as a heartbeat. REGISTER_GATEWAY registers like
+REGISTER a sender that may also forward readings of other sensors
+(BATCH_GATEWAY).
+*/
+typedef enum ControlFrameTypeTag {
+      CONTROL_REGISTER,
+      CONTROL_HEARTBEAT,
+      CONTROL_ALERT,
+      CONTROL_REACTIVATE,
+      CONTROL_REGISTER_GATEWAY
+} ControlFrameType;
+
+typedef struct ControlFrameHeaderTag {
+      uint8_t type;
+      uint16_t length;
+} ControlFrameHeader;
+
+/*
+A batched datagram is this header followed by count readings stored by
+column: [sensor IDs if BATCH_GATEWAY], timestamps, temperatures,
+humidities, air qualities. A sensor batches its own readings, a gateway
+sets BATCH_GATEWAY and forwards readings of many sensors; sensorID is
+always the sender. The server drops batches whose sensorID is not the
+sender, and gateway batches of senders not registered as gateways.
+*/
+typedef struct SensorBatchHeaderTag {
+      uint8_t magic;
+      uint8_t flags;
+      uint8_t sensorID;
+      uint16_t count;
+      uint32_t sequence;
+} SensorBatchHeader;
+
 SensorPayload createPayload(uint8_t temperature, uint8_t humidity, uint8_t airQuality);
 SensorPayload createRandomPayload();
+/*
+True if the reading crosses one of the MAX_ALERT_* / MIN_ALERT_* thresholds.
+*/
+bool alert(const SensorPayload* p);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "registry.h"
+#include "epoch.h"
+#include "../Common/pool.h"
+
+// a deleted hash entry: probes go past it, inserts may reuse it
+#define TOMBSTONE ((Sensor*)1)
+
+typedef struct RegistryTableTag {
+      size_t capacity;        // power of two
+      size_t used;            // live entries plus tombstones, writer only
+      _Atomic(Sensor*) slots[];
+} RegistryTable;
+
+typedef struct RegistryTag {
+      _Atomic(Sensor*) byID[UINT8_MAX + 1];
+      _Atomic(RegistryTable*) table;
+      atomic_size_t count;
+      uint64_t registrations;       // writer only
+      pthread_mutex_t mutex;
+} Registry;
+
+static Registry registry;
+
+static uint64_t hashAddress(in_addr_t host, in_port_t port) {
+      uint64_t key = ((uint64_t)host << 16) | port;
+      key ^= key >> 33;
+      key *= 0xff51afd7ed558ccdULL;
+      key ^= key >> 33;
+      return key;
+}
+
+static RegistryTable* createTable(size_t capacity) {
+      RegistryTable* table = calloc(1, sizeof *table + capacity * sizeof table->slots[0]);
+      if(!table)
+            return NULL;
+
+      table->capacity = capacity;
+      table->used = 0;
+      for(size_t i = 0; i < capacity; i++)
+            atomic_init(&table->slots[i], NULL);
+      return table;
+}
+
+static void tableInsert(RegistryTable* table, Sensor* sensor) {
+      size_t mask = table->capacity - 1;
+      size_t i = hashAddress(sensor->addr.sin_addr.s_addr, sensor->addr.sin_port) & mask;
+      while(true) {
+            Sensor* current = atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+            if(current == NULL || current == TOMBSTONE) {
+                  if(current == NULL)
+                        table->used++;
+                  atomic_store_explicit(&table->slots[i], sensor, memory_order_release);
+                  return;
+            }
+            i = (i + 1) & mask;
+      }
+}
+
+static void tableErase(RegistryTable* table, const Sensor* sensor) {
+      size_t mask = table->capacity - 1;
+      size_t i = hashAddress(sensor->addr.sin_addr.s_addr, sensor->addr.sin_port) & mask;
+      while(true) {
+            Sensor* current = atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+            if(current == NULL)
+                  return;
+            if(current == sensor) {
+                  atomic_store_explicit(&table->slots[i], TOMBSTONE, memory_order_release);
+                  return;
+            }
+            i = (i + 1) & mask;
+      }
+}
+
+static const Sensor* tableFind(const RegistryTable* table, in_addr_t host, in_port_t port) {
+      size_t mask = table->capacity - 1;
+      size_t i = hashAddress(host, port) & mask;
+      for(size_t probes = 0; probes < table->capacity; probes++) {
+            Sensor* current = atomic_load_explicit(&table->slots[i], memory_order_acquire);
+            if(current == NULL)
+                  return NULL;
+            if(current != TOMBSTONE
+                  && current->addr.sin_addr.s_addr == host
+                  && current->addr.sin_port == port)
+                  return current;
+            i = (i + 1) & mask;
+      }
+      return NULL;
+}
+
+// too many tombstones: readers keep using the old table until it is retired
+static bool rebuildTable() {
+      RegistryTable* old = atomic_load_explicit(&registry.table, memory_order_relaxed);
+      size_t capacity = REGISTRY_MIN_CAPACITY;
+      while(capacity < atomic_load(&registry.count) * 4)
+            capacity *= 2;
+
+      RegistryTable* fresh = createTable(capacity);
+      if(!fresh)
+            return false;
+
+      for(size_t i = 0; i <= UINT8_MAX; i++) {
+            Sensor* sensor = atomic_load_explicit(&registry.byID[i], memory_order_relaxed);
+            if(sensor != NULL)
+                  tableInsert(fresh, sensor);
+      }
+
+      atomic_store_explicit(&registry.table, fresh, memory_order_release);
+      epochRetire(old, free);
+      return true;
+}
+
+// every registration takes a sensor, every removal retires one
+static Pool sensorPool = POOL_OF(Sensor);
+
+Sensor* registrySensorNew() {
+      return POOL_NEW(&sensorPool, Sensor);
+}
+
+void registrySensorFree(void* sensor) {
+      poolFree(&sensorPool, sensor);
+}
+
+bool registryInit() {
+      for(size_t i = 0; i <= UINT8_MAX; i++)
+            atomic_init(&registry.byID[i], NULL);
+      atomic_init(&registry.count, 0);
+
+      RegistryTable* table = createTable(REGISTRY_MIN_CAPACITY);
+      if(!table) {
+            perror("Memory allocation failed");
+            return false;
+      }
+      atomic_init(&registry.table, table);
+
+      if(pthread_mutex_init(&registry.mutex, NULL)) {
+            perror("Mutex failed");
+            free(table);
+            return false;
+      }
+      return true;
+}
+
+bool registryAdd(Sensor* sensor) {
+      pthread_mutex_lock(&registry.mutex);
+
+      RegistryTable* table = atomic_load_explicit(&registry.table, memory_order_relaxed);
+      Sensor* previous = atomic_load_explicit(&registry.byID[sensor->id], memory_order_relaxed);
+      if(previous == NULL && atomic_load(&registry.count) == MAX_SENSORS) {
+            pthread_mutex_unlock(&registry.mutex);
+            return false;
+      }
+
+      if(previous != NULL)
+            tableErase(table, previous);
+      else
+            atomic_fetch_add(&registry.count, 1);
+
+      sensor->registration = ++registry.registrations;
+      atomic_store_explicit(&registry.byID[sensor->id], sensor, memory_order_release);
+      tableInsert(table, sensor);
+
+      // keep free slots at a quarter of the table at least, or probes get long
+      if(table->used * 4 > table->capacity * 3 && !rebuildTable())
+            perror("Registry rebuild failed");
+
+      pthread_mutex_unlock(&registry.mutex);
+
+      if(previous != NULL)
+            epochRetire(previous, registrySensorFree);
+      return true;
+}
+
+bool registryRemove(uint8_t id) {
+      pthread_mutex_lock(&registry.mutex);
+
+      Sensor* sensor = atomic_load_explicit(&registry.byID[id], memory_order_relaxed);
+      if(sensor == NULL) {
+            pthread_mutex_unlock(&registry.mutex);
+            return false;
+      }
+
+      atomic_store_explicit(&registry.byID[id], NULL, memory_order_release);
+      tableErase(atomic_load_explicit(&registry.table, memory_order_relaxed), sensor);
+      atomic_fetch_sub(&registry.count, 1);
+
+      pthread_mutex_unlock(&registry.mutex);
+
+      epochRetire(sensor, registrySensorFree);
+      return true;
+}
+
+const Sensor* registryFindByID(uint8_t id) {
+      return atomic_load_explicit(&registry.byID[id], memory_order_acquire);
+}
+
+const Sensor* registryFindByAddress(const struct sockaddr_in* source) {
+      const RegistryTable* table = atomic_load_explicit(&registry.table, memory_order_acquire);
+
+      const Sensor* sensor = tableFind(table, source->sin_addr.s_addr, source->sin_port);
+      if(sensor == NULL)
+            sensor = tableFind(table, source->sin_addr.s_addr, 0);
+      return sensor;
+}
+
+size_t registryCount() {
+      return atomic_load_explicit(&registry.count, memory_order_relaxed);
+}
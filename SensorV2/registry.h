@@ -0,0 +1,47 @@
+#ifndef REGISTRY_H
+
+#define REGISTRY_H
+// twice the possible sensors, so probes stay short
+#define REGISTRY_MIN_CAPACITY 512
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#include "protocol.h"
+
+/*
+Concurrent sensor registry: an ID indexed slot array plus an open
+addressing hash table keyed by the sensor address.
+Lookups are lock-free and must run between epochEnter and epochExit,
+the returned Sensor stays valid until epochExit.
+Writers are serialized by a mutex and retire replaced sensors and
+tables through the epoch module.
+*/
+
+bool registryInit();
+/*
+Sensors come from the pool of the registry, which frees them once they
+are replaced or removed. registrySensorFree only takes back a sensor
+that never made it into the registry.
+*/
+Sensor* registrySensorNew();
+void registrySensorFree(void* sensor);
+/*
+Takes ownership of sensor (from registrySensorNew), unless it returns
+false, and gives it the next registration number. A sensor re-registering
+with an ID already in use replaces the old entry.
+*/
+bool registryAdd(Sensor* sensor);
+bool registryRemove(uint8_t id);
+
+const Sensor* registryFindByID(uint8_t id);
+/*
+Exact address match first, then a sensor that registered without
+announcing its data port (port 0) on the same host.
+*/
+const Sensor* registryFindByAddress(const struct sockaddr_in* source);
+size_t registryCount();
+
+#endif
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rules.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const char* metricNames[METRIC_COUNT] = { "temperature", "humidity", "airquality" };
+static const char kindOps[] = { '>', '<', '~' };
+
+void rulesInit(RuleEngine* engine, RuleSink sink, void* ctx) {
+      memset(engine, 0, sizeof *engine);
+      engine->sink = sink;
+      engine->ctx = ctx;
+      atomic_init(&engine->evaluated, 0);
+}
+
+size_t rulesDefaults(Rule* rules) {
+      rules[0] = (Rule){ RULE_ABOVE, METRIC_TEMPERATURE, MAX_ALERT_TEMPERATURE };
+      rules[1] = (Rule){ RULE_ABOVE, METRIC_HUMIDITY, MAX_ALERT_HUMIDITY };
+      rules[2] = (Rule){ RULE_BELOW, METRIC_AIR_QUALITY, MIN_ALERT_AIR_QUALITY };
+      return 3;
+}
+
+static bool parseRule(const char* spec, size_t length, Rule* rule) {
+      for(size_t m = 0; m < METRIC_COUNT; m++) {
+            size_t nameLength = strlen(metricNames[m]);
+            if(length <= nameLength + 1 || strncmp(spec, metricNames[m], nameLength) != 0)
+                  continue;
+
+            const char* op = memchr(kindOps, spec[nameLength], sizeof kindOps);
+            if(op == NULL)
+                  return false;
+
+            unsigned threshold = 0;
+            for(size_t i = nameLength + 1; i < length; i++) {
+                  if(spec[i] < '0' || spec[i] > '9')
+                        return false;
+                  threshold = threshold * 10 + (unsigned)(spec[i] - '0');
+                  if(threshold > UINT8_MAX)
+                        return false;
+            }
+
+            rule->kind = (RuleKind)(op - kindOps);
+            rule->metric = (AggregateMetric)m;
+            rule->threshold = (uint8_t)threshold;
+            return true;
+      }
+      return false;
+}
+
+int rulesParse(const char* spec, Rule* rules) {
+      int count = 0;
+
+      while(*spec != '\0') {
+            const char* end = strchr(spec, ',');
+            size_t length = end ? (size_t)(end - spec) : strlen(spec);
+            if(count == RULES_MAX || !parseRule(spec, length, &rules[count]))
+                  return -1;
+            count++;
+            spec += length;
+            if(*spec == ',')
+                  spec++;
+      }
+      return count;
+}
+
+void ruleFormat(const Rule* rule, char* buffer, size_t size) {
+      snprintf(buffer, size, "%s%c%u", metricNames[rule->metric], kindOps[rule->kind], rule->threshold);
+}
+
+const char* ruleMetricName(AggregateMetric metric) {
+      return metricNames[metric];
+}
+
+char ruleOperator(RuleKind kind) {
+      return kindOps[kind];
+}
+
+void ruleSetInit(RuleSet* set) {
+      memset(set, 0, sizeof *set);
+      for(size_t i = 0; i < RULES_MAX; i++)
+            atomic_init(&set->fired[i], 0);
+}
+
+bool ruleSetApply(RuleSet* set, const Rule* rule, uint8_t sensorID) {
+      size_t r = 0;
+      while(r < set->ruleCount && (set->rules[r].kind != rule->kind || set->rules[r].metric != rule->metric))
+            r++;
+
+      if(r == set->ruleCount) {
+            if(r == RULES_MAX)
+                  return false;
+            set->rules[r] = *rule;
+            set->rules[r].threshold = 0;
+            // nothing crosses these until a sensor gets the rule
+            memset(set->thresholds[r], rule->kind == RULE_BELOW ? 0 : UINT8_MAX, sizeof set->thresholds[r]);
+            set->ruleCount++;
+            if(rule->kind == RULE_RATE)
+                  set->hasRate = true;
+      }
+      set->thresholds[r][sensorID] = rule->threshold;
+      return true;
+}
+
+/*
+Sets bit i of mask when reading i breaks the rule: x > limits[i], or
+limits[i] > x for RULE_BELOW, x being the value or, with previous, its
+distance from the previous reading. Bytes are unsigned: flipping the
+sign bit turns the signed compare of SSE2/AVX2 into an unsigned one.
+*/
+static void matchColumn(const uint8_t* values, const uint8_t* previous, const uint8_t* limits, size_t count, bool below, uint64_t* mask) {
+      memset(mask, 0, RULES_CHUNK / 64 * sizeof *mask);
+      size_t i = 0;
+
+#if defined(__AVX2__)
+      const __m256i sign = _mm256_set1_epi8((char)0x80);
+      for(; i + 32 <= count; i += 32) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(values + i));
+            __m256i limit = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(limits + i)), sign);
+            if(previous) {
+                  __m256i p = _mm256_loadu_si256((const __m256i*)(previous + i));
+                  x = _mm256_or_si256(_mm256_subs_epu8(x, p), _mm256_subs_epu8(p, x));
+            }
+            x = _mm256_xor_si256(x, sign);
+            __m256i hit = below ? _mm256_cmpgt_epi8(limit, x) : _mm256_cmpgt_epi8(x, limit);
+            mask[i / 64] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(hit) << (i % 64);
+      }
+#elif defined(__SSE2__)
+      const __m128i sign = _mm_set1_epi8((char)0x80);
+      for(; i + 16 <= count; i += 16) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(values + i));
+            __m128i limit = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(limits + i)), sign);
+            if(previous) {
+                  __m128i p = _mm_loadu_si128((const __m128i*)(previous + i));
+                  x = _mm_or_si128(_mm_subs_epu8(x, p), _mm_subs_epu8(p, x));
+            }
+            x = _mm_xor_si128(x, sign);
+            __m128i hit = below ? _mm_cmplt_epi8(x, limit) : _mm_cmpgt_epi8(x, limit);
+            mask[i / 64] |= (uint64_t)(uint16_t)_mm_movemask_epi8(hit) << (i % 64);
+      }
+#endif
+
+      for(; i < count; i++) {
+            uint8_t x = values[i];
+            if(previous)
+                  x = x > previous[i] ? x - previous[i] : previous[i] - x;
+            if(below ? x < limits[i] : x > limits[i])
+                  mask[i / 64] |= (uint64_t)1 << (i % 64);
+      }
+}
+
+static size_t evaluateChunk(RuleEngine* engine, RuleSet* set, const OutputRecord* records, size_t count) {
+      // transpose into columns
+      for(size_t i = 0; i < count; i++) {
+            engine->ids[i] = records[i].sensorID;
+            engine->values[METRIC_TEMPERATURE][i] = records[i].payload.temperature;
+            engine->values[METRIC_HUMIDITY][i] = records[i].payload.humidity;
+            engine->values[METRIC_AIR_QUALITY][i] = records[i].payload.airQuality;
+      }
+
+      // the previous reading may be earlier in the same chunk: this walk is sequential
+      if(set->hasRate) {
+            for(size_t i = 0; i < count; i++) {
+                  uint8_t id = engine->ids[i];
+                  for(size_t m = 0; m < METRIC_COUNT; m++) {
+                        uint8_t value = engine->values[m][i];
+                        engine->previous[m][i] = engine->seen[id] ? engine->last[m][id] : value;
+                        engine->last[m][id] = value;
+                  }
+                  engine->seen[id] = true;
+            }
+      }
+
+      size_t fired = 0, total = 0;
+      for(size_t r = 0; r < set->ruleCount; r++) {
+            const Rule* rule = &set->rules[r];
+            const uint8_t* values = engine->values[rule->metric];
+            const uint8_t* previous = rule->kind == RULE_RATE ? engine->previous[rule->metric] : NULL;
+            // the one gather of the rule: thresholds of the readings' sensors
+            for(size_t i = 0; i < count; i++)
+                  engine->limits[i] = set->thresholds[r][engine->ids[i]];
+            uint64_t mask[RULES_CHUNK / 64];
+            matchColumn(values, previous, engine->limits, count, rule->kind == RULE_BELOW, mask);
+
+            size_t ruleFired = 0;
+            for(size_t w = 0; w < RULES_CHUNK / 64; w++) {
+                  for(uint64_t bits = mask[w]; bits != 0; bits &= bits - 1) {
+                        size_t i = w * 64 + (size_t)__builtin_ctzll(bits);
+                        RuleEvent* event = &engine->events[fired++];
+                        event->sensorID = engine->ids[i];
+                        event->rule = (uint8_t)r;
+                        event->value = values[i];
+                        event->previous = previous ? previous[i] : 0;
+                        event->timestamp = records[i].payload.timestamp;
+                        ruleFired++;
+
+                        // more events than readings: hand over what is there
+                        if(fired == RULES_CHUNK) {
+                              engine->sink(set, engine->events, fired, engine->ctx);
+                              fired = 0;
+                        }
+                  }
+            }
+            if(ruleFired > 0)
+                  atomic_fetch_add_explicit(&set->fired[r], ruleFired, memory_order_relaxed);
+            total += ruleFired;
+      }
+
+      if(fired > 0)
+            engine->sink(set, engine->events, fired, engine->ctx);
+      return total;
+}
+
+size_t rulesEvaluate(RuleEngine* engine, RuleSet* set, const OutputRecord* records, size_t count) {
+      size_t fired = 0;
+
+      for(size_t done = 0; done < count; done += RULES_CHUNK) {
+            size_t chunk = count - done < RULES_CHUNK ? count - done : RULES_CHUNK;
+            fired += evaluateChunk(engine, set, records + done, chunk);
+      }
+      atomic_fetch_add_explicit(&engine->evaluated, count, memory_order_relaxed);
+      return fired;
+}
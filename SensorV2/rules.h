@@ -0,0 +1,113 @@
+#ifndef RULES_H
+
+#define RULES_H
+#define RULES_MAX 32
+// readings evaluated together, the columns of one chunk stay in L1
+#define RULES_CHUNK 256
+#define RULE_NAME_MAX 32
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "protocol.h"
+#include "output.h"
+#include "aggregate.h"
+
+typedef enum RuleKindTag {
+      RULE_ABOVE,       // value > threshold
+      RULE_BELOW,       // value < threshold
+      RULE_RATE         // |value - previous reading of the sensor| > threshold
+} RuleKind;
+
+typedef struct RuleTag {
+      RuleKind kind;
+      AggregateMetric metric;
+      uint8_t threshold;
+} Rule;
+
+typedef struct RuleEventTag {
+      uint8_t sensorID;
+      uint8_t rule;           // index in the rule set
+      uint8_t value;
+      uint8_t previous;       // RULE_RATE only
+      time_t timestamp;
+} RuleEvent;
+
+/*
+The rules to evaluate, each with a threshold by sensor: sensors of
+different groups share the rule and compare against their own limit.
+A sensor a rule does not apply to gets a limit nothing crosses (255,
+or 0 for RULE_BELOW). The threshold of rules[] itself is unused.
+*/
+typedef struct RuleSetTag {
+      Rule rules[RULES_MAX];
+      size_t ruleCount;
+      bool hasRate;
+      uint8_t thresholds[RULES_MAX][MAX_SENSORS + 1];
+      atomic_uint_fast64_t fired[RULES_MAX];  // since the set was built
+} RuleSet;
+
+/*
+Receives the events of a batch rule by rule, in reading order for each
+rule, at most RULES_CHUNK at a time.
+*/
+typedef void (*RuleSink)(const RuleSet* set, const RuleEvent* events, size_t count, void* ctx);
+
+/*
+Server side alert rules, evaluated on every reading whatever the sensor
+reports. A batch is transposed into one byte column per metric and each
+rule compares a whole column at once against the column of thresholds
+of the readings' sensors (SSE2/AVX2 when the target has them),
+producing a bitmask of the readings that break it: a clean batch costs
+a few vector compares per rule and no branch per reading.
+Only one thread may evaluate.
+*/
+typedef struct RuleEngineTag {
+      RuleSink sink;
+      void* ctx;
+      // last value of every metric by sensor, for the rate rules
+      bool seen[MAX_SENSORS + 1];
+      uint8_t last[METRIC_COUNT][MAX_SENSORS + 1];
+      // columns of the chunk being evaluated
+      uint8_t ids[RULES_CHUNK];
+      uint8_t values[METRIC_COUNT][RULES_CHUNK];
+      uint8_t previous[METRIC_COUNT][RULES_CHUNK];
+      uint8_t limits[RULES_CHUNK];
+      RuleEvent events[RULES_CHUNK];
+      atomic_uint_fast64_t evaluated;
+} RuleEngine;
+
+void rulesInit(RuleEngine* engine, RuleSink sink, void* ctx);
+/*
+The thresholds the sensors check themselves (MAX_ALERT_* and
+MIN_ALERT_AIR_QUALITY in protocol.h), returns how many rules.
+*/
+size_t rulesDefaults(Rule* rules);
+/*
+Parses a comma separated list of <metric><op><threshold>, metric being
+temperature, humidity or airquality and op > (above), < (below) or
+~ (rate of change), e.g. "temperature>50,humidity~20", into rules
+(RULES_MAX long). Returns how many, -1 on a malformed list.
+*/
+int rulesParse(const char* spec, Rule* rules);
+void ruleFormat(const Rule* rule, char* buffer, size_t size);
+const char* ruleMetricName(AggregateMetric metric);
+char ruleOperator(RuleKind kind);
+
+void ruleSetInit(RuleSet* set);
+/*
+Applies rule, with its threshold, to sensorID: the rule of the same
+kind and metric is added to the set the first time. False when the set
+is full.
+*/
+bool ruleSetApply(RuleSet* set, const Rule* rule, uint8_t sensorID);
+/*
+Checks every rule of set against every reading and hands what fired to
+the sink, counting them in set. Returns how many events fired.
+*/
+size_t rulesEvaluate(RuleEngine* engine, RuleSet* set, const OutputRecord* records, size_t count);
+
+#endif
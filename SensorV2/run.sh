@@ -0,0 +1,4 @@
+gcc -o client client.c sensor.c wire.c
+gcc -o server server.c ingest.c timerwheel.c registry.c epoch.c output.c tsstore.c aggregate.c rules.c config.c wire.c sequence.c ../Common/spsc.c ../Common/textbuf.c ../Common/netio.c ../Common/metrics.c ../Common/pool.c
+gcc -o history history.c tsstore.c ../Common/spsc.c ../Common/textbuf.c
+gcc -o loadgen loadgen.c sensor.c wire.c
@@ -18,4 +18,10 @@ SensorPayload createRandomPayload() {
             rand() % MAX_HUMIDITY,             
             (rand() % MAX_AIR_QUALITY)                      
       );
+}
+
+bool alert(const SensorPayload* p) {
+      return p->temperature > MAX_ALERT_TEMPERATURE 
+          || p->humidity > MAX_ALERT_HUMIDITY 
+          || p->airQuality < MIN_ALERT_AIR_QUALITY;
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "sequence.h"
+
+// single writer: a plain load and store, no locked instruction
+static void bump(atomic_uint_fast64_t* counter, uint64_t amount) {
+      uint64_t value = atomic_load_explicit(counter, memory_order_relaxed);
+      atomic_store_explicit(counter, value + amount, memory_order_relaxed);
+}
+
+void sequenceInit(SequenceTracker* tracker) {
+      tracker->started = false;
+      tracker->highest = 0;
+      tracker->window = 0;
+      atomic_init(&tracker->received, 0);
+      atomic_init(&tracker->lost, 0);
+      atomic_init(&tracker->duplicates, 0);
+      atomic_init(&tracker->reordered, 0);
+      atomic_init(&tracker->late, 0);
+      atomic_init(&tracker->restarts, 0);
+      atomic_init(&tracker->maxReorderDepth, 0);
+}
+
+void sequenceReset(SequenceTracker* tracker) {
+      tracker->started = false;
+      tracker->highest = 0;
+      tracker->window = 0;
+      atomic_store_explicit(&tracker->received, 0, memory_order_relaxed);
+      atomic_store_explicit(&tracker->lost, 0, memory_order_relaxed);
+      atomic_store_explicit(&tracker->duplicates, 0, memory_order_relaxed);
+      atomic_store_explicit(&tracker->reordered, 0, memory_order_relaxed);
+      atomic_store_explicit(&tracker->late, 0, memory_order_relaxed);
+      atomic_store_explicit(&tracker->restarts, 0, memory_order_relaxed);
+      atomic_store_explicit(&tracker->maxReorderDepth, 0, memory_order_relaxed);
+}
+
+static void restart(SequenceTracker* tracker, uint32_t sequence) {
+      tracker->highest = sequence;
+      // nothing before the first sequence number is missing
+      tracker->window = UINT64_MAX;
+}
+
+void sequenceTrack(SequenceTracker* tracker, uint32_t sequence) {
+      if(!tracker->started) {
+            tracker->started = true;
+            restart(tracker, sequence);
+            bump(&tracker->received, 1);
+            return;
+      }
+
+      // signed distance, so the numbering may wrap around
+      int32_t distance = (int32_t)(sequence - tracker->highest);
+      if(distance > SEQUENCE_RESYNC || distance < -SEQUENCE_RESYNC) {
+            restart(tracker, sequence);
+            bump(&tracker->restarts, 1);
+            bump(&tracker->received, 1);
+            return;
+      }
+
+      if(distance > 0) {
+            uint64_t lost;
+            if(distance >= SEQUENCE_WINDOW) {
+                  lost = (SEQUENCE_WINDOW - __builtin_popcountll(tracker->window)) + (distance - SEQUENCE_WINDOW);
+                  tracker->window = 1;
+            } else {
+                  // the oldest distance slots leave the window, their holes are final
+                  uint64_t leaving = tracker->window >> (SEQUENCE_WINDOW - distance);
+                  lost = distance - __builtin_popcountll(leaving);
+                  tracker->window = (tracker->window << distance) | 1;
+            }
+            tracker->highest = sequence;
+            if(lost > 0)
+                  bump(&tracker->lost, lost);
+            bump(&tracker->received, 1);
+            return;
+      }
+
+      unsigned depth = (unsigned)-distance;
+      if(depth >= SEQUENCE_WINDOW) {
+            bump(&tracker->late, 1);
+            return;
+      }
+
+      uint64_t bit = (uint64_t)1 << depth;
+      if(tracker->window & bit) {
+            bump(&tracker->duplicates, 1);
+            return;
+      }
+
+      tracker->window |= bit;
+      bump(&tracker->reordered, 1);
+      bump(&tracker->received, 1);
+      if(depth > atomic_load_explicit(&tracker->maxReorderDepth, memory_order_relaxed))
+            atomic_store_explicit(&tracker->maxReorderDepth, depth, memory_order_relaxed);
+}
+
+void sequenceStats(const SequenceTracker* tracker, SequenceStats* stats) {
+      stats->received = atomic_load_explicit(&tracker->received, memory_order_relaxed);
+      stats->lost = atomic_load_explicit(&tracker->lost, memory_order_relaxed);
+      stats->duplicates = atomic_load_explicit(&tracker->duplicates, memory_order_relaxed);
+      stats->reordered = atomic_load_explicit(&tracker->reordered, memory_order_relaxed);
+      stats->late = atomic_load_explicit(&tracker->late, memory_order_relaxed);
+      stats->restarts = atomic_load_explicit(&tracker->restarts, memory_order_relaxed);
+      stats->maxReorderDepth = atomic_load_explicit(&tracker->maxReorderDepth, memory_order_relaxed);
+
+      uint64_t expected = stats->lost + stats->received;
+      stats->lossRate = expected > 0 ? (double)stats->lost / expected : 0.0;
+}
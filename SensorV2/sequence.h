@@ -0,0 +1,52 @@
+#ifndef SEQUENCE_H
+
+#define SEQUENCE_H
+#define SEQUENCE_WINDOW 64
+// a jump this big either way means the sender restarted its numbering
+#define SEQUENCE_RESYNC 4096
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/*
+Per sender sequence tracking over a sliding bitmap: bit i of window
+says whether highest - i arrived. A hole becomes a loss only when it
+slides out of the window, so reordering up to SEQUENCE_WINDOW deep is
+not mistaken for loss. One thread tracks, any thread may read the
+counters.
+*/
+typedef struct SequenceTrackerTag {
+      bool started;
+      uint32_t highest;
+      uint64_t window;
+      atomic_uint_fast64_t received;
+      atomic_uint_fast64_t lost;
+      atomic_uint_fast64_t duplicates;
+      atomic_uint_fast64_t reordered;
+      atomic_uint_fast64_t late;          // arrived after being counted as lost
+      atomic_uint_fast64_t restarts;
+      atomic_uint maxReorderDepth;
+} SequenceTracker;
+
+typedef struct SequenceStatsTag {
+      uint64_t received;
+      uint64_t lost;
+      uint64_t duplicates;
+      uint64_t reordered;
+      uint64_t late;
+      uint64_t restarts;
+      unsigned maxReorderDepth;
+      double lossRate;        // lost / (lost + received)
+} SequenceStats;
+
+void sequenceInit(SequenceTracker* tracker);
+/*
+Forgets everything tracked, for a new sender, while other threads may
+be reading the counters.
+*/
+void sequenceReset(SequenceTracker* tracker);
+void sequenceTrack(SequenceTracker* tracker, uint32_t sequence);
+void sequenceStats(const SequenceTracker* tracker, SequenceStats* stats);
+
+#endif
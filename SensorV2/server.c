@@ -9,78 +9,296 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <signal.h>
 
 #include "protocol.h"
-
-typedef struct ActiveSensorsTag {
-      const Sensor* sensors[MAX_SENSORS];
-      size_t currentActive;
-      pthread_mutex_t mutex;
-} ActiveSensors;
-
+#include "wire.h"
+#include "ingest.h"
+#include "timerwheel.h"
+#include "registry.h"
+#include "output.h"
+#include "tsstore.h"
+#include "aggregate.h"
+#include "sequence.h"
+#include "rules.h"
+#include "config.h"
+#include "epoch.h"
+#include "../Common/netio.h"
+#include "../Common/metrics.h"
+#include "../Common/pool.h"
+
+#define SEQUENCE_REPORT_TIME 60 // seconds
+#define CONTROL_EVENTS 64
+// receive chunk of the control connections, a few frames
+#define CONTROL_BUFFER 256
+#define USAGE "[store directory] [uring|epoll|auto] [config file]"
+
+/*
+One entry per sensor ID: a new alert from a sensor that is already
+waiting reschedules its timer instead of piling up another one.
+*/
 typedef struct ReactivationSensorInfoTag {
       SensorAlert alert;
-      int sensorSocketFD;
+      int sensorSocketFD;     // -1 when no reactivation is pending
+      bool onChannel;         // sensorSocketFD is the control channel, which stays open
+      uint64_t deadline;      // metricsNow() the reactivation is due at
+      Timer timer;
 } ReactivationSensorInfo;
 
-ActiveSensors activeSensorList;
+/*
+The control channel of a registered sensor, by ID. Every frame from the
+sensor reschedules the heartbeat timer, which removes the sensor from
+the registry when it fires.
+*/
+typedef struct SensorChannelTag {
+      int socketFD;           // -1 when the sensor has no channel
+      Timer heartbeat;
+} SensorChannel;
+
+/*
+A connection of the control thread: a one-shot registration or alert
+until its whole message is in, or a control channel for as long as the
+sensor keeps it open.
+*/
+typedef struct ControlConnectionTag {
+      int socketFD;
+      int listenerFD;         // connectionSocketFD, errorSocketFD or channelSocketFD
+      struct sockaddr_in addr;
+      uint8_t wire[CONTROL_FRAME_HEADER_WIRE_SIZE + CONTROL_PAYLOAD_MAX];
+      size_t expected;        // one-shot connections: size of their message
+      size_t received;
+      int sensorID;           // channels: -1 until the sensor registers
+      bool finished;          // freed at the end of the round
+} ControlConnection;
+
+IngestEngine ingestEngine;
+OutputStage outputStage;
+// the control thread alone allocates and frees connections
+Pool connectionPool = POOL_OF(ControlConnection);
+TimeSeriesStore store;
+AggregateEngine aggregates;
+RuleEngine rules;
+// reloaded on SIGHUP
+const char* configPath;
+Metric* alertMetric;
+Metric* ruleEventMetric;
+Metric* reactivationLagMetric;
+TimerWheel reactivationWheel;
+Timer sequenceReportTimer;
+ReactivationSensorInfo reactivations[UINT8_MAX + 1];
+SensorChannel channels[UINT8_MAX + 1];
+// reactivations and channels, shared by the control and the wheel thread
+pthread_mutex_t controlMutex = PTHREAD_MUTEX_INITIALIZER;
 int connectionSocketFD;
 int sendSocketFD;
 int errorSocketFD;
+int channelSocketFD;
+NetIOBackend backend = NETIO_AUTO;
 
-void initList();
+void initReactivations();
+/*
+Registers the server metrics; the ingest engine has its own.
+*/
+void initMetrics();
 int createTCPServer(uint16_t port);
-int createUDPServer(uint16_t port);
-bool addToList(const Sensor* newSensor);
+/*
+receiveBuffer sizes SO_RCVBUF, 0 keeps the system default.
+*/
+int createUDPServer(uint16_t port, int receiveBuffer);
 
-/* 
-This thread routine receive new connection, then it adds the sensor 
-to the list of active sensors
+/*
+This thread routine serves every TCP listener with a single NetIO: it
+accepts one-shot registrations and alerts and collects their messages,
+however they are split, and reads the frames of the control channels.
+*/
+void* handleControl(void* arg);
+/*
+Completes a one-shot registration or alert with the bytes received.
+*/
+void receiveMessage(NetIO* io, ControlConnection* conn, const uint8_t* data, size_t length);
+/*
+Splits the bytes received on a channel into frames and handles each,
+keeping a partial frame for the next chunk.
+*/
+void receiveFrames(NetIO* io, ControlConnection* conn, const uint8_t* data, size_t length);
+/*
+Returns false on a protocol error: the channel has to be closed.
+*/
+bool handleFrame(ControlConnection* conn, const ControlFrameHeader* header, const uint8_t* payload);
+/*
+Binds the channel to the sensor it registered, replacing an older
+channel of the same ID.
 */
-void* handleNewConnections(void* arg);
+void attachChannel(ControlConnection* conn, uint8_t id);
+/*
+Unbinds a closing channel: its sensor leaves the registry and its
+pending reactivation is dropped.
+*/
+void detachChannel(ControlConnection* conn);
+void closeConnection(NetIO* io, ControlConnection* conn);
+/*
+Adds the sensor announced in wire to the registry of active sensors,
+its host taken from the connection address. Only a gateway may send
+readings of other sensors.
+*/
+bool registerSensor(const struct sockaddr_in* addr, const uint8_t* wire, bool gateway);
 /* 
-This thread routine receives data and print it. 
+This routine receives a batch of decoded readings from the ingest
+engine, updates the rolling stats of each sensor and hands the batch to
+the output stage (ctx) for printing and to the on-disk store.
 */
-void* handleSensor(void* arg);
+void handleSensor(const IngestRecord* records, size_t count, void* ctx);
+/*
+Rule sink: prints the rules that fired, at most one line per sensor and
+second of readings; the lines held back are counted in the next one.
+*/
+void handleRuleEvents(const RuleSet* set, const RuleEvent* events, size_t count, void* ctx);
 /* 
-This thread routine wait for any errors from sensor, then it starts
-a certain amount of time (defined in protocol.h) and reboot the sensor
+This routine takes an alert connection (or a reference to the channel)
+over, then it schedules the reboot of the sensor after a certain amount
+of time (defined in protocol.h)
 */
-void* handleErrors(void* arg);
-
-void* rebootSensor(void* arg);
+void handleAlert(const SensorAlert* alertMsg, int clientFD, bool onChannel);
+/*
+Timer callback: sends REACTIVATE on the alert connection and closes it,
+or as a frame on the control channel.
+*/
+void rebootSensor(Timer* timer, void* arg);
+/*
+Timer callback: the channel went silent, its sensor is removed and the
+channel shut down; the control thread then closes it.
+*/
+void heartbeatExpired(Timer* timer, void* arg);
+/*
+This thread routine waits for SIGHUP and publishes the configuration
+file again; the ports only change with a restart. SIGINT and SIGTERM
+make it return, for main to shut the server down.
+*/
+void* handleReload(void* arg);
+/*
+Timer callback: prints loss, reordering and duplicates of every sensor
+heard from since the last report, then reschedules itself.
+*/
+void reportSequences(Timer* timer, void* arg);
 
 int main(int argc, char** argv) {
-      initList();
+      if(argc > 4 || (argc >= 3 && !netioParseBackend(argv[2], &backend))) {
+            fprintf(stderr, "Usage: %s %s\n", argv[0], USAGE);
+            exit(EXIT_FAILURE);
+      }
 
-      if((connectionSocketFD = createTCPServer(CONNECTION_PORT)) == -1)
-            exit(EXIT_FAILURE);   
-      if((sendSocketFD = createUDPServer(SEND_PORT)) == -1) 
+      configPath = argc == 4 ? argv[3] : NULL;
+      Config* config = configPath ? configLoad(configPath) : configDefault();
+      if(!config)
             exit(EXIT_FAILURE);
-      if((errorSocketFD = createTCPServer(ALERT_PORT)) == -1)
+      configPublish(config);
+      rulesInit(&rules, handleRuleEvents, NULL);
+
+      // every thread inherits the mask: only the reload thread takes them
+      sigset_t reloadSignals;
+      sigemptyset(&reloadSignals);
+      sigaddset(&reloadSignals, SIGHUP);
+      sigaddset(&reloadSignals, SIGINT);
+      sigaddset(&reloadSignals, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &reloadSignals, NULL);
+
+      if(!registryInit())
             exit(EXIT_FAILURE);
+      initReactivations();
+      aggregateInit(&aggregates);
 
-      pthread_t handleConnectionThread, alertsThread;
-      pthread_create(&handleConnectionThread, NULL, handleNewConnections, NULL);
-      pthread_create(&alertsThread, NULL, handleErrors, NULL);
-      pthread_join(handleConnectionThread, NULL);
-      pthread_join(alertsThread, NULL);
+      if((connectionSocketFD = createTCPServer(config->connectionPort)) == -1)
+            exit(EXIT_FAILURE);   
+      if((sendSocketFD = createUDPServer(config->sendPort, config->receiveBuffer)) == -1) 
+            exit(EXIT_FAILURE);
+      if((errorSocketFD = createTCPServer(config->alertPort)) == -1)
+            exit(EXIT_FAILURE);
+      if((channelSocketFD = createTCPServer(config->controlPort)) == -1)
+            exit(EXIT_FAILURE);
 
-      close(connectionSocketFD);
-      close(sendSocketFD);
-      close(errorSocketFD);
+      if(!outputInit(&outputStage, STDOUT_FILENO))
+            exit(EXIT_FAILURE);
+      if(!storeOpen(&store, argc >= 2 ? argv[1] : STORE_DEFAULT_ROOT))
+            exit(EXIT_FAILURE);
+      initMetrics();
+      if(config->metricsPort != 0 && !metricsServe(config->metricsPort))
+            exit(EXIT_FAILURE);
+      if(!ingestInit(
+            &ingestEngine,
+            sendSocketFD,
+            INGEST_DEFAULT_BATCH,
+            registryFindByAddress,
+            registryFindByID,
+            handleSensor,
+            &outputStage
+      ))
+            exit(EXIT_FAILURE);
+      ingestEngine.backend = backend;
+
+      timerInit(&sequenceReportTimer, reportSequences, NULL);
+      wheelSchedule(&reactivationWheel, &sequenceReportTimer, SEQUENCE_REPORT_TIME * 1000);
+
+      pthread_t controlThread, ingestThread, wheelThread, outputThread, storeThread, reloadThread;
+      pthread_create(&reloadThread, NULL, handleReload, &reloadSignals);
+      pthread_create(&controlThread, NULL, handleControl, NULL);
+      pthread_create(&outputThread, NULL, outputLoop, &outputStage);
+      pthread_create(&storeThread, NULL, storeLoop, &store);
+      pthread_create(&ingestThread, NULL, ingestLoop, &ingestEngine);
+      pthread_create(&wheelThread, NULL, wheelRun, &reactivationWheel);
+      pthread_join(reloadThread, NULL);
+
+      // readings flow ingest -> output and store: each stage stops once the
+      // one feeding it is gone, so whatever was received reaches the disk
+      ingestStop(&ingestEngine);
+      pthread_join(ingestThread, NULL);
+      outputStop(&outputStage);
+      storeStop(&store);
+      pthread_join(outputThread, NULL);
+      pthread_join(storeThread, NULL);
+      storeClose(&store);
+
+      // exit ends the control and wheel threads: the sensors they still
+      // have registered are in use, not leaked
+      printf("Shutting down, %zu sensors registered\n", registryCount());
+      fflush(stdout);
+      poolReport(stderr);
       exit(EXIT_SUCCESS);
 }
 
-void initList() {
-      activeSensorList.currentActive = 0;
-      if(pthread_mutex_init(&activeSensorList.mutex, NULL)) {
-            perror("Mutex failed");
+void initReactivations() {
+      if(!wheelInit(&reactivationWheel, WHEEL_DEFAULT_TICK_MS))
             exit(EXIT_FAILURE);
+
+      for(size_t i = 0; i <= UINT8_MAX; i++) {
+            reactivations[i].sensorSocketFD = -1;
+            timerInit(&reactivations[i].timer, rebootSensor, &reactivations[i]);
+            channels[i].socketFD = -1;
+            timerInit(&channels[i].heartbeat, heartbeatExpired, &channels[i]);
       }
+}
+
+static uint64_t readActiveSensors(void* ctx) {
+      return registryCount();
+}
+
+static uint64_t readQueueDepth(void* ctx) {
+      return spscSize((SpscQueue*)ctx);
+}
+
+static uint64_t readDropped(void* ctx) {
+      return atomic_load_explicit((atomic_uint_fast64_t*)ctx, memory_order_relaxed);
+}
 
-      for(size_t i = 0; i < MAX_SENSORS; i++)
-            activeSensorList.sensors[i] = NULL;
+void initMetrics() {
+      alertMetric = metricsCounter("sensorv2_alerts_total", "Alerts received from the sensors.");
+      ruleEventMetric = metricsCounter("sensorv2_rule_events_total", "Readings that broke a server side rule.");
+      reactivationLagMetric = metricsHistogram("sensorv2_reactivation_lag_us", "Delay of a reactivation past its due time, microseconds.");
+      metricsGauge("sensorv2_active_sensors", "Sensors in the registry.", readActiveSensors, NULL);
+      metricsGauge("sensorv2_output_queue_depth", "Readings waiting for the output thread.", readQueueDepth, &outputStage.queue);
+      metricsGauge("sensorv2_store_queue_depth", "Readings waiting for the store thread.", readQueueDepth, &store.queue);
+      metricsCounterFn("sensorv2_output_dropped_total", "Readings lost to a full output queue.", readDropped, &outputStage.dropped);
+      metricsCounterFn("sensorv2_store_dropped_total", "Readings lost to a full store queue.", readDropped, &store.dropped);
 }
 
 int createTCPServer(uint16_t port) {
@@ -92,6 +310,10 @@ int createTCPServer(uint16_t port) {
             return -1;
       }
 
+      // registrations are closed by us, allow restarts with connections in TIME_WAIT
+      int reuse = 1;
+      setsockopt(socketFD, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+
       memset(&addr, 0, sizeof(addr));
       addr.sin_family = AF_INET;
       addr.sin_port = htons(port);
@@ -112,7 +334,7 @@ int createTCPServer(uint16_t port) {
       return socketFD;
 }
 
-int createUDPServer(uint16_t port) {
+int createUDPServer(uint16_t port, int receiveBuffer) {
       int socketFD;
       struct sockaddr_in addr;
       
@@ -121,6 +343,18 @@ int createUDPServer(uint16_t port) {
             return -1;
       }
 
+      if(receiveBuffer > 0) {
+            // SO_RCVBUF is capped by net.core.rmem_max, the FORCE variant needs CAP_NET_ADMIN
+            if(setsockopt(socketFD, SOL_SOCKET, SO_RCVBUFFORCE, &receiveBuffer, sizeof receiveBuffer) < 0
+                  && setsockopt(socketFD, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof receiveBuffer) < 0)
+                  perror("Receive buffer setting failed");
+
+            int effective;
+            socklen_t length = sizeof effective;
+            if(getsockopt(socketFD, SOL_SOCKET, SO_RCVBUF, &effective, &length) == 0)
+                  printf("Receive buffer: %d bytes\n", effective);
+      }
+
       memset(&addr, 0, sizeof(addr));
       addr.sin_family = AF_INET;
       addr.sin_port = htons(port);
@@ -134,185 +368,487 @@ int createUDPServer(uint16_t port) {
       return socketFD;
 }
 
-bool addToList(const Sensor* newSensor) {
-      pthread_mutex_lock(&activeSensorList.mutex);
-      if(activeSensorList.currentActive == MAX_SENSORS) {
-            pthread_mutex_unlock(&activeSensorList.mutex);
-            return false;
+void* handleControl(void* arg) {
+      NetIO io;
+      if(!netioInit(&io, backend, CONTROL_BUFFER, NETIO_DEFAULT_BUFFERS))
+            return NULL;
+      if(!netioAccept(&io, connectionSocketFD, NULL)
+            || !netioAccept(&io, errorSocketFD, NULL)
+            || !netioAccept(&io, channelSocketFD, NULL)) {
+            fprintf(stderr, "Accept failed to start\n");
+            netioDestroy(&io);
+            return NULL;
       }
-      for(size_t i = 0; i < MAX_SENSORS; i++) {
-            if(activeSensorList.sensors[i] == NULL) {
-                  activeSensorList.sensors[i] = newSensor;
-                  activeSensorList.currentActive++;
+      printf("Control connections on %s\n", netioBackendName(&io));
+
+      NetIOEvent events[CONTROL_EVENTS];
+      // every event finishes at most one connection
+      ControlConnection* finished[CONTROL_EVENTS];
+      while(true) {
+            int ready = netioWait(&io, events, CONTROL_EVENTS, -1);
+            if(ready < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  perror("Wait failed");
                   break;
             }
+
+            size_t finishedCount = 0;
+            for(int i = 0; i < ready; i++) {
+                  NetIOEvent* event = &events[i];
+
+                  if(event->kind == NETIO_ACCEPT) {
+                        if(event->result < 0) {
+                              errno = -event->result;
+                              perror("Accept failed");
+                              continue;
+                        }
+
+                        ControlConnection* conn = POOL_NEW(&connectionPool, ControlConnection);
+                        if(!conn) {
+                              perror("Memory allocation failed");
+                              close(event->result);
+                              continue;
+                        }
+                        conn->socketFD = event->result;
+                        conn->listenerFD = event->fd;
+                        conn->addr = event->peer;
+                        conn->expected = event->fd == connectionSocketFD ? SENSOR_WIRE_SIZE
+                              : event->fd == errorSocketFD ? SENSOR_ALERT_WIRE_SIZE : 0;
+                        conn->received = 0;
+                        conn->sensorID = -1;
+                        conn->finished = false;
+                        if(!netioRecv(&io, conn->socketFD, conn)) {
+                              fprintf(stderr, "Receive failed to start\n");
+                              close(conn->socketFD);
+                              poolFree(&connectionPool, conn);
+                        }
+                        continue;
+                  }
+
+                  // a chunk and the end of the stream may come in the same round
+                  ControlConnection* conn = event->ctx;
+                  if(conn->finished)
+                        continue;
+
+                  if(event->result <= 0) {
+                        if(event->result < 0) {
+                              errno = -event->result;
+                              perror("Receive failed");
+                        } else if(conn->expected > 0) {
+                              fprintf(stderr, "Expected %zu bytes, got %zu\n", conn->expected, conn->received);
+                        }
+                        closeConnection(&io, conn);
+                  } else if(conn->listenerFD == channelSocketFD) {
+                        receiveFrames(&io, conn, event->data, (size_t)event->result);
+                  } else {
+                        receiveMessage(&io, conn, event->data, (size_t)event->result);
+                  }
+
+                  if(conn->finished)
+                        finished[finishedCount++] = conn;
+            }
+
+            for(size_t i = 0; i < finishedCount; i++)
+                  poolFree(&connectionPool, finished[i]);
       }
-      pthread_mutex_unlock(&activeSensorList.mutex);
-      return true;
+
+      netioDestroy(&io);
+      return NULL;
 }
 
-void* handleNewConnections(void* arg) {
-      while(true) {
-            struct sockaddr_in sensorAddr;
-            socklen_t addrlen = sizeof(sensorAddr);
-
-            int clientFD = accept(
-                  connectionSocketFD,
-                  (struct sockaddr*)&sensorAddr,
-                  &addrlen
-            );
-            if(clientFD < 0) {
-                  perror("Accept failed");
-                  continue;
+void receiveMessage(NetIO* io, ControlConnection* conn, const uint8_t* data, size_t length) {
+      if(length > conn->expected - conn->received)
+            length = conn->expected - conn->received;
+      memcpy(conn->wire + conn->received, data, length);
+      conn->received += length;
+      if(conn->received < conn->expected)
+            return;
+
+      netioCancel(io, conn->socketFD);
+      conn->finished = true;
+      if(conn->listenerFD == connectionSocketFD) {
+            registerSensor(&conn->addr, conn->wire, false);
+            close(conn->socketFD);
+            return;
+      }
+
+      SensorAlert alertMsg;
+      sensorAlertDecode(&alertMsg, conn->wire);
+      if(alertMsg.type != ALERT) {
+            close(conn->socketFD);
+            return;
+      }
+      handleAlert(&alertMsg, conn->socketFD, false);
+}
+
+void receiveFrames(NetIO* io, ControlConnection* conn, const uint8_t* data, size_t length) {
+      ControlFrameHeader header;
+
+      while(length > 0) {
+            // the header first, then as much payload as it announces
+            size_t needed = CONTROL_FRAME_HEADER_WIRE_SIZE;
+            if(conn->received >= CONTROL_FRAME_HEADER_WIRE_SIZE) {
+                  controlFrameHeaderDecode(&header, conn->wire);
+                  needed += header.length;
             }
 
-            Sensor* newSensor = malloc(sizeof* newSensor);
-            if(!newSensor) {
-                  perror("Memory allocation failed");
-                  close(clientFD);
-                  continue;
+            size_t n = needed - conn->received < length ? needed - conn->received : length;
+            memcpy(conn->wire + conn->received, data, n);
+            conn->received += n;
+            data += n;
+            length -= n;
+            if(conn->received < needed)
+                  return;
+
+            controlFrameHeaderDecode(&header, conn->wire);
+            if(header.length > CONTROL_PAYLOAD_MAX) {
+                  fprintf(stderr, "Control frame of %u bytes, closing the channel\n", header.length);
+                  closeConnection(io, conn);
+                  return;
             }
-            ssize_t n = recv(clientFD, newSensor, sizeof* newSensor, 0);
-            if(n <= 0) {
-                  perror("Received failed");
-                  close(clientFD);
-                  continue;
-            } 
-            if(n != sizeof *newSensor) {
-                  fprintf(stderr, "Expected %zu bytes, got %zd\n", sizeof *newSensor, n);
-                  free(newSensor);
-                  close(clientFD);
+            if(needed == CONTROL_FRAME_HEADER_WIRE_SIZE && header.length > 0)
                   continue;
+
+            conn->received = 0;
+            if(!handleFrame(conn, &header, conn->wire + CONTROL_FRAME_HEADER_WIRE_SIZE)) {
+                  closeConnection(io, conn);
+                  return;
             }
+      }
+}
 
+bool handleFrame(ControlConnection* conn, const ControlFrameHeader* header, const uint8_t* payload) {
+      // any frame proves the sensor alive
+      if(conn->sensorID >= 0) {
+            SensorChannel* channel = &channels[conn->sensorID];
+            pthread_mutex_lock(&controlMutex);
+            if(channel->socketFD == conn->socketFD)
+                  wheelSchedule(&reactivationWheel, &channel->heartbeat, HEARTBEAT_TIMEOUT * 1000);
+            pthread_mutex_unlock(&controlMutex);
+      }
 
-            // store the client's address inside newSensor.addr:
-            newSensor->addr = sensorAddr;
-            if(!addToList(newSensor)) {
-                  fprintf(stderr, "Adding sensor failed\n");
-                  close(clientFD);
-                  continue;
+      switch(header->type) {
+            case CONTROL_REGISTER:
+            case CONTROL_REGISTER_GATEWAY: {
+                  if(header->length != SENSOR_WIRE_SIZE)
+                        break;
+                  if(!registerSensor(&conn->addr, payload, header->type == CONTROL_REGISTER_GATEWAY))
+                        return false;
+                  attachChannel(conn, payload[0]);
+                  return true;
             }
-
-            pthread_t tid;
-            if(pthread_create(&tid, NULL, handleSensor, newSensor) == 0) {
-                  pthread_detach(tid);
-            } else {
-                  perror("Thread creation failed");
-                  close(clientFD);
+            case CONTROL_HEARTBEAT:
+                  return true;
+            case CONTROL_ALERT: {
+                  if(header->length != SENSOR_ALERT_WIRE_SIZE || conn->sensorID < 0)
+                        break;
+                  SensorAlert alertMsg;
+                  sensorAlertDecode(&alertMsg, payload);
+                  // the channel tells who the sensor is, whatever the alert says
+                  alertMsg.sensor.id = (uint8_t)conn->sensorID;
+                  handleAlert(&alertMsg, conn->socketFD, true);
+                  return true;
             }
       }
 
-      return NULL;
+      fprintf(stderr, "Unexpected control frame %u (%u bytes), closing the channel\n", header->type, header->length);
+      return false;
 }
 
-void* handleSensor(void* arg) {
-      Sensor* sensor = (Sensor*)arg;
-      socklen_t addrLen = sizeof(sensor->addr);
-      while(true) {
-            SensorPayload payload;
-            ssize_t bytesReceived = recvfrom(
-                  sendSocketFD, 
-                  &payload, 
-                  sizeof(SensorPayload), 
-                  0, 
-                  (struct sockaddr*)&sensor->addr, 
-                  &addrLen
-            );
-
-            // no partial message allowed
-            if(bytesReceived != sizeof(SensorPayload))
-                  continue;
+void attachChannel(ControlConnection* conn, uint8_t id) {
+      // registering again under another ID leaves the old one
+      if(conn->sensorID >= 0 && conn->sensorID != id)
+            detachChannel(conn);
+
+      SensorChannel* channel = &channels[id];
+      pthread_mutex_lock(&controlMutex);
+      // a sensor reconnecting: the old channel only ends, the sensor stays
+      if(channel->socketFD != -1 && channel->socketFD != conn->socketFD)
+            shutdown(channel->socketFD, SHUT_RDWR);
+      channel->socketFD = conn->socketFD;
+      wheelSchedule(&reactivationWheel, &channel->heartbeat, HEARTBEAT_TIMEOUT * 1000);
+      pthread_mutex_unlock(&controlMutex);
+
+      conn->sensorID = id;
+}
 
-            char timeBuffer[128];
-            struct tm* timeinfo = localtime(&payload.timestamp);
-            strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", timeinfo);
-
-            printf(
-                  PAYLOAD_FORMAT_SPECIFIER, 
-                  sensor->id,
-                  timeBuffer,
-                  payload.temperature,
-                  payload.humidity,
-                  payload.airQuality
-            );
+void detachChannel(ControlConnection* conn) {
+      if(conn->sensorID < 0)
+            return;
+
+      uint8_t id = (uint8_t)conn->sensorID;
+      SensorChannel* channel = &channels[id];
+      ReactivationSensorInfo* info = &reactivations[id];
+      pthread_mutex_lock(&controlMutex);
+      bool current = channel->socketFD == conn->socketFD;
+      if(current) {
+            channel->socketFD = -1;
+            wheelCancel(&reactivationWheel, &channel->heartbeat);
+      }
+      if(info->onChannel && info->sensorSocketFD == conn->socketFD) {
+            info->sensorSocketFD = -1;
+            wheelCancel(&reactivationWheel, &info->timer);
       }
+      pthread_mutex_unlock(&controlMutex);
 
-      free(sensor);
-      return NULL;
+      if(current) {
+            registryRemove(id);
+            printf("Sensor %u disconnected\n", id);
+      }
+      conn->sensorID = -1;
 }
 
-void* handleErrors(void* arg) {
-      while(true) {
-            struct sockaddr_in sensorAddr;
-            socklen_t addrlen = sizeof(sensorAddr);
-
-            int clientFD = accept(
-                  errorSocketFD,
-                  (struct sockaddr*)&sensorAddr,
-                  &addrlen
-            );
-            if(clientFD < 0) {
-                  perror("Accept failed");
-                  continue;
-            }
+void closeConnection(NetIO* io, ControlConnection* conn) {
+      detachChannel(conn);
+      netioCancel(io, conn->socketFD);
+      close(conn->socketFD);
+      conn->finished = true;
+}
 
-            SensorAlert alertMsg;
-            ssize_t bytesReceived = recv(clientFD, &alertMsg, sizeof alertMsg, 0);
-            if(bytesReceived <= 0) {
-                  perror("Connection failed");
-                  continue;
-            }
-            if(bytesReceived != sizeof alertMsg) {
-                  fprintf(stderr,
-                        "Received only %zd of %zu bytes\n",
-                        bytesReceived, sizeof alertMsg);
-                  close(clientFD);
-                  continue;
-            }
-            
-            if(alertMsg.type == ALERT) {
-                  printf("Alert received from %u\n", alertMsg.sensor.id);
-                  ReactivationSensorInfo* info = malloc(sizeof(ReactivationSensorInfo));
-                  if(!info) {
-                        perror("Memory allocation failed");
-                        close(clientFD);
-                        continue;
-                  }
+bool registerSensor(const struct sockaddr_in* addr, const uint8_t* wire, bool gateway) {
+      Sensor* newSensor = registrySensorNew();
+      if(!newSensor) {
+            perror("Memory allocation failed");
+            return false;
+      }
+      sensorDecode(newSensor, wire);
+      newSensor->gateway = gateway;
+
+      epochEnter();
+      bool full = registryFindByID(newSensor->id) == NULL && registryCount() >= configAcquire()->maxSensors;
+      epochExit();
+      if(full) {
+            fprintf(stderr, "Sensor %u refused: too many sensors\n", newSensor->id);
+            registrySensorFree(newSensor);
+            return false;
+      }
 
-                  info->alert = alertMsg;
-                  info->sensorSocketFD = clientFD;
-                  pthread_t waitThread;
-                  if(pthread_create(&waitThread, NULL, rebootSensor, info) == 0) {
-                        pthread_detach(waitThread);
-                  } else {
-                        perror("Thread creation failed");
-                        close(clientFD);
-                        free(info);
-                  }
+      // the sensor announces the UDP port it sends from (0 if unknown),
+      // the host comes from the registration connection
+      in_port_t dataPort = newSensor->addr.sin_port;
+      newSensor->addr = *addr;
+      newSensor->addr.sin_port = dataPort;
+      if(!registryAdd(newSensor)) {
+            fprintf(stderr, "Adding sensor failed\n");
+            registrySensorFree(newSensor);
+            return false;
+      }
+      return true;
+}
+
+void handleSensor(const IngestRecord* records, size_t count, void* ctx) {
+      OutputStage* stage = (OutputStage*)ctx;
+      OutputRecord batch[INGEST_MAX_BATCH];
+
+      // no formatting here: the receive thread only copies what it decoded
+      for(size_t i = 0; i < count; i++) {
+            batch[i].sensorID = records[i].sensor->id;
+            batch[i].payload = records[i].payload;
+      }
+
+      aggregateAdd(&aggregates, batch, count);
+      // the ingest thread calls in an epoch: the snapshot lasts the batch
+      rulesEvaluate(&rules, &configAcquire()->rules, batch, count);
+      outputSubmit(stage, batch, count);
+      storeSubmit(&store, batch, count);
+}
+
+void handleRuleEvents(const RuleSet* set, const RuleEvent* events, size_t count, void* ctx) {
+      // by sensor: second of the last line printed, events held back since
+      static time_t printed[MAX_SENSORS + 1];
+      static uint32_t suppressed[MAX_SENSORS + 1];
+
+      metricsAdd(ruleEventMetric, count);
 
+      for(size_t i = 0; i < count; i++) {
+            const RuleEvent* event = &events[i];
+            if(event->timestamp == printed[event->sensorID]) {
+                  suppressed[event->sensorID]++;
+                  continue;
             }
+            printed[event->sensorID] = event->timestamp;
+
+            Rule rule = set->rules[event->rule];
+            rule.threshold = set->thresholds[event->rule][event->sensorID];
+            char name[RULE_NAME_MAX];
+            ruleFormat(&rule, name, sizeof name);
+            if(rule.kind == RULE_RATE)
+                  printf("Rule %s fired for sensor %u: %u -> %u", name, event->sensorID, event->previous, event->value);
+            else
+                  printf("Rule %s fired for sensor %u: %u", name, event->sensorID, event->value);
+            if(suppressed[event->sensorID] > 0)
+                  printf(" (%u more held back)", suppressed[event->sensorID]);
+            printf("\n");
+            suppressed[event->sensorID] = 0;
+      }
+}
+
+void handleAlert(const SensorAlert* alertMsg, int clientFD, bool onChannel) {
+      printf("Alert received from %u\n", alertMsg->sensor.id);
+      metricsAdd(alertMetric, 1);
+      AggregateStats stats;
+      if(aggregateQuery(&aggregates, alertMsg->sensor.id, WINDOW_1M, &stats)) {
+            printf("Sensor %u last minute: %llu readings, T %u-%u C (p50 %u), H %u-%u (p50 %u), AQ %u-%u %% (p50 %u)\n",
+                  alertMsg->sensor.id, (unsigned long long)stats.count,
+                  stats.metrics[METRIC_TEMPERATURE].min, stats.metrics[METRIC_TEMPERATURE].max, stats.metrics[METRIC_TEMPERATURE].p50,
+                  stats.metrics[METRIC_HUMIDITY].min, stats.metrics[METRIC_HUMIDITY].max, stats.metrics[METRIC_HUMIDITY].p50,
+                  stats.metrics[METRIC_AIR_QUALITY].min, stats.metrics[METRIC_AIR_QUALITY].max, stats.metrics[METRIC_AIR_QUALITY].p50);
       }
+      ReactivationSensorInfo* info = &reactivations[alertMsg->sensor.id];
+
+      pthread_mutex_lock(&controlMutex);
+      // the sensor gave up on its previous alert connection
+      if(info->sensorSocketFD != -1 && !info->onChannel)
+            close(info->sensorSocketFD);
+      info->alert = *alertMsg;
+      info->sensorSocketFD = clientFD;
+      info->onChannel = onChannel;
+      printf("Sensor %u reactivation...\n", alertMsg->sensor.id);
+      epochEnter();
+      unsigned reactivateTime = configAcquire()->reactivateTime;
+      epochExit();
+      info->deadline = metricsNow() + reactivateTime * 1000000000ULL;
+      wheelSchedule(&reactivationWheel, &info->timer, reactivateTime * 1000);
+      pthread_mutex_unlock(&controlMutex);
 }
 
-void* rebootSensor(void* arg) {
+void rebootSensor(Timer* timer, void* arg) {
       ReactivationSensorInfo* info = (ReactivationSensorInfo*)arg;
-      printf("Sensor %u reactivation...\n", info->alert.sensor.id);
-      sleep(SENSOR_REACTIVATE_TIME);
-      printf("Sensor %u reactivated\n", info->alert.sensor.id);
 
-      info->alert.type = REACTIVATE;
-      ssize_t bytesSent = send(info->sensorSocketFD, &info->alert, sizeof info->alert, 0);
+      pthread_mutex_lock(&controlMutex);
+      // a new alert rescheduled the timer while this expiry was on its way
+      if(wheelIsPending(&reactivationWheel, timer)) {
+            pthread_mutex_unlock(&controlMutex);
+            return;
+      }
+      SensorAlert alert = info->alert;
+      bool onChannel = info->onChannel;
+      uint64_t deadline = info->deadline;
+      // the channel stays with the control thread, which may close it
+      // meanwhile: the reply goes through a duplicate
+      int sensorSocketFD = onChannel && info->sensorSocketFD != -1 ? dup(info->sensorSocketFD) : info->sensorSocketFD;
+      info->sensorSocketFD = -1;
+      pthread_mutex_unlock(&controlMutex);
+
+      if(sensorSocketFD == -1)
+            return;
+
+      uint64_t now = metricsNow();
+      metricsRecord(reactivationLagMetric, now > deadline ? (now - deadline) / 1000 : 0);
+      printf("Sensor %u reactivated\n", alert.sensor.id);
+
+      alert.type = REACTIVATE;
+      uint8_t alertWire[SENSOR_ALERT_WIRE_SIZE];
+      sensorAlertEncode(alertWire, &alert);
+      uint8_t frame[CONTROL_FRAME_HEADER_WIRE_SIZE + SENSOR_ALERT_WIRE_SIZE];
+      const uint8_t* wire = alertWire;
+      size_t length = sizeof alertWire;
+      if(onChannel) {
+            length = controlFrameEncode(frame, CONTROL_REACTIVATE, alertWire, sizeof alertWire);
+            wire = frame;
+      }
+
+      ssize_t bytesSent = send(sensorSocketFD, wire, length, MSG_NOSIGNAL);
       if(bytesSent <= 0) {
             perror("Send failed");
-      }
-      if(bytesSent != sizeof info->alert) {
+      } else if((size_t)bytesSent != length) {
             fprintf(stderr,
                   "Sent only %zd of %zu bytes\n",
-                  bytesSent, sizeof info->alert);
+                  bytesSent, length);
       }
 
-      close(info->sensorSocketFD);
-      free(info);
-      return NULL;
+      close(sensorSocketFD);
+}
+
+void heartbeatExpired(Timer* timer, void* arg) {
+      SensorChannel* channel = (SensorChannel*)arg;
+      uint8_t id = (uint8_t)(channel - channels);
+
+      pthread_mutex_lock(&controlMutex);
+      // a frame came in while this expiry was on its way
+      if(wheelIsPending(&reactivationWheel, timer) || channel->socketFD == -1) {
+            pthread_mutex_unlock(&controlMutex);
+            return;
+      }
+      printf("Sensor %u missed its heartbeats, removed\n", id);
+      registryRemove(id);
+      // the control thread sees the end of the stream and closes the channel
+      shutdown(channel->socketFD, SHUT_RDWR);
+      pthread_mutex_unlock(&controlMutex);
+}
+
+void reportSequences(Timer* timer, void* arg) {
+      static uint64_t reported[MAX_SENSORS + 1];
+
+      printf("Sequence report: %llu datagrams dropped by the kernel\n",
+            (unsigned long long)atomic_load_explicit(&ingestEngine.kernelDrops, memory_order_relaxed));
+      printf("Rules: %llu readings evaluated\n",
+            (unsigned long long)atomic_load_explicit(&rules.evaluated, memory_order_relaxed));
+      epochEnter();
+      const RuleSet* set = &configAcquire()->rules;
+      for(size_t r = 0; r < set->ruleCount; r++) {
+            printf("Rule %s%c: fired %llu times since the last reload\n",
+                  ruleMetricName(set->rules[r].metric), ruleOperator(set->rules[r].kind),
+                  (unsigned long long)atomic_load_explicit(&set->fired[r], memory_order_relaxed));
+      }
+      epochExit();
+      for(size_t id = 0; id <= MAX_SENSORS; id++) {
+            SequenceStats stats;
+            sequenceStats(&ingestEngine.sequences[id], &stats);
+            if(stats.received == reported[id])
+                  continue;
+            reported[id] = stats.received;
+
+            printf("Sensor %zu: %llu received, %llu lost (%.2f%%), %llu duplicates, %llu reordered (max depth %u), %llu late, %llu restarts\n",
+                  id,
+                  (unsigned long long)stats.received,
+                  (unsigned long long)stats.lost,
+                  stats.lossRate * 100,
+                  (unsigned long long)stats.duplicates,
+                  (unsigned long long)stats.reordered,
+                  stats.maxReorderDepth,
+                  (unsigned long long)stats.late,
+                  (unsigned long long)stats.restarts);
+      }
+
+      wheelSchedule(&reactivationWheel, timer, SEQUENCE_REPORT_TIME * 1000);
+}
+
+void* handleReload(void* arg) {
+      const sigset_t* signals = (const sigset_t*)arg;
+
+      for(;;) {
+            int received;
+            if(sigwait(signals, &received) != 0)
+                  continue;
+            if(received != SIGHUP)
+                  return NULL;
+            if(configPath == NULL) {
+                  fprintf(stderr, "No configuration file to reload\n");
+                  continue;
+            }
+
+            Config* config = configLoad(configPath);
+            if(!config) {
+                  fprintf(stderr, "Reload failed, keeping the current configuration\n");
+                  continue;
+            }
+
+            // only this thread publishes: the current snapshot cannot go away under it
+            const Config* old = configAcquire();
+            if(config->connectionPort != old->connectionPort || config->sendPort != old->sendPort
+                  || config->alertPort != old->alertPort || config->controlPort != old->controlPort
+                  || config->metricsPort != old->metricsPort)
+                  fprintf(stderr, "Port changes take effect on restart\n");
+            if(config->receiveBuffer != old->receiveBuffer)
+                  fprintf(stderr, "Receive buffer changes take effect on restart\n");
+
+            printf("Configuration reloaded: %zu profiles, %zu rules\n", config->profileCount, config->rules.ruleCount);
+            for(size_t i = 0; i < config->profileCount; i++) {
+                  const ConfigProfile* profile = &config->profiles[i];
+                  printf("Profile %s: %zu sensors, %zu rules\n", profile->name, profile->sensorCount, profile->ruleCount);
+            }
+            configPublish(config);
+      }
 }
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "timerwheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_RANGE ((uint64_t)1 << (WHEEL_LEVELS * WHEEL_SLOT_BITS))
+
+static void listInit(Timer* head) {
+      head->next = head;
+      head->prev = head;
+}
+
+static void listAppend(Timer* head, Timer* timer) {
+      timer->prev = head->prev;
+      timer->next = head;
+      head->prev->next = timer;
+      head->prev = timer;
+}
+
+static void listUnlink(Timer* timer) {
+      timer->prev->next = timer->next;
+      timer->next->prev = timer->prev;
+      timer->next = timer->prev = timer;
+}
+
+// picks the level whose slot width covers the distance to the expiry
+static void wheelPlace(TimerWheel* wheel, Timer* timer) {
+      uint64_t delta = timer->expires - wheel->now;
+      size_t level = 0;
+      while(level < WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * WHEEL_SLOT_BITS)))
+            level++;
+
+      size_t slot = (timer->expires >> (level * WHEEL_SLOT_BITS)) & WHEEL_MASK;
+      listAppend(&wheel->slots[level][slot], timer);
+}
+
+static void wheelCascade(TimerWheel* wheel, size_t level) {
+      size_t slot = (wheel->now >> (level * WHEEL_SLOT_BITS)) & WHEEL_MASK;
+
+      // the level above completes its turn first, so its timers land here in time
+      if(slot == 0 && level + 1 < WHEEL_LEVELS)
+            wheelCascade(wheel, level + 1);
+
+      Timer moving;
+      listInit(&moving);
+      Timer* head = &wheel->slots[level][slot];
+      while(head->next != head) {
+            Timer* timer = head->next;
+            listUnlink(timer);
+            listAppend(&moving, timer);
+      }
+      while(moving.next != &moving) {
+            Timer* timer = moving.next;
+            listUnlink(timer);
+            wheelPlace(wheel, timer);
+      }
+}
+
+bool wheelInit(TimerWheel* wheel, unsigned tickMs) {
+      if(tickMs == 0)
+            tickMs = WHEEL_DEFAULT_TICK_MS;
+
+      for(size_t level = 0; level < WHEEL_LEVELS; level++)
+            for(size_t slot = 0; slot < WHEEL_SLOTS; slot++)
+                  listInit(&wheel->slots[level][slot]);
+
+      wheel->now = 0;
+      wheel->tickMs = tickMs;
+      wheel->pending = 0;
+
+      if(pthread_mutex_init(&wheel->mutex, NULL)) {
+            perror("Mutex failed");
+            return false;
+      }
+
+      if((wheel->timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0) {
+            perror("Timer creation failed");
+            pthread_mutex_destroy(&wheel->mutex);
+            return false;
+      }
+
+      struct itimerspec period;
+      period.it_interval.tv_sec = tickMs / 1000;
+      period.it_interval.tv_nsec = (long)(tickMs % 1000) * 1000000L;
+      period.it_value = period.it_interval;
+      if(timerfd_settime(wheel->timerFD, 0, &period, NULL) < 0) {
+            perror("Timer setting failed");
+            close(wheel->timerFD);
+            pthread_mutex_destroy(&wheel->mutex);
+            return false;
+      }
+
+      return true;
+}
+
+void wheelDestroy(TimerWheel* wheel) {
+      close(wheel->timerFD);
+      pthread_mutex_destroy(&wheel->mutex);
+}
+
+void timerInit(Timer* timer, TimerCallback callback, void* arg) {
+      timer->next = timer->prev = timer;
+      timer->expires = 0;
+      timer->callback = callback;
+      timer->arg = arg;
+      timer->pending = false;
+}
+
+void wheelSchedule(TimerWheel* wheel, Timer* timer, unsigned delayMs) {
+      uint64_t ticks = (delayMs + wheel->tickMs - 1) / wheel->tickMs;
+      if(ticks == 0)
+            ticks = 1;
+      if(ticks >= WHEEL_RANGE)
+            ticks = WHEEL_RANGE - 1;
+
+      pthread_mutex_lock(&wheel->mutex);
+      if(timer->pending) {
+            listUnlink(timer);
+            wheel->pending--;
+      }
+      timer->expires = wheel->now + ticks;
+      timer->pending = true;
+      wheelPlace(wheel, timer);
+      wheel->pending++;
+      pthread_mutex_unlock(&wheel->mutex);
+}
+
+bool wheelCancel(TimerWheel* wheel, Timer* timer) {
+      bool wasPending;
+
+      pthread_mutex_lock(&wheel->mutex);
+      wasPending = timer->pending;
+      if(wasPending) {
+            listUnlink(timer);
+            timer->pending = false;
+            wheel->pending--;
+      }
+      pthread_mutex_unlock(&wheel->mutex);
+
+      return wasPending;
+}
+
+bool wheelIsPending(TimerWheel* wheel, const Timer* timer) {
+      pthread_mutex_lock(&wheel->mutex);
+      bool pending = timer->pending;
+      pthread_mutex_unlock(&wheel->mutex);
+      return pending;
+}
+
+size_t wheelPending(TimerWheel* wheel) {
+      pthread_mutex_lock(&wheel->mutex);
+      size_t pending = wheel->pending;
+      pthread_mutex_unlock(&wheel->mutex);
+      return pending;
+}
+
+void* wheelRun(void* arg) {
+      TimerWheel* wheel = (TimerWheel*)arg;
+
+      while(true) {
+            uint64_t expirations;
+            ssize_t bytesRead = read(wheel->timerFD, &expirations, sizeof expirations);
+            if(bytesRead < 0 && errno == EINTR)
+                  continue;
+            if(bytesRead != sizeof expirations) {
+                  perror("Timer read failed");
+                  break;
+            }
+
+            // a late wakeup catches up on every missed tick
+            Timer expired;
+            listInit(&expired);
+
+            pthread_mutex_lock(&wheel->mutex);
+            for(uint64_t i = 0; i < expirations; i++) {
+                  wheel->now++;
+                  size_t slot = wheel->now & WHEEL_MASK;
+                  if(slot == 0)
+                        wheelCascade(wheel, 1);
+
+                  Timer* head = &wheel->slots[0][slot];
+                  // still pending until fired: cancel or reschedule just unlink them from here
+                  while(head->next != head) {
+                        Timer* timer = head->next;
+                        listUnlink(timer);
+                        listAppend(&expired, timer);
+                  }
+            }
+
+            // callbacks may reschedule, they run without the lock held
+            while(expired.next != &expired) {
+                  Timer* timer = expired.next;
+                  listUnlink(timer);
+                  timer->pending = false;
+                  wheel->pending--;
+                  pthread_mutex_unlock(&wheel->mutex);
+                  timer->callback(timer, timer->arg);
+                  pthread_mutex_lock(&wheel->mutex);
+            }
+            pthread_mutex_unlock(&wheel->mutex);
+      }
+
+      return NULL;
+}
@@ -0,0 +1,66 @@
+#ifndef TIMERWHEEL_H
+
+#define TIMERWHEEL_H
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)
+#define WHEEL_DEFAULT_TICK_MS 100
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+struct TimerTag;
+typedef void (*TimerCallback)(struct TimerTag* timer, void* arg);
+
+/*
+Intrusive timer: it lives inside the object it belongs to, so the wheel
+never allocates and cancel/reschedule are O(1).
+*/
+typedef struct TimerTag {
+      struct TimerTag* next;
+      struct TimerTag* prev;
+      uint64_t expires;       // absolute tick
+      TimerCallback callback;
+      void* arg;
+      bool pending;
+} Timer;
+
+/*
+Hierarchical timer wheel: level 0 has one slot per tick, every upper
+level has one slot per full turn of the level below and is cascaded
+down when that turn completes. With 4 levels of 64 slots it covers
+2^24 ticks; scheduling, cancelling and each tick cost O(1) apart from
+the timers that actually expire or cascade.
+*/
+typedef struct TimerWheelTag {
+      Timer slots[WHEEL_LEVELS][WHEEL_SLOTS]; // list heads
+      uint64_t now;
+      unsigned tickMs;
+      size_t pending;
+      int timerFD;
+      pthread_mutex_t mutex;
+} TimerWheel;
+
+bool wheelInit(TimerWheel* wheel, unsigned tickMs);
+void wheelDestroy(TimerWheel* wheel);
+
+void timerInit(Timer* timer, TimerCallback callback, void* arg);
+/*
+Arms the timer delayMs from now, moving it if it was already pending.
+*/
+void wheelSchedule(TimerWheel* wheel, Timer* timer, unsigned delayMs);
+/*
+Returns false if the timer was not pending (never armed or already fired).
+*/
+bool wheelCancel(TimerWheel* wheel, Timer* timer);
+bool wheelIsPending(TimerWheel* wheel, const Timer* timer);
+size_t wheelPending(TimerWheel* wheel);
+
+/*
+This thread routine drives the wheel from a periodic timerfd and runs
+the expired callbacks, outside the wheel lock.
+*/
+void* wheelRun(void* arg);
+
+#endif
@@ -0,0 +1,487 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "tsstore.h"
+
+#define HEADER_SIZE (sizeof(STORE_MAGIC) - 1 + sizeof(int64_t))
+#define SCAN_CHUNK 4096
+
+static const char* columnSuffix[COLUMN_COUNT] = { "ts", "tmp", "hum", "aq" };
+
+static size_t encodeVarint(uint8_t* dst, int64_t value) {
+      // zigzag: small negative deltas stay small
+      uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+      size_t length = 0;
+      while(zigzag >= 0x80) {
+            dst[length++] = (uint8_t)(zigzag | 0x80);
+            zigzag >>= 7;
+      }
+      dst[length++] = (uint8_t)zigzag;
+      return length;
+}
+
+// returns the bytes consumed, 0 if the varint is truncated
+static size_t decodeVarint(const uint8_t* src, size_t available, int64_t* value) {
+      uint64_t zigzag = 0;
+      for(size_t i = 0; i < available && i < 10; i++) {
+            zigzag |= (uint64_t)(src[i] & 0x7f) << (7 * i);
+            if(!(src[i] & 0x80)) {
+                  *value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+                  return i + 1;
+            }
+      }
+      return 0;
+}
+
+static void columnPath(char* path, size_t size, const char* root, uint8_t sensorID, uint32_t segment, StoreColumn column) {
+      snprintf(path, size, "%s/%u/%08u.%s", root, sensorID, segment, columnSuffix[column]);
+}
+
+static bool writeAll(int fd, const uint8_t* data, size_t length) {
+      while(length > 0) {
+            ssize_t n = write(fd, data, length);
+            if(n < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  return false;
+            }
+            data += n;
+            length -= (size_t)n;
+      }
+      return true;
+}
+
+static void closeSegment(SensorSeries* series) {
+      for(int c = 0; c < COLUMN_COUNT; c++) {
+            if(series->fds[c] != -1)
+                  close(series->fds[c]);
+            series->fds[c] = -1;
+      }
+}
+
+static off_t fileSize(const char* path) {
+      struct stat info;
+      return stat(path, &info) == 0 ? info.st_size : -1;
+}
+
+/*
+Reopens the last segment of a sensor after a restart. Columns left
+uneven by a crash are cut back to the rows every column has.
+*/
+static void resumeSegment(TimeSeriesStore* store, uint8_t sensorID, SensorSeries* series) {
+      char path[PATH_MAX + 32];
+      snprintf(path, sizeof path, "%s/%u", store->root, sensorID);
+
+      DIR* dir = opendir(path);
+      if(!dir)
+            return;
+
+      bool found = false;
+      uint32_t last = 0;
+      struct dirent* entry;
+      while((entry = readdir(dir)) != NULL) {
+            unsigned segment;
+            char suffix[8];
+            if(sscanf(entry->d_name, "%u.%7s", &segment, suffix) == 2 && strcmp(suffix, "ts") == 0) {
+                  if(!found || segment > last)
+                        last = segment;
+                  found = true;
+            }
+      }
+      closedir(dir);
+
+      if(!found)
+            return;
+
+      off_t rows = -1;
+      for(int c = COLUMN_TEMPERATURE; c < COLUMN_COUNT; c++) {
+            columnPath(path, sizeof path, store->root, sensorID, last, c);
+            off_t size = fileSize(path);
+            if(size < 0)
+                  size = 0;
+            if(rows < 0 || size < rows)
+                  rows = size;
+      }
+
+      columnPath(path, sizeof path, store->root, sensorID, last, COLUMN_TIMESTAMP);
+      int tsFD = open(path, O_RDWR);
+      if(tsFD < 0) {
+            series->segment = last + 1;
+            return;
+      }
+
+      struct stat info;
+      uint8_t* map = MAP_FAILED;
+      if(fstat(tsFD, &info) == 0 && (size_t)info.st_size >= HEADER_SIZE)
+            map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, tsFD, 0);
+
+      if(map == MAP_FAILED || memcmp(map, STORE_MAGIC, sizeof(STORE_MAGIC) - 1) != 0) {
+            // not a segment we can append to: start the next one
+            if(map != MAP_FAILED)
+                  munmap(map, info.st_size);
+            close(tsFD);
+            series->segment = last + 1;
+            return;
+      }
+
+      int64_t timestamp;
+      memcpy(&timestamp, map + sizeof(STORE_MAGIC) - 1, sizeof timestamp);
+      size_t offset = HEADER_SIZE;
+      off_t decoded = 0;
+      while(decoded < rows) {
+            int64_t delta;
+            size_t used = decodeVarint(map + offset, info.st_size - offset, &delta);
+            if(used == 0)
+                  break;
+            timestamp += delta;
+            offset += used;
+            decoded++;
+      }
+      munmap(map, info.st_size);
+
+      if(decoded >= STORE_SEGMENT_ROWS) {
+            close(tsFD);
+            series->segment = last + 1;
+            return;
+      }
+
+      if(ftruncate(tsFD, offset) < 0)
+            perror("Store truncate failed");
+      close(tsFD);
+
+      series->segment = last;
+      series->segmentRows = decoded;
+      series->lastTimestamp = timestamp;
+      for(int c = 0; c < COLUMN_COUNT; c++) {
+            columnPath(path, sizeof path, store->root, sensorID, last, c);
+            series->fds[c] = open(path, O_WRONLY | O_APPEND);
+            if(series->fds[c] < 0) {
+                  perror("Store open failed");
+                  closeSegment(series);
+                  series->segment = last + 1;
+                  series->segmentRows = 0;
+                  return;
+            }
+            if(c != COLUMN_TIMESTAMP && ftruncate(series->fds[c], decoded) < 0)
+                  perror("Store truncate failed");
+      }
+}
+
+static SensorSeries* openSeries(TimeSeriesStore* store, uint8_t sensorID) {
+      SensorSeries* series = calloc(1, sizeof *series);
+      if(!series) {
+            perror("Memory allocation failed");
+            return NULL;
+      }
+
+      for(int c = 0; c < COLUMN_COUNT; c++)
+            series->fds[c] = -1;
+
+      char path[PATH_MAX + 8];
+      snprintf(path, sizeof path, "%s/%u", store->root, sensorID);
+      if(mkdir(path, 0755) < 0 && errno != EEXIST) {
+            perror("Store directory creation failed");
+            free(series);
+            return NULL;
+      }
+
+      resumeSegment(store, sensorID, series);
+      return series;
+}
+
+static bool createSegment(TimeSeriesStore* store, uint8_t sensorID, SensorSeries* series, int64_t base) {
+      char path[PATH_MAX + 32];
+      for(int c = 0; c < COLUMN_COUNT; c++) {
+            columnPath(path, sizeof path, store->root, sensorID, series->segment, c);
+            series->fds[c] = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+            if(series->fds[c] < 0) {
+                  perror("Store segment creation failed");
+                  closeSegment(series);
+                  return false;
+            }
+      }
+
+      uint8_t header[HEADER_SIZE];
+      memcpy(header, STORE_MAGIC, sizeof(STORE_MAGIC) - 1);
+      memcpy(header + sizeof(STORE_MAGIC) - 1, &base, sizeof base);
+      if(!writeAll(series->fds[COLUMN_TIMESTAMP], header, sizeof header)) {
+            perror("Store write failed");
+            closeSegment(series);
+            return false;
+      }
+
+      series->segmentRows = 0;
+      series->lastTimestamp = base;
+      return true;
+}
+
+static void nextSegment(SensorSeries* series) {
+      closeSegment(series);
+      series->segment++;
+      series->segmentRows = 0;
+}
+
+static bool flushSeries(SensorSeries* series) {
+      if(series->buffered == 0)
+            return true;
+
+      // where every column ends before the flush, to cut a failed one back
+      off_t sizes[COLUMN_COUNT];
+      for(int c = 0; c < COLUMN_COUNT; c++) {
+            struct stat info;
+            sizes[c] = fstat(series->fds[c], &info) == 0 ? info.st_size : -1;
+      }
+
+      // timestamps go first: after a crash the byte columns decide the row count
+      bool written = writeAll(series->fds[COLUMN_TIMESTAMP], series->timestamps, series->timestampBytes)
+            && writeAll(series->fds[COLUMN_TEMPERATURE], series->temperature, series->buffered)
+            && writeAll(series->fds[COLUMN_HUMIDITY], series->humidity, series->buffered)
+            && writeAll(series->fds[COLUMN_AIR_QUALITY], series->airQuality, series->buffered);
+
+      series->buffered = 0;
+      series->timestampBytes = 0;
+      if(written)
+            return true;
+
+      // the columns are out of step: the rows of this flush are lost, the
+      // segment is cut back to the ones before and never appended to again
+      perror("Store write failed");
+      for(int c = 0; c < COLUMN_COUNT; c++) {
+            if(sizes[c] >= 0 && ftruncate(series->fds[c], sizes[c]) < 0)
+                  perror("Store truncate failed");
+      }
+      nextSegment(series);
+      return false;
+}
+
+bool storeOpen(TimeSeriesStore* store, const char* root) {
+      memset(store->series, 0, sizeof store->series);
+      atomic_init(&store->dropped, 0);
+      atomic_init(&store->stopping, false);
+
+      if(snprintf(store->root, sizeof store->root, "%s", root) >= (int)sizeof store->root) {
+            fprintf(stderr, "Store path too long: %s\n", root);
+            return false;
+      }
+      if(mkdir(root, 0755) < 0 && errno != EEXIST) {
+            perror("Store directory creation failed");
+            return false;
+      }
+      if(!spscInit(&store->queue, STORE_QUEUE_CAPACITY, sizeof(OutputRecord))) {
+            perror("Memory allocation failed");
+            return false;
+      }
+      return true;
+}
+
+void storeClose(TimeSeriesStore* store) {
+      storeFlush(store);
+      for(size_t i = 0; i <= UINT8_MAX; i++) {
+            if(store->series[i] != NULL) {
+                  closeSegment(store->series[i]);
+                  free(store->series[i]);
+                  store->series[i] = NULL;
+            }
+      }
+      spscDestroy(&store->queue);
+}
+
+bool storeAppend(TimeSeriesStore* store, uint8_t sensorID, const SensorPayload* payload) {
+      SensorSeries* series = store->series[sensorID];
+      if(series == NULL) {
+            if((series = openSeries(store, sensorID)) == NULL)
+                  return false;
+            store->series[sensorID] = series;
+      }
+
+      if(series->fds[0] == -1 && !createSegment(store, sensorID, series, payload->timestamp))
+            return false;
+
+      size_t row = series->buffered;
+      series->timestampBytes += encodeVarint(
+            series->timestamps + series->timestampBytes,
+            (int64_t)payload->timestamp - series->lastTimestamp
+      );
+      series->lastTimestamp = payload->timestamp;
+      series->temperature[row] = payload->temperature;
+      series->humidity[row] = payload->humidity;
+      series->airQuality[row] = payload->airQuality;
+      series->buffered++;
+      series->segmentRows++;
+
+      bool flushed = true;
+      if(series->buffered == STORE_BUFFER_ROWS)
+            flushed = flushSeries(series);
+
+      if(series->segmentRows == STORE_SEGMENT_ROWS) {
+            // a failed flush has already moved on to the next segment
+            if(flushSeries(series))
+                  nextSegment(series);
+            else
+                  flushed = false;
+      }
+
+      return flushed;
+}
+
+bool storeFlush(TimeSeriesStore* store) {
+      bool flushed = true;
+      for(size_t i = 0; i <= UINT8_MAX; i++) {
+            if(store->series[i] != NULL)
+                  flushed = flushSeries(store->series[i]) && flushed;
+      }
+      return flushed;
+}
+
+void storeSubmit(TimeSeriesStore* store, const OutputRecord* records, size_t count) {
+      size_t pushed = spscPush(&store->queue, records, count);
+      if(pushed < count)
+            atomic_fetch_add_explicit(&store->dropped, count - pushed, memory_order_relaxed);
+}
+
+static long long monotonicMs() {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+void* storeLoop(void* arg) {
+      TimeSeriesStore* store = (TimeSeriesStore*)arg;
+      OutputRecord batch[STORE_BATCH];
+      long long lastFlush = monotonicMs();
+
+      while(true) {
+            // read before the pop: stopping with nothing popped means drained
+            bool stopping = atomic_load_explicit(&store->stopping, memory_order_acquire);
+            size_t count = spscPop(&store->queue, batch, STORE_BATCH);
+            for(size_t i = 0; i < count; i++)
+                  storeAppend(store, batch[i].sensorID, &batch[i].payload);
+
+            long long now = monotonicMs();
+            if(now - lastFlush >= STORE_FLUSH_MS) {
+                  storeFlush(store);
+                  lastFlush = now;
+            }
+
+            if(count == 0) {
+                  if(stopping)
+                        break;
+                  struct timespec idle = { 0, STORE_IDLE_NS };
+                  nanosleep(&idle, NULL);
+            }
+      }
+
+      return NULL;
+}
+
+void storeStop(TimeSeriesStore* store) {
+      atomic_store_explicit(&store->stopping, true, memory_order_release);
+}
+
+typedef struct SegmentMapTag {
+      const uint8_t* columns[COLUMN_COUNT];
+      size_t sizes[COLUMN_COUNT];
+} SegmentMap;
+
+static void unmapSegment(SegmentMap* map) {
+      for(int c = 0; c < COLUMN_COUNT; c++) {
+            if(map->columns[c] != NULL)
+                  munmap((void*)map->columns[c], map->sizes[c]);
+            map->columns[c] = NULL;
+      }
+}
+
+// false once the segment does not exist
+static bool mapSegment(const char* root, uint8_t sensorID, uint32_t segment, SegmentMap* map) {
+      char path[PATH_MAX + 32];
+      memset(map, 0, sizeof *map);
+
+      for(int c = 0; c < COLUMN_COUNT; c++) {
+            columnPath(path, sizeof path, root, sensorID, segment, c);
+            int fd = open(path, O_RDONLY);
+            if(fd < 0) {
+                  unmapSegment(map);
+                  return false;
+            }
+
+            struct stat info;
+            if(fstat(fd, &info) == 0 && info.st_size > 0) {
+                  void* data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                  if(data != MAP_FAILED) {
+                        madvise(data, info.st_size, MADV_SEQUENTIAL);
+                        map->columns[c] = data;
+                        map->sizes[c] = info.st_size;
+                  }
+            }
+            close(fd);
+      }
+      return true;
+}
+
+long long storeScan(const char* root, uint8_t sensorID, StoreScanCallback callback, void* ctx) {
+      long long scanned = 0;
+      int64_t* timestamps = malloc(SCAN_CHUNK * sizeof *timestamps);
+      if(!timestamps) {
+            perror("Memory allocation failed");
+            return -1;
+      }
+
+      SegmentMap map;
+      for(uint32_t segment = 0; mapSegment(root, sensorID, segment, &map); segment++) {
+            const uint8_t* ts = map.columns[COLUMN_TIMESTAMP];
+            size_t tsSize = map.sizes[COLUMN_TIMESTAMP];
+            if(ts == NULL || tsSize < HEADER_SIZE || memcmp(ts, STORE_MAGIC, sizeof(STORE_MAGIC) - 1) != 0) {
+                  unmapSegment(&map);
+                  continue;
+            }
+
+            size_t rows = map.sizes[COLUMN_TEMPERATURE];
+            for(int c = COLUMN_HUMIDITY; c < COLUMN_COUNT; c++)
+                  if(map.sizes[c] < rows)
+                        rows = map.sizes[c];
+
+            int64_t timestamp;
+            memcpy(&timestamp, ts + sizeof(STORE_MAGIC) - 1, sizeof timestamp);
+            size_t offset = HEADER_SIZE;
+            size_t row = 0;
+
+            while(row < rows) {
+                  size_t count = 0;
+                  while(count < SCAN_CHUNK && row + count < rows) {
+                        int64_t delta;
+                        size_t used = decodeVarint(ts + offset, tsSize - offset, &delta);
+                        if(used == 0)
+                              break;
+                        offset += used;
+                        timestamp += delta;
+                        timestamps[count++] = timestamp;
+                  }
+                  if(count == 0)
+                        break;
+
+                  StoreChunk chunk = {
+                        timestamps,
+                        map.columns[COLUMN_TEMPERATURE] + row,
+                        map.columns[COLUMN_HUMIDITY] + row,
+                        map.columns[COLUMN_AIR_QUALITY] + row,
+                        count
+                  };
+                  callback(&chunk, ctx);
+                  row += count;
+                  scanned += count;
+            }
+
+            unmapSegment(&map);
+      }
+
+      free(timestamps);
+      return scanned;
+}
@@ -0,0 +1,111 @@
+#ifndef TSSTORE_H
+
+#define TSSTORE_H
+#define STORE_SEGMENT_ROWS (1 << 20)
+#define STORE_BUFFER_ROWS 4096
+#define STORE_QUEUE_CAPACITY 65536
+#define STORE_BATCH 1024
+#define STORE_FLUSH_MS 1000
+#define STORE_IDLE_NS 1000000L
+#define STORE_MAGIC "TSC1"
+#define STORE_DEFAULT_ROOT "sensordata"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+#include "protocol.h"
+#include "output.h"
+#include "../Common/spsc.h"
+
+/*
+Append-only columnar store, one directory per sensor ID:
+
+      <root>/<id>/<segment>.ts    header + zigzag varint timestamp deltas
+      <root>/<id>/<segment>.tmp   one temperature byte per reading
+      <root>/<id>/<segment>.hum   one humidity byte per reading
+      <root>/<id>/<segment>.aq    one air quality byte per reading
+
+The .ts header is STORE_MAGIC followed by the first timestamp of the
+segment (int64, little endian); every row then stores its delta from the
+previous one (the first row from the header). The row count of a segment
+is the length of its byte columns, so nothing is ever rewritten.
+A segment holds up to STORE_SEGMENT_ROWS readings.
+*/
+
+typedef enum StoreColumnTag {
+      COLUMN_TIMESTAMP,
+      COLUMN_TEMPERATURE,
+      COLUMN_HUMIDITY,
+      COLUMN_AIR_QUALITY,
+      COLUMN_COUNT
+} StoreColumn;
+
+typedef struct SensorSeriesTag {
+      uint32_t segment;
+      uint64_t segmentRows;         // flushed and buffered
+      int64_t lastTimestamp;
+      int fds[COLUMN_COUNT];        // -1 when the segment is not open
+      size_t buffered;
+      size_t timestampBytes;
+      uint8_t timestamps[STORE_BUFFER_ROWS * 10];
+      uint8_t temperature[STORE_BUFFER_ROWS];
+      uint8_t humidity[STORE_BUFFER_ROWS];
+      uint8_t airQuality[STORE_BUFFER_ROWS];
+} SensorSeries;
+
+/*
+Writer side. storeAppend and storeFlush belong to a single thread,
+storeLoop when the store is fed through storeSubmit.
+*/
+typedef struct TimeSeriesStoreTag {
+      char root[PATH_MAX];
+      SensorSeries* series[UINT8_MAX + 1];
+      SpscQueue queue;
+      atomic_uint_fast64_t dropped;
+      atomic_bool stopping;
+} TimeSeriesStore;
+
+bool storeOpen(TimeSeriesStore* store, const char* root);
+void storeClose(TimeSeriesStore* store);
+bool storeAppend(TimeSeriesStore* store, uint8_t sensorID, const SensorPayload* payload);
+bool storeFlush(TimeSeriesStore* store);
+/*
+Producer side of the store queue, never blocks: what does not fit is
+counted as dropped.
+*/
+void storeSubmit(TimeSeriesStore* store, const OutputRecord* records, size_t count);
+/*
+This thread routine drains the store queue into the segment files and
+flushes them at least every STORE_FLUSH_MS.
+*/
+void* storeLoop(void* arg);
+/*
+Once the producer is done: storeLoop appends what is queued and returns,
+storeClose then flushes it.
+*/
+void storeStop(TimeSeriesStore* store);
+
+/*
+Reader side: the byte columns of a segment are used straight from the
+mapping, timestamps are decoded a chunk at a time.
+*/
+typedef struct StoreChunkTag {
+      const int64_t* timestamps;
+      const uint8_t* temperature;
+      const uint8_t* humidity;
+      const uint8_t* airQuality;
+      size_t count;
+} StoreChunk;
+
+typedef void (*StoreScanCallback)(const StoreChunk* chunk, void* ctx);
+
+/*
+Feeds the whole history of a sensor, oldest first, to callback.
+Returns the number of readings scanned, -1 on error.
+*/
+long long storeScan(const char* root, uint8_t sensorID, StoreScanCallback callback, void* ctx);
+
+#endif
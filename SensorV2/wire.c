@@ -0,0 +1,109 @@
+#include "wire.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void wireSwap64(uint64_t* values, size_t count) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      (void)values;
+      (void)count;
+#else
+      size_t i = 0;
+
+#if defined(__AVX2__)
+      const __m256i reverse = _mm256_setr_epi8(
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+      );
+      for(; i + 4 <= count; i += 4) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+            _mm256_storeu_si256((__m256i*)(values + i), _mm256_shuffle_epi8(v, reverse));
+      }
+#elif defined(__SSE2__)
+      // no byte shuffle in SSE2: swap the bytes of each 16 bit word, then reverse the words
+      for(; i + 2 <= count; i += 2) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+            _mm_storeu_si128((__m128i*)(values + i), v);
+      }
+#endif
+
+      for(; i < count; i++)
+            values[i] = __builtin_bswap64(values[i]);
+#endif
+}
+
+size_t controlFrameEncode(uint8_t* dst, ControlFrameType type, const uint8_t* payload, size_t length) {
+      ControlFrameHeader header = { (uint8_t)type, (uint16_t)length };
+      uint8_t* p = controlFrameHeaderEncode(dst, &header);
+      if(length > 0)
+            memcpy(p, payload, length);
+      return CONTROL_FRAME_HEADER_WIRE_SIZE + length;
+}
+
+size_t sensorBatchSize(uint8_t flags, size_t count) {
+      size_t perReading = SENSOR_PAYLOAD_WIRE_SIZE + ((flags & BATCH_GATEWAY) ? 1 : 0);
+      return SENSOR_BATCH_HEADER_WIRE_SIZE + count * perReading;
+}
+
+size_t sensorBatchEncode(uint8_t* dst, SensorBatchHeader* header, const uint8_t* ids, const SensorPayload* payloads) {
+      size_t count = header->count;
+      header->magic = BATCH_MAGIC;
+      uint8_t* p = sensorBatchHeaderEncode(dst, header);
+
+      if(header->flags & BATCH_GATEWAY) {
+            memcpy(p, ids, count);
+            p += count;
+      }
+      for(size_t i = 0; i < count; i++)
+            p = wirePutI64(p, payloads[i].timestamp);
+      for(size_t i = 0; i < count; i++)
+            *p++ = payloads[i].temperature;
+      for(size_t i = 0; i < count; i++)
+            *p++ = payloads[i].humidity;
+      for(size_t i = 0; i < count; i++)
+            *p++ = payloads[i].airQuality;
+
+      return (size_t)(p - dst);
+}
+
+bool sensorBatchDecode(const uint8_t* src, size_t length, SensorBatchHeader* header, uint8_t* ids, SensorPayload* payloads) {
+      if(length < SENSOR_BATCH_HEADER_WIRE_SIZE)
+            return false;
+
+      const uint8_t* p = sensorBatchHeaderDecode(header, src);
+      size_t count = header->count;
+      if(header->magic != BATCH_MAGIC
+            || count == 0
+            || count > SENSOR_BATCH_MAX_READINGS
+            || length != sensorBatchSize(header->flags, count))
+            return false;
+
+      if(header->flags & BATCH_GATEWAY) {
+            memcpy(ids, p, count);
+            p += count;
+      }
+
+      // the timestamp column is swapped in one pass
+      uint64_t timestamps[SENSOR_BATCH_MAX_READINGS];
+      memcpy(timestamps, p, count * sizeof timestamps[0]);
+      p += count * sizeof timestamps[0];
+      wireSwap64(timestamps, count);
+
+      const uint8_t* temperature = p;
+      const uint8_t* humidity = temperature + count;
+      const uint8_t* airQuality = humidity + count;
+      for(size_t i = 0; i < count; i++) {
+            payloads[i].timestamp = (time_t)timestamps[i];
+            payloads[i].temperature = temperature[i];
+            payloads[i].humidity = humidity[i];
+            payloads[i].airQuality = airQuality[i];
+      }
+
+      return true;
+}
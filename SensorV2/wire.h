@@ -0,0 +1,225 @@
+#ifndef WIRE_H
+
+#define WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#include "protocol.h"
+
+/*
+Wire format of the protocol structs: every field big endian, no padding,
+whatever the compiler does with the in-memory structs. Each message is
+described once as a list of (field, wire type); WIRE_MESSAGE turns the
+list into its size constant and inline encode/decode routines, so the
+generated code is just the loads, stores and byte swaps of the fields.
+
+Python struct formats, kept in sync by the static asserts below:
+
+      SensorPayload     '>qBBB'     11 bytes
+      Sensor            '>BHI'       7 bytes (port and IPv4 address only)
+      SensorAlert       '>BBHI'      8 bytes
+      SensorBatchHeader '>BBBHI'     9 bytes, then the reading columns
+      ControlFrameHeader '>BH'       3 bytes, then the frame payload
+*/
+
+#define SENSOR_PAYLOAD_SCHEMA(FIELD) \
+      FIELD(timestamp, I64) \
+      FIELD(temperature, U8) \
+      FIELD(humidity, U8) \
+      FIELD(airQuality, U8)
+
+#define SENSOR_SCHEMA(FIELD) \
+      FIELD(id, U8) \
+      FIELD(addr.sin_family, INET) \
+      FIELD(addr.sin_port, NET16) \
+      FIELD(addr.sin_addr.s_addr, NET32)
+
+#define SENSOR_ALERT_SCHEMA(FIELD) \
+      FIELD(type, U8) \
+      FIELD(sensor.id, U8) \
+      FIELD(sensor.addr.sin_family, INET) \
+      FIELD(sensor.addr.sin_port, NET16) \
+      FIELD(sensor.addr.sin_addr.s_addr, NET32)
+
+#define SENSOR_BATCH_HEADER_SCHEMA(FIELD) \
+      FIELD(magic, U8) \
+      FIELD(flags, U8) \
+      FIELD(sensorID, U8) \
+      FIELD(count, U16) \
+      FIELD(sequence, U32)
+
+#define CONTROL_FRAME_HEADER_SCHEMA(FIELD) \
+      FIELD(type, U8) \
+      FIELD(length, U16)
+
+// wire types: NET16/NET32 are already in network order in memory,
+// INET takes no space and decodes to AF_INET
+#define WIRE_SIZE_U8 1
+#define WIRE_SIZE_U16 2
+#define WIRE_SIZE_U32 4
+#define WIRE_SIZE_I64 8
+#define WIRE_SIZE_NET16 2
+#define WIRE_SIZE_NET32 4
+#define WIRE_SIZE_INET 0
+
+static inline uint8_t* wirePutU8(uint8_t* dst, uint8_t value) {
+      dst[0] = value;
+      return dst + 1;
+}
+
+static inline uint8_t* wirePutU16(uint8_t* dst, uint16_t value) {
+      dst[0] = (uint8_t)(value >> 8);
+      dst[1] = (uint8_t)value;
+      return dst + 2;
+}
+
+static inline uint8_t* wirePutU32(uint8_t* dst, uint32_t value) {
+      dst[0] = (uint8_t)(value >> 24);
+      dst[1] = (uint8_t)(value >> 16);
+      dst[2] = (uint8_t)(value >> 8);
+      dst[3] = (uint8_t)value;
+      return dst + 4;
+}
+
+static inline uint8_t* wirePutI64(uint8_t* dst, int64_t value) {
+      uint64_t bits = (uint64_t)value;
+      for(int i = 7; i >= 0; i--) {
+            dst[i] = (uint8_t)bits;
+            bits >>= 8;
+      }
+      return dst + 8;
+}
+
+static inline uint8_t* wirePutNET16(uint8_t* dst, uint16_t value) {
+      memcpy(dst, &value, 2);
+      return dst + 2;
+}
+
+static inline uint8_t* wirePutNET32(uint8_t* dst, uint32_t value) {
+      memcpy(dst, &value, 4);
+      return dst + 4;
+}
+
+static inline uint8_t* wirePutINET(uint8_t* dst, sa_family_t value) {
+      (void)value;
+      return dst;
+}
+
+static inline uint8_t wireGetU8(const uint8_t** src) {
+      return *(*src)++;
+}
+
+static inline uint16_t wireGetU16(const uint8_t** src) {
+      const uint8_t* p = *src;
+      *src += 2;
+      return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t wireGetU32(const uint8_t** src) {
+      const uint8_t* p = *src;
+      *src += 4;
+      return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline int64_t wireGetI64(const uint8_t** src) {
+      const uint8_t* p = *src;
+      uint64_t bits = 0;
+      for(int i = 0; i < 8; i++)
+            bits = bits << 8 | p[i];
+      *src += 8;
+      return (int64_t)bits;
+}
+
+static inline uint16_t wireGetNET16(const uint8_t** src) {
+      uint16_t value;
+      memcpy(&value, *src, 2);
+      *src += 2;
+      return value;
+}
+
+static inline uint32_t wireGetNET32(const uint8_t** src) {
+      uint32_t value;
+      memcpy(&value, *src, 4);
+      *src += 4;
+      return value;
+}
+
+static inline sa_family_t wireGetINET(const uint8_t** src) {
+      (void)src;
+      return AF_INET;
+}
+
+#define WIRE_FIELD_SIZE(field, type) + WIRE_SIZE_##type
+#define WIRE_FIELD_ENCODE(field, type) dst = wirePut##type(dst, msg->field);
+#define WIRE_FIELD_DECODE(field, type) msg->field = wireGet##type(&src);
+
+/*
+Defines SIZE (wire bytes) plus
+      uint8_t* nameEncode(uint8_t* dst, const Type* msg)    returns dst + SIZE
+      const uint8_t* nameDecode(Type* msg, const uint8_t* src)  returns src + SIZE
+*/
+#define WIRE_MESSAGE(name, SIZE, Type, SCHEMA) \
+      enum { SIZE = 0 SCHEMA(WIRE_FIELD_SIZE) }; \
+      static inline uint8_t* name##Encode(uint8_t* dst, const Type* msg) { \
+            SCHEMA(WIRE_FIELD_ENCODE) \
+            return dst; \
+      } \
+      static inline const uint8_t* name##Decode(Type* msg, const uint8_t* src) { \
+            memset(msg, 0, sizeof *msg); \
+            SCHEMA(WIRE_FIELD_DECODE) \
+            return src; \
+      }
+
+WIRE_MESSAGE(sensorPayload, SENSOR_PAYLOAD_WIRE_SIZE, SensorPayload, SENSOR_PAYLOAD_SCHEMA)
+WIRE_MESSAGE(sensor, SENSOR_WIRE_SIZE, Sensor, SENSOR_SCHEMA)
+WIRE_MESSAGE(sensorAlert, SENSOR_ALERT_WIRE_SIZE, SensorAlert, SENSOR_ALERT_SCHEMA)
+WIRE_MESSAGE(sensorBatchHeader, SENSOR_BATCH_HEADER_WIRE_SIZE, SensorBatchHeader, SENSOR_BATCH_HEADER_SCHEMA)
+WIRE_MESSAGE(controlFrameHeader, CONTROL_FRAME_HEADER_WIRE_SIZE, ControlFrameHeader, CONTROL_FRAME_HEADER_SCHEMA)
+
+_Static_assert(SENSOR_PAYLOAD_WIRE_SIZE == 11, "SensorPayload no longer matches '>qBBB'");
+_Static_assert(SENSOR_WIRE_SIZE == 7, "Sensor no longer matches '>BHI'");
+_Static_assert(SENSOR_ALERT_WIRE_SIZE == 8, "SensorAlert no longer matches '>BBHI'");
+_Static_assert(SENSOR_BATCH_HEADER_WIRE_SIZE == 9, "SensorBatchHeader no longer matches '>BBBHI'");
+_Static_assert(CONTROL_FRAME_HEADER_WIRE_SIZE == 3, "ControlFrameHeader no longer matches '>BH'");
+
+// largest control frame payload, anything longer is a protocol error
+#define CONTROL_PAYLOAD_MAX 64
+
+// readings of a batch that fit in BATCH_MAX_BYTES (fewer with BATCH_GATEWAY)
+#define SENSOR_BATCH_MAX_READINGS ((BATCH_MAX_BYTES - SENSOR_BATCH_HEADER_WIRE_SIZE) / SENSOR_PAYLOAD_WIRE_SIZE)
+#define SENSOR_GATEWAY_MAX_READINGS ((BATCH_MAX_BYTES - SENSOR_BATCH_HEADER_WIRE_SIZE) / (SENSOR_PAYLOAD_WIRE_SIZE + 1))
+
+/*
+Wire size of a batch of count readings.
+*/
+size_t sensorBatchSize(uint8_t flags, size_t count);
+/*
+Writes header (its magic is filled in) and its readings: ids is only read
+with BATCH_GATEWAY. Returns the bytes written, sensorBatchSize of the header.
+*/
+size_t sensorBatchEncode(uint8_t* dst, SensorBatchHeader* header, const uint8_t* ids, const SensorPayload* payloads);
+/*
+Checks magic, count and length of the datagram before decoding anything.
+ids and payloads need room for SENSOR_BATCH_MAX_READINGS; ids is only
+written with BATCH_GATEWAY. Returns false on a malformed batch.
+*/
+bool sensorBatchDecode(const uint8_t* src, size_t length, SensorBatchHeader* header, uint8_t* ids, SensorPayload* payloads);
+
+/*
+Writes a control frame: header and length bytes of payload. dst needs
+CONTROL_FRAME_HEADER_WIRE_SIZE + length bytes; returns the bytes written.
+*/
+size_t controlFrameEncode(uint8_t* dst, ControlFrameType type, const uint8_t* payload, size_t length);
+
+/*
+Converts count big endian 64 bit values to host order in place (and
+back, the swap is its own inverse). Batches go through SSE2/AVX2 byte
+shuffles when the target has them; a no-op on big endian hosts.
+*/
+void wireSwap64(uint64_t* values, size_t count);
+
+#endif
@@ -0,0 +1,61 @@
+#include <string.h>
+#include <sys/uio.h>
+
+#include "decoder.h"
+
+#define DECODER_MASK (DECODER_CAPACITY - 1)
+
+void decoderInit(StreamDecoder* decoder) {
+      decoder->head = 0;
+      decoder->tail = 0;
+}
+
+size_t decoderBuffered(const StreamDecoder* decoder) {
+      return decoder->tail - decoder->head;
+}
+
+ssize_t decoderFill(StreamDecoder* decoder, int fd) {
+      size_t space = DECODER_CAPACITY - decoderBuffered(decoder);
+      size_t start = decoder->tail & DECODER_MASK;
+
+      // the free space is at most two segments: up to the end and from the start
+      struct iovec segments[2];
+      int count = 1;
+      segments[0].iov_base = decoder->ring + start;
+      segments[0].iov_len = space;
+      if(start + space > DECODER_CAPACITY) {
+            segments[0].iov_len = DECODER_CAPACITY - start;
+            segments[1].iov_base = decoder->ring;
+            segments[1].iov_len = space - segments[0].iov_len;
+            count = 2;
+      }
+
+      ssize_t bytesRead = readv(fd, segments, count);
+      if(bytesRead > 0)
+            decoder->tail += bytesRead;
+
+      return bytesRead;
+}
+
+size_t decoderExtract(StreamDecoder* decoder, SensorPayload* records, size_t max) {
+      size_t available = decoderBuffered(decoder) / sizeof(SensorPayload);
+      size_t count = available < max ? available : max;
+
+      for(size_t i = 0; i < count; i++) {
+            size_t start = decoder->head & DECODER_MASK;
+            size_t first = DECODER_CAPACITY - start;
+            uint8_t* dst = (uint8_t*)&records[i];
+
+            // a record may wrap around the end of the ring
+            if(first >= sizeof(SensorPayload)) {
+                  memcpy(dst, decoder->ring + start, sizeof(SensorPayload));
+            } else {
+                  memcpy(dst, decoder->ring + start, first);
+                  memcpy(dst + first, decoder->ring, sizeof(SensorPayload) - first);
+            }
+
+            decoder->head += sizeof(SensorPayload);
+      }
+
+      return count;
+}
@@ -0,0 +1,38 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "sensors.h"
+
+// power of two, so positions wrap with a mask
+#define DECODER_CAPACITY 4096
+#define DECODER_MAX_RECORDS (DECODER_CAPACITY / sizeof(SensorPayload))
+
+/*
+Incremental decoder for a stream of SensorPayload records: every record
+is framed by its fixed length, so a read may hold any number of records
+plus a partial tail that is kept for the next read.
+head and tail only grow, their difference is the number of buffered bytes.
+*/
+typedef struct StreamDecoderTag {
+      uint8_t ring[DECODER_CAPACITY];
+      size_t head;
+      size_t tail;
+} StreamDecoder;
+
+void decoderInit(StreamDecoder* decoder);
+/*
+Reads as much as fits in the free space of the ring with a single readv.
+Returns the bytes read, 0 on end of stream, -1 on error (errno is kept).
+*/
+ssize_t decoderFill(StreamDecoder* decoder, int fd);
+/*
+Moves up to max complete records out of the ring and returns how many.
+*/
+size_t decoderExtract(StreamDecoder* decoder, SensorPayload* records, size_t max);
+size_t decoderBuffered(const StreamDecoder* decoder);
+
+#endif // DECODER_H
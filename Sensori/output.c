@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "output.h"
+
+bool outputInit(OutputStage* stage, size_t producers, int fd) {
+      stage->queues = calloc(producers, sizeof *stage->queues);
+      if(!stage->queues) {
+            perror("Allocation failed");
+            return false;
+      }
+
+      for(size_t i = 0; i < producers; i++) {
+            if(!spscInit(&stage->queues[i], OUTPUT_QUEUE_CAPACITY, sizeof(SensorPayload))) {
+                  perror("Allocation failed");
+                  return false;
+            }
+      }
+
+      stage->producers = producers;
+      textInit(&stage->text, fd);
+      atomic_init(&stage->dropped, 0);
+      return true;
+}
+
+void outputSubmit(OutputStage* stage, size_t producer, const SensorPayload* payloads, size_t count) {
+      size_t pushed = spscPush(&stage->queues[producer], payloads, count);
+      if(pushed < count)
+            atomic_fetch_add_explicit(&stage->dropped, count - pushed, memory_order_relaxed);
+}
+
+// same layout as SENSOR_PAYLOAD_FORMAT_SPECIFIER
+static void renderPayload(TextBuffer* text, const SensorPayload* payload) {
+      textAppendUint(text, payload->ID);
+      textAppend(text, " - ", 3);
+      textAppendDate(text, payload->timestamp);
+      textAppend(text, ":\tT ", 4);
+      textAppendFixed2(text, payload->temperature);
+      textAppend(text, "°; H ", sizeof("°; H ") - 1);
+      textAppendUintPadded(text, payload->humidity, 3);
+      textAppend(text, "%; ", 3);
+      textAppendUintPadded(text, payload->quality, 3);
+      textAppend(text, "%\n", 2);
+}
+
+void* outputLoop(void* arg) {
+      OutputStage* stage = (OutputStage*)arg;
+      SensorPayload batch[OUTPUT_BATCH];
+
+      while(true) {
+            size_t rendered = 0;
+            for(size_t i = 0; i < stage->producers; i++) {
+                  size_t count = spscPop(&stage->queues[i], batch, OUTPUT_BATCH);
+                  for(size_t j = 0; j < count; j++)
+                        renderPayload(&stage->text, &batch[j]);
+                  rendered += count;
+            }
+
+            if(rendered == 0) {
+                  struct timespec idle = { 0, OUTPUT_IDLE_NS };
+                  nanosleep(&idle, NULL);
+                  continue;
+            }
+
+            if(!textFlush(&stage->text))
+                  perror("Output write failed");
+      }
+
+      return NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "sensors.h"
+#include "../Common/spsc.h"
+#include "../Common/textbuf.h"
+
+#define OUTPUT_QUEUE_CAPACITY 16384
+#define OUTPUT_BATCH 1024
+// consumer nap when every queue is empty, producers never make a syscall
+#define OUTPUT_IDLE_NS 1000000L
+
+/*
+Output stage shared by the reactors: every reactor owns one SPSC queue,
+a dedicated thread drains them all and renders the payloads with
+SENSOR_PAYLOAD_FORMAT_SPECIFIER's layout, one write per batch.
+*/
+typedef struct OutputStageTag {
+      SpscQueue* queues;
+      size_t producers;
+      TextBuffer text;
+      atomic_uint_fast64_t dropped;    // payloads lost to a full queue
+} OutputStage;
+
+bool outputInit(OutputStage* stage, size_t producers, int fd);
+/*
+Producer side, only called by the thread owning queue producer.
+Never blocks: what does not fit is counted as dropped.
+*/
+void outputSubmit(OutputStage* stage, size_t producer, const SensorPayload* payloads, size_t count);
+/*
+This thread routine is the only consumer of the stage.
+*/
+void* outputLoop(void* arg);
+
+#endif // OUTPUT_H
@@ -1,2 +1,2 @@
 gcc -o client client.c sensor.c
-gcc -o server server.c
\ No newline at end of file
+gcc -o server server.c decoder.c output.c ../Common/spsc.c ../Common/textbuf.c ../Common/metrics.c ../Common/pool.c
\ No newline at end of file
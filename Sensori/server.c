@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,182 +8,450 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
 #include <time.h>
+#include <signal.h>
+#include <sys/epoll.h>
 
 #include "sensors.h"
+#include "decoder.h"
+#include "output.h"
+#include "../Common/metrics.h"
+#include "../Common/pool.h"
 
 #define PORT 8080
-#define MAX_SENSORS 10
-#define BUFFER_SIZE 1024
+// Prometheus text on 127.0.0.1
+#define METRICS_PORT 9101
+#define DEFAULT_MAX_SENSORS 10
+#define MAX_EVENTS 256
+#define USAGE "[max sensors] [reactors, 0 = one per core]"
 
 typedef struct SensorInfoTag {
       int sensorFD;
       struct sockaddr_in address;
-      SensorPayload payload;
+      StreamDecoder decoder;
 } SensorInfo;
 
 typedef struct SensorInfoListTag {
-      SensorInfo* sensors[MAX_SENSORS];
-      size_t active;
-      pthread_mutex_t mutex;
+      atomic_size_t active;
+      size_t max;
 } SensorInfoList;
 
-SensorInfoList list;
+/*
+Every reactor owns a SO_REUSEPORT listener and all the sensors accepted
+on it: the kernel spreads new connections among the listeners, so
+reactors never share a socket.
+*/
+typedef struct ReactorTag {
+      int epollFD;
+      int listenFD;
+      size_t index;     // also the reactor's output queue
+      pthread_t thread;
+} Reactor;
 
-void initList();
+SensorInfoList list;
+OutputStage output;
+// one SensorInfo per connection, recycled by the reactors
+Pool sensorPool = POOL_OF(SensorInfo);
+Metric* connectionMetric;
+Metric* refusedMetric;
+Metric* payloadMetric;
+Metric* batchMetric;
+Metric* latencyMetric;
+
+void checkArgs(int argc, char** argv, size_t* maxSensors, size_t* reactors);
+void initList(size_t maxSensors);
+int createListener(uint16_t port);
+bool initReactor(Reactor* reactor, size_t index);
+void initMetrics();
 SensorInfo* createSensorInfo(int sensorFD, struct sockaddr_in address);
-void addSensor(int sensorFD, struct sockaddr_in address);
-void* handleSensor(void* arg);
+bool reserveSensorSlot();
+void releaseSensorSlot();
+/*
+This routine accepts every pending connection of the reactor listener
+and registers the new sensors in its epoll set.
+*/
+void acceptSensors(Reactor* reactor);
+/*
+This routine drains a readable sensor socket. It returns false once
+the sensor has disconnected or failed.
+*/
+bool handleSensor(Reactor* reactor, SensorInfo* sensor);
+/*
+Hands a batch of payloads to the output stage, formatting and printing
+happen off the reactor thread.
+*/
+void processPayloads(Reactor* reactor, const SensorPayload* payloads, size_t count);
+void removeSensor(Reactor* reactor, SensorInfo* sensor);
+/*
+This thread routine is the event loop of a single reactor.
+*/
+void* runReactor(void* arg);
+/*
+This thread routine waits for SIGINT or SIGTERM, reports the pools and
+ends the server.
+*/
+void* handleShutdown(void* arg);
+
+int main(int argc, char** argv) {
+      size_t maxSensors, reactorCount;
+      checkArgs(argc, argv, &maxSensors, &reactorCount);
+      initList(maxSensors);
+
+      // every thread inherits the mask: only the shutdown thread takes them
+      sigset_t shutdownSignals;
+      sigemptyset(&shutdownSignals);
+      sigaddset(&shutdownSignals, SIGINT);
+      sigaddset(&shutdownSignals, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &shutdownSignals, NULL);
+
+      Reactor* reactors = calloc(reactorCount, sizeof *reactors);
+      if(!reactors) {
+            perror("Allocation failed");
+            exit(EXIT_FAILURE);
+      }
+
+      for(size_t i = 0; i < reactorCount; i++) {
+            if(!initReactor(&reactors[i], i))
+                  exit(EXIT_FAILURE);
+      }
+
+      if(!outputInit(&output, reactorCount, STDOUT_FILENO))
+            exit(EXIT_FAILURE);
+      initMetrics();
+      if(!metricsServe(METRICS_PORT))
+            exit(EXIT_FAILURE);
+      pthread_t outputThread, shutdownThread;
+      if(pthread_create(&shutdownThread, NULL, handleShutdown, &shutdownSignals) != 0
+            || pthread_create(&outputThread, NULL, outputLoop, &output) != 0) {
+            perror("Thread creation failed");
+            exit(EXIT_FAILURE);
+      }
 
-int main() {
-      initList();
+      printf("Sensor server listening on port %d (%zu reactors, %zu sensors max)\n",
+            PORT, reactorCount, maxSensors);
+
+      // the main thread runs the first reactor itself
+      for(size_t i = 1; i < reactorCount; i++) {
+            if(pthread_create(&reactors[i].thread, NULL, runReactor, &reactors[i]) != 0) {
+                  perror("Thread creation failed");
+                  exit(EXIT_FAILURE);
+            }
+      }
+      runReactor(&reactors[0]);
+
+      for(size_t i = 1; i < reactorCount; i++)
+            pthread_join(reactors[i].thread, NULL);
+
+      for(size_t i = 0; i < reactorCount; i++) {
+            close(reactors[i].listenFD);
+            close(reactors[i].epollFD);
+      }
+      free(reactors);
+      exit(EXIT_SUCCESS);
+}
+
+void checkArgs(int argc, char** argv, size_t* maxSensors, size_t* reactors) {
+      // 1: max sensors (optional)
+      // 2: reactors (optional)
+
+      if(argc > 3) {
+            fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
+            exit(EXIT_FAILURE);
+      }
 
+      *maxSensors = DEFAULT_MAX_SENSORS;
+      if(argc > 1) {
+            long maxCheck = atol(argv[1]);
+            if(maxCheck <= 0) {
+                  fprintf(stderr, "Invalid max sensors: %s\n", argv[1]);
+                  exit(EXIT_FAILURE);
+            }
+            *maxSensors = (size_t)maxCheck;
+      }
+
+      *reactors = 1;
+      if(argc > 2) {
+            long reactorCheck = atol(argv[2]);
+            if(reactorCheck < 0) {
+                  fprintf(stderr, "Invalid reactors: %s\n", argv[2]);
+                  exit(EXIT_FAILURE);
+            }
+            if(reactorCheck == 0) {
+                  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+                  reactorCheck = cores > 0 ? cores : 1;
+            }
+            *reactors = (size_t)reactorCheck;
+      }
+}
+
+void initList(size_t maxSensors) {
+      atomic_init(&list.active, 0);
+      list.max = maxSensors;
+}
+
+int createListener(uint16_t port) {
       struct sockaddr_in address;
-      int serverFD = socket(AF_INET, SOCK_STREAM, 0);
-      if(serverFD == 0) {
+      int serverFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if(serverFD < 0) {
             perror("Socket creation failed");
-            exit(EXIT_FAILURE);
+            return -1;
+      }
+
+      // every reactor binds the same port, the kernel balances the accepts
+      int reuse = 1;
+      if(setsockopt(serverFD, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof reuse) < 0
+            || setsockopt(serverFD, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse) < 0) {
+            perror("Socket options failed");
+            close(serverFD);
+            return -1;
       }
 
       memset(&address, 0, sizeof(address));
       address.sin_family = AF_INET;
-      address.sin_port = htons(PORT);
+      address.sin_port = htons(port);
       address.sin_addr.s_addr = INADDR_ANY;
 
       int bindCheck = bind(serverFD, (struct sockaddr*)&address, sizeof(address));
       if(bindCheck < 0) {
             perror("Binding failed");
-            exit(EXIT_FAILURE);
+            close(serverFD);
+            return -1;
       }
 
       // listening
-      int listenCheck = listen(serverFD, MAX_SENSORS);
+      int listenCheck = listen(serverFD, SOMAXCONN);
       if(listenCheck < 0) {
             perror("Listening failed");
-            exit(EXIT_FAILURE);
+            close(serverFD);
+            return -1;
       }
 
-      printf("Chat server listening on port %d\n", PORT);
+      return serverFD;
+}
 
-      bool listening = true;
-      bool clientCreated;
-      while(listening) {
-            clientCreated = true;
-            struct sockaddr_in newClientAddress;
-            socklen_t addrLen = sizeof(newClientAddress);
-            int newClientFD = accept(serverFD, (struct sockaddr*)&newClientAddress, &addrLen);      
-
-            if(newClientFD < 0) {
-                  perror("Client creation failed");
-                  clientCreated = false;
-            }
+bool initReactor(Reactor* reactor, size_t index) {
+      reactor->index = index;
+      if((reactor->listenFD = createListener(PORT)) < 0)
+            return false;
 
-            if(clientCreated) {
-                  addSensor(newClientFD, newClientAddress);
-            }            
+      if((reactor->epollFD = epoll_create1(0)) < 0) {
+            perror("Epoll creation failed");
+            close(reactor->listenFD);
+            return false;
       }
 
-      close(serverFD);
-      exit(EXIT_SUCCESS);
+      // the listener is the only entry with a NULL pointer
+      struct epoll_event event;
+      event.events = EPOLLIN | EPOLLET;
+      event.data.ptr = NULL;
+      if(epoll_ctl(reactor->epollFD, EPOLL_CTL_ADD, reactor->listenFD, &event) < 0) {
+            perror("Epoll add failed");
+            close(reactor->listenFD);
+            close(reactor->epollFD);
+            return false;
+      }
+
+      return true;
+}
+
+static uint64_t readActiveSensors(void* ctx) {
+      return atomic_load(&list.active);
 }
 
-void initList() {
-      list.active = 0;
+static uint64_t readQueueDepth(void* ctx) {
+      uint64_t depth = 0;
+      for(size_t i = 0; i < output.producers; i++)
+            depth += spscSize(&output.queues[i]);
+      return depth;
+}
 
-      for(size_t i = 0; i < MAX_SENSORS; i++)
-            list.sensors[i] = NULL;
+static uint64_t readDropped(void* ctx) {
+      return atomic_load_explicit(&output.dropped, memory_order_relaxed);
+}
 
-      if(pthread_mutex_init(&list.mutex, NULL) != 0) {
-            perror("pthread mutex init failed");
-            exit(EXIT_FAILURE);
-      }
+void initMetrics() {
+      connectionMetric = metricsCounter("sensori_connections_total", "Sensor connections accepted.");
+      refusedMetric = metricsCounter("sensori_refused_total", "Sensor connections refused, the server was full.");
+      payloadMetric = metricsCounter("sensori_payloads_total", "Payloads decoded.");
+      batchMetric = metricsHistogram("sensori_read_payloads", "Payloads decoded from one read.");
+      latencyMetric = metricsHistogram("sensori_processing_latency_ns", "From a readable sensor to its payloads handed to the output, nanoseconds.");
+      metricsGauge("sensori_active_sensors", "Sensors connected.", readActiveSensors, NULL);
+      metricsGauge("sensori_output_queue_depth", "Payloads waiting for the output thread.", readQueueDepth, NULL);
+      metricsCounterFn("sensori_output_dropped_total", "Payloads lost to a full output queue.", readDropped, NULL);
 }
 
 SensorInfo* createSensorInfo(int sensorFD, struct sockaddr_in address) {
-      SensorInfo* newSensor = malloc(sizeof(SensorInfo));
+      SensorInfo* newSensor = POOL_NEW(&sensorPool, SensorInfo);
       if(!newSensor) {
             perror("Allocation failed");
             close(sensorFD);
-            exit(EXIT_FAILURE);
+            return NULL;
       }
 
       newSensor->sensorFD = sensorFD;
       newSensor->address = address;
+      decoderInit(&newSensor->decoder);
 
       return newSensor;
 }
 
-void addSensor(int sensorFD, struct sockaddr_in address) {
-      SensorInfo* sensor = createSensorInfo(sensorFD, address);
+bool reserveSensorSlot() {
+      size_t active = atomic_load(&list.active);
+      do {
+            if(active >= list.max)
+                  return false;
+      } while(!atomic_compare_exchange_weak(&list.active, &active, active + 1));
 
-      pthread_t threadID;
-      int threadCheck = pthread_create(&threadID, NULL, handleSensor, (void*)sensor);
-      if(threadCheck != 0) {
-            perror("Thread creation failed");
-            close(sensor->sensorFD);
-            free(sensor);
-      } else {
-            pthread_detach(threadID);
-      }      
+      return true;
 }
 
-void* handleSensor(void* arg) {
-      SensorInfo* sensor = (SensorInfo*)arg;
+void releaseSensorSlot() {
+      atomic_fetch_sub(&list.active, 1);
+}
 
-      char sensorIP[INET_ADDRSTRLEN];
-      inet_ntop(AF_INET, &sensor->address.sin_addr, sensorIP, INET_ADDRSTRLEN);
-      uint16_t sensorPort = ntohs(sensor->address.sin_port);
+void acceptSensors(Reactor* reactor) {
+      while(true) {
+            struct sockaddr_in newSensorAddress;
+            socklen_t addrLen = sizeof(newSensorAddress);
+            int newSensorFD = accept4(
+                  reactor->listenFD,
+                  (struct sockaddr*)&newSensorAddress,
+                  &addrLen,
+                  SOCK_NONBLOCK
+            );
 
-      printf("New connection from %s:%u\n", sensorIP, sensorPort);
-
-      pthread_mutex_lock(&list.mutex);
-      if(list.active < MAX_SENSORS) {
-            list.sensors[list.active] = sensor;
-            list.active++;
-      } else {
-            pthread_mutex_unlock(&list.mutex);
-            close(sensor->sensorFD);
-            free(sensor);
-            printf("Too sensor conneted. Refused from %s:%u\n", sensorIP, sensorPort);
-            return NULL;
+            if(newSensorFD < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  // edge triggered: stop only once the backlog is empty
+                  if(errno != EAGAIN && errno != EWOULDBLOCK)
+                        perror("Client creation failed");
+                  return;
+            }
+
+            char sensorIP[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &newSensorAddress.sin_addr, sensorIP, INET_ADDRSTRLEN);
+            uint16_t sensorPort = ntohs(newSensorAddress.sin_port);
+
+            if(!reserveSensorSlot()) {
+                  metricsAdd(refusedMetric, 1);
+                  close(newSensorFD);
+                  printf("Too sensor conneted. Refused from %s:%u\n", sensorIP, sensorPort);
+                  continue;
+            }
+
+            SensorInfo* sensor = createSensorInfo(newSensorFD, newSensorAddress);
+            if(!sensor) {
+                  releaseSensorSlot();
+                  continue;
+            }
+
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+            event.data.ptr = sensor;
+            if(epoll_ctl(reactor->epollFD, EPOLL_CTL_ADD, newSensorFD, &event) < 0) {
+                  perror("Epoll add failed");
+                  close(newSensorFD);
+                  poolFree(&sensorPool, sensor);
+                  releaseSensorSlot();
+                  continue;
+            }
+
+            metricsAdd(connectionMetric, 1);
+            printf("New connection from %s:%u\n", sensorIP, sensorPort);
       }
-      pthread_mutex_unlock(&list.mutex);
+}
+
+bool handleSensor(Reactor* reactor, SensorInfo* sensor) {
+      SensorPayload payloads[DECODER_MAX_RECORDS];
 
-      bool receiving = true;
-      while(receiving) {
-            ssize_t bytesReceived = recv(sensor->sensorFD, &sensor->payload, BUFFER_SIZE-1, 0);
+      // edge triggered: read until the socket would block
+      while(true) {
+            ssize_t bytesReceived = decoderFill(&sensor->decoder, sensor->sensorFD);
             if(bytesReceived == -1) {
+                  if(errno == EINTR)
+                        continue;
+                  if(errno == EAGAIN || errno == EWOULDBLOCK)
+                        return true;
                   perror("Receive failed");
-                  receiving = false;
-                  break;
+                  return false;
             } else if(bytesReceived == 0) {
-                  printf("Client %s:%d disconnected\n", sensorIP, sensorPort);
-                  receiving = false;
-                  break;
+                  return false;
             }
 
-            char timeBuffer[128];
-            struct tm* timeinfo = localtime(&sensor->payload.timestamp);
-            strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", timeinfo);
-
-            fprintf(stdout, 
-                  SENSOR_PAYLOAD_FORMAT_SPECIFIER, 
-                  sensor->payload.ID,
-                  timeBuffer,
-                  sensor->payload.temperature,
-                  sensor->payload.humidity,
-                  sensor->payload.quality
-            );
+            // whole records go out as a batch, a partial tail waits for the next read
+            size_t count = decoderExtract(&sensor->decoder, payloads, DECODER_MAX_RECORDS);
+            if(count > 0)
+                  processPayloads(reactor, payloads, count);
       }
+}
 
-      pthread_mutex_lock(&list.mutex);
-      list.sensors[list.active] = NULL;
-      list.active--;
-      pthread_mutex_unlock(&list.mutex);
+void processPayloads(Reactor* reactor, const SensorPayload* payloads, size_t count) {
+      metricsAdd(payloadMetric, count);
+      metricsRecord(batchMetric, count);
+      outputSubmit(&output, reactor->index, payloads, count);
+}
+
+void removeSensor(Reactor* reactor, SensorInfo* sensor) {
+      char sensorIP[INET_ADDRSTRLEN];
+      inet_ntop(AF_INET, &sensor->address.sin_addr, sensorIP, INET_ADDRSTRLEN);
+      uint16_t sensorPort = ntohs(sensor->address.sin_port);
 
       printf("Sensor %s:%d has disconnected\n", sensorIP, sensorPort);
 
+      epoll_ctl(reactor->epollFD, EPOLL_CTL_DEL, sensor->sensorFD, NULL);
       close(sensor->sensorFD);
-      free(sensor);
+      poolFree(&sensorPool, sensor);
+      releaseSensorSlot();
+}
+
+void* runReactor(void* arg) {
+      Reactor* reactor = (Reactor*)arg;
+      struct epoll_event events[MAX_EVENTS];
+
+      bool listening = true;
+      while(listening) {
+            int ready = epoll_wait(reactor->epollFD, events, MAX_EVENTS, -1);
+            if(ready < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  perror("Epoll wait failed");
+                  listening = false;
+                  break;
+            }
+
+            for(int i = 0; i < ready; i++) {
+                  SensorInfo* sensor = events[i].data.ptr;
+                  if(sensor == NULL) {
+                        acceptSensors(reactor);
+                        continue;
+                  }
+
+                  bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+                  if(alive && (events[i].events & (EPOLLIN | EPOLLRDHUP))) {
+                        uint64_t start = metricsNow();
+                        alive = handleSensor(reactor, sensor);
+                        metricsRecord(latencyMetric, metricsNow() - start);
+                  }
+                  if(!alive)
+                        removeSensor(reactor, sensor);
+            }
+      }
+
       return NULL;
-}
\ No newline at end of file
+}
+
+void* handleShutdown(void* arg) {
+      const sigset_t* signals = (const sigset_t*)arg;
+
+      int received;
+      while(sigwait(signals, &received) != 0)
+            ;
+      // the sensors still connected are in use, not leaked
+      printf("Shutting down, %zu sensors connected\n", atomic_load(&list.active));
+      fflush(stdout);
+      poolReport(stderr);
+      exit(EXIT_SUCCESS);
+}
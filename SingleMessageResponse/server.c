@@ -1,25 +1,164 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
 
-#define MAX_CLIENT 4
+#define PORT 8080
+#define MAX_CLIENT 128
 #define MSG_LEN 256
+#define GREETING "Ciao da Manu\n"
+#define USAGE "[fork|prefork|threads] [workers, 0 = one per core]"
+// a preforked worker dying this soon after its start failed to start
+#define WORKER_STARTUP_MS 1000
+// respawn delay after a failed start, doubled at each failure in a row
+#define RESPAWN_DELAY_MS 100
+#define RESPAWN_DELAY_MAX_MS 5000
+// failed starts in a row of a worker before the server gives up
+#define WORKER_MAX_FAILURES 5
 
-int create_server(uint16_t port){
+typedef enum ServeModeTag {
+      MODE_FORK,        // a child per accepted connection
+      MODE_PREFORK,     // worker processes, each with its own listener
+      MODE_THREADS      // worker threads, each with its own listener
+} ServeMode;
+
+/*
+A preforked worker and the listener it inherits: the parent binds it
+once, so a respawned worker takes over its queue without binding again.
+*/
+typedef struct WorkerSlotTag {
+      int listenerFD;
+      pid_t pid;                    // -1 while waiting to be respawned
+      struct timespec started;
+      struct timespec retryAt;
+      unsigned failures;            // failed starts in a row
+      long delayMs;
+} WorkerSlot;
+
+// the response never changes: built once, sent with a single send
+char response[MSG_LEN];
+
+ServeMode mode = MODE_FORK;
+long workerCount = 0;
+WorkerSlot* workers;
+volatile sig_atomic_t stopping = 0;
+
+void checkArgs(int argc, char** argv);
+/*
+Creates the listening socket. With reusePort every worker binds its own
+listener to the port and the kernel spreads connections among them.
+*/
+int create_server(uint16_t port, bool reusePort);
+/*
+Answers a connection with the prebuilt response and closes it.
+*/
+void serveClient(int socketClientFD);
+/*
+Accept loop of a pool worker, until the server stops.
+*/
+void serveForever(int socketServerFD);
+void runFork();
+void runPrefork();
+void runThreads();
+/*
+Forks the worker of slot, or schedules a retry with backoff when fork
+fails. False once the slot failed WORKER_MAX_FAILURES times in a row.
+*/
+bool spawnWorker(WorkerSlot* slot);
+/*
+Accounts for the exit of a worker: one that died at startup is
+respawned with backoff, any other right away. False as spawnWorker.
+*/
+bool workerExited(WorkerSlot* slot);
+bool retryFailed(WorkerSlot* slot);
+long elapsedMs(const struct timespec* from, const struct timespec* to);
+void* workerThread(void* arg);
+void reapChildren(int signal);
+void stopServer(int signal);
+
+int main(int argc, char** argv) {
+      checkArgs(argc, argv);
+      memset(response, 0, sizeof response);
+      memcpy(response, GREETING, sizeof GREETING - 1);
+      // a client leaving before the response must not kill the worker
+      signal(SIGPIPE, SIG_IGN);
+
+      switch(mode) {
+            case MODE_FORK:
+                  runFork();
+                  break;
+            case MODE_PREFORK:
+                  runPrefork();
+                  break;
+            case MODE_THREADS:
+                  runThreads();
+                  break;
+      }
+
+      exit(EXIT_SUCCESS);
+}
+
+void checkArgs(int argc, char** argv) {
+      if(argc > 3) {
+            fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
+            exit(EXIT_FAILURE);
+      }
+
+      if(argc > 1) {
+            if(strcmp(argv[1], "fork") == 0) {
+                  mode = MODE_FORK;
+            } else if(strcmp(argv[1], "prefork") == 0) {
+                  mode = MODE_PREFORK;
+            } else if(strcmp(argv[1], "threads") == 0) {
+                  mode = MODE_THREADS;
+            } else {
+                  fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
+                  exit(EXIT_FAILURE);
+            }
+      }
+
+      if(argc > 2 && (workerCount = atol(argv[2])) < 0) {
+            fprintf(stderr, "Invalid workers: %s\n", argv[2]);
+            exit(EXIT_FAILURE);
+      }
+      if(workerCount == 0)
+            workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+      if(workerCount <= 0)
+            workerCount = 1;
+}
+
+int create_server(uint16_t port, bool reusePort){
       int socketServerFD;
       struct sockaddr_in addr;
-      socklen_t addr_len = sizeof(addr);
       if ((socketServerFD = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
             perror("socket failed");
             return -1;
       }
 
+      // it closes every connection first: restarts must not wait out TIME_WAIT
+      int enable = 1;
+      if (setsockopt(socketServerFD, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+            perror("SO_REUSEADDR failed");
+            close(socketServerFD);
+            return -1;
+      }
+      if (reusePort && setsockopt(socketServerFD, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+            perror("SO_REUSEPORT failed");
+            close(socketServerFD);
+            return -1;
+      }
+
       memset(&addr, 0, sizeof(addr));
       addr.sin_family = AF_INET;
       addr.sin_port = htons(port);
@@ -28,49 +167,261 @@ int create_server(uint16_t port){
       // Bind and listen
       if (bind(socketServerFD, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
             perror("bind failed");
+            close(socketServerFD);
             return -2;
       }
 
       if (listen(socketServerFD, MAX_CLIENT) < 0) {
             perror("listen failed");
+            close(socketServerFD);
             return -3;
       }
 
       return socketServerFD;
 }
 
-int main() {
-      int socketServerFD, socketClientFD;
-      struct sockaddr_in sa;
-      struct sockaddr saClientConnected;
-      socklen_t clientLen = sizeof(saClientConnected);
+void serveClient(int socketClientFD) {
+      ssize_t sent = send(socketClientFD, response, MSG_LEN, MSG_NOSIGNAL);
+      if (sent < 0)
+            perror("send failed");
+      close(socketClientFD);
+}
 
-      /* 1) Create a TCP socket */
-      socketServerFD = create_server(8080);
+void serveForever(int socketServerFD) {
+      while(!stopping) {
+            int socketClientFD = accept(socketServerFD, NULL, NULL);
+            if(socketClientFD < 0) {
+                  if(errno != EINTR && errno != ECONNABORTED)
+                        perror("accept failed");
+                  continue;
+            }
+            serveClient(socketClientFD);
+      }
+}
+
+void runFork() {
+      int socketServerFD = create_server(PORT, false);
+      if (socketServerFD < 0)
+            exit(EXIT_FAILURE);
+
+      // children are reaped as they exit, no zombies pile up
+      struct sigaction reap;
+      memset(&reap, 0, sizeof(reap));
+      reap.sa_handler = reapChildren;
+      sigemptyset(&reap.sa_mask);
+      reap.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+      sigaction(SIGCHLD, &reap, NULL);
+
+      printf("Listening on port %d, a process per connection\n", PORT);
 
       bool comunicating = true;
       while(comunicating) {
-            socketClientFD = accept(socketServerFD, (struct sockaddr*)&saClientConnected, &clientLen);
+            int socketClientFD = accept(socketServerFD, NULL, NULL);
+            if (socketClientFD < 0) {
+                  if (errno != EINTR && errno != ECONNABORTED)
+                        perror("accept failed");
+                  continue;
+            }
 
             pid_t pid = fork();
-            printf("%d\n", pid);
-            
             if(pid == 0) {
                   // Child process that will handle socket client file descriptor that has been accepted
 
                   // we need no more file descriptor of server, we'll handle only fd of client
                   close(socketServerFD);
-
-                  char msg[MSG_LEN] = "Ciao da Manu\n\0";
-                  // scanf("%s", &msg);
-
-                  write(socketClientFD, msg, MSG_LEN);
-
-                  close(socketClientFD);
+                  serveClient(socketClientFD);
                   _exit(0);
             } else {
+                  if (pid < 0)
+                        perror("fork failed");
                   // I'm still server, don't need to handle client socket file descriptor
                   close(socketClientFD);
             }
       }
 }
+
+void runPrefork() {
+      workers = calloc(workerCount, sizeof(*workers));
+      if (!workers) {
+            perror("Allocation failed");
+            exit(EXIT_FAILURE);
+      }
+
+      struct sigaction stop;
+      memset(&stop, 0, sizeof(stop));
+      stop.sa_handler = stopServer;
+      sigemptyset(&stop.sa_mask);
+      sigaction(SIGINT, &stop, NULL);
+      sigaction(SIGTERM, &stop, NULL);
+
+      // bound here, so a port in use stops the server before any fork
+      for (long i = 0; i < workerCount; i++) {
+            workers[i].pid = -1;
+            if ((workers[i].listenerFD = create_server(PORT, true)) < 0)
+                  exit(EXIT_FAILURE);
+      }
+
+      printf("Listening on port %d, %ld preforked workers\n", PORT, workerCount);
+
+      bool running = true;
+      for (long i = 0; running && i < workerCount; i++)
+            running = spawnWorker(&workers[i]);
+
+      // the parent only supervises: it reaps every worker and replaces the ones that died
+      while (running && !stopping) {
+            bool waiting = false;
+            for (long i = 0; running && i < workerCount; i++) {
+                  if (workers[i].pid < 0) {
+                        running = retryFailed(&workers[i]);
+                        waiting = waiting || workers[i].pid < 0;
+                  }
+            }
+            if (!running)
+                  break;
+
+            // with a respawn pending, poll for exits until it is due
+            pid_t pid = waitpid(-1, NULL, waiting ? WNOHANG : 0);
+            if (pid < 0 && errno != EINTR && errno != ECHILD)
+                  perror("waitpid failed");
+            if (pid <= 0) {
+                  if (waiting && !stopping)
+                        nanosleep(&(struct timespec){ 0, RESPAWN_DELAY_MS * 1000000L }, NULL);
+                  continue;
+            }
+
+            for (long i = 0; i < workerCount; i++) {
+                  if (workers[i].pid == pid)
+                        running = workerExited(&workers[i]);
+            }
+      }
+
+      for (long i = 0; i < workerCount; i++) {
+            if (workers[i].pid > 0)
+                  kill(workers[i].pid, SIGTERM);
+      }
+      while (waitpid(-1, NULL, 0) > 0)
+            ;
+      for (long i = 0; i < workerCount; i++)
+            close(workers[i].listenerFD);
+      free(workers);
+
+      if (!running) {
+            fprintf(stderr, "Workers keep failing at startup, giving up\n");
+            exit(EXIT_FAILURE);
+      }
+}
+
+bool spawnWorker(WorkerSlot* slot) {
+      clock_gettime(CLOCK_MONOTONIC, &slot->started);
+      pid_t pid = fork();
+      if (pid > 0) {
+            slot->pid = pid;
+            return true;
+      }
+      if (pid < 0) {
+            perror("fork failed");
+            return workerExited(slot);
+      }
+
+      // a worker dies with the default action, its parent does the cleanup
+      signal(SIGINT, SIG_DFL);
+      signal(SIGTERM, SIG_DFL);
+      for (long i = 0; i < workerCount; i++) {
+            if (&workers[i] != slot)
+                  close(workers[i].listenerFD);
+      }
+      serveForever(slot->listenerFD);
+      _exit(EXIT_SUCCESS);
+}
+
+bool workerExited(WorkerSlot* slot) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      pid_t pid = slot->pid;
+      slot->pid = -1;
+      slot->retryAt = now;
+
+      if (elapsedMs(&slot->started, &now) >= WORKER_STARTUP_MS) {
+            fprintf(stderr, "Worker %d exited, restarting it\n", pid);
+            slot->failures = 0;
+            slot->delayMs = 0;
+            return true;
+      }
+
+      // do not spin when workers cannot even start
+      if (++slot->failures >= WORKER_MAX_FAILURES)
+            return false;
+      slot->delayMs = slot->delayMs == 0 ? RESPAWN_DELAY_MS : slot->delayMs * 2;
+      if (slot->delayMs > RESPAWN_DELAY_MAX_MS)
+            slot->delayMs = RESPAWN_DELAY_MAX_MS;
+      slot->retryAt.tv_sec += slot->delayMs / 1000;
+      slot->retryAt.tv_nsec += (slot->delayMs % 1000) * 1000000L;
+      if (slot->retryAt.tv_nsec >= 1000000000L) {
+            slot->retryAt.tv_sec++;
+            slot->retryAt.tv_nsec -= 1000000000L;
+      }
+      fprintf(stderr, "Worker %d failed at startup, retrying in %ld ms\n", pid, slot->delayMs);
+      return true;
+}
+
+bool retryFailed(WorkerSlot* slot) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (elapsedMs(&slot->retryAt, &now) < 0)
+            return true;
+      return spawnWorker(slot);
+}
+
+long elapsedMs(const struct timespec* from, const struct timespec* to) {
+      return (to->tv_sec - from->tv_sec) * 1000L + (to->tv_nsec - from->tv_nsec) / 1000000L;
+}
+
+void runThreads() {
+      pthread_t* threads = calloc(workerCount, sizeof(*threads));
+      int* listeners = calloc(workerCount, sizeof(*listeners));
+      if (!threads || !listeners) {
+            perror("Allocation failed");
+            exit(EXIT_FAILURE);
+      }
+
+      for (long i = 0; i < workerCount; i++) {
+            if ((listeners[i] = create_server(PORT, true)) < 0)
+                  exit(EXIT_FAILURE);
+      }
+
+      printf("Listening on port %d, %ld worker threads\n", PORT, workerCount);
+
+      // the main thread is the first worker
+      for (long i = 1; i < workerCount; i++) {
+            if (pthread_create(&threads[i], NULL, workerThread, &listeners[i]) != 0) {
+                  perror("Thread creation failed");
+                  exit(EXIT_FAILURE);
+            }
+      }
+      serveForever(listeners[0]);
+
+      for (long i = 1; i < workerCount; i++)
+            pthread_join(threads[i], NULL);
+      for (long i = 0; i < workerCount; i++)
+            close(listeners[i]);
+      free(listeners);
+      free(threads);
+}
+
+void* workerThread(void* arg) {
+      serveForever(*(int*)arg);
+      return NULL;
+}
+
+void reapChildren(int signal) {
+      (void)signal;
+      int savedErrno = errno;
+      while (waitpid(-1, NULL, WNOHANG) > 0)
+            ;
+      errno = savedErrno;
+}
+
+void stopServer(int signal) {
+      (void)signal;
+      stopping = 1;
+}
@@ -0,0 +1,185 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../Common/gorilla.h"
+
+#define READINGS (1 << 20)
+#define DEFAULT_BLOCK 4096
+#define TICK 2
+// packed SensorPayload: SensorV2 without the sensor, Sensori with its ID byte
+#define SENSORV2_PAYLOAD_SIZE 11
+#define SENSORI_PAYLOAD_SIZE 15
+
+typedef struct DatasetTag {
+      const char* name;
+      const GorillaKind* kinds;
+      size_t channels;
+      size_t rawSize;
+      GorillaSample* samples;
+} Dataset;
+
+static const GorillaKind sensorV2Kinds[] = { GORILLA_BYTE, GORILLA_BYTE, GORILLA_BYTE };
+static const GorillaKind sensoriKinds[] = { GORILLA_FLOAT, GORILLA_BYTE, GORILLA_BYTE };
+
+/*
+Fills the dataset with a reading every TICK seconds (with some jitter).
+drift: values wander by at most one step per tick like a real sensor,
+otherwise they are uniform random like createRandomPayload.
+*/
+void generate(Dataset* dataset, bool drift);
+/*
+Encodes the dataset in blocks of blockSize bytes, decodes it back and
+prints bytes/reading and encode/decode ns/reading.
+*/
+bool runBenchmark(const Dataset* dataset, size_t blockSize);
+double elapsedNs(const struct timespec* start, const struct timespec* end);
+
+int main(int argc, char** argv) {
+      size_t blockSize = DEFAULT_BLOCK;
+      if(argc > 2) {
+            fprintf(stderr, "Usage: %s [block size]\n", argv[0]);
+            exit(EXIT_FAILURE);
+      }
+      if(argc == 2 && (blockSize = strtoul(argv[1], NULL, 10)) < 64) {
+            fprintf(stderr, "Block size must be at least 64 bytes\n");
+            exit(EXIT_FAILURE);
+      }
+
+      Dataset datasets[] = {
+            { "SensorV2 drifting", sensorV2Kinds, 3, SENSORV2_PAYLOAD_SIZE, NULL },
+            { "SensorV2 random", sensorV2Kinds, 3, SENSORV2_PAYLOAD_SIZE, NULL },
+            { "Sensori drifting", sensoriKinds, 3, SENSORI_PAYLOAD_SIZE, NULL },
+            { "Sensori random", sensoriKinds, 3, SENSORI_PAYLOAD_SIZE, NULL },
+      };
+      size_t count = sizeof datasets / sizeof datasets[0];
+
+      srand(42);
+      printf("%-20s %10s %10s %8s %12s %12s\n", "dataset", "raw B/r", "coded B/r", "ratio", "encode ns/r", "decode ns/r");
+      for(size_t i = 0; i < count; i++) {
+            datasets[i].samples = malloc(READINGS * sizeof *datasets[i].samples);
+            if(!datasets[i].samples) {
+                  perror("Memory allocation failed");
+                  exit(EXIT_FAILURE);
+            }
+            generate(&datasets[i], i % 2 == 0);
+            bool passed = runBenchmark(&datasets[i], blockSize);
+            free(datasets[i].samples);
+            if(!passed)
+                  exit(EXIT_FAILURE);
+      }
+
+      exit(EXIT_SUCCESS);
+}
+
+void generate(Dataset* dataset, bool drift) {
+      int64_t timestamp = time(NULL);
+      int values[GORILLA_MAX_CHANNELS] = { 35, 40, 60 };
+
+      for(size_t i = 0; i < READINGS; i++) {
+            GorillaSample* sample = &dataset->samples[i];
+            // a late tick now and then
+            timestamp += TICK + (rand() % 50 == 0);
+            sample->timestamp = timestamp;
+
+            for(size_t c = 0; c < dataset->channels; c++) {
+                  if(drift) {
+                        values[c] += rand() % 3 - 1;
+                        if(values[c] < 0)
+                              values[c] = 0;
+                        if(values[c] > 99)
+                              values[c] = 99;
+                  } else {
+                        values[c] = rand() % 100;
+                  }
+
+                  if(dataset->kinds[c] == GORILLA_FLOAT) {
+                        // Sensori temperatures have two meaningful decimals
+                        float temperature = values[c] + (drift ? 0.25f * (i % 4) : (rand() % 100) / 100.0f);
+                        sample->values[c] = gorillaFloatBits(temperature);
+                  } else {
+                        sample->values[c] = (uint32_t)values[c];
+                  }
+            }
+      }
+}
+
+bool runBenchmark(const Dataset* dataset, size_t blockSize) {
+      // every block holds at least this many readings
+      size_t perBlock = (blockSize - 1) * 8 / GORILLA_MAX_SAMPLE_BITS;
+      size_t maxBlocks = READINGS / (perBlock > 0 ? perBlock : 1) + 1;
+      uint8_t* data = malloc(maxBlocks * blockSize);
+      size_t* lengths = malloc(maxBlocks * sizeof *lengths);
+      size_t* counts = malloc(maxBlocks * sizeof *counts);
+      if(!data || !lengths || !counts) {
+            perror("Memory allocation failed");
+            free(data);
+            free(lengths);
+            free(counts);
+            return false;
+      }
+
+      struct timespec start, end;
+      size_t blocks = 0;
+      size_t total = 0;
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      GorillaEncoder encoder;
+      gorillaEncoderInit(&encoder, data, blockSize, dataset->kinds, dataset->channels);
+      counts[0] = 0;
+      for(size_t i = 0; i < READINGS; i++) {
+            if(!gorillaAppend(&encoder, &dataset->samples[i])) {
+                  lengths[blocks] = gorillaFinish(&encoder);
+                  total += lengths[blocks];
+                  blocks++;
+                  counts[blocks] = 0;
+                  gorillaEncoderInit(&encoder, data + blocks * blockSize, blockSize, dataset->kinds, dataset->channels);
+                  gorillaAppend(&encoder, &dataset->samples[i]);
+            }
+            counts[blocks]++;
+      }
+      lengths[blocks] = gorillaFinish(&encoder);
+      total += lengths[blocks];
+      blocks++;
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double encodeNs = elapsedNs(&start, &end);
+
+      size_t mismatches = 0;
+      size_t next = 0;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for(size_t b = 0; b < blocks; b++) {
+            GorillaDecoder decoder;
+            gorillaDecoderInit(&decoder, data + b * blockSize, lengths[b], dataset->kinds, dataset->channels);
+            for(size_t i = 0; i < counts[b]; i++, next++) {
+                  GorillaSample sample;
+                  const GorillaSample* expected = &dataset->samples[next];
+                  if(!gorillaNext(&decoder, &sample)
+                        || sample.timestamp != expected->timestamp
+                        || memcmp(sample.values, expected->values, dataset->channels * sizeof sample.values[0]) != 0)
+                        mismatches++;
+            }
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      double decodeNs = elapsedNs(&start, &end);
+
+      double bytesPerReading = (double)total / READINGS;
+      printf("%-20s %10zu %10.3f %7.1fx %12.2f %12.2f\n",
+            dataset->name, dataset->rawSize, bytesPerReading, dataset->rawSize / bytesPerReading,
+            encodeNs / READINGS, decodeNs / READINGS);
+
+      free(data);
+      free(lengths);
+      free(counts);
+
+      if(mismatches > 0) {
+            fprintf(stderr, "%s: %zu readings did not survive the roundtrip\n", dataset->name, mismatches);
+            return false;
+      }
+      return true;
+}
+
+double elapsedNs(const struct timespec* start, const struct timespec* end) {
+      return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
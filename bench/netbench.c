@@ -0,0 +1,881 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../SensorV2/wire.h"
+#include "../MessagingApp/framing.h"
+
+#define USAGE "<accept|chat|sensori|sensorv2> [-c concurrency] [-d seconds] [-r messages/s, 0 = flat out] [-b readings per datagram] [-p server pid] [-s server output] [-o results file] [-l label] [-v server variant]"
+#define DEFAULT_CONCURRENCY 8
+#define DEFAULT_SECONDS 5
+#define DEFAULT_RESULTS "results.jsonl"
+#define TICK_NS 1000000L
+#define MAX_EVENTS 256
+// SingleMessageResponse answers every connection with MSG_LEN bytes
+#define ACCEPT_RESPONSE 256
+// every chat client is in the one room, each message reaches all the others
+#define CHAT_MAX_CLIENTS 64
+#define CHAT_BUFFER 4096
+#define CHAT_TIMEOUT_NS 1000000000L
+// packed Sensori SensorPayload: ID, time_t timestamp, float, humidity, quality
+#define SENSORI_PAYLOAD_SIZE 15
+#define SENSORI_CHUNK 64
+// chunks written per event when flat out, so the deadline is still checked
+#define SENSORI_WRITES 16
+#define SENSORV2_CHUNK 64
+// time the servers get to register connections before traffic starts
+#define SETTLE_NS 200000000L
+
+typedef enum ScenarioTag {
+      SCENARIO_ACCEPT,
+      SCENARIO_CHAT,
+      SCENARIO_SENSORI,
+      SCENARIO_SENSORV2
+} Scenario;
+
+/*
+What each scenario drives and what its latency samples measure. The
+sensor servers never answer a reading, so their latency is the
+connection (registration) setup and their throughput is checked against
+the lines counted in the server output, marker identifying a reading.
+*/
+typedef struct ScenarioInfoTag {
+      const char* name;
+      const char* server;
+      const char* latency;
+      uint16_t port;
+      const char* marker;
+} ScenarioInfo;
+
+static const ScenarioInfo scenarios[] = {
+      { "accept", "SingleMessageResponse", "connect to response", 8080, NULL },
+      { "chat", "MessagingApp", "broadcast delivery", 8080, NULL },
+      { "sensori", "Sensori", "connect", 8080, ":\tT " },
+      { "sensorv2", "SensorV2", "registration connect", CONNECTION_PORT, " at " },
+};
+
+typedef struct ConnectionTag {
+      int fd;
+      size_t index;
+      uint64_t start;
+      bool connected;
+      size_t received;
+      // chat: the message in flight and the deliveries still missing
+      uint64_t sequence;
+      uint64_t sentAt;
+      size_t pendingDeliveries;
+      FrameReader frames;
+      // sensori: the chunk being written
+      uint8_t out[SENSORI_CHUNK * SENSORI_PAYLOAD_SIZE];
+      size_t outLength;
+      size_t outOffset;
+      bool watchingOut;
+      // sensorv2: the data socket and its batch numbering
+      int udpFD;
+      in_port_t dataPort;
+      uint32_t batchSequence;
+      double credit;
+} Connection;
+
+typedef struct LatencyLogTag {
+      uint64_t* samples;
+      size_t count;
+      size_t capacity;
+} LatencyLog;
+
+typedef struct ResultsTag {
+      uint64_t connections;
+      uint64_t messages;
+      uint64_t errors;
+      long long delivered;          // -1 when the server output is not counted
+      double connectSeconds;
+      double seconds;
+      double cpuSeconds;            // -1 without a server pid
+      long peakRSS;                 // kB, -1 without a server pid
+} Results;
+
+Scenario scenario;
+const ScenarioInfo* info;
+size_t concurrency = DEFAULT_CONCURRENCY;
+unsigned duration = DEFAULT_SECONDS;
+double rate = 0;
+size_t batchSize = 1;
+pid_t serverPID = 0;
+const char* serverOutput = NULL;
+const char* resultsPath = DEFAULT_RESULTS;
+const char* label = "";
+const char* variant = "";
+
+struct sockaddr_in serverAddr;
+int epollFD;
+Connection* connections;
+LatencyLog latencies;
+Results results;
+
+void checkArgs(int argc, char** argv);
+uint64_t nowNs();
+void latencyRecord(LatencyLog* log, uint64_t ns);
+/*
+Sorts the samples the first time, q in [0, 1].
+*/
+double latencyPercentileUs(LatencyLog* log, double q);
+bool startConnect(Connection* c, uint16_t port);
+void closeConnection(Connection* c);
+void watch(Connection* c, uint32_t events, int op);
+/*
+Opens every connection of the scenario and waits until all of them
+completed or failed, recording how long each took.
+*/
+void connectAll(uint16_t port);
+
+void handleAccept(Connection* c, uint32_t events);
+void chatSend(Connection* c);
+void handleChat(Connection* c, uint32_t events);
+bool chatFrame(const char* payload, size_t length, void* ctx);
+void chatExpire(uint64_t now);
+void sensoriWrite(Connection* c, bool paced);
+void sensorV2Register(Connection* c);
+void sensorV2Send(Connection* c, bool paced);
+
+/*
+CPU time of the server, plus the children it has not reaped yet (zombies
+keep their counters until then), in clock ticks.
+*/
+long long serverCpuTicks();
+long serverPeakRSS();
+off_t fileSize(const char* path);
+long long countLines(const char* path, off_t from, const char* marker);
+void writeResults();
+
+int main(int argc, char** argv) {
+      checkArgs(argc, argv);
+      signal(SIGPIPE, SIG_IGN);
+
+      if((epollFD = epoll_create1(0)) < 0) {
+            perror("Epoll creation failed");
+            exit(EXIT_FAILURE);
+      }
+
+      connections = calloc(concurrency, sizeof *connections);
+      if(!connections) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+      }
+      for(size_t i = 0; i < concurrency; i++) {
+            connections[i].fd = -1;
+            connections[i].udpFD = -1;
+            connections[i].index = i;
+      }
+
+      results.delivered = -1;
+      results.cpuSeconds = -1;
+      results.peakRSS = -1;
+
+      // long lived connections are opened before the clock starts
+      if(scenario != SCENARIO_ACCEPT) {
+            uint64_t start = nowNs();
+            connectAll(info->port);
+            results.connectSeconds = (nowNs() - start) / 1e9;
+            struct timespec settle = { 0, SETTLE_NS };
+            nanosleep(&settle, NULL);
+      }
+
+      int timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+      struct itimerspec period = { { 0, TICK_NS }, { 0, TICK_NS } };
+      if(timerFD < 0 || timerfd_settime(timerFD, 0, &period, NULL) < 0) {
+            perror("Timer creation failed");
+            exit(EXIT_FAILURE);
+      }
+      struct epoll_event timerEvent = { .events = EPOLLIN, .data.ptr = NULL };
+      epoll_ctl(epollFD, EPOLL_CTL_ADD, timerFD, &timerEvent);
+
+      off_t outputStart = serverOutput ? fileSize(serverOutput) : 0;
+      long long cpuStart = serverCpuTicks();
+      uint64_t start = nowNs();
+      uint64_t deadline = start + duration * 1000000000ULL;
+      bool paced = rate > 0;
+
+      switch(scenario) {
+            case SCENARIO_ACCEPT:
+                  for(size_t i = 0; i < concurrency; i++)
+                        if(!startConnect(&connections[i], info->port))
+                              results.errors++;
+                  break;
+            case SCENARIO_CHAT:
+                  for(size_t i = 0; i < concurrency; i++)
+                        if(connections[i].connected)
+                              chatSend(&connections[i]);
+                  break;
+            case SCENARIO_SENSORI:
+                  if(!paced)
+                        for(size_t i = 0; i < concurrency; i++)
+                              if(connections[i].connected)
+                                    watch(&connections[i], EPOLLOUT, EPOLL_CTL_MOD);
+                  break;
+            case SCENARIO_SENSORV2:
+                  break;
+      }
+
+      uint64_t now = start;
+      while(now < deadline) {
+            // flat out UDP never blocks in epoll, it sends between polls
+            int timeout = scenario == SCENARIO_SENSORV2 && !paced ? 0 : 100;
+            struct epoll_event events[MAX_EVENTS];
+            int ready = epoll_wait(epollFD, events, MAX_EVENTS, timeout);
+            if(ready < 0) {
+                  if(errno == EINTR)
+                        continue;
+                  perror("Epoll wait failed");
+                  break;
+            }
+
+            for(int i = 0; i < ready; i++) {
+                  Connection* c = events[i].data.ptr;
+                  if(c == NULL) {
+                        uint64_t expirations;
+                        if(read(timerFD, &expirations, sizeof expirations) != sizeof expirations)
+                              continue;
+                        for(size_t j = 0; j < concurrency; j++) {
+                              Connection* t = &connections[j];
+                              if(scenario == SCENARIO_ACCEPT && t->fd == -1 && !startConnect(t, info->port))
+                                    results.errors++;
+                              if(!paced || !t->connected)
+                                    continue;
+                              t->credit += rate / concurrency / 1000 * expirations;
+                              if(scenario == SCENARIO_SENSORI)
+                                    sensoriWrite(t, true);
+                              else if(scenario == SCENARIO_SENSORV2)
+                                    sensorV2Send(t, true);
+                        }
+                        if(scenario == SCENARIO_CHAT)
+                              chatExpire(nowNs());
+                        continue;
+                  }
+
+                  if(scenario == SCENARIO_ACCEPT)
+                        handleAccept(c, events[i].events);
+                  else if(scenario == SCENARIO_CHAT)
+                        handleChat(c, events[i].events);
+                  else if(scenario == SCENARIO_SENSORI) {
+                        if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                              results.errors++;
+                              closeConnection(c);
+                        } else {
+                              sensoriWrite(c, paced);
+                        }
+                  }
+            }
+
+            if(scenario == SCENARIO_SENSORV2 && !paced)
+                  for(size_t j = 0; j < concurrency; j++)
+                        if(connections[j].connected)
+                              sensorV2Send(&connections[j], false);
+
+            now = nowNs();
+      }
+
+      results.seconds = (now - start) / 1e9;
+      if(scenario == SCENARIO_ACCEPT)
+            results.connectSeconds = results.seconds;
+
+      long long cpuEnd = serverCpuTicks();
+      if(cpuStart >= 0 && cpuEnd >= 0) {
+            results.cpuSeconds = (double)(cpuEnd - cpuStart) / sysconf(_SC_CLK_TCK);
+            results.peakRSS = serverPeakRSS();
+      }
+
+      for(size_t i = 0; i < concurrency; i++)
+            closeConnection(&connections[i]);
+
+      if(serverOutput && info->marker) {
+            // let the output stage drain what is already queued
+            struct timespec settle = { 0, SETTLE_NS * 5 };
+            nanosleep(&settle, NULL);
+            results.delivered = countLines(serverOutput, outputStart, info->marker);
+      }
+
+      writeResults();
+
+      free(latencies.samples);
+      free(connections);
+      close(timerFD);
+      close(epollFD);
+      exit(EXIT_SUCCESS);
+}
+
+void checkArgs(int argc, char** argv) {
+      if(argc < 2) {
+            fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
+            exit(EXIT_FAILURE);
+      }
+
+      size_t count = sizeof scenarios / sizeof scenarios[0];
+      size_t s = 0;
+      while(s < count && strcmp(argv[1], scenarios[s].name) != 0)
+            s++;
+      if(s == count) {
+            fprintf(stderr, "Unknown scenario: %s\nUSAGE: %s %s\n", argv[1], argv[0], USAGE);
+            exit(EXIT_FAILURE);
+      }
+      scenario = (Scenario)s;
+      info = &scenarios[s];
+
+      int option;
+      optind = 2;
+      while((option = getopt(argc, argv, "c:d:r:b:p:s:o:l:v:")) != -1) {
+            switch(option) {
+                  case 'c': concurrency = strtoul(optarg, NULL, 10); break;
+                  case 'd': duration = strtoul(optarg, NULL, 10); break;
+                  case 'r': rate = strtod(optarg, NULL); break;
+                  case 'b': batchSize = strtoul(optarg, NULL, 10); break;
+                  case 'p': serverPID = (pid_t)atoi(optarg); break;
+                  case 's': serverOutput = optarg; break;
+                  case 'o': resultsPath = optarg; break;
+                  case 'l': label = optarg; break;
+                  case 'v': variant = optarg; break;
+                  default:
+                        fprintf(stderr, "USAGE: %s %s\n", argv[0], USAGE);
+                        exit(EXIT_FAILURE);
+            }
+      }
+
+      if(concurrency == 0 || duration == 0 || rate < 0 || batchSize == 0 || batchSize > SENSOR_BATCH_MAX_READINGS) {
+            fprintf(stderr, "Need concurrency > 0, seconds > 0, rate >= 0, readings per datagram in [1, %d]\n",
+                  (int)SENSOR_BATCH_MAX_READINGS);
+            exit(EXIT_FAILURE);
+      }
+      if(scenario == SCENARIO_CHAT && (concurrency < 2 || concurrency > CHAT_MAX_CLIENTS)) {
+            fprintf(stderr, "The chat room takes 2 to %d clients\n", CHAT_MAX_CLIENTS);
+            exit(EXIT_FAILURE);
+      }
+      if(scenario == SCENARIO_SENSORV2 && concurrency > MAX_SENSORS + 1) {
+            fprintf(stderr, "SensorV2 registers at most %d sensors\n", MAX_SENSORS + 1);
+            exit(EXIT_FAILURE);
+      }
+
+      memset(&serverAddr, 0, sizeof serverAddr);
+      serverAddr.sin_family = AF_INET;
+      serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+uint64_t nowNs() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void latencyRecord(LatencyLog* log, uint64_t ns) {
+      if(log->count == log->capacity) {
+            size_t capacity = log->capacity ? log->capacity * 2 : 4096;
+            uint64_t* samples = realloc(log->samples, capacity * sizeof *samples);
+            if(!samples)
+                  return;
+            log->samples = samples;
+            log->capacity = capacity;
+      }
+      log->samples[log->count++] = ns;
+}
+
+static int compareSamples(const void* a, const void* b) {
+      uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+      return (x > y) - (x < y);
+}
+
+double latencyPercentileUs(LatencyLog* log, double q) {
+      static bool sorted = false;
+      if(log->count == 0)
+            return -1;
+      if(!sorted) {
+            qsort(log->samples, log->count, sizeof *log->samples, compareSamples);
+            sorted = true;
+      }
+      size_t rank = (size_t)(q * (log->count - 1) + 0.5);
+      return log->samples[rank] / 1e3;
+}
+
+bool startConnect(Connection* c, uint16_t port) {
+      struct sockaddr_in addr = serverAddr;
+      addr.sin_port = htons(port);
+
+      c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+      if(c->fd < 0) {
+            perror("Socket creation failed");
+            return false;
+      }
+      // the driver must not add Nagle delays to what it measures
+      int noDelay = 1;
+      setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof noDelay);
+      c->start = nowNs();
+      c->connected = false;
+      c->received = 0;
+      if(connect(c->fd, (struct sockaddr*)&addr, sizeof addr) < 0 && errno != EINPROGRESS) {
+            close(c->fd);
+            c->fd = -1;
+            return false;
+      }
+
+      // the accept scenario waits for the response, the others for the handshake
+      watch(c, scenario == SCENARIO_ACCEPT ? EPOLLIN : EPOLLOUT, EPOLL_CTL_ADD);
+      return true;
+}
+
+void closeConnection(Connection* c) {
+      if(c->fd != -1) {
+            epoll_ctl(epollFD, EPOLL_CTL_DEL, c->fd, NULL);
+            close(c->fd);
+            c->fd = -1;
+      }
+      if(c->udpFD != -1) {
+            close(c->udpFD);
+            c->udpFD = -1;
+      }
+      c->connected = false;
+}
+
+void watch(Connection* c, uint32_t events, int op) {
+      struct epoll_event event = { .events = events, .data.ptr = c };
+      epoll_ctl(epollFD, op, c->fd, &event);
+      c->watchingOut = (events & EPOLLOUT) != 0;
+}
+
+void connectAll(uint16_t port) {
+      size_t pending = 0;
+      for(size_t i = 0; i < concurrency; i++) {
+            Connection* c = &connections[i];
+            if(scenario == SCENARIO_SENSORV2) {
+                  // the data socket exists first, its port goes in the registration
+                  struct sockaddr_in local = { .sin_family = AF_INET };
+                  socklen_t localLen = sizeof local;
+                  c->udpFD = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+                  if(c->udpFD < 0
+                        || bind(c->udpFD, (struct sockaddr*)&local, sizeof local) < 0
+                        || getsockname(c->udpFD, (struct sockaddr*)&local, &localLen) < 0) {
+                        perror("Data socket creation failed");
+                        exit(EXIT_FAILURE);
+                  }
+                  c->dataPort = local.sin_port;
+            }
+            if(startConnect(c, port))
+                  pending++;
+            else
+                  results.errors++;
+      }
+
+      while(pending > 0) {
+            struct epoll_event events[MAX_EVENTS];
+            int ready = epoll_wait(epollFD, events, MAX_EVENTS, 1000);
+            if(ready <= 0) {
+                  if(ready < 0 && errno == EINTR)
+                        continue;
+                  fprintf(stderr, "%zu connections never completed\n", pending);
+                  results.errors += pending;
+                  return;
+            }
+
+            for(int i = 0; i < ready; i++) {
+                  Connection* c = events[i].data.ptr;
+                  pending--;
+
+                  int error = 0;
+                  socklen_t length = sizeof error;
+                  getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                  if(error != 0 || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                        results.errors++;
+                        closeConnection(c);
+                        continue;
+                  }
+
+                  latencyRecord(&latencies, nowNs() - c->start);
+                  results.connections++;
+                  c->connected = true;
+
+                  if(scenario == SCENARIO_SENSORV2)
+                        sensorV2Register(c);
+                  else if(scenario == SCENARIO_CHAT)
+                        watch(c, EPOLLIN, EPOLL_CTL_MOD);
+                  else
+                        watch(c, 0, EPOLL_CTL_MOD);
+            }
+      }
+}
+
+void handleAccept(Connection* c, uint32_t events) {
+      char buffer[ACCEPT_RESPONSE];
+      ssize_t n;
+      while((n = recv(c->fd, buffer, sizeof buffer, 0)) > 0)
+            c->received += n;
+
+      if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !(events & (EPOLLERR | EPOLLHUP)))
+            return;
+
+      // the server closes right after the response
+      if(n == 0 && c->received == ACCEPT_RESPONSE) {
+            latencyRecord(&latencies, nowNs() - c->start);
+            results.connections++;
+            results.messages++;
+      } else {
+            results.errors++;
+      }
+      closeConnection(c);
+      if(!startConnect(c, info->port))
+            results.errors++;
+}
+
+void chatSend(Connection* c) {
+      // '#' and ';' delimit a message whatever the server puts around it
+      char frame[FRAME_HEADER + 64];
+      c->sequence++;
+      c->sentAt = nowNs();
+      int length = snprintf(frame + FRAME_HEADER, sizeof frame - FRAME_HEADER, "#%zu,%llu,%llu;",
+            c->index, (unsigned long long)c->sequence, (unsigned long long)c->sentAt);
+      frameHeader(frame, length);
+      length += FRAME_HEADER;
+      c->pendingDeliveries = results.connections - 1;
+
+      if(send(c->fd, frame, length, MSG_NOSIGNAL) != length) {
+            results.errors++;
+            closeConnection(c);
+      }
+}
+
+bool chatFrame(const char* payload, size_t length, void* ctx) {
+      (void)ctx;
+      // the server's own notices carry no '#'
+      const char* token = memchr(payload, '#', length);
+      if(token == NULL)
+            return true;
+
+      char message[64];
+      size_t tokenLength = length - (size_t)(token - payload);
+      if(tokenLength >= sizeof message)
+            tokenLength = sizeof message - 1;
+      memcpy(message, token, tokenLength);
+      message[tokenLength] = '\0';
+
+      size_t sender;
+      unsigned long long sequence, sentAt;
+      if(sscanf(message, "#%zu,%llu,%llu;", &sender, &sequence, &sentAt) != 3 || sender >= concurrency) {
+            results.errors++;
+            return true;
+      }
+
+      latencyRecord(&latencies, nowNs() - sentAt);
+      results.messages++;
+
+      // the sender moves on once the whole room has its message
+      Connection* from = &connections[sender];
+      if(from->connected && from->sequence == sequence && --from->pendingDeliveries == 0)
+            chatSend(from);
+      return true;
+}
+
+void handleChat(Connection* c, uint32_t events) {
+      if(events & (EPOLLERR | EPOLLHUP)) {
+            results.errors++;
+            closeConnection(c);
+            return;
+      }
+
+      char buffer[CHAT_BUFFER];
+      ssize_t n = recv(c->fd, buffer, sizeof buffer, 0);
+      if(n <= 0) {
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                  return;
+            results.errors++;
+            closeConnection(c);
+            return;
+      }
+
+      // a frame cut by the TCP stream waits in the reader for the next read
+      if(frameParse(&c->frames, buffer, (size_t)n, chatFrame, NULL) != FRAME_OK) {
+            results.errors++;
+            closeConnection(c);
+      }
+}
+
+void chatExpire(uint64_t now) {
+      // a message the server dropped must not stall its sender
+      for(size_t i = 0; i < concurrency; i++) {
+            Connection* c = &connections[i];
+            if(c->connected && c->pendingDeliveries > 0 && now - c->sentAt > CHAT_TIMEOUT_NS) {
+                  results.errors += c->pendingDeliveries;
+                  chatSend(c);
+            }
+      }
+}
+
+void sensoriWrite(Connection* c, bool paced) {
+      if(!c->connected)
+            return;
+
+      for(size_t writes = 0; writes < SENSORI_WRITES; writes++) {
+            if(c->outOffset == c->outLength) {
+                  size_t count = SENSORI_CHUNK;
+                  if(paced) {
+                        if(c->credit < 1)
+                              break;
+                        if(c->credit < count)
+                              count = (size_t)c->credit;
+                        c->credit -= count;
+                  }
+
+                  uint8_t* p = c->out;
+                  int64_t timestamp = time(NULL);
+                  for(size_t i = 0; i < count; i++) {
+                        float temperature = (rand() % 6000) / 100.0f;
+                        *p++ = (uint8_t)c->index;
+                        memcpy(p, &timestamp, sizeof timestamp);
+                        p += sizeof timestamp;
+                        memcpy(p, &temperature, sizeof temperature);
+                        p += sizeof temperature;
+                        *p++ = rand() % 100;
+                        *p++ = rand() % 100;
+                  }
+                  c->outLength = p - c->out;
+                  c->outOffset = 0;
+            }
+
+            ssize_t n = send(c->fd, c->out + c->outOffset, c->outLength - c->outOffset, MSG_NOSIGNAL);
+            if(n < 0) {
+                  if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                        results.errors++;
+                        closeConnection(c);
+                        return;
+                  }
+                  break;
+            }
+
+            // a reading counts once all its bytes are out
+            size_t before = c->outOffset / SENSORI_PAYLOAD_SIZE;
+            c->outOffset += n;
+            results.messages += c->outOffset / SENSORI_PAYLOAD_SIZE - before;
+      }
+
+      // flat out keeps EPOLLOUT, paced only while a chunk is stuck
+      bool writable = !paced || c->outOffset < c->outLength;
+      if(writable != c->watchingOut)
+            watch(c, writable ? EPOLLOUT : 0, EPOLL_CTL_MOD);
+}
+
+void sensorV2Register(Connection* c) {
+      // the server takes our host from the connection, we only announce the data port
+      Sensor announce;
+      memset(&announce, 0, sizeof announce);
+      announce.id = (uint8_t)c->index;
+      announce.addr.sin_family = AF_INET;
+      announce.addr.sin_port = c->dataPort;
+
+      uint8_t wire[SENSOR_WIRE_SIZE];
+      sensorEncode(wire, &announce);
+      if(send(c->fd, wire, sizeof wire, MSG_NOSIGNAL) != sizeof wire) {
+            results.errors++;
+            closeConnection(c);
+            return;
+      }
+
+      epoll_ctl(epollFD, EPOLL_CTL_DEL, c->fd, NULL);
+      close(c->fd);
+      c->fd = -1;
+}
+
+void sensorV2Send(Connection* c, bool paced) {
+      static uint8_t buffers[SENSORV2_CHUNK][BATCH_MAX_BYTES];
+      static struct iovec iovecs[SENSORV2_CHUNK];
+      static struct mmsghdr messages[SENSORV2_CHUNK];
+      static SensorPayload payloads[SENSOR_BATCH_MAX_READINGS];
+
+      struct sockaddr_in addr = serverAddr;
+      addr.sin_port = htons(SEND_PORT);
+      time_t timestamp = time(NULL);
+
+      while(!paced || c->credit >= batchSize) {
+            size_t count = 0;
+            for(; count < SENSORV2_CHUNK && (!paced || c->credit >= batchSize); count++) {
+                  if(paced)
+                        c->credit -= batchSize;
+                  for(size_t i = 0; i < batchSize; i++) {
+                        payloads[i].timestamp = timestamp;
+                        payloads[i].temperature = rand() % MAX_ALERT_TEMPERATURE;
+                        payloads[i].humidity = rand() % MAX_ALERT_HUMIDITY;
+                        payloads[i].airQuality = MIN_ALERT_AIR_QUALITY + rand() % (MAX_AIR_QUALITY - MIN_ALERT_AIR_QUALITY);
+                  }
+
+                  SensorBatchHeader header = { 0 };
+                  header.sensorID = (uint8_t)c->index;
+                  header.count = (uint16_t)batchSize;
+                  header.sequence = c->batchSequence++;
+
+                  iovecs[count].iov_base = buffers[count];
+                  iovecs[count].iov_len = sensorBatchEncode(buffers[count], &header, NULL, payloads);
+                  memset(&messages[count], 0, sizeof messages[count]);
+                  messages[count].msg_hdr.msg_name = &addr;
+                  messages[count].msg_hdr.msg_namelen = sizeof addr;
+                  messages[count].msg_hdr.msg_iov = &iovecs[count];
+                  messages[count].msg_hdr.msg_iovlen = 1;
+            }
+
+            int sent = sendmmsg(c->udpFD, messages, count, 0);
+            if(sent < 0)
+                  sent = 0;
+            results.messages += (uint64_t)sent * batchSize;
+            results.errors += count - sent;
+            // flat out sends one chunk per sensor and round
+            if(!paced || sent < (int)count)
+                  break;
+      }
+}
+
+long long serverCpuTicks() {
+      if(serverPID <= 0)
+            return -1;
+
+      DIR* proc = opendir("/proc");
+      if(!proc)
+            return -1;
+
+      long long ticks = -1;
+      struct dirent* entry;
+      while((entry = readdir(proc)) != NULL) {
+            char path[300];
+            snprintf(path, sizeof path, "/proc/%s/stat", entry->d_name);
+            FILE* stat = fopen(path, "r");
+            if(!stat)
+                  continue;
+
+            // pid (comm) state ppid ... utime(14) stime cutime cstime
+            int pid, ppid;
+            unsigned long long utime, stime;
+            long long cutime, cstime;
+            bool parsed = fscanf(stat, "%d (%*[^)]) %*c %d %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu %llu %lld %lld",
+                  &pid, &ppid, &utime, &stime, &cutime, &cstime) == 6;
+            fclose(stat);
+            if(!parsed)
+                  continue;
+
+            if(pid == serverPID) {
+                  ticks = (ticks < 0 ? 0 : ticks) + utime + stime + cutime + cstime;
+            } else if(ppid == serverPID) {
+                  ticks = (ticks < 0 ? 0 : ticks) + utime + stime;
+            }
+      }
+      closedir(proc);
+      return ticks;
+}
+
+long serverPeakRSS() {
+      char path[64];
+      snprintf(path, sizeof path, "/proc/%d/status", (int)serverPID);
+      FILE* status = fopen(path, "r");
+      if(!status)
+            return -1;
+
+      char line[256];
+      long peak = -1;
+      while(fgets(line, sizeof line, status))
+            if(sscanf(line, "VmHWM: %ld kB", &peak) == 1)
+                  break;
+      fclose(status);
+      return peak;
+}
+
+off_t fileSize(const char* path) {
+      int fd = open(path, O_RDONLY);
+      if(fd < 0)
+            return 0;
+      off_t size = lseek(fd, 0, SEEK_END);
+      close(fd);
+      return size < 0 ? 0 : size;
+}
+
+long long countLines(const char* path, off_t from, const char* marker) {
+      FILE* file = fopen(path, "r");
+      if(!file) {
+            perror("Server output not readable");
+            return -1;
+      }
+      fseeko(file, from, SEEK_SET);
+
+      long long lines = 0;
+      char line[512];
+      while(fgets(line, sizeof line, file))
+            if(strstr(line, marker))
+                  lines++;
+      fclose(file);
+      return lines;
+}
+
+static void printNumber(FILE* out, const char* key, double value, bool last) {
+      if(value < 0)
+            fprintf(out, "\"%s\": null%s", key, last ? "" : ", ");
+      else
+            fprintf(out, "\"%s\": %.3f%s", key, value, last ? "" : ", ");
+}
+
+void writeResults() {
+      double p50 = latencyPercentileUs(&latencies, 0.5);
+      double p99 = latencyPercentileUs(&latencies, 0.99);
+      double p999 = latencyPercentileUs(&latencies, 0.999);
+      double connectionsPerSecond = results.connectSeconds > 0 ? results.connections / results.connectSeconds : -1;
+      double messagesPerSecond = results.messages / results.seconds;
+      double cpuPercent = results.cpuSeconds >= 0 ? results.cpuSeconds / results.seconds * 100 : -1;
+
+      printf("%s on %s%s%s: %zu concurrent, %.1f s\n", info->name, info->server,
+            *variant ? " " : "", variant, concurrency, results.seconds);
+      printf("  %llu connections (%.0f/s), %llu messages (%.0f/s), %llu errors",
+            (unsigned long long)results.connections, connectionsPerSecond,
+            (unsigned long long)results.messages, messagesPerSecond,
+            (unsigned long long)results.errors);
+      if(results.delivered >= 0)
+            printf(", %lld delivered (%.0f/s)", results.delivered, results.delivered / results.seconds);
+      printf("\n  %s latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us\n", info->latency, p50, p99, p999);
+      if(results.cpuSeconds >= 0)
+            printf("  server: %.2f s CPU (%.0f%%), peak RSS %ld kB\n", results.cpuSeconds, cpuPercent, results.peakRSS);
+
+      FILE* out = fopen(resultsPath, "a");
+      if(!out) {
+            perror("Results file not writable");
+            exit(EXIT_FAILURE);
+      }
+
+      // one JSON object per line, unknown values are null
+      time_t now = time(NULL);
+      fprintf(out, "{\"label\": \"%s\", \"time\": %lld, \"scenario\": \"%s\", \"server\": \"%s\", \"variant\": \"%s\", ",
+            label, (long long)now, info->name, info->server, variant);
+      fprintf(out, "\"concurrency\": %zu, \"rate\": %.0f, \"readings_per_datagram\": %zu, ",
+            concurrency, rate, scenario == SCENARIO_SENSORV2 ? batchSize : 1);
+      printNumber(out, "seconds", results.seconds, false);
+      fprintf(out, "\"connections\": %llu, ", (unsigned long long)results.connections);
+      printNumber(out, "connections_per_s", connectionsPerSecond, false);
+      fprintf(out, "\"messages\": %llu, ", (unsigned long long)results.messages);
+      printNumber(out, "messages_per_s", messagesPerSecond, false);
+      if(results.delivered >= 0)
+            fprintf(out, "\"delivered\": %lld, ", results.delivered);
+      else
+            fprintf(out, "\"delivered\": null, ");
+      fprintf(out, "\"errors\": %llu, \"latency\": \"%s\", ", (unsigned long long)results.errors, info->latency);
+      printNumber(out, "p50_us", p50, false);
+      printNumber(out, "p99_us", p99, false);
+      printNumber(out, "p999_us", p999, false);
+      printNumber(out, "cpu_s", results.cpuSeconds, false);
+      printNumber(out, "cpu_pct", cpuPercent, false);
+      if(results.peakRSS >= 0)
+            fprintf(out, "\"peak_rss_kb\": %ld}\n", results.peakRSS);
+      else
+            fprintf(out, "\"peak_rss_kb\": null}\n");
+      fclose(out);
+}
@@ -0,0 +1,3 @@
+gcc -O2 -o codec codec.c ../Common/gorilla.c
+gcc -O2 -o netbench netbench.c ../SensorV2/wire.c ../MessagingApp/framing.c
+gcc -O2 -o wirecheck wirecheck.c ../SensorV2/wire.c
@@ -0,0 +1,95 @@
+#!/bin/bash
+# Starts every server of the repo on loopback, one at a time, drives it
+# with netbench and appends one JSON line per scenario to $RESULTS.
+# Overrides: CONCURRENCY DURATION RATE BATCH RESULTS LABEL, SCENARIOS to
+# run a subset (sensorv2 sensori chat accept) and ACCEPT_MODES for the
+# SingleMessageResponse serving modes (fork prefork threads).
+
+cd "$(dirname "$0")" || exit 1
+
+BUILD=build
+RESULTS=${RESULTS:-results.jsonl}
+CONCURRENCY=${CONCURRENCY:-8}
+DURATION=${DURATION:-5}
+RATE=${RATE:-0}
+BATCH=${BATCH:-16}
+LABEL=${LABEL:-$(git rev-parse --short HEAD 2>/dev/null || echo unknown)}
+# SingleMessageResponse leaves port 8080 full of TIME_WAIT connections the
+# other servers cannot bind over, so it goes last
+SCENARIOS=${SCENARIOS:-sensorv2 sensori chat accept}
+ACCEPT_MODES=${ACCEPT_MODES:-fork prefork threads}
+
+mkdir -p $BUILD
+gcc -O2 -o $BUILD/netbench netbench.c ../SensorV2/wire.c ../MessagingApp/framing.c || exit 1
+gcc -O2 -pthread -o $BUILD/singlemessage ../SingleMessageResponse/server.c || exit 1
+gcc -O2 -pthread -o $BUILD/messaging ../MessagingApp/server.c ../MessagingApp/fanout.c ../MessagingApp/rooms.c ../MessagingApp/framing.c ../MessagingApp/history.c ../Common/netio.c ../Common/spsc.c ../Common/pool.c || exit 1
+gcc -O2 -pthread -o $BUILD/sensori ../Sensori/server.c ../Sensori/decoder.c ../Sensori/output.c ../Common/spsc.c ../Common/textbuf.c ../Common/metrics.c ../Common/pool.c || exit 1
+(cd ../SensorV2 && gcc -O2 -pthread -o ../bench/$BUILD/sensorv2 server.c ingest.c timerwheel.c registry.c epoch.c output.c tsstore.c aggregate.c rules.c config.c wire.c sequence.c ../Common/spsc.c ../Common/textbuf.c ../Common/netio.c ../Common/metrics.c ../Common/pool.c) || exit 1
+
+# start <port> <output> <command...>: sets SERVER once the port accepts,
+# retrying while a previous run still holds the port
+start() {
+      local port=$1 output=$2
+      shift 2
+      for attempt in $(seq 60); do
+            "$@" > "$output" 2>&1 &
+            SERVER=$!
+            for wait in $(seq 50); do
+                  kill -0 $SERVER 2> /dev/null || break
+                  if (exec 3<> /dev/tcp/127.0.0.1/$port) 2> /dev/null; then
+                        sleep 0.2
+                        return 0
+                  fi
+                  sleep 0.1
+            done
+            kill $SERVER 2> /dev/null
+            wait $SERVER 2> /dev/null
+            sleep 1
+      done
+      echo "$1 never listened on port $port" >&2
+      return 1
+}
+
+stop() {
+      kill $SERVER 2> /dev/null
+      wait $SERVER 2> /dev/null
+}
+
+bench() {
+      $BUILD/netbench "$@" -p $SERVER -o "$RESULTS" -l "$LABEL" -d $DURATION -r $RATE
+}
+
+for scenario in $SCENARIOS; do
+      case $scenario in
+            sensorv2)
+                  rm -rf $BUILD/sensordata
+                  start 4040 $BUILD/sensorv2.out $BUILD/sensorv2 $BUILD/sensordata || continue
+                  bench sensorv2 -c $(( CONCURRENCY < 256 ? CONCURRENCY : 256 )) -b $BATCH -s $BUILD/sensorv2.out
+                  ;;
+            sensori)
+                  start 8080 $BUILD/sensori.out $BUILD/sensori $(( CONCURRENCY + 1 )) || continue
+                  bench sensori -c $CONCURRENCY -s $BUILD/sensori.out
+                  ;;
+            chat)
+                  # every client in the lobby, across one worker per core
+                  start 8080 /dev/null $BUILD/messaging drop-message auto 0 || continue
+                  bench chat -c $(( CONCURRENCY < 64 ? (CONCURRENCY < 2 ? 2 : CONCURRENCY) : 64 ))
+                  ;;
+            accept)
+                  for mode in $ACCEPT_MODES; do
+                        start 8080 /dev/null $BUILD/singlemessage $mode || continue
+                        bench accept -c $CONCURRENCY -v $mode
+                        stop
+                  done
+                  ;;
+            *)
+                  echo "Unknown scenario $scenario" >&2
+                  continue
+                  ;;
+      esac
+      stop
+      # flat out runs print gigabytes of readings
+      rm -f $BUILD/*.out
+done
+
+echo "Results appended to $RESULTS"
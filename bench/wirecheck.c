@@ -0,0 +1,426 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "../SensorV2/wire.h"
+
+#define ROUNDS 10000
+#define DEFAULT_CLIENT "../SensorV2/client.py"
+
+/*
+Reads "<kind> <fields...> <hex>" lines and packs the fields with the
+formats of client.py: every line must give the bytes the C codec wrote.
+*/
+static const char* pythonCheck =
+      "import importlib.util, struct, sys\n"
+      "spec = importlib.util.spec_from_file_location('client', sys.argv[1])\n"
+      "client = importlib.util.module_from_spec(spec)\n"
+      "spec.loader.exec_module(client)\n"
+      "formats = {\n"
+      "    'payload': [client.PAYLOAD_STRUCT_FORMAT],\n"
+      "    'sensor': [client.SENSOR_STRUCT_FORMAT],\n"
+      "    'alert': [client.ALERT_STRUCT_FORMAT],\n"
+      "    'header': [client.BATCH_HEADER_FORMAT],\n"
+      "    'control': [client.CONTROL_HEADER_FORMAT],\n"
+      "    'batch': [client.BATCH_HEADER_FORMAT, client.PAYLOAD_STRUCT_FORMAT],\n"
+      "}\n"
+      "checked = mismatches = 0\n"
+      "for line in sys.stdin:\n"
+      "    kind, *fields, wire = line.split()\n"
+      "    values = [int(field) for field in fields]\n"
+      "    packed = b''\n"
+      "    for fmt in formats[kind]:\n"
+      "        n = len(struct.unpack(fmt, bytes(struct.calcsize(fmt))))\n"
+      "        packed += struct.pack(fmt, *values[:n])\n"
+      "        values = values[n:]\n"
+      "    checked += 1\n"
+      "    if packed.hex() != wire:\n"
+      "        mismatches += 1\n"
+      "        if mismatches <= 10:\n"
+      "            print(f'{kind}: C wrote {wire}, Python packs {packed.hex()}')\n"
+      "print(f'{checked} messages packed by client.py, {mismatches} mismatches')\n"
+      "sys.exit(1 if mismatches else 0)\n";
+
+typedef struct CheckTag {
+      size_t checked;
+      size_t failed;
+      FILE* python;                 // NULL without python3
+} Check;
+
+/*
+Counts a check, printing what went wrong the first few times.
+*/
+void expect(Check* check, bool ok, const char* what);
+/*
+Compares the encoded bytes with the ones built by hand and sends the
+fields and bytes to the Python side.
+*/
+void compareBytes(Check* check, const char* kind, const uint8_t* wire, const uint8_t* expected, size_t size, const char* fields);
+// big endian, the way struct's '>' lays out an integer
+uint8_t* putBig(uint8_t* dst, uint64_t value, size_t bytes);
+uint64_t randomBits(size_t bits);
+
+void checkPayload(Check* check);
+void checkSensor(Check* check);
+void checkAlert(Check* check);
+void checkBatchHeader(Check* check);
+void checkControlFrame(Check* check);
+/*
+A batch of one reading, what client.py sends: the header then '>qBBB'.
+*/
+void checkSingleBatch(Check* check);
+/*
+Batches of any size, with and without BATCH_GATEWAY, against a column
+layout built by hand, then truncated and corrupted copies of them.
+*/
+void checkBatch(Check* check, bool gateway);
+
+bool startPython(Check* check, const char* client, pid_t* pid);
+bool finishPython(Check* check, pid_t pid);
+
+int main(int argc, char** argv) {
+      if(argc > 2) {
+            fprintf(stderr, "Usage: %s [client.py]\n", argv[0]);
+            exit(EXIT_FAILURE);
+      }
+      const char* client = argc == 2 ? argv[1] : DEFAULT_CLIENT;
+
+      Check check = { 0 };
+      pid_t pid;
+      if(!startPython(&check, client, &pid))
+            printf("python3 not available, checking against the hand built bytes only\n");
+
+      srand(42);
+      for(size_t i = 0; i < ROUNDS; i++) {
+            checkPayload(&check);
+            checkSensor(&check);
+            checkAlert(&check);
+            checkBatchHeader(&check);
+            checkControlFrame(&check);
+            checkSingleBatch(&check);
+            checkBatch(&check, false);
+            checkBatch(&check, true);
+      }
+
+      printf("%zu checks, %zu failed\n", check.checked, check.failed);
+      fflush(stdout);
+      bool pythonOk = check.python == NULL || finishPython(&check, pid);
+      return check.failed == 0 && pythonOk ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void expect(Check* check, bool ok, const char* what) {
+      check->checked++;
+      if(ok)
+            return;
+      if(check->failed++ < 10)
+            fprintf(stderr, "Check failed: %s\n", what);
+}
+
+void compareBytes(Check* check, const char* kind, const uint8_t* wire, const uint8_t* expected, size_t size, const char* fields) {
+      expect(check, memcmp(wire, expected, size) == 0, kind);
+      if(check->python == NULL)
+            return;
+
+      fprintf(check->python, "%s %s ", kind, fields);
+      for(size_t i = 0; i < size; i++)
+            fprintf(check->python, "%02x", wire[i]);
+      fputc('\n', check->python);
+}
+
+uint8_t* putBig(uint8_t* dst, uint64_t value, size_t bytes) {
+      for(size_t i = 0; i < bytes; i++)
+            dst[i] = (uint8_t)(value >> (8 * (bytes - 1 - i)));
+      return dst + bytes;
+}
+
+uint64_t randomBits(size_t bits) {
+      uint64_t value = 0;
+      for(size_t i = 0; i < 64; i += 16)
+            value = value << 16 | (uint64_t)(rand() & 0xFFFF);
+      return bits == 64 ? value : value & ((UINT64_C(1) << bits) - 1);
+}
+
+void checkPayload(Check* check) {
+      SensorPayload payload = {
+            .timestamp = (time_t)randomBits(64),
+            .temperature = (uint8_t)randomBits(8),
+            .humidity = (uint8_t)randomBits(8),
+            .airQuality = (uint8_t)randomBits(8),
+      };
+      uint8_t wire[SENSOR_PAYLOAD_WIRE_SIZE], expected[SENSOR_PAYLOAD_WIRE_SIZE];
+      expect(check, sensorPayloadEncode(wire, &payload) == wire + sizeof wire, "payload encoded size");
+
+      uint8_t* p = putBig(expected, (uint64_t)payload.timestamp, 8);
+      p = putBig(p, payload.temperature, 1);
+      p = putBig(p, payload.humidity, 1);
+      putBig(p, payload.airQuality, 1);
+
+      char fields[96];
+      snprintf(fields, sizeof fields, "%lld %u %u %u", (long long)payload.timestamp,
+            payload.temperature, payload.humidity, payload.airQuality);
+      compareBytes(check, "payload", wire, expected, sizeof wire, fields);
+
+      SensorPayload decoded;
+      sensorPayloadDecode(&decoded, wire);
+      expect(check, decoded.timestamp == payload.timestamp && decoded.temperature == payload.temperature
+            && decoded.humidity == payload.humidity && decoded.airQuality == payload.airQuality, "payload roundtrip");
+}
+
+void checkSensor(Check* check) {
+      uint16_t port = (uint16_t)randomBits(16);
+      uint32_t address = (uint32_t)randomBits(32);
+      Sensor sensor = { .id = (uint8_t)randomBits(8) };
+      sensor.addr.sin_family = AF_INET;
+      sensor.addr.sin_port = htons(port);
+      sensor.addr.sin_addr.s_addr = htonl(address);
+
+      uint8_t wire[SENSOR_WIRE_SIZE], expected[SENSOR_WIRE_SIZE];
+      expect(check, sensorEncode(wire, &sensor) == wire + sizeof wire, "sensor encoded size");
+
+      uint8_t* p = putBig(expected, sensor.id, 1);
+      p = putBig(p, port, 2);
+      putBig(p, address, 4);
+
+      char fields[64];
+      snprintf(fields, sizeof fields, "%u %u %u", sensor.id, port, address);
+      compareBytes(check, "sensor", wire, expected, sizeof wire, fields);
+
+      Sensor decoded;
+      sensorDecode(&decoded, wire);
+      expect(check, decoded.id == sensor.id && decoded.addr.sin_family == AF_INET
+            && decoded.addr.sin_port == sensor.addr.sin_port
+            && decoded.addr.sin_addr.s_addr == sensor.addr.sin_addr.s_addr, "sensor roundtrip");
+}
+
+void checkAlert(Check* check) {
+      uint16_t port = (uint16_t)randomBits(16);
+      uint32_t address = (uint32_t)randomBits(32);
+      SensorAlert alert = { .type = randomBits(1) ? REACTIVATE : ALERT };
+      alert.sensor.id = (uint8_t)randomBits(8);
+      alert.sensor.addr.sin_family = AF_INET;
+      alert.sensor.addr.sin_port = htons(port);
+      alert.sensor.addr.sin_addr.s_addr = htonl(address);
+
+      uint8_t wire[SENSOR_ALERT_WIRE_SIZE], expected[SENSOR_ALERT_WIRE_SIZE];
+      expect(check, sensorAlertEncode(wire, &alert) == wire + sizeof wire, "alert encoded size");
+
+      uint8_t* p = putBig(expected, alert.type, 1);
+      p = putBig(p, alert.sensor.id, 1);
+      p = putBig(p, port, 2);
+      putBig(p, address, 4);
+
+      char fields[64];
+      snprintf(fields, sizeof fields, "%u %u %u %u", (unsigned)alert.type, alert.sensor.id, port, address);
+      compareBytes(check, "alert", wire, expected, sizeof wire, fields);
+
+      SensorAlert decoded;
+      sensorAlertDecode(&decoded, wire);
+      expect(check, decoded.type == alert.type && decoded.sensor.id == alert.sensor.id
+            && decoded.sensor.addr.sin_port == alert.sensor.addr.sin_port
+            && decoded.sensor.addr.sin_addr.s_addr == alert.sensor.addr.sin_addr.s_addr, "alert roundtrip");
+}
+
+void checkBatchHeader(Check* check) {
+      SensorBatchHeader header = {
+            .magic = (uint8_t)randomBits(8),
+            .flags = (uint8_t)randomBits(8),
+            .sensorID = (uint8_t)randomBits(8),
+            .count = (uint16_t)randomBits(16),
+            .sequence = (uint32_t)randomBits(32),
+      };
+      uint8_t wire[SENSOR_BATCH_HEADER_WIRE_SIZE], expected[SENSOR_BATCH_HEADER_WIRE_SIZE];
+      expect(check, sensorBatchHeaderEncode(wire, &header) == wire + sizeof wire, "batch header encoded size");
+
+      uint8_t* p = putBig(expected, header.magic, 1);
+      p = putBig(p, header.flags, 1);
+      p = putBig(p, header.sensorID, 1);
+      p = putBig(p, header.count, 2);
+      putBig(p, header.sequence, 4);
+
+      char fields[64];
+      snprintf(fields, sizeof fields, "%u %u %u %u %u", header.magic, header.flags,
+            header.sensorID, header.count, (unsigned)header.sequence);
+      compareBytes(check, "header", wire, expected, sizeof wire, fields);
+
+      SensorBatchHeader decoded;
+      sensorBatchHeaderDecode(&decoded, wire);
+      expect(check, decoded.magic == header.magic && decoded.flags == header.flags && decoded.sensorID == header.sensorID
+            && decoded.count == header.count && decoded.sequence == header.sequence, "batch header roundtrip");
+}
+
+void checkControlFrame(Check* check) {
+      ControlFrameType type = (ControlFrameType)randomBits(2);
+      uint8_t payload[CONTROL_PAYLOAD_MAX];
+      size_t length = randomBits(16) % (CONTROL_PAYLOAD_MAX + 1);
+      for(size_t i = 0; i < length; i++)
+            payload[i] = (uint8_t)randomBits(8);
+
+      uint8_t wire[CONTROL_FRAME_HEADER_WIRE_SIZE + CONTROL_PAYLOAD_MAX];
+      uint8_t expected[CONTROL_FRAME_HEADER_WIRE_SIZE + CONTROL_PAYLOAD_MAX];
+      size_t size = controlFrameEncode(wire, type, payload, length);
+      expect(check, size == CONTROL_FRAME_HEADER_WIRE_SIZE + length, "control frame encoded size");
+
+      uint8_t* p = putBig(expected, type, 1);
+      p = putBig(p, length, 2);
+      memcpy(p, payload, length);
+      expect(check, memcmp(wire + CONTROL_FRAME_HEADER_WIRE_SIZE, payload, length) == 0, "control frame payload");
+
+      // the payloads are the messages above, the header is the part of its own
+      char fields[32];
+      snprintf(fields, sizeof fields, "%u %zu", (unsigned)type, length);
+      compareBytes(check, "control", wire, expected, CONTROL_FRAME_HEADER_WIRE_SIZE, fields);
+
+      ControlFrameHeader decoded;
+      controlFrameHeaderDecode(&decoded, wire);
+      expect(check, decoded.type == type && decoded.length == length, "control frame roundtrip");
+}
+
+void checkSingleBatch(Check* check) {
+      SensorBatchHeader header = {
+            .flags = 0,
+            .sensorID = (uint8_t)randomBits(8),
+            .count = 1,
+            .sequence = (uint32_t)randomBits(32),
+      };
+      SensorPayload payload = {
+            .timestamp = (time_t)randomBits(64),
+            .temperature = (uint8_t)randomBits(8),
+            .humidity = (uint8_t)randomBits(8),
+            .airQuality = (uint8_t)randomBits(8),
+      };
+      uint8_t wire[SENSOR_BATCH_HEADER_WIRE_SIZE + SENSOR_PAYLOAD_WIRE_SIZE];
+      uint8_t expected[sizeof wire];
+      expect(check, sensorBatchEncode(wire, &header, NULL, &payload) == sizeof wire, "single batch encoded size");
+
+      uint8_t* p = putBig(expected, BATCH_MAGIC, 1);
+      p = putBig(p, 0, 1);
+      p = putBig(p, header.sensorID, 1);
+      p = putBig(p, 1, 2);
+      p = putBig(p, header.sequence, 4);
+      p = putBig(p, (uint64_t)payload.timestamp, 8);
+      p = putBig(p, payload.temperature, 1);
+      p = putBig(p, payload.humidity, 1);
+      putBig(p, payload.airQuality, 1);
+
+      char fields[128];
+      snprintf(fields, sizeof fields, "%u 0 %u 1 %u %lld %u %u %u", BATCH_MAGIC, header.sensorID, (unsigned)header.sequence,
+            (long long)payload.timestamp, payload.temperature, payload.humidity, payload.airQuality);
+      compareBytes(check, "batch", wire, expected, sizeof wire, fields);
+}
+
+void checkBatch(Check* check, bool gateway) {
+      static uint8_t wire[BATCH_MAX_BYTES], expected[BATCH_MAX_BYTES];
+      uint8_t ids[SENSOR_BATCH_MAX_READINGS], decodedIDs[SENSOR_BATCH_MAX_READINGS];
+      SensorPayload payloads[SENSOR_BATCH_MAX_READINGS], decoded[SENSOR_BATCH_MAX_READINGS];
+
+      size_t max = gateway ? SENSOR_GATEWAY_MAX_READINGS : SENSOR_BATCH_MAX_READINGS;
+      SensorBatchHeader header = {
+            .flags = gateway ? BATCH_GATEWAY : 0,
+            .sensorID = (uint8_t)randomBits(8),
+            .count = (uint16_t)(1 + randomBits(16) % max),
+            .sequence = (uint32_t)randomBits(32),
+      };
+      for(size_t i = 0; i < header.count; i++) {
+            ids[i] = (uint8_t)randomBits(8);
+            payloads[i] = (SensorPayload){
+                  .timestamp = (time_t)randomBits(64),
+                  .temperature = (uint8_t)randomBits(8),
+                  .humidity = (uint8_t)randomBits(8),
+                  .airQuality = (uint8_t)randomBits(8),
+            };
+      }
+
+      size_t size = sensorBatchEncode(wire, &header, ids, payloads);
+      expect(check, size == sensorBatchSize(header.flags, header.count) && size <= BATCH_MAX_BYTES, "batch encoded size");
+
+      uint8_t* p = putBig(expected, BATCH_MAGIC, 1);
+      p = putBig(p, header.flags, 1);
+      p = putBig(p, header.sensorID, 1);
+      p = putBig(p, header.count, 2);
+      p = putBig(p, header.sequence, 4);
+      if(gateway) {
+            for(size_t i = 0; i < header.count; i++)
+                  p = putBig(p, ids[i], 1);
+      }
+      for(size_t i = 0; i < header.count; i++)
+            p = putBig(p, (uint64_t)payloads[i].timestamp, 8);
+      for(size_t i = 0; i < header.count; i++)
+            p = putBig(p, payloads[i].temperature, 1);
+      for(size_t i = 0; i < header.count; i++)
+            p = putBig(p, payloads[i].humidity, 1);
+      for(size_t i = 0; i < header.count; i++)
+            p = putBig(p, payloads[i].airQuality, 1);
+      expect(check, (size_t)(p - expected) == size && memcmp(wire, expected, size) == 0, "batch bytes");
+
+      SensorBatchHeader decodedHeader;
+      bool ok = sensorBatchDecode(wire, size, &decodedHeader, decodedIDs, decoded);
+      expect(check, ok && decodedHeader.count == header.count && decodedHeader.flags == header.flags
+            && decodedHeader.sensorID == header.sensorID && decodedHeader.sequence == header.sequence, "batch header decoded");
+      for(size_t i = 0; ok && i < header.count; i++) {
+            expect(check, (!gateway || decodedIDs[i] == ids[i]) && decoded[i].timestamp == payloads[i].timestamp
+                  && decoded[i].temperature == payloads[i].temperature && decoded[i].humidity == payloads[i].humidity
+                  && decoded[i].airQuality == payloads[i].airQuality, "batch reading decoded");
+      }
+
+      // a datagram of any other length, or without the magic, is rejected
+      size_t cut = randomBits(16) % size;
+      expect(check, !sensorBatchDecode(wire, cut, &decodedHeader, decodedIDs, decoded), "truncated batch rejected");
+      expect(check, !sensorBatchDecode(wire, size + 1, &decodedHeader, decodedIDs, decoded), "padded batch rejected");
+      wire[0] ^= (uint8_t)(1 + randomBits(7));
+      expect(check, !sensorBatchDecode(wire, size, &decodedHeader, decodedIDs, decoded), "bad magic rejected");
+
+      // random garbage must never be read past its length
+      size_t garbage = randomBits(16) % BATCH_MAX_BYTES;
+      for(size_t i = 0; i < garbage; i++)
+            wire[i] = (uint8_t)randomBits(8);
+      if(sensorBatchDecode(wire, garbage, &decodedHeader, decodedIDs, decoded))
+            expect(check, garbage == sensorBatchSize(decodedHeader.flags, decodedHeader.count), "garbage accepted with its own size");
+}
+
+bool startPython(Check* check, const char* client, pid_t* pid) {
+      int fds[2];
+      if(pipe(fds) < 0) {
+            perror("Pipe creation failed");
+            return false;
+      }
+
+      if((*pid = fork()) < 0) {
+            perror("Fork failed");
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+      }
+      if(*pid == 0) {
+            dup2(fds[0], STDIN_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+            execlp("python3", "python3", "-c", pythonCheck, client, (char*)NULL);
+            _exit(127);
+      }
+
+      close(fds[0]);
+      // the Python side may quit early, the check then fails on its status
+      signal(SIGPIPE, SIG_IGN);
+      check->python = fdopen(fds[1], "w");
+      return check->python != NULL;
+}
+
+bool finishPython(Check* check, pid_t pid) {
+      fclose(check->python);
+      int status;
+      if(waitpid(pid, &status, 0) < 0) {
+            perror("Waiting for python3 failed");
+            return false;
+      }
+      if(WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+            printf("python3 not available, checked against the hand built bytes only\n");
+            return true;
+      }
+      return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}